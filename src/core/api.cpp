@@ -13,10 +13,10 @@ uint32_t getCurrentBlockCount(string host_url) {
     return std::stoi(std::string{response.body.begin(), response.body.end()});
 }
 
-Bigint getTotalWork(string host_url) {
+UInt256 getTotalWork(string host_url) {
     http::Request request{host_url + "/total_work"};
     const auto response = request.send("GET","",{},std::chrono::milliseconds{TIMEOUT_MS});
-    return Bigint(std::string{response.body.begin(), response.body.end()});
+    return UInt256::fromString(std::string{response.body.begin(), response.body.end()});
 }
 
 json getName(string host_url) {
@@ -5,7 +5,7 @@
 #include "common.hpp"
 using namespace std;
 
-Bigint getTotalWork(string host_url);
+UInt256 getTotalWork(string host_url);
 uint32_t getCurrentBlockCount(string host_url);
 json getName(string host_url);
 json getBlockData(string host_url, int idx);
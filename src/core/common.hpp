@@ -1,6 +1,7 @@
 #pragma once
 #include "../external/json.hpp"
 #include "../external/bigint/bigint.h"
+#include "uint256.hpp"
 #include "openssl/sha.h"
  #include "openssl/ripemd.h"
 #include <map>
@@ -1,11 +1,14 @@
 #include "config.hpp"
 #include "helpers.hpp"
 #include "crypto.hpp"
+#include "constants.hpp"
 #include <vector>
 #include <map>
 #include <string>
 #include <iostream>
 #include <thread>
+#include <fstream>
+#include <algorithm>
 using namespace std;
 
 json getConfig(int argc, char**argv) {
@@ -38,6 +41,16 @@ json getConfig(int argc, char**argv) {
     json checkpoints = json::array();
     json bannedHashes = json::array();
     int customPort = 3000;
+    int ledgerCacheMB = 64;
+    bool blockSegments = false;
+    // snapshots are opt in, each one copies the whole ledger and txdb
+    int snapshotInterval = 0;
+    int pruneDepth = 0;
+    string archivePath = "";
+    int hotBlocks = HOT_BLOCK_WINDOW;
+    bool idleCompaction = true;
+    string ledgerBackend = "leveldb";
+    json storage = json::object();
     int threads = std::thread::hardware_concurrency();
     int thread_priority = 0;
 
@@ -76,6 +89,55 @@ json getConfig(int argc, char**argv) {
         customPort = std::stoi(*it);
     }
 
+    it = std::find(args.begin(), args.end(), "--ledger-cache-mb");
+    if (it != args.end()) {
+        ledgerCacheMB = std::stoi(*++it);
+    }
+
+    it = std::find(args.begin(), args.end(), "--block-segments");
+    if (it != args.end()) {
+        blockSegments = true;
+    }
+
+    it = std::find(args.begin(), args.end(), "--snapshot-interval");
+    if (it != args.end()) {
+        snapshotInterval = std::stoi(*++it);
+    }
+
+    // keep only the newest N block bodies, deep forks still need a margin
+    it = std::find(args.begin(), args.end(), "--prune-depth");
+    if (it != args.end()) {
+        pruneDepth = std::max(std::stoi(*++it), MIN_PRUNE_DEPTH);
+    }
+
+    // blocks older than the hot window move to a second, slower disk
+    it = std::find(args.begin(), args.end(), "--archive-path");
+    if (it != args.end()) {
+        archivePath = string(*++it);
+    }
+
+    it = std::find(args.begin(), args.end(), "--ledger-backend");
+    if (it != args.end()) {
+        ledgerBackend = string(*++it);
+    }
+
+    it = std::find(args.begin(), args.end(), "--hot-blocks");
+    if (it != args.end()) {
+        hotBlocks = std::stoi(*++it);
+    }
+
+    // leave compactions to leveldb instead of running them while idle
+    it = std::find(args.begin(), args.end(), "--no-idle-compaction");
+    if (it != args.end()) {
+        idleCompaction = false;
+    }
+
+    it = std::find(args.begin(), args.end(), "--storage-config");
+    if (it != args.end()) {
+        std::ifstream storageFile(*++it);
+        storage = json::parse(storageFile);
+    }
+
     it = std::find(args.begin(), args.end(), "--network-name");
     if (it++ != args.end()) {
         networkName = string(*it);
@@ -138,6 +200,15 @@ json getConfig(int argc, char**argv) {
     config["hostSources"] = hostSources;
     config["minHostVersion"] = "0.9.0-alpha";
     config["showHeaderStats"] = true;
+    config["ledgerCacheMB"] = ledgerCacheMB;
+    config["blockSegments"] = blockSegments;
+    config["storage"] = storage;
+    config["snapshotInterval"] = snapshotInterval;
+    config["pruneDepth"] = pruneDepth;
+    config["archivePath"] = archivePath;
+    config["hotBlocks"] = hotBlocks;
+    config["idleCompaction"] = idleCompaction;
+    config["ledgerBackend"] = ledgerBackend;
 
     if (local) {
         // do nothing
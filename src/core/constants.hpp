@@ -15,11 +15,14 @@
 #define LEDGER_FILE_PATH "./data/ledger"
 #define TXDB_FILE_PATH "./data/txdb"
 #define BLOCK_STORE_FILE_PATH "./data/blocks"
+#define WALLET_STORE_FILE_PATH "./data/wallets"
 #define PUFFERFISH_CACHE_FILE_PATH "./data/pufferfish"
 
 // Blocks
 #define MAX_TRANSACTIONS_PER_BLOCK 25000
 #define PUFFERFISH_START_BLOCK 124500
+#define MIN_PRUNE_DEPTH 1000
+#define HOT_BLOCK_WINDOW 10000
 
 // Difficulty
 #define DIFFICULTY_LOOKBACK 100
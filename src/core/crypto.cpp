@@ -14,23 +14,40 @@
 using namespace std;
 
 
-PufferfishCache * pufferfishCache = NULL;
+std::atomic<PufferfishCache*> pufferfishCache(NULL);
 std::mutex pufferfishCacheLock;
 
+json getPufferfishCacheStats() {
+    PufferfishCache* cache = pufferfishCache;
+    if (!cache) return profileToJson(PufferfishCache::getDefaultProfile());
+    return cache->getStats();
+}
+
+// NULL until the first cached hash opens the store, it is never closed
+PufferfishCache* getPufferfishCache() {
+    return pufferfishCache;
+}
+
+static PufferfishCache* openPufferfishCache() {
+    PufferfishCache* cache = pufferfishCache;
+    if (cache) return cache;
+    std::unique_lock<std::mutex> ul(pufferfishCacheLock);
+    if (!pufferfishCache) {
+        cache = new PufferfishCache();
+        cache->init(PUFFERFISH_CACHE_FILE_PATH, PufferfishCache::getDefaultProfile());
+        pufferfishCache = cache;
+    }
+    return pufferfishCache;
+}
+
 SHA256Hash PUFFERFISH(const char* buffer, size_t len, bool useCache) {
     SHA256Hash inputHash;
+    PufferfishCache* cache = NULL;
     if (useCache) {
-        std::unique_lock<std::mutex> ul(pufferfishCacheLock);
         memcpy(inputHash.data(), buffer, 32);
-        if (!pufferfishCache) {
-            pufferfishCache = new PufferfishCache();
-            pufferfishCache->init(PUFFERFISH_CACHE_FILE_PATH);
-        }
+        cache = openPufferfishCache();
         SHA256Hash h;
-        try {
-            h = pufferfishCache->getHash(inputHash);
-            return h;
-        } catch(...) {}
+        if (cache->lookup(inputHash, h)) return h;
     }
     char hash[PF_HASHSPACE];
     memset(hash, 0, PF_HASHSPACE);
@@ -42,10 +59,7 @@ SHA256Hash PUFFERFISH(const char* buffer, size_t len, bool useCache) {
 
     auto finalHash =  SHA256(hash, sz);
 
-    if (useCache) {
-        std::unique_lock<std::mutex> ul(pufferfishCacheLock);
-        pufferfishCache->setHash(inputHash, finalHash);
-    }
+    if (cache) cache->insert(inputHash, finalHash);
     return finalHash;
 }
 
@@ -239,16 +253,12 @@ bool checkLeadingZeroBits(SHA256Hash& hash, uint8_t challengeSize) {
     else return true;
 }
 
-Bigint addWork(Bigint previousWork, uint32_t challengeSize) {
-    Bigint base = 2;
-    previousWork+= base.pow((int) challengeSize);
-    return previousWork;
+UInt256 addWork(const UInt256& previousWork, uint32_t challengeSize) {
+    return previousWork + UInt256::pow2(challengeSize);
 }
 
-Bigint removeWork(Bigint previousWork, uint32_t challengeSize) {
-    Bigint base = 2;
-    previousWork -= base.pow((int) challengeSize);
-    return previousWork;
+UInt256 removeWork(const UInt256& previousWork, uint32_t challengeSize) {
+    return previousWork - UInt256::pow2(challengeSize);
 }
 
 bool verifyHash(SHA256Hash& target, SHA256Hash& nonce, uint8_t challengeSize, bool usePufferFish, bool useCache) {
@@ -14,8 +14,8 @@ std::vector<uint8_t> hexDecode(const string& hex);
 string hexEncode(const char* buffer, size_t len);
 SHA256Hash concatHashes(SHA256Hash& a, SHA256Hash& b, bool usePufferFish = false, bool useCache = false);
 bool checkLeadingZeroBits(SHA256Hash& hash, unsigned int challengeSize);
-Bigint addWork(Bigint previousWork, uint32_t challengeSize);
-Bigint removeWork(Bigint previousWork, uint32_t challengeSize);
+UInt256 addWork(const UInt256& previousWork, uint32_t challengeSize);
+UInt256 removeWork(const UInt256& previousWork, uint32_t challengeSize);
 
 PublicWalletAddress walletAddressFromPublicKey(PublicKey inputKey);
 string walletAddressToString(PublicWalletAddress p);
@@ -12,9 +12,7 @@ void chain_sync(HeaderChain& chain) {
     while(true) {
         if (!chain.triedBlockStoreCache && chain.blockStore) {
             uint64_t chainLength = chain.blockStore->getBlockCount();
-            for(uint64_t i = 1; i <= chainLength; i++) {
-                chain.blockHashes.push_back(chain.blockStore->getBlock(i).getHash());
-            }
+            chain.blockStore->getHeaderHashes(chainLength, chain.blockHashes);
             chain.totalWork = chain.blockStore->getTotalWork();
             chain.chainLength = chainLength;
             chain.triedBlockStoreCache = true;
@@ -61,7 +59,7 @@ string HeaderChain::getHost() const{
     return this->host;
 }
 
-Bigint HeaderChain::getTotalWork() const{
+UInt256 HeaderChain::getTotalWork() const{
     if (this->failed) return 0;
     return this->totalWork;
 }
@@ -89,7 +87,7 @@ void HeaderChain::load() {
     }
     uint64_t numBlocks = this->blockHashes.size();
     uint64_t startBlocks = numBlocks;
-    Bigint totalWork = this->totalWork;
+    UInt256 totalWork = this->totalWork;
     // download any remaining blocks in batches
     for(int i = numBlocks + 1; i <= targetBlockCount; i+=BLOCK_HEADERS_PER_FETCH) {
         try {
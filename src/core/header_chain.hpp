@@ -14,14 +14,14 @@ class HeaderChain {
         void reset();
         bool valid();
         string getHost() const;
-        Bigint getTotalWork() const;
+        UInt256 getTotalWork() const;
         uint64_t getChainLength() const;
         uint64_t getCurrentDownloaded() const;
         SHA256Hash getHash(uint64_t blockId) const;
         vector<SHA256Hash> blockHashes;
     protected:
         string host;
-        Bigint totalWork;
+        UInt256 totalWork;
         uint64_t chainLength;
         uint64_t offset;
         std::shared_ptr<BlockStore> blockStore;
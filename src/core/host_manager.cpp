@@ -216,11 +216,15 @@ uint64_t HostManager::getNetworkTimestamp() const{
 }   
 
 /*
-    Asks nodes for their current POW and chooses the best peer
+    Asks nodes for their current POW and chooses the best peer. Pruned
+    peers only keep their newest blocks, so when fromBlock is given we
+    prefer a peer on the best chain that still stores it and only fall
+    back to a pruned one if none does. Peers with less work are never
+    chosen: sync takes its target and fork check from the best chain.
 */
-string HostManager::getGoodHost() const{
+string HostManager::getGoodHost(uint64_t fromBlock) const{
     if (this->currPeers.size() < 1) return "";
-    Bigint bestWork = 0;
+    UInt256 bestWork = 0;
     string bestHost = this->currPeers[0]->getHost();
     std::unique_lock<std::mutex> ul(lock);
     for(auto h : this->currPeers) {
@@ -229,9 +233,23 @@ string HostManager::getGoodHost() const{
             bestHost = h->getHost();
         }
     }
+    for(auto h : this->currPeers) {
+        if (h->getTotalWork() != bestWork) continue;
+        auto pruned = this->hostPruneDepths.find(h->getHost());
+        if (pruned == this->hostPruneDepths.end() || fromBlock + pruned->second > h->getChainLength()) return h->getHost();
+    }
     return bestHost;
 }
 
+void HostManager::recordPruneDepth(const string& host, const json& info) {
+    std::unique_lock<std::mutex> ul(lock);
+    if (info.contains("pruneDepth") && info["pruneDepth"] > 0) {
+        this->hostPruneDepths[host] = info["pruneDepth"];
+    } else {
+        this->hostPruneDepths.erase(host);
+    }
+}
+
 /*
     Returns number of block headers downloaded by peer host
 */
@@ -249,7 +267,7 @@ map<string,uint64_t> HostManager::getHeaderChainStats() const{
 uint64_t HostManager::getBlockCount() const{
     if (this->currPeers.size() < 1) return 0;
     uint64_t bestLength = 0;
-    Bigint bestWork = 0;
+    UInt256 bestWork = 0;
     std::unique_lock<std::mutex> ul(lock);
     for(auto h : this->currPeers) {
         if (h->getTotalWork() > bestWork) {
@@ -263,8 +281,8 @@ uint64_t HostManager::getBlockCount() const{
 /*
     Returns the total work of the highest PoW chain amongst current peers
 */
-Bigint HostManager::getTotalWork() const{
-    Bigint bestWork = 0;
+UInt256 HostManager::getTotalWork() const{
+    UInt256 bestWork = 0;
     std::unique_lock<std::mutex> ul(lock);
     if (this->currPeers.size() < 1) return bestWork;
     for(auto h : this->currPeers) {
@@ -337,6 +355,7 @@ void HostManager::addPeer(string addr, uint64_t time, string version, string net
     if (!isJsHost(addr)) {
         try {
             json name = getName(addr);
+            this->recordPruneDepth(addr, name);
         } catch(...) {
             // if not exit
             return;
@@ -437,6 +456,7 @@ void HostManager::refreshHostList() {
                         Logger::logStatus(RED + "[ DEPRECATED ] " + RESET  + hostUrl);
                         return;
                     }
+                    hm.recordPruneDepth(hostUrl, hostInfo);
                     std::unique_lock<std::mutex> ul(lock);
                     if (hm.whitelist.size() == 0 || hm.whitelist.find(hostUrl) != hm.whitelist.end()){
                         hm.hosts.push_back(hostUrl);
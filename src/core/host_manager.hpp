@@ -18,9 +18,9 @@ class HostManager {
         void refreshHostList();
         void startPingingPeers();
 
-        string getGoodHost() const;
+        string getGoodHost(uint64_t fromBlock = 0) const;
         uint64_t getBlockCount() const;
-        Bigint getTotalWork() const;
+        UInt256 getTotalWork() const;
         SHA256Hash getBlockHash(string host, uint64_t blockId) const;
         map<string,uint64_t> getHeaderChainStats() const;
         std::pair<string,uint64_t> getRandomHost() const;
@@ -35,6 +35,7 @@ class HostManager {
         bool isDisabled();
         void syncHeadersWithPeers();
     protected:
+        void recordPruneDepth(const string& host, const json& info);
         vector<std::shared_ptr<HeaderChain>> currPeers; 
         std::shared_ptr<BlockStore> blockStore;
 
@@ -51,6 +52,7 @@ class HostManager {
         
         map<string,uint64_t> hostPingTimes;
         map<string,int32_t> peerClockDeltas;
+        map<string,uint64_t> hostPruneDepths;
         map<uint64_t, SHA256Hash> checkpoints;
         map<uint64_t, SHA256Hash> bannedHashes;
         vector<string> hostSources;
@@ -0,0 +1,72 @@
+#include <stdexcept>
+#include "uint256.hpp"
+
+#define DECIMAL_CHUNK 1000000000
+#define DECIMAL_CHUNK_DIGITS 9
+
+// this = this * multiplier + addend, returns what overflowed the top limb
+uint32_t UInt256::mulAdd(uint32_t multiplier, uint32_t addend) {
+    uint64_t carry = addend;
+    for(int i = 0; i < 4; i++) {
+        uint64_t lo = (this->limbs[i] & 0xffffffff) * multiplier + carry;
+        uint64_t hi = (this->limbs[i] >> 32) * multiplier + (lo >> 32);
+        this->limbs[i] = (hi << 32) | (lo & 0xffffffff);
+        carry = hi >> 32;
+    }
+    return carry;
+}
+
+// this = this / divisor, returns the remainder
+uint32_t UInt256::divide(uint32_t divisor) {
+    uint64_t rem = 0;
+    for(int i = 3; i >= 0; i--) {
+        uint64_t hi = (rem << 32) | (this->limbs[i] >> 32);
+        rem = hi % divisor;
+        uint64_t lo = (rem << 32) | (this->limbs[i] & 0xffffffff);
+        rem = lo % divisor;
+        this->limbs[i] = ((hi / divisor) << 32) | (lo / divisor);
+    }
+    return rem;
+}
+
+UInt256 UInt256::fromString(const string& decimal) {
+    if (decimal.empty()) throw std::runtime_error("Invalid work value: empty");
+    UInt256 ret;
+    for(char c : decimal) {
+        if (c < '0' || c > '9') throw std::runtime_error("Invalid work value: " + decimal);
+        if (ret.mulAdd(10, c - '0') != 0) throw std::runtime_error("Work value out of range: " + decimal);
+    }
+    return ret;
+}
+
+string UInt256::toString() const{
+    UInt256 value = *this;
+    string ret;
+    do {
+        uint32_t chunk = value.divide(DECIMAL_CHUNK);
+        string digits = std::to_string(chunk);
+        if (value != 0) digits.insert(0, DECIMAL_CHUNK_DIGITS - digits.size(), '0');
+        ret.insert(0, digits);
+    } while (value != 0);
+    return ret;
+}
+
+UInt256 UInt256::fromBytes(const uint8_t* buffer) {
+    UInt256 ret;
+    for(int i = 0; i < 4; i++) {
+        uint64_t limb = 0;
+        for(int j = 0; j < 8; j++) limb = (limb << 8) | buffer[(3 - i) * 8 + j];
+        ret.limbs[i] = limb;
+    }
+    return ret;
+}
+
+void UInt256::toBytes(uint8_t* buffer) const{
+    for(int i = 0; i < 4; i++) {
+        for(int j = 0; j < 8; j++) buffer[(3 - i) * 8 + j] = this->limbs[i] >> (56 - 8 * j);
+    }
+}
+
+string to_string(const UInt256& value) {
+    return value.toString();
+}
@@ -0,0 +1,87 @@
+#pragma once
+#include <cstdint>
+#include <string>
+using namespace std;
+
+#define UINT256_SIZE 32
+
+/*
+    Fixed width unsigned 256 bit integer for accumulated chain work. Work
+    is a sum of 2^difficulty terms, so all that is needed is add, subtract,
+    powers of two and compares; each is a handful of word operations with
+    no allocation and no data dependent branches. Limbs are little endian.
+*/
+class UInt256 {
+    public:
+        constexpr UInt256() : limbs{0, 0, 0, 0} {}
+        constexpr UInt256(uint64_t value) : limbs{value, 0, 0, 0} {}
+
+        // 2^exponent, 0 past the top bit
+        static constexpr UInt256 pow2(uint32_t exponent) {
+            UInt256 ret;
+            if (exponent < 256) ret.limbs[exponent / 64] = (uint64_t)1 << (exponent % 64);
+            return ret;
+        }
+
+        constexpr UInt256& operator+=(const UInt256& other) {
+            uint64_t carry = 0;
+            for(int i = 0; i < 4; i++) {
+                uint64_t sum = this->limbs[i] + other.limbs[i];
+                uint64_t next = sum < this->limbs[i];
+                this->limbs[i] = sum + carry;
+                carry = next | (this->limbs[i] < sum);
+            }
+            return *this;
+        }
+
+        constexpr UInt256& operator-=(const UInt256& other) {
+            uint64_t borrow = 0;
+            for(int i = 0; i < 4; i++) {
+                uint64_t diff = this->limbs[i] - other.limbs[i];
+                uint64_t next = this->limbs[i] < other.limbs[i];
+                this->limbs[i] = diff - borrow;
+                borrow = next | (diff < borrow);
+            }
+            return *this;
+        }
+
+        friend constexpr UInt256 operator+(UInt256 a, const UInt256& b) {
+            return a += b;
+        }
+
+        friend constexpr UInt256 operator-(UInt256 a, const UInt256& b) {
+            return a -= b;
+        }
+
+        // a < b exactly when a - b borrows out of the top limb
+        friend constexpr bool operator<(const UInt256& a, const UInt256& b) {
+            uint64_t borrow = 0;
+            for(int i = 0; i < 4; i++) {
+                uint64_t diff = a.limbs[i] - b.limbs[i];
+                borrow = (a.limbs[i] < b.limbs[i]) | (diff < borrow);
+            }
+            return borrow;
+        }
+
+        friend constexpr bool operator==(const UInt256& a, const UInt256& b) {
+            return ((a.limbs[0] ^ b.limbs[0]) | (a.limbs[1] ^ b.limbs[1]) | (a.limbs[2] ^ b.limbs[2]) | (a.limbs[3] ^ b.limbs[3])) == 0;
+        }
+
+        friend constexpr bool operator>(const UInt256& a, const UInt256& b) { return b < a; }
+        friend constexpr bool operator<=(const UInt256& a, const UInt256& b) { return !(b < a); }
+        friend constexpr bool operator>=(const UInt256& a, const UInt256& b) { return !(a < b); }
+        friend constexpr bool operator!=(const UInt256& a, const UInt256& b) { return !(a == b); }
+
+        // decimal text, the format of /total_work and of older stores
+        static UInt256 fromString(const string& decimal);
+        string toString() const;
+        // 32 bytes big endian
+        static UInt256 fromBytes(const uint8_t* buffer);
+        void toBytes(uint8_t* buffer) const;
+    protected:
+        uint32_t mulAdd(uint32_t multiplier, uint32_t addend);
+        uint32_t divide(uint32_t divisor);
+        uint64_t limbs[4];
+};
+
+string to_string(const UInt256& value);
@@ -0,0 +1,355 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include "../core/transaction.hpp"
+#include "block_segment_store.hpp"
+
+#ifdef _WIN32
+#include <filesystem>
+#else
+#include <experimental/filesystem>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+BlockSegmentStore::BlockSegmentStore() {
+    this->indexFd = -1;
+    this->writeSegment = 0;
+    this->writeOffset = 0;
+    this->viewPins = 0;
+    this->packedCount = 0;
+}
+
+BlockSegmentStore::~BlockSegmentStore() {
+    this->closeFiles();
+}
+
+#ifdef _WIN32
+
+void BlockSegmentStore::init(string path) {
+    throw std::runtime_error("Block segment store is not supported on Windows");
+}
+
+void BlockSegmentStore::openSegment(uint32_t segmentId) {}
+void BlockSegmentStore::closeFiles() {}
+void BlockSegmentStore::flush() {}
+void BlockSegmentStore::truncateIndex(uint32_t blockCount) {}
+void BlockSegmentStore::setBlock(Block& block) {}
+void BlockSegmentStore::moveBlock(uint32_t blockId, uint32_t segment, uint64_t offset) {}
+
+void BlockSegmentStore::deleteDB() {
+    filesystem::remove_all(this->path);
+}
+
+#else
+
+static void writeFully(int fd, const char* buffer, size_t len, uint64_t offset) {
+    while (len > 0) {
+        ssize_t written = pwrite(fd, buffer, len, offset);
+        if (written < 0) throw std::runtime_error("Could not write to block segment store : " + string(strerror(errno)));
+        buffer += written;
+        offset += written;
+        len -= written;
+    }
+}
+
+void BlockSegmentStore::init(string path) {
+    this->closeFiles();
+    this->path = path;
+    experimental::filesystem::create_directories(path);
+
+    this->indexFd = open((path + "/index").c_str(), O_RDWR | O_CREAT, 0644);
+    if (this->indexFd < 0) throw std::runtime_error("Could not open block segment index : " + string(strerror(errno)));
+    struct stat st;
+    fstat(this->indexFd, &st);
+    // a torn trailing entry from a crash mid-append is dropped
+    size_t numEntries = st.st_size / sizeof(IndexEntry);
+    this->index.resize(numEntries);
+    if (numEntries > 0 && pread(this->indexFd, this->index.data(), numEntries * sizeof(IndexEntry), 0) != (ssize_t)(numEntries * sizeof(IndexEntry))) {
+        throw std::runtime_error("Could not read block segment index");
+    }
+
+    // map every segment that exists on disk so old views stay addressable
+    uint32_t segmentId = 0;
+    do {
+        this->openSegment(segmentId++);
+    } while(experimental::filesystem::exists(path + "/" + to_string(segmentId) + ".seg"));
+    this->packedCount = 0;
+    this->truncateIndex(this->index.size());
+}
+
+void BlockSegmentStore::openSegment(uint32_t segmentId) {
+    string segmentPath = this->path + "/" + to_string(segmentId) + ".seg";
+    int fd = open(segmentPath.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd < 0) throw std::runtime_error("Could not open block segment " + segmentPath + " : " + string(strerror(errno)));
+    struct stat st;
+    fstat(fd, &st);
+    if (st.st_size < BLOCK_SEGMENT_SIZE && ftruncate(fd, BLOCK_SEGMENT_SIZE) != 0) {
+        close(fd);
+        throw std::runtime_error("Could not size block segment " + segmentPath + " : " + string(strerror(errno)));
+    }
+    void* data = mmap(NULL, BLOCK_SEGMENT_SIZE, PROT_READ, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED) {
+        close(fd);
+        throw std::runtime_error("Could not map block segment " + segmentPath + " : " + string(strerror(errno)));
+    }
+    this->segments.push_back({fd, (char*)data, false});
+}
+
+void BlockSegmentStore::closeFiles() {
+    for(auto& segment : this->segments) {
+        munmap(segment.data, BLOCK_SEGMENT_SIZE);
+        close(segment.fd);
+    }
+    this->segments.clear();
+    this->index.clear();
+    if (this->indexFd >= 0) close(this->indexFd);
+    this->indexFd = -1;
+}
+
+void BlockSegmentStore::flush() {
+    std::unique_lock<std::mutex> ul(this->lock);
+    for(auto& segment : this->segments) {
+        if (!segment.dirty) continue;
+        if (fdatasync(segment.fd) != 0) throw std::runtime_error("Could not sync block segment : " + string(strerror(errno)));
+        segment.dirty = false;
+    }
+    if (this->indexFd >= 0 && fdatasync(this->indexFd) != 0) {
+        throw std::runtime_error("Could not sync block segment index : " + string(strerror(errno)));
+    }
+}
+
+void BlockSegmentStore::truncateIndex(uint32_t blockCount) {
+    if (blockCount < this->index.size()) this->index.resize(blockCount);
+    if (ftruncate(this->indexFd, this->index.size() * sizeof(IndexEntry)) != 0) {
+        throw std::runtime_error("Could not truncate block segment index : " + string(strerror(errno)));
+    }
+    this->packedCount = min(this->packedCount, (uint32_t)this->index.size());
+    // with no views out the dropped blocks' bytes can be written over at once
+    if (this->viewPins == 0) this->liveEnd(this->writeSegment, this->writeOffset);
+}
+
+/*
+    Copies a block to an earlier position and points its index entry at
+    it. The destination must not overlap the block's current bytes. The
+    copy is synced before the entry and the entry before the next move,
+    so a crash leaves every entry pointing at a complete copy.
+*/
+void BlockSegmentStore::moveBlock(uint32_t blockId, uint32_t segment, uint64_t offset) {
+    IndexEntry& entry = this->index[blockId - 1];
+    vector<char> buffer(this->segments[entry.segment].data + entry.offset, this->segments[entry.segment].data + entry.offset + entry.length);
+    writeFully(this->segments[segment].fd, buffer.data(), buffer.size(), offset);
+    if (fdatasync(this->segments[segment].fd) != 0) throw std::runtime_error("Could not sync block segment : " + string(strerror(errno)));
+    entry.segment = segment;
+    entry.offset = offset;
+    uint64_t indexOffset = (uint64_t)(blockId - 1) * sizeof(IndexEntry);
+    writeFully(this->indexFd, (const char*)&entry, sizeof(IndexEntry), indexOffset);
+    if (fdatasync(this->indexFd) != 0) throw std::runtime_error("Could not sync block segment index : " + string(strerror(errno)));
+}
+
+void BlockSegmentStore::setBlock(Block& block) {
+    uint32_t blockId = block.getId();
+    if (blockId == 0) throw std::runtime_error("Cannot store block 0 in segment store");
+
+    size_t numBytes = BLOCKHEADER_BUFFER_SIZE + (TRANSACTIONINFO_BUFFER_SIZE * block.getTransactions().size());
+    if (numBytes > BLOCK_SEGMENT_SIZE) throw std::runtime_error("Block too large for segment store");
+    vector<char> buffer(numBytes);
+    BlockHeader header = block.serialize();
+    blockHeaderToBuffer(header, buffer.data());
+    char* currTransactionPtr = buffer.data() + BLOCKHEADER_BUFFER_SIZE;
+    for(auto& t : block.getTransactions()) {
+        TransactionInfo txinfo = t.serialize();
+        transactionInfoToBuffer(txinfo, currTransactionPtr);
+        currTransactionPtr += TRANSACTIONINFO_BUFFER_SIZE;
+    }
+
+    std::unique_lock<std::mutex> ul(this->lock);
+    // overwriting a block drops it and everything after it
+    if (blockId <= this->index.size()) this->truncateIndex(blockId - 1);
+
+    if (this->writeOffset + numBytes > BLOCK_SEGMENT_SIZE) {
+        this->writeSegment++;
+        this->writeOffset = 0;
+    }
+    while (this->writeSegment >= this->segments.size()) {
+        this->openSegment(this->segments.size());
+    }
+    Segment& segment = this->segments[this->writeSegment];
+    writeFully(segment.fd, buffer.data(), numBytes, this->writeOffset);
+    segment.dirty = true;
+
+    uint64_t indexOffset = this->index.size() * sizeof(IndexEntry);
+    while (this->index.size() < blockId - 1) {
+        this->index.push_back({0, 0, 0});
+    }
+    this->index.push_back({this->writeSegment, (uint32_t)numBytes, this->writeOffset});
+    size_t newEntries = this->index.size() * sizeof(IndexEntry) - indexOffset;
+    writeFully(this->indexFd, (const char*)(this->index.data()) + indexOffset, newEntries, indexOffset);
+    this->writeOffset += numBytes;
+}
+
+void BlockSegmentStore::deleteDB() {
+    this->closeFiles();
+    experimental::filesystem::remove_all(this->path);
+}
+
+#endif
+
+// segment and offset directly after the last stored block, callers hold the lock
+void BlockSegmentStore::liveEnd(uint32_t& segment, uint64_t& offset) const {
+    segment = 0;
+    offset = 0;
+    for(auto it = this->index.rbegin(); it != this->index.rend(); it++) {
+        if (it->length == 0) continue;
+        segment = it->segment;
+        offset = it->offset + it->length;
+        return;
+    }
+}
+
+/*
+    Packs the blocks stored after a gap left by a truncation with views
+    out back down over it, in order, and moves the append position to the
+    end of the last block. A block whose new place would overlap its own
+    bytes stays where it is, copying it there would write over the only
+    complete copy, and packing carries on after it. Does nothing while
+    views are out. Returns true if anything moved.
+*/
+bool BlockSegmentStore::reclaim() {
+    std::unique_lock<std::mutex> ul(this->lock);
+    if (this->viewPins > 0) return false;
+    uint32_t segment = 0;
+    uint64_t offset = 0;
+    for(uint32_t i = this->packedCount; i > 0; i--) {
+        const IndexEntry& entry = this->index[i - 1];
+        if (entry.length == 0) continue;
+        segment = entry.segment;
+        offset = entry.offset + entry.length;
+        break;
+    }
+    bool moved = false;
+    for(uint32_t i = this->packedCount; i < this->index.size(); i++) {
+        const IndexEntry& entry = this->index[i];
+        if (entry.length == 0) continue;
+        if (offset + entry.length > BLOCK_SEGMENT_SIZE) {
+            segment++;
+            offset = 0;
+        }
+        if (entry.segment == segment && offset < entry.offset && offset + entry.length > entry.offset) {
+            offset = entry.offset;
+        } else if (entry.segment != segment || entry.offset != offset) {
+            this->moveBlock(i + 1, segment, offset);
+            moved = true;
+        }
+        offset += entry.length;
+    }
+    this->packedCount = this->index.size();
+    if (segment != this->writeSegment || offset != this->writeOffset) moved = true;
+    this->writeSegment = segment;
+    this->writeOffset = offset;
+    return moved;
+}
+
+void BlockSegmentStore::closeDB() {
+    this->closeFiles();
+}
+
+void BlockSegmentStore::clear() {
+    std::unique_lock<std::mutex> ul(this->lock);
+    this->truncateIndex(0);
+}
+
+void BlockSegmentStore::truncate(uint32_t blockCount) {
+    std::unique_lock<std::mutex> ul(this->lock);
+    if (blockCount >= this->index.size()) return;
+    this->truncateIndex(blockCount);
+}
+
+uint32_t BlockSegmentStore::getBlockCount() const {
+    std::unique_lock<std::mutex> ul(this->lock);
+    return this->index.size();
+}
+
+bool BlockSegmentStore::hasBlock(uint32_t blockId) const {
+    std::unique_lock<std::mutex> ul(this->lock);
+    return blockId > 0 && blockId <= this->index.size() && this->index[blockId - 1].length > 0;
+}
+
+// bytes of blockId in the mapping, callers hold the lock while looking it up
+std::string_view BlockSegmentStore::blockData(uint32_t blockId) const {
+    if (blockId == 0 || blockId > this->index.size() || this->index[blockId - 1].length == 0) {
+        throw std::runtime_error("Could not read block " + to_string(blockId) + " from block segment store");
+    }
+    const IndexEntry& entry = this->index[blockId - 1];
+    return std::string_view(this->segments[entry.segment].data + entry.offset, entry.length);
+}
+
+// wire format of blocks start..end, copied out in one pass under the lock
+std::pair<uint8_t*, size_t> BlockSegmentStore::getRawRange(uint32_t start, uint32_t end) const {
+    std::unique_lock<std::mutex> ul(this->lock);
+    size_t numBytes = 0;
+    for(uint32_t i = start; i <= end; i++) numBytes += this->blockData(i).size();
+    uint8_t* buffer = (uint8_t*)malloc(numBytes);
+    uint8_t* currPtr = buffer;
+    for(uint32_t i = start; i <= end; i++) {
+        std::string_view raw = this->blockData(i);
+        memcpy(currPtr, raw.data(), raw.size());
+        currPtr += raw.size();
+    }
+    return std::pair<uint8_t*, size_t>(buffer, numBytes);
+}
+
+/*
+    Calls visitor with the wire format of each block start..end, viewed in
+    place in the mapping. The views are taken together under the lock, so
+    the range is from a single chain, and stay valid until readRawRange
+    returns.
+*/
+void BlockSegmentStore::readRawRange(uint32_t start, uint32_t end, std::function<void(std::string_view)> visitor) const {
+    vector<std::string_view> views;
+    {
+        std::unique_lock<std::mutex> ul(this->lock);
+        for(uint32_t i = start; i <= end; i++) views.push_back(this->blockData(i));
+        this->viewPins++;
+    }
+    try {
+        for(auto& raw : views) visitor(raw);
+    } catch(...) {
+        std::unique_lock<std::mutex> ul(this->lock);
+        this->viewPins--;
+        throw;
+    }
+    std::unique_lock<std::mutex> ul(this->lock);
+    this->viewPins--;
+}
+
+BlockHeader BlockSegmentStore::getBlockHeader(uint32_t blockId) const {
+    std::unique_lock<std::mutex> ul(this->lock);
+    return blockHeaderFromBuffer(this->blockData(blockId).data());
+}
+
+Block BlockSegmentStore::getBlock(uint32_t blockId) const {
+    std::unique_lock<std::mutex> ul(this->lock);
+    std::string_view raw = this->blockData(blockId);
+    const char* currPtr = raw.data();
+    BlockHeader header = blockHeaderFromBuffer(currPtr);
+    currPtr += BLOCKHEADER_BUFFER_SIZE;
+    vector<Transaction> transactions;
+    for(int i = 0; i < header.numTransactions; i++) {
+        TransactionInfo tx = transactionInfoFromBuffer(currPtr);
+        currPtr += TRANSACTIONINFO_BUFFER_SIZE;
+        transactions.push_back(Transaction(tx));
+    }
+    return Block(header, transactions);
+}
+
+TransactionInfo BlockSegmentStore::getTransactionInfo(uint32_t blockId, uint32_t txIndex) const {
+    std::unique_lock<std::mutex> ul(this->lock);
+    std::string_view raw = this->blockData(blockId);
+    size_t offset = BLOCKHEADER_BUFFER_SIZE + (size_t)txIndex * TRANSACTIONINFO_BUFFER_SIZE;
+    if (offset + TRANSACTIONINFO_BUFFER_SIZE > raw.size()) throw std::runtime_error("Could not read transaction from BlockStore : index out of range");
+    return transactionInfoFromBuffer(raw.data() + offset);
+}
@@ -0,0 +1,72 @@
+#pragma once
+#include <functional>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "../core/common.hpp"
+#include "../core/block.hpp"
+using namespace std;
+
+#define BLOCK_SEGMENT_SIZE (256 * 1024 * 1024)
+
+/*
+    Append-only block storage. Each block is stored in its wire format
+    (header followed by its transactions) in fixed size segment files,
+    and a dense index maps blockId -> (segment, offset, length).
+
+    Segments are memory mapped for the lifetime of the store. readRawRange
+    hands out views straight into the mapping, so bytes a view may point
+    at are never written again while it is out: truncating with views out
+    leaves the dropped blocks' bytes behind and appends continue after
+    them. reclaim(), run from compaction, later packs the blocks stored
+    after such a gap back down over it.
+*/
+class BlockSegmentStore {
+    public:
+        BlockSegmentStore();
+        ~BlockSegmentStore();
+        void init(string path);
+        void closeDB();
+        void deleteDB();
+        void clear();
+        void flush();
+        bool hasBlock(uint32_t blockId) const;
+        uint32_t getBlockCount() const;
+        void setBlock(Block& block);
+        void truncate(uint32_t blockCount);
+        std::pair<uint8_t*, size_t> getRawRange(uint32_t start, uint32_t end) const;
+        void readRawRange(uint32_t start, uint32_t end, std::function<void(std::string_view)> visitor) const;
+        bool reclaim();
+        BlockHeader getBlockHeader(uint32_t blockId) const;
+        Block getBlock(uint32_t blockId) const;
+        TransactionInfo getTransactionInfo(uint32_t blockId, uint32_t txIndex) const;
+    protected:
+        struct IndexEntry {
+            uint32_t segment;
+            uint32_t length;
+            uint64_t offset;
+        };
+        struct Segment {
+            int fd;
+            char* data;
+            bool dirty;
+        };
+        string path;
+        int indexFd;
+        vector<IndexEntry> index;
+        vector<Segment> segments;
+        uint32_t writeSegment;
+        uint64_t writeOffset;
+        // readRawRange calls whose views may still be in use
+        mutable uint32_t viewPins;
+        // index entries known to be stored back to back from the start
+        uint32_t packedCount;
+        mutable std::mutex lock;
+        std::string_view blockData(uint32_t blockId) const;
+        void openSegment(uint32_t segmentId);
+        void truncateIndex(uint32_t blockCount);
+        void liveEnd(uint32_t& segment, uint64_t& offset) const;
+        void moveBlock(uint32_t blockId, uint32_t segment, uint64_t offset);
+        void closeFiles();
+};
@@ -4,23 +4,598 @@
 #include "../core/transaction.hpp"
 #include "../core/logger.hpp"
 #include "block_store.hpp"
+
+#ifdef _WIN32
+#include <filesystem>
+#else
+#include <experimental/filesystem>
+#endif
 using namespace std;
 
 #define BLOCK_COUNT_KEY "BLOCK_COUNT"
 #define TOTAL_WORK_KEY "TOTAL_WORK"
+#define SCHEMA_VERSION_KEY "SCHEMA_VERSION"
+#define HASH_INDEX_KEY "HASH_INDEX"
+#define PRUNED_HEIGHT_KEY "PRUNED_HEIGHT"
+#define ARCHIVED_HEIGHT_KEY "ARCHIVED_HEIGHT"
+#define CHAIN_TIP_KEY "CHAIN_TIP"
+#define CHAIN_TIP_FIXED_SIZE (4 + 4 + 32 + 32)
+#define SYNC_WINDOW_KEY "SYNC_WINDOW"
+#define WORK_BINARY_TAG 0x00
+#define WORK_BINARY_SIZE (1 + UINT256_SIZE)
+#define HASH_KEY_NAMESPACE 0x02
+#define HASH_KEY_SIZE 33
+#define LEGACY_SCHEMA_VERSION 1
+#define BLOCK_KEY_NAMESPACE 0x01
+#define HEADER_KEY_SIZE 5
+#define TRANSACTION_KEY_SIZE 9
+#define LEGACY_HEADER_KEY_SIZE 4
+#define LEGACY_TRANSACTION_KEY_SIZE 8
+// wallet|txid index entries, moved to WalletStore
+#define LEGACY_WALLET_KEY_SIZE (25 + 32)
+#define MIGRATION_BATCH_KEYS 100000
+// blocks this close to the tip may still be popped and are left alone
+#define COMPACTION_HOT_BLOCKS 1000
+#define COMPACTION_BLOCKS_PER_STEP 5000
+
+/*
+    Schema v2 keys are a namespace byte followed by the big endian block id
+    for headers, and by block id + transaction index for transactions. A
+    block's header sorts directly before its transactions and blocks sort
+    in chain order, so any run of blocks is one seek and sequential reads.
+    Metadata keys are ascii strings and sort after every block key.
+*/
+static void headerKey(char* key, uint32_t blockId) {
+    key[0] = BLOCK_KEY_NAMESPACE;
+    key[1] = blockId >> 24;
+    key[2] = blockId >> 16;
+    key[3] = blockId >> 8;
+    key[4] = blockId;
+}
+
+static void transactionKey(char* key, uint32_t blockId, uint32_t txIndex) {
+    headerKey(key, blockId);
+    key[5] = txIndex >> 24;
+    key[6] = txIndex >> 16;
+    key[7] = txIndex >> 8;
+    key[8] = txIndex;
+}
+
+static void hashKey(char* key, const SHA256Hash& hash) {
+    key[0] = HASH_KEY_NAMESPACE;
+    memcpy(key + 1, hash.data(), hash.size());
+}
 
 BlockStore::BlockStore() {
+    this->schemaVersion = BLOCK_STORE_SCHEMA_VERSION;
+    this->prunedHeight = 0;
+    this->stagedPrunedHeight = 0;
+    this->hasStagedPrunedHeight = false;
+    this->archivedHeight = 0;
+    this->stagedArchivedHeight = 0;
+    this->hasStagedArchivedHeight = false;
+    this->stagedBlockCount = 0;
+    this->hasStagedBlockCount = false;
+    this->compactedHeight = 0;
+    this->compactionPrefix = string(1, (char)HASH_KEY_NAMESPACE);
+}
+
+void BlockStore::init(string path, DataStoreProfile profile) {
+    DataStore::init(path, profile);
+    string value;
+    leveldb::Status status = db->Get(leveldb::ReadOptions(), SCHEMA_VERSION_KEY, &value);
+    if (status.ok()) {
+        this->schemaVersion = *((uint32_t*)value.c_str());
+        if (this->schemaVersion > BLOCK_STORE_SCHEMA_VERSION) {
+            throw std::runtime_error("BlockStore at " + path + " uses unknown key schema v" + to_string(this->schemaVersion));
+        }
+    } else if (this->hasBlockCount()) {
+        // written before the key schema was versioned
+        this->schemaVersion = LEGACY_SCHEMA_VERSION;
+    } else {
+        this->writeSchemaVersion();
+        this->markHashIndexed();
+    }
+    this->prunedHeight = 0;
+    if (db->Get(leveldb::ReadOptions(), PRUNED_HEIGHT_KEY, &value).ok()) {
+        this->prunedHeight = *((uint32_t*)value.c_str());
+    }
+    this->archivedHeight = 0;
+    if (db->Get(leveldb::ReadOptions(), ARCHIVED_HEIGHT_KEY, &value).ok()) {
+        this->archivedHeight = *((uint32_t*)value.c_str());
+    }
+}
+
+void BlockStore::writeSchemaVersion() {
+    uint32_t version = BLOCK_STORE_SCHEMA_VERSION;
+    this->put(leveldb::Slice(SCHEMA_VERSION_KEY), leveldb::Slice((const char*)&version, sizeof(uint32_t)), true);
+    this->schemaVersion = version;
+}
+
+uint32_t BlockStore::getSchemaVersion() const {
+    return this->schemaVersion;
+}
+
+bool BlockStore::needsMigration() const {
+    return this->schemaVersion < BLOCK_STORE_SCHEMA_VERSION;
+}
+
+/*
+    Rewrites v1 keys (little endian block id, and little endian
+    blockId/txIndex pairs) to the v2 encoding in place, and drops the
+    wallet|txid index entries v3 no longer keeps (WalletStore has them).
+    The old and new keys have different lengths so both can coexist; the
+    schema version is only bumped once every key has moved, so an
+    interrupted migration is simply run again.
+*/
+void BlockStore::migrateSchema() {
+    if (!this->needsMigration()) return;
+    Logger::logStatus("Migrating BlockStore keys to schema v" + to_string(BLOCK_STORE_SCHEMA_VERSION));
+    leveldb::ReadOptions options;
+    options.snapshot = db->GetSnapshot();
+    std::unique_ptr<leveldb::Iterator> it(db->NewIterator(options));
+    uint64_t moved = 0;
+    this->startBatch();
+    try {
+        for(it->SeekToFirst(); it->Valid(); it->Next()) {
+            leveldb::Slice key = it->key();
+            if (key.size() == LEGACY_HEADER_KEY_SIZE || key.size() == LEGACY_TRANSACTION_KEY_SIZE) {
+                uint32_t ids[2];
+                memcpy(ids, key.data(), key.size());
+                if (key.size() == LEGACY_HEADER_KEY_SIZE) {
+                    char newKey[HEADER_KEY_SIZE];
+                    headerKey(newKey, ids[0]);
+                    this->put(leveldb::Slice(newKey, HEADER_KEY_SIZE), it->value());
+                } else {
+                    char newKey[TRANSACTION_KEY_SIZE];
+                    transactionKey(newKey, ids[0], ids[1]);
+                    this->put(leveldb::Slice(newKey, TRANSACTION_KEY_SIZE), it->value());
+                }
+            } else if (key.size() != LEGACY_WALLET_KEY_SIZE) {
+                continue;
+            }
+            this->remove(key);
+            if (++moved % MIGRATION_BATCH_KEYS == 0) {
+                this->commitBatch();
+                this->startBatch();
+                Logger::logStatus("Migrated " + to_string(moved) + " BlockStore keys");
+            }
+        }
+        this->commitBatch(true);
+    } catch(...) {
+        this->discardBatch();
+        db->ReleaseSnapshot(options.snapshot);
+        throw;
+    }
+    it.reset();
+    db->ReleaseSnapshot(options.snapshot);
+    this->writeSchemaVersion();
+    Logger::logStatus("Migrated " + to_string(moved) + " BlockStore keys");
+}
+
+/*
+    Moves block bodies out of LevelDB and into append-only segment files.
+    Metadata and the hash index stay in LevelDB. An existing LevelDB
+    chain is copied into the segments the first time they are enabled.
+*/
+void BlockStore::enableSegments(string path) {
+    std::unique_ptr<BlockSegmentStore> store = std::make_unique<BlockSegmentStore>();
+    store->init(path);
+    if (this->hasBlockCount()) {
+        size_t count = this->getBlockCount();
+        // the count may be ahead of the segments after a crash inside a sync window
+        ChainTip durable;
+        if (this->getSyncWindow(durable)) count = durable.count;
+        if (store->getBlockCount() > count) {
+            // blocks appended after the last durable block count
+            store->truncate(count);
+        } else if (store->getBlockCount() < count) {
+            Logger::logStatus("Copying " + to_string(count) + " blocks into block segments");
+            for(uint32_t i = store->getBlockCount() + 1; i <= count; i++) {
+                Block block = this->getBlock(i);
+                store->setBlock(block);
+            }
+            store->flush();
+        }
+    }
+    this->segments = std::move(store);
+    this->segmentsPath = path;
+}
+
+bool BlockStore::isSegmented() const {
+    return this->segments != nullptr;
+}
+
+/*
+    Splits blocks across two LevelDBs: this store keeps the recent window
+    and all metadata, the archive at path holds blocks 1..archivedHeight.
+    Reads are routed by block id, callers never see which tier a block
+    lives in.
+*/
+void BlockStore::enableArchive(string path, DataStoreProfile profile) {
+    if (this->segments) throw std::runtime_error("Block segments cannot be combined with an archive store");
+    std::unique_ptr<BlockStore> store = std::make_unique<BlockStore>();
+    store->init(path, profile);
+    this->archive = std::move(store);
+    this->archivePath = path;
+}
+
+bool BlockStore::isTiered() const {
+    return this->archive != nullptr;
+}
+
+/*
+    The header file is owned by the chain's block store only, it is kept
+    in step with the chain by BlockChain.
+*/
+void BlockStore::enableHeaderFile(string path) {
+    this->headerFile = std::make_unique<HeaderFile>();
+    this->headerFile->init(path);
+    this->headerFilePath = path;
+}
+
+HeaderFile* BlockStore::getHeaderFile() {
+    return this->headerFile.get();
+}
+
+// hashes of blocks 1..count, from the header file where it has them
+void BlockStore::getHeaderHashes(uint32_t count, vector<SHA256Hash>& hashes) const{
+    hashes.clear();
+    hashes.reserve(count);
+    uint32_t loaded = this->headerFile ? this->headerFile->read(count, NULL, hashes, false) : 0;
+    vector<Transaction> noTransactions;
+    for(uint32_t i = loaded + 1; i <= count; i++) {
+        hashes.push_back(Block(this->getBlockHeader(i), noTransactions).getHash());
+    }
+}
+
+/*
+    Total work is a tag byte and 32 big endian bytes. Older stores wrote a
+    decimal string, which never starts with the tag, and are still read.
+*/
+static string encodeWork(const UInt256& work) {
+    string value(WORK_BINARY_SIZE, '\0');
+    value[0] = WORK_BINARY_TAG;
+    work.toBytes((uint8_t*)&value[1]);
+    return value;
+}
+
+static UInt256 decodeWork(const string& value) {
+    if (value.size() == WORK_BINARY_SIZE && value[0] == WORK_BINARY_TAG) return UInt256::fromBytes((const uint8_t*)&value[1]);
+    return UInt256::fromString(value);
+}
+
+/*
+    Fixed fields followed by the total work. Written in the same batch as
+    the block count it describes.
+*/
+static string encodeChainTip(const ChainTip& tip) {
+    string value(CHAIN_TIP_FIXED_SIZE, '\0');
+    memcpy(&value[0], &tip.count, 4);
+    memcpy(&value[4], &tip.difficulty, 4);
+    memcpy(&value[8], tip.lastHash.data(), 32);
+    memcpy(&value[40], tip.headerChecksum.data(), 32);
+    value += encodeWork(tip.totalWork);
+    return value;
+}
+
+static bool decodeChainTip(const string& value, ChainTip& tip) {
+    if (value.size() <= CHAIN_TIP_FIXED_SIZE) return false;
+    memcpy(&tip.count, &value[0], 4);
+    memcpy(&tip.difficulty, &value[4], 4);
+    memcpy(tip.lastHash.data(), &value[8], 32);
+    memcpy(tip.headerChecksum.data(), &value[40], 32);
+    tip.totalWork = decodeWork(value.substr(CHAIN_TIP_FIXED_SIZE));
+    return true;
+}
+
+void BlockStore::setChainTip(const ChainTip& tip) {
+    string value = encodeChainTip(tip);
+    this->put(leveldb::Slice(CHAIN_TIP_KEY), leveldb::Slice(value));
+}
+
+bool BlockStore::getChainTip(ChainTip& tip) const{
+    string value;
+    if (!db->Get(leveldb::ReadOptions(), CHAIN_TIP_KEY, &value).ok()) return false;
+    return decodeChainTip(value, tip);
+}
+
+/*
+    Marks a stretch of unsynced block commits. durable is the last tip
+    known to be on disk in every store; while the marker exists anything
+    above it may be partly lost and is rolled back at startup. Written
+    outside any batch and synced, so it is on disk before the first
+    unsynced commit it covers.
+*/
+void BlockStore::setSyncWindow(const ChainTip& durable) {
+    string value = encodeChainTip(durable);
+    this->put(leveldb::Slice(SYNC_WINDOW_KEY), leveldb::Slice(value), true);
+}
+
+bool BlockStore::getSyncWindow(ChainTip& durable) const{
+    string value;
+    if (!db->Get(leveldb::ReadOptions(), SYNC_WINDOW_KEY, &value).ok()) return false;
+    return decodeChainTip(value, durable);
+}
+
+void BlockStore::clearSyncWindow() {
+    this->remove(leveldb::Slice(SYNC_WINDOW_KEY), true);
+}
+
+// drops hash index entries of blocks above height, block bodies are left to be overwritten
+void BlockStore::removeHashesAbove(uint32_t height) {
+    this->startBatch();
+    std::unique_ptr<leveldb::Iterator> it(db->NewIterator(leveldb::ReadOptions()));
+    char prefix = HASH_KEY_NAMESPACE;
+    for(it->Seek(leveldb::Slice(&prefix, 1)); it->Valid() && it->key()[0] == prefix; it->Next()) {
+        if (it->key().size() != HASH_KEY_SIZE || it->value().size() != sizeof(uint32_t)) continue;
+        if (*((const uint32_t*)it->value().data()) > height) this->remove(it->key());
+    }
+    this->commitBatch(true);
+}
+
+uint32_t BlockStore::getArchivedHeight() const{
+    return this->archivedHeight;
+}
+
+void BlockStore::setArchivedHeight(uint32_t height) {
+    this->put(leveldb::Slice(ARCHIVED_HEIGHT_KEY), leveldb::Slice((const char*)&height, sizeof(uint32_t)));
+    if (this->isBatching()) {
+        this->stagedArchivedHeight = height;
+        this->hasStagedArchivedHeight = true;
+    } else {
+        this->archivedHeight = height;
+    }
+}
+
+bool BlockStore::isArchived(uint32_t blockId) const{
+    return this->archive && blockId <= this->archivedHeight;
+}
+
+/*
+    Moves blocks start..end (start must be archivedHeight + 1) into the
+    archive. The copy is synced before the blocks are deleted here, and
+    readers are switched over as soon as the archive holds them, so a
+    crash at any point leaves every block readable from at least one tier.
+*/
+void BlockStore::archiveBlocks(uint32_t start, uint32_t end) {
+    if (!this->archive) throw std::runtime_error("BlockStore has no archive");
+    if (start != this->archivedHeight + 1) throw std::runtime_error("Blocks must be archived in order");
+    vector<Block> blocks;
+    this->scanBlocks(start, end, [&blocks](BlockHeader& header, vector<TransactionInfo>& transactionInfo) {
+        vector<Transaction> transactions;
+        for(auto& t : transactionInfo) {
+            transactions.push_back(Transaction(t));
+        }
+        blocks.push_back(Block(header, transactions));
+    });
+    this->archive->startBatch();
+    for(auto& block : blocks) {
+        this->archive->writeBlock(block);
+    }
+    this->archive->commitBatch(true);
+    this->archivedHeight = end;
+    this->startBatch();
+    for(auto& block : blocks) {
+        this->removeBlock(block);
+    }
+    this->setArchivedHeight(end);
+    this->commitBatch(true);
+}
+
+void BlockStore::closeDB() {
+    if (this->headerFile) this->headerFile->closeFile();
+    this->headerFile = nullptr;
+    if (this->segments) this->segments->closeDB();
+    this->segments = nullptr;
+    if (this->archive) this->archive->closeDB();
+    this->archive = nullptr;
+    DataStore::closeDB();
+}
+
+void BlockStore::deleteDB() {
+    if (this->headerFile) this->headerFile->closeFile();
+    this->headerFile = nullptr;
+    if (this->segments) this->segments->closeDB();
+    this->segments = nullptr;
+    if (this->headerFilePath != "") {
+#ifdef _WIN32
+        filesystem::remove(this->headerFilePath);
+#else
+        experimental::filesystem::remove(this->headerFilePath);
+#endif
+    }
+    if (this->segmentsPath != "") {
+#ifdef _WIN32
+        filesystem::remove_all(this->segmentsPath);
+#else
+        experimental::filesystem::remove_all(this->segmentsPath);
+#endif
+    }
+    if (this->archivePath != "") {
+        leveldb::DestroyDB(this->archivePath, leveldb::Options());
+#ifdef _WIN32
+        filesystem::remove_all(this->archivePath);
+#else
+        experimental::filesystem::remove_all(this->archivePath);
+#endif
+    }
+    DataStore::deleteDB();
+}
+
+void BlockStore::clear() {
+    if (this->headerFile) this->headerFile->truncate(0);
+    if (this->segments) this->segments->clear();
+    if (this->archive) this->archive->clear();
+    DataStore::clear();
+    this->writeSchemaVersion();
+    this->markHashIndexed();
+    this->prunedHeight = 0;
+    this->archivedHeight = 0;
+}
+
+json BlockStore::getStats() const {
+    json ret = DataStore::getStats();
+    if (this->archive) {
+        ret["archive"] = this->archive->getStats();
+        ret["archivedHeight"] = (uint32_t)this->archivedHeight;
+    }
+    return ret;
+}
+
+// a synced commit makes the block bodies in the segments durable first
+void BlockStore::commitBatch(bool sync) {
+    if (sync && this->segments) this->segments->flush();
+    DataStore::commitBatch(sync);
+    if (this->hasStagedPrunedHeight) this->prunedHeight = this->stagedPrunedHeight;
+    if (this->hasStagedArchivedHeight) this->archivedHeight = this->stagedArchivedHeight;
+    if (this->hasStagedBlockCount && this->segments) this->segments->truncate(this->stagedBlockCount);
+    this->hasStagedPrunedHeight = false;
+    this->hasStagedArchivedHeight = false;
+    this->hasStagedBlockCount = false;
+}
+
+void BlockStore::discardBatch() {
+    DataStore::discardBatch();
+    this->hasStagedPrunedHeight = false;
+    this->hasStagedArchivedHeight = false;
+    this->hasStagedBlockCount = false;
+}
+
+void BlockStore::sync() {
+    if (this->segments) this->segments->flush();
+    DataStore::sync();
+}
+
+/*
+    Blocks 1..prunedHeight have had their transactions deleted, only the
+    header and hash index entry remain. The height is written in the same
+    batch as the deletes and only becomes visible to readers once that
+    batch has been committed.
+*/
+uint32_t BlockStore::getPrunedHeight() const{
+    return this->prunedHeight;
+}
+
+void BlockStore::setPrunedHeight(uint32_t height) {
+    this->put(leveldb::Slice(PRUNED_HEIGHT_KEY), leveldb::Slice((const char*)&height, sizeof(uint32_t)));
+    if (this->isBatching()) {
+        this->stagedPrunedHeight = height;
+        this->hasStagedPrunedHeight = true;
+    } else {
+        this->prunedHeight = height;
+    }
+}
+
+bool BlockStore::isPruned(uint32_t blockId) const{
+    return blockId <= this->prunedHeight;
+}
+
+void BlockStore::pruneBlock(uint32_t blockId) {
+    if (this->segments) throw std::runtime_error("Cannot prune blocks stored in block segments");
+    BlockHeader header = this->getBlockHeader(blockId);
+    char key[TRANSACTION_KEY_SIZE];
+    for(uint32_t i = 0; i < header.numTransactions; i++) {
+        transactionKey(key, blockId, i);
+        this->remove(leveldb::Slice(key, TRANSACTION_KEY_SIZE));
+    }
+}
+
+/*
+    Pruned blocks are contiguous in key order, so compacting just their
+    range drops the tombstones without touching the rest of the store.
+*/
+void BlockStore::compactBlocks(uint32_t start, uint32_t end) {
+    char startKey[HEADER_KEY_SIZE];
+    char endKey[HEADER_KEY_SIZE];
+    headerKey(startKey, start);
+    headerKey(endKey, end + 1);
+    leveldb::Slice begin(startKey, HEADER_KEY_SIZE);
+    leveldb::Slice limit(endKey, HEADER_KEY_SIZE);
+    db->CompactRange(&begin, &limit);
+}
+
+/*
+    Blocks below the hot window are never written again, so they are
+    compacted once, in chain order, a step at a time. After that only the
+    hash index namespace gets the periodic passes of the default.
+*/
+bool BlockStore::nextCompactionRange(string& begin, string& end) {
+    // idle steps also hand back the segment space of popped blocks
+    if (this->segments) this->segments->reclaim();
+    uint32_t count = this->hasBlockCount() ? this->getBlockCount() : 0;
+    // rewinds may have removed blocks that were already compacted
+    this->compactedHeight = min(this->compactedHeight, count);
+    if (count > this->compactedHeight + COMPACTION_HOT_BLOCKS && !this->segments) {
+        uint32_t start = max(this->compactedHeight + 1, (uint32_t)this->archivedHeight + 1);
+        uint32_t last = min(count - COMPACTION_HOT_BLOCKS, start + COMPACTION_BLOCKS_PER_STEP - 1);
+        this->compactedHeight = last;
+        if (start <= last) {
+            char startKey[HEADER_KEY_SIZE];
+            char endKey[HEADER_KEY_SIZE];
+            headerKey(startKey, start);
+            headerKey(endKey, last + 1);
+            begin = string(startKey, HEADER_KEY_SIZE);
+            end = string(endKey, HEADER_KEY_SIZE);
+            return true;
+        }
+    }
+    return DataStore::nextCompactionRange(begin, end);
+}
+
+/*
+    Block hash -> block id. Entries are written in the same batch as the
+    block and removed when it is popped. Stores created before the index
+    existed lack the HASH_INDEX marker until the index has been built.
+*/
+bool BlockStore::hasHashIndex() const{
+    string value;
+    return db->Get(leveldb::ReadOptions(), HASH_INDEX_KEY, &value).ok();
+}
+
+void BlockStore::markHashIndexed() {
+    this->put(leveldb::Slice(HASH_INDEX_KEY), leveldb::Slice("1", 1), true);
+}
+
+void BlockStore::setBlockHash(const SHA256Hash& hash, uint32_t blockId) {
+    char key[HASH_KEY_SIZE];
+    hashKey(key, hash);
+    this->put(leveldb::Slice(key, HASH_KEY_SIZE), leveldb::Slice((const char*)&blockId, sizeof(uint32_t)));
+}
+
+void BlockStore::removeBlockHash(const SHA256Hash& hash) {
+    char key[HASH_KEY_SIZE];
+    hashKey(key, hash);
+    this->remove(leveldb::Slice(key, HASH_KEY_SIZE));
+}
+
+bool BlockStore::getBlockIdForHash(const SHA256Hash& hash, uint32_t& blockId) const{
+    char key[HASH_KEY_SIZE];
+    hashKey(key, hash);
+    string value;
+    leveldb::Status status = db->Get(leveldb::ReadOptions(), leveldb::Slice(key, HASH_KEY_SIZE), &value);
+    if (!status.ok() || value.size() != sizeof(uint32_t)) return false;
+    blockId = *((uint32_t*)value.c_str());
+    return true;
 }
 
 void BlockStore::setBlockCount(size_t count) {
+    // block bodies must be durable before the count that references them,
+    // inside a batch that happens in commitBatch
+    if (this->segments && !this->isBatching()) this->segments->flush();
     string countKey = BLOCK_COUNT_KEY;
     size_t num = count;
     leveldb::Slice key = leveldb::Slice(countKey);
     leveldb::Slice slice = leveldb::Slice((const char*)&num, sizeof(size_t));
-    leveldb::WriteOptions write_options;
-    write_options.sync = true;
-    leveldb::Status status = db->Put(write_options, key, slice);
-    if(!status.ok()) throw std::runtime_error("Could not write block count to DB : " + status.ToString());
+    this->put(key, slice, true);
+    // popped blocks leave the segment index once the lower count is written
+    if (!this->segments) return;
+    if (this->isBatching()) {
+        this->stagedBlockCount = count;
+        this->hasStagedBlockCount = true;
+    } else {
+        this->segments->truncate(count);
+    }
 }
 
 size_t BlockStore::getBlockCount() const {
@@ -33,25 +608,21 @@ size_t BlockStore::getBlockCount() const {
     return ret;
 }
 
-void BlockStore::setTotalWork(Bigint count) {
+void BlockStore::setTotalWork(const UInt256& work) {
     string countKey = TOTAL_WORK_KEY;
-    string sz = to_string(count);
+    string sz = encodeWork(work);
     leveldb::Slice key = leveldb::Slice(countKey);
     leveldb::Slice slice = leveldb::Slice((const char*)sz.c_str(), sz.size());
-    leveldb::WriteOptions write_options;
-    write_options.sync = true;
-    leveldb::Status status = db->Put(write_options, key, slice);
-    if(!status.ok()) throw std::runtime_error("Could not write block count to DB : " + status.ToString());
+    this->put(key, slice, true);
 }
 
-Bigint BlockStore::getTotalWork() const{
+UInt256 BlockStore::getTotalWork() const{
     string countKey = TOTAL_WORK_KEY;
     leveldb::Slice key = leveldb::Slice(countKey);
     string value;
     leveldb::Status status = db->Get(leveldb::ReadOptions(),key, &value);
     if(!status.ok()) throw std::runtime_error("Could not read block count from DB : " + status.ToString());
-    Bigint b(value);
-    return b;
+    return decodeWork(value);
 }
 
 bool BlockStore::hasBlockCount() {
@@ -64,16 +635,22 @@ bool BlockStore::hasBlockCount() {
 }
 
 bool BlockStore::hasBlock(uint32_t blockId) {
-    leveldb::Slice key = leveldb::Slice((const char*) &blockId, sizeof(uint32_t));
+    if (this->segments) return this->segments->hasBlock(blockId);
+    if (this->isArchived(blockId)) return this->archive->hasBlock(blockId);
+    char key[HEADER_KEY_SIZE];
+    headerKey(key, blockId);
     string value;
-    leveldb::Status status = db->Get(leveldb::ReadOptions(),key, &value);
+    leveldb::Status status = db->Get(leveldb::ReadOptions(), leveldb::Slice(key, HEADER_KEY_SIZE), &value);
     return (status.ok());
 }
 
 BlockHeader BlockStore::getBlockHeader(uint32_t blockId) const{
-    leveldb::Slice key = leveldb::Slice((const char*) &blockId, sizeof(uint32_t));
+    if (this->segments) return this->segments->getBlockHeader(blockId);
+    if (this->isArchived(blockId)) return this->archive->getBlockHeader(blockId);
+    char key[HEADER_KEY_SIZE];
+    headerKey(key, blockId);
     string valueStr;
-    leveldb::Status status = db->Get(leveldb::ReadOptions(),key, &valueStr);
+    leveldb::Status status = db->Get(leveldb::ReadOptions(), leveldb::Slice(key, HEADER_KEY_SIZE), &valueStr);
     if(!status.ok()) throw std::runtime_error("Could not read block header " + to_string(blockId) + " from BlockStore db : " + status.ToString());
     
     BlockHeader value;
@@ -81,162 +658,171 @@ BlockHeader BlockStore::getBlockHeader(uint32_t blockId) const{
     return value;
 }
 
-vector<TransactionInfo> BlockStore::getBlockTransactions(BlockHeader& block) const{
-    vector<TransactionInfo> transactions;
-    for(int i = 0; i < block.numTransactions; i++) {
-        int idx = i;
-        int transactionId[2];
-        transactionId[0] = block.id;
-        transactionId[1] = idx;
-        leveldb::Slice key = leveldb::Slice((const char*) transactionId, 2*sizeof(int));
-        string valueStr;
-        leveldb::Status status = db->Get(leveldb::ReadOptions(),key, &valueStr);
-        if(!status.ok()) throw std::runtime_error("Could not read transaction from BlockStore db : " + status.ToString());
-        TransactionInfo t;
-        memcpy(&t, valueStr.c_str(), sizeof(TransactionInfo));
-        transactions.push_back(t);
+/*
+    Reads blocks start..end with a single iterator. Each block normally
+    follows the previous one directly; we only seek again when stale
+    transactions of a longer block that was popped and replaced sit in
+    between.
+*/
+void BlockStore::scanBlocks(uint32_t start, uint32_t end, std::function<void(BlockHeader&, vector<TransactionInfo>&)> visitor) const{
+    std::unique_ptr<leveldb::Iterator> it(db->NewIterator(leveldb::ReadOptions()));
+    char hKey[HEADER_KEY_SIZE];
+    char tKey[TRANSACTION_KEY_SIZE];
+    headerKey(hKey, start);
+    it->Seek(leveldb::Slice(hKey, HEADER_KEY_SIZE));
+    for(uint32_t blockId = start; blockId <= end; blockId++) {
+        headerKey(hKey, blockId);
+        leveldb::Slice expected(hKey, HEADER_KEY_SIZE);
+        if (!it->Valid() || it->key() != expected) it->Seek(expected);
+        if (!it->Valid() || it->key() != expected) throw std::runtime_error("Could not read block header " + to_string(blockId) + " from BlockStore db");
+        BlockHeader header;
+        memcpy(&header, it->value().data(), sizeof(BlockHeader));
+        it->Next();
+        vector<TransactionInfo> transactions(header.numTransactions);
+        for(uint32_t i = 0; i < header.numTransactions; i++) {
+            transactionKey(tKey, blockId, i);
+            if (!it->Valid() || it->key() != leveldb::Slice(tKey, TRANSACTION_KEY_SIZE)) {
+                throw std::runtime_error("Could not read transaction from BlockStore db : block " + to_string(blockId));
+            }
+            memcpy(&transactions[i], it->value().data(), sizeof(TransactionInfo));
+            it->Next();
+        }
+        visitor(header, transactions);
     }
-    return std::move(transactions);
 }
 
-std::pair<uint8_t*, size_t> BlockStore::getRawData(uint32_t blockId) const{
-    BlockHeader block = this->getBlockHeader(blockId);
-    size_t numBytes = BLOCKHEADER_BUFFER_SIZE + (TRANSACTIONINFO_BUFFER_SIZE * block.numTransactions);
-    char* buffer = (char*)malloc(numBytes);
-    blockHeaderToBuffer(block, buffer);
-    char* transactionBuffer = buffer + BLOCKHEADER_BUFFER_SIZE;
-    char* currTransactionPtr = transactionBuffer;
-    for(int i = 0; i < block.numTransactions; i++) {
-        int idx = i;
-        uint32_t transactionId[2];
-        transactionId[0] = blockId;
-        transactionId[1] = idx;
-        leveldb::Slice key = leveldb::Slice((const char*) transactionId, 2*sizeof(uint32_t));
-        string value;
-        leveldb::Status status = db->Get(leveldb::ReadOptions(),key, &value);
-        TransactionInfo txinfo = *(TransactionInfo*)(value.c_str());
-        transactionInfoToBuffer(txinfo, currTransactionPtr);
-        if (!status.ok()) throw std::runtime_error("Could not read transaction from BlockStore db : " + status.ToString());
-        currTransactionPtr += TRANSACTIONINFO_BUFFER_SIZE;
-    }
-    return std::pair<uint8_t*, size_t>((uint8_t*)buffer, numBytes);
-}
-
-Block BlockStore::getBlock(uint32_t blockId) const{
-    BlockHeader block = this->getBlockHeader(blockId);
-    vector<TransactionInfo> transactionInfo = this->getBlockTransactions(block);
-    vector<Transaction> transactions;
-    for(auto t : transactionInfo) {
-        transactions.push_back(Transaction(t));
+/*
+    Calls visitor with the wire format of blocks start..end. Segments hand
+    out views into their mapping, one per block, other stores one buffer
+    for the whole range.
+*/
+void BlockStore::readRawRange(uint32_t start, uint32_t end, std::function<void(std::string_view)> visitor) const{
+    if (this->isPruned(start)) throw std::runtime_error("Block " + to_string(start) + " has been pruned");
+    if (this->segments) {
+        this->segments->readRawRange(start, end, visitor);
+        return;
     }
-    Block ret(block, transactions);
-    return ret;
+    std::pair<uint8_t*, size_t> buffer = this->getRawRange(start, end);
+    try {
+        visitor(std::string_view((const char*)buffer.first, buffer.second));
+    } catch(...) {
+        free(buffer.first);
+        throw;
+    }
+    free(buffer.first);
 }
 
-vector<SHA256Hash> BlockStore::getTransactionsForWallet(PublicWalletAddress& wallet) const{
-    struct {
-        uint8_t addr[25];
-        uint8_t txId[32];
-    } startKey;
-
-    struct {
-        uint8_t addr[25];
-        uint8_t txId[32];
-    } endKey;
-
-    memcpy(startKey.addr,wallet.data(), 25);
-    memset(startKey.txId, 0, 32);
-    memcpy(endKey.addr, wallet.data(), 25);
-    memset(endKey.txId, -1, 32);
-
-    auto startSlice = leveldb::Slice((const char*) &startKey, sizeof(startKey));
-    auto endSlice = leveldb::Slice((const char*) &endKey, sizeof(endKey));
-
-    // Get a database iterator
-    std::shared_ptr<leveldb::Iterator> it(db->NewIterator(leveldb::ReadOptions()));
+std::pair<uint8_t*, size_t> BlockStore::getRawData(uint32_t blockId) const{
+    return this->getRawRange(blockId, blockId);
+}
 
-    vector<SHA256Hash> ret;
-    for(it->Seek(startSlice); it->Valid() && it->key().compare(endSlice) < 0; it->Next()) {                
-        leveldb::Slice keySlice(it->key());
-        SHA256Hash txid;
-        memcpy(txid.data(), keySlice.data() + 25, 32);
-        ret.push_back(txid);
+/*
+    Wire format of blocks start..end back to back, as served by /sync.
+*/
+std::pair<uint8_t*, size_t> BlockStore::getRawRange(uint32_t start, uint32_t end) const{
+    if (this->isPruned(start)) throw std::runtime_error("Block " + to_string(start) + " has been pruned");
+    if (this->segments) return this->segments->getRawRange(start, end);
+    string raw;
+    if (this->isArchived(start)) {
+        this->archive->appendRawRange(start, min(end, (uint32_t)this->archivedHeight), raw);
+        start = this->archivedHeight + 1;
     }
-    return std::move(ret);
+    if (start <= end) this->appendRawRange(start, end, raw);
+    uint8_t* buffer = (uint8_t*)malloc(raw.size());
+    memcpy(buffer, raw.data(), raw.size());
+    return std::pair<uint8_t*, size_t>(buffer, raw.size());
 }
 
+void BlockStore::appendRawRange(uint32_t start, uint32_t end, string& raw) const{
+    this->scanBlocks(start, end, [&raw](BlockHeader& header, vector<TransactionInfo>& transactions) {
+        size_t offset = raw.size();
+        raw.resize(offset + BLOCKHEADER_BUFFER_SIZE + (TRANSACTIONINFO_BUFFER_SIZE * transactions.size()));
+        char* currPtr = (char*)raw.data() + offset;
+        blockHeaderToBuffer(header, currPtr);
+        currPtr += BLOCKHEADER_BUFFER_SIZE;
+        for(auto& txinfo : transactions) {
+            transactionInfoToBuffer(txinfo, currPtr);
+            currPtr += TRANSACTIONINFO_BUFFER_SIZE;
+        }
+    });
+}
 
-void BlockStore::removeBlockWalletTransactions(Block& block) {
-    for(auto t : block.getTransactions()) {
-        SHA256Hash txid = t.hashContents();
-        struct {
-            uint8_t addr[25];
-            uint8_t txId[32];
-        } w1Key;
-
-        struct {
-            uint8_t addr[25];
-            uint8_t txId[32];
-        } w2Key;
-
-        memcpy(w1Key.addr, t.fromWallet().data(), 25);
-        memcpy(w1Key.txId, txid.data(), 32);
-        memcpy(w2Key.addr, t.toWallet().data(), 25);
-        memcpy(w2Key.txId, txid.data(), 32);
+Transaction BlockStore::getTransaction(uint32_t blockId, uint32_t txIndex) const{
+    if (this->isPruned(blockId)) throw std::runtime_error("Block " + to_string(blockId) + " has been pruned");
+    if (this->segments) return Transaction(this->segments->getTransactionInfo(blockId, txIndex));
+    if (this->isArchived(blockId)) return this->archive->getTransaction(blockId, txIndex);
+    // keys past the end can be left by a longer block popped at this height
+    if (txIndex >= this->getBlockHeader(blockId).numTransactions) throw std::runtime_error("Could not read transaction from BlockStore : index out of range");
+    char key[TRANSACTION_KEY_SIZE];
+    transactionKey(key, blockId, txIndex);
+    string valueStr;
+    leveldb::Status status = db->Get(leveldb::ReadOptions(), leveldb::Slice(key, TRANSACTION_KEY_SIZE), &valueStr);
+    if(!status.ok()) throw std::runtime_error("Could not read transaction from BlockStore db : " + status.ToString());
+    TransactionInfo t;
+    memcpy(&t, valueStr.c_str(), sizeof(TransactionInfo));
+    return Transaction(t);
+}
 
-        leveldb::Slice key = leveldb::Slice((const char*) &w1Key, sizeof(w1Key));
-        leveldb::Status status = db->Delete(leveldb::WriteOptions(), key);
-        if(!status.ok()) throw std::runtime_error("Could not remove transaction from wallet in blockstore db : " + status.ToString());
+Block BlockStore::getBlock(uint32_t blockId) const{
+    if (this->isPruned(blockId)) throw std::runtime_error("Block " + to_string(blockId) + " has been pruned");
+    if (this->segments) return this->segments->getBlock(blockId);
+    if (this->isArchived(blockId)) return this->archive->getBlock(blockId);
+    vector<Block> blocks;
+    this->scanBlocks(blockId, blockId, [&blocks](BlockHeader& header, vector<TransactionInfo>& transactionInfo) {
+        vector<Transaction> transactions;
+        for(auto& t : transactionInfo) {
+            transactions.push_back(Transaction(t));
+        }
+        blocks.push_back(Block(header, transactions));
+    });
+    return blocks[0];
+}
 
-        key = leveldb::Slice((const char*) &w2Key, sizeof(w2Key));
-        status = db->Delete(leveldb::WriteOptions(), key);
-        if(!status.ok()) throw std::runtime_error("Could not remove transaction from wallet in blockstore db : " + status.ToString());
+void BlockStore::setBlock(Block& block) {
+    uint32_t blockId = block.getId();
+    this->setBlockHash(block.getHash(), blockId);
+    if (this->segments) {
+        this->segments->setBlock(block);
+        return;
     }
+    this->writeBlock(block);
 }
 
-void BlockStore::setBlock(Block& block) {
+void BlockStore::writeBlock(Block& block) {
     uint32_t blockId = block.getId();
-    leveldb::Slice key = leveldb::Slice((const char*) &blockId, sizeof(uint32_t));
+    char hKey[HEADER_KEY_SIZE];
+    headerKey(hKey, blockId);
     BlockHeader blockStruct = block.serialize();
     leveldb::Slice slice = leveldb::Slice((const char*)&blockStruct, sizeof(BlockHeader));
-    leveldb::Status status = db->Put(leveldb::WriteOptions(), key, slice);
-    if(!status.ok()) throw std::runtime_error("Could not write block to BlockStore db : " + status.ToString());
+    this->put(leveldb::Slice(hKey, HEADER_KEY_SIZE), slice);
+    this->removeTransactionsFrom(blockId, block.getTransactions().size());
+    char tKey[TRANSACTION_KEY_SIZE];
     for(int i = 0; i < block.getTransactions().size(); i++) {
-        uint32_t transactionId[2];
-        transactionId[0] = blockId;
-        transactionId[1] = i;
+        transactionKey(tKey, blockId, i);
         TransactionInfo t = block.getTransactions()[i].serialize();
-        leveldb::Slice key = leveldb::Slice((const char*) transactionId, 2*sizeof(uint32_t));
         leveldb::Slice slice = leveldb::Slice((const char*)&t, sizeof(TransactionInfo));
-        leveldb::Status status = db->Put(leveldb::WriteOptions(), key, slice);
-        if(!status.ok()) throw std::runtime_error("Could not write transaction to BlockStore db : " + status.ToString());
-
-        // add the transaction to from and to wallets list of transactions
-        SHA256Hash txid = block.getTransactions()[i].hashContents();
-        struct {
-            uint8_t addr[25];
-            uint8_t txId[32];
-        } w1Key;
-
-        struct {
-            uint8_t addr[25];
-            uint8_t txId[32];
-        } w2Key;
-
-        memcpy(w1Key.addr, t.from.data(), 25);
-        memcpy(w1Key.txId, txid.data(), 32);
-        memcpy(w2Key.addr, t.to.data(), 25);
-        memcpy(w2Key.txId, txid.data(), 32);
+        this->put(leveldb::Slice(tKey, TRANSACTION_KEY_SIZE), slice);
+    }
+}
 
-        key = leveldb::Slice((const char*) &w1Key, sizeof(w1Key));
-        slice = leveldb::Slice("", 0);
-        status = db->Put(leveldb::WriteOptions(), key, slice);
-        if(!status.ok()) throw std::runtime_error("Could not write wallet transactions to BlockStore db : " + status.ToString());
+void BlockStore::removeBlock(Block& block) {
+    char key[HEADER_KEY_SIZE];
+    headerKey(key, block.getId());
+    this->remove(leveldb::Slice(key, HEADER_KEY_SIZE));
+    this->removeTransactionsFrom(block.getId(), 0);
+}
 
-        key = leveldb::Slice((const char*) &w2Key, sizeof(w2Key));
-        slice = leveldb::Slice("", 0);
-        status = db->Put(leveldb::WriteOptions(), key, slice);
-        if(!status.ok()) throw std::runtime_error("Could not write wallet transactions to BlockStore db : " + status.ToString());
+/*
+    Removes every stored transaction of blockId from index first on, found
+    by scanning the block's key prefix rather than trusting a count, so
+    tails left by an earlier, longer block at the same height go as well.
+*/
+void BlockStore::removeTransactionsFrom(uint32_t blockId, uint32_t first) {
+    char key[TRANSACTION_KEY_SIZE];
+    transactionKey(key, blockId, first);
+    std::unique_ptr<leveldb::Iterator> it(db->NewIterator(leveldb::ReadOptions()));
+    for(it->Seek(leveldb::Slice(key, TRANSACTION_KEY_SIZE)); it->Valid(); it->Next()) {
+        if (it->key().size() != TRANSACTION_KEY_SIZE || memcmp(it->key().data(), key, HEADER_KEY_SIZE) != 0) break;
+        this->remove(it->key());
     }
 }
-
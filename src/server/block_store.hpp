@@ -1,26 +1,101 @@
 #pragma once
+#include <atomic>
+#include <functional>
 #include <mutex>
 #include "leveldb/db.h"
 #include "../core/common.hpp"
 #include "../core/block.hpp"
 #include "data_store.hpp"
+#include "block_segment_store.hpp"
+#include "header_file.hpp"
+
+#define BLOCK_STORE_SCHEMA_VERSION 3
+
+// written with every block commit so startup does not have to derive it
+struct ChainTip {
+    uint32_t count;
+    uint32_t difficulty;
+    SHA256Hash lastHash;
+    SHA256Hash headerChecksum;
+    UInt256 totalWork;
+};
 
 class BlockStore : public DataStore {
     public:
         BlockStore();
+        void init(string path, DataStoreProfile profile = DataStoreProfile());
+        uint32_t getSchemaVersion() const;
+        bool needsMigration() const;
+        void migrateSchema();
+        void enableSegments(string path);
+        bool isSegmented() const;
+        void enableArchive(string path, DataStoreProfile profile = DataStoreProfile());
+        bool isTiered() const;
+        void enableHeaderFile(string path);
+        HeaderFile* getHeaderFile();
+        void getHeaderHashes(uint32_t count, vector<SHA256Hash>& hashes) const;
+        void setChainTip(const ChainTip& tip);
+        bool getChainTip(ChainTip& tip) const;
+        void setSyncWindow(const ChainTip& durable);
+        bool getSyncWindow(ChainTip& durable) const;
+        void clearSyncWindow();
+        void removeHashesAbove(uint32_t height);
+        uint32_t getArchivedHeight() const;
+        void setArchivedHeight(uint32_t height);
+        void archiveBlocks(uint32_t start, uint32_t end);
+        void closeDB();
+        void deleteDB();
+        void clear();
+        json getStats() const;
+        void commitBatch(bool sync = false);
+        void discardBatch();
+        void sync();
         bool hasBlock(uint32_t blockId);
         Block getBlock(uint32_t blockId)const;
+        Transaction getTransaction(uint32_t blockId, uint32_t txIndex) const;
         std::pair<uint8_t*, size_t> getRawData(uint32_t blockId) const;
+        std::pair<uint8_t*, size_t> getRawRange(uint32_t start, uint32_t end) const;
+        void readRawRange(uint32_t start, uint32_t end, std::function<void(std::string_view)> visitor) const;
         BlockHeader getBlockHeader(uint32_t blockId) const;
         void setBlock(Block& b);
         void setBlockCount(size_t count);
         size_t getBlockCount() const;
-        void setTotalWork(Bigint work);
-        Bigint getTotalWork() const;
+        void setTotalWork(const UInt256& work);
+        UInt256 getTotalWork() const;
         bool hasBlockCount();
-
-        vector<SHA256Hash> getTransactionsForWallet(PublicWalletAddress& wallet) const;
-        void removeBlockWalletTransactions(Block& block);
+        bool hasHashIndex() const;
+        void markHashIndexed();
+        void setBlockHash(const SHA256Hash& hash, uint32_t blockId);
+        void removeBlockHash(const SHA256Hash& hash);
+        bool getBlockIdForHash(const SHA256Hash& hash, uint32_t& blockId) const;
+        uint32_t getPrunedHeight() const;
+        void setPrunedHeight(uint32_t height);
+        bool isPruned(uint32_t blockId) const;
+        void pruneBlock(uint32_t blockId);
+        void compactBlocks(uint32_t start, uint32_t end);
+        bool nextCompactionRange(string& begin, string& end);
     protected:
-        vector<TransactionInfo> getBlockTransactions(BlockHeader& block) const;
+        void scanBlocks(uint32_t start, uint32_t end, std::function<void(BlockHeader&, vector<TransactionInfo>&)> visitor) const;
+        void appendRawRange(uint32_t start, uint32_t end, string& raw) const;
+        void writeBlock(Block& block);
+        void removeBlock(Block& block);
+        void removeTransactionsFrom(uint32_t blockId, uint32_t first);
+        bool isArchived(uint32_t blockId) const;
+        void writeSchemaVersion();
+        uint32_t schemaVersion;
+        std::atomic<uint32_t> prunedHeight;
+        uint32_t stagedPrunedHeight;
+        bool hasStagedPrunedHeight;
+        std::atomic<uint32_t> archivedHeight;
+        uint32_t stagedArchivedHeight;
+        bool hasStagedArchivedHeight;
+        size_t stagedBlockCount;
+        bool hasStagedBlockCount;
+        uint32_t compactedHeight;
+        std::unique_ptr<BlockStore> archive;
+        string archivePath;
+        std::unique_ptr<BlockSegmentStore> segments;
+        string segmentsPath;
+        std::unique_ptr<HeaderFile> headerFile;
+        string headerFilePath;
 };
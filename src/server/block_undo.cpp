@@ -0,0 +1,79 @@
+#include <map>
+#include <stdexcept>
+#include "../core/helpers.hpp"
+#include "block_undo.hpp"
+
+#define WALLET_UNDO_SIZE (25 + 1 + 8)
+#define TRANSACTION_UNDO_SIZE (32 + 4 + 4)
+
+BlockUndo::BlockUndo() {
+}
+
+/*
+    Must be called before the block executes: balances are read as of the
+    last committed block.
+*/
+BlockUndo::BlockUndo(Block& block, const Ledger& ledger) {
+    map<PublicWalletAddress, uint32_t> slots;
+    auto slotFor = [&](const PublicWalletAddress& wallet) {
+        auto it = slots.find(wallet);
+        if (it != slots.end()) return it->second;
+        WalletUndo entry;
+        entry.wallet = wallet;
+        ledger.getCommittedWallet(wallet, entry.exists, entry.balance);
+        uint32_t slot = this->wallets.size();
+        this->wallets.push_back(entry);
+        slots[wallet] = slot;
+        return slot;
+    };
+    for(auto& t : block.getTransactions()) {
+        TransactionUndo entry;
+        entry.txid = t.hashContents();
+        entry.fromSlot = slotFor(t.fromWallet());
+        entry.toSlot = slotFor(t.toWallet());
+        this->transactions.push_back(entry);
+    }
+}
+
+BlockUndo::BlockUndo(const string& serialized) {
+    const char* buffer = serialized.c_str();
+    const char* end = buffer + serialized.size();
+    if (serialized.size() < 4) throw std::runtime_error("Corrupt undo record");
+    uint32_t numWallets = readNetworkUint32(buffer);
+    if (end - buffer < (int64_t)numWallets * WALLET_UNDO_SIZE + 4) throw std::runtime_error("Corrupt undo record");
+    for(uint32_t i = 0; i < numWallets; i++) {
+        WalletUndo entry;
+        entry.wallet = readNetworkPublicWalletAddress(buffer);
+        entry.exists = *buffer++ != 0;
+        entry.balance = readNetworkUint64(buffer);
+        this->wallets.push_back(entry);
+    }
+    uint32_t numTransactions = readNetworkUint32(buffer);
+    if (end - buffer != (int64_t)numTransactions * TRANSACTION_UNDO_SIZE) throw std::runtime_error("Corrupt undo record");
+    for(uint32_t i = 0; i < numTransactions; i++) {
+        TransactionUndo entry;
+        entry.txid = readNetworkSHA256(buffer);
+        entry.fromSlot = readNetworkUint32(buffer);
+        entry.toSlot = readNetworkUint32(buffer);
+        if (entry.fromSlot >= numWallets || entry.toSlot >= numWallets) throw std::runtime_error("Corrupt undo record");
+        this->transactions.push_back(entry);
+    }
+}
+
+string BlockUndo::serialize() const {
+    string ret(8 + this->wallets.size() * WALLET_UNDO_SIZE + this->transactions.size() * TRANSACTION_UNDO_SIZE, '\0');
+    char* buffer = (char*)ret.data();
+    writeNetworkUint32(buffer, this->wallets.size());
+    for(auto entry : this->wallets) {
+        writeNetworkPublicWalletAddress(buffer, entry.wallet);
+        *buffer++ = entry.exists ? 1 : 0;
+        writeNetworkUint64(buffer, entry.balance);
+    }
+    writeNetworkUint32(buffer, this->transactions.size());
+    for(auto entry : this->transactions) {
+        writeNetworkSHA256(buffer, entry.txid);
+        writeNetworkUint32(buffer, entry.fromSlot);
+        writeNetworkUint32(buffer, entry.toSlot);
+    }
+    return ret;
+}
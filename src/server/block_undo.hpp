@@ -0,0 +1,36 @@
+#pragma once
+#include <string>
+#include <vector>
+#include "../core/common.hpp"
+#include "../core/block.hpp"
+#include "ledger.hpp"
+using namespace std;
+
+struct WalletUndo {
+    PublicWalletAddress wallet;
+    bool exists;
+    TransactionAmount balance;
+};
+
+struct TransactionUndo {
+    SHA256Hash txid;
+    uint32_t fromSlot;
+    uint32_t toSlot;
+};
+
+/*
+    Everything needed to take a block back off the chain without
+    re-executing it: the balance of every wallet the block touched as it
+    was before the block, the txids it inserted, and for each transaction
+    the slots of its from/to wallets, which together with the block id and
+    transaction index give back the wallet store keys.
+*/
+class BlockUndo {
+    public:
+        BlockUndo();
+        BlockUndo(const string& serialized);
+        BlockUndo(Block& block, const Ledger& ledger);
+        vector<WalletUndo> wallets;
+        vector<TransactionUndo> transactions;
+        string serialize() const;
+};
@@ -24,8 +24,14 @@
 
 #define FORK_CHAIN_POP_COUNT 100
 #define FORK_RESET_RETRIES 3
+// undo records are kept for blocks at most this deep, the most the sync retries pop
+#define UNDO_RECORD_WINDOW (FORK_CHAIN_POP_COUNT * (FORK_RESET_RETRIES + 1))
+#define UNDO_RECORDS_REMOVED_PER_BLOCK 1000
 #define MAX_DISCONNECTS_BEFORE_RESET 15
 #define FAILURES_BEFORE_POP_ATTEMPT 1
+#define PRUNE_BATCH_BLOCKS 1000
+#define ARCHIVE_BATCH_BLOCKS 500
+#define MAINTENANCE_INTERVAL_MS 60000
 
 using namespace std;
 
@@ -49,10 +55,8 @@ void chain_sync(BlockChain& blockchain) {
                     Logger::logError(RED + "[ERROR]" + RESET, "Rollback retry #" + to_string(blockchain.retries));
                     std::unique_lock<std::mutex> ul(blockchain.lock);
                     blockchain.isSyncing = true;
-                    for (uint64_t i = 0; i < FORK_CHAIN_POP_COUNT*blockchain.retries; i++) {
-                        if (blockchain.numBlocks == 1) break;
-                        blockchain.popBlock();
-                    }
+                    int toPop = FORK_CHAIN_POP_COUNT*blockchain.retries;
+                    blockchain.rewindTo(max(1, blockchain.numBlocks - toPop));
                     blockchain.isSyncing = false;
                 }
             }
@@ -71,41 +75,224 @@ void chain_sync(BlockChain& blockchain) {
     }
 }
 
-BlockChain::BlockChain(HostManager& hosts, string ledgerPath, string blockPath, string txdbPath) : hosts(hosts) {
+void chain_maintenance(BlockChain& blockchain) {
+    while(!blockchain.shutdown) {
+        uint32_t done = 0;
+        try {
+            done += blockchain.pruneBlocks();
+            done += blockchain.archiveBlocks();
+        } catch(const std::exception& e) {
+            Logger::logError("BlockChain::maintenance", e.what());
+        }
+        // keep going while there is a backlog, then wait for new blocks
+        if (done > 0) continue;
+        std::this_thread::sleep_for(std::chrono::milliseconds(MAINTENANCE_INTERVAL_MS));
+    }
+}
+
+/*
+    Runs each task on its own thread and rethrows the first failure once
+    all of them have finished.
+*/
+static void openInParallel(vector<std::function<void()>> tasks) {
+    vector<std::exception_ptr> errors(tasks.size());
+    vector<std::thread> threads;
+    for(size_t i = 0; i < tasks.size(); i++) {
+        threads.push_back(std::thread([&tasks, &errors, i]() {
+            try {
+                tasks[i]();
+            } catch(...) {
+                errors[i] = std::current_exception();
+            }
+        }));
+    }
+    for(auto& t : threads) t.join();
+    for(auto& error : errors) {
+        if (error) std::rethrow_exception(error);
+    }
+}
+
+BlockChain::BlockChain(HostManager& hosts, string ledgerPath, string blockPath, string txdbPath, string walletPath, json config) : hosts(hosts) {
     if (ledgerPath == "") ledgerPath = LEDGER_FILE_PATH;
     if (blockPath == "") blockPath = BLOCK_STORE_FILE_PATH;
     if (txdbPath == "") txdbPath = TXDB_FILE_PATH;
+    if (walletPath == "") walletPath = WALLET_STORE_FILE_PATH;
     this->memPool = nullptr;
     this->shutdown = false;
     this->retries = 0;
-    this->ledger.init(ledgerPath);
+    json storage = config.contains("storage") ? mergeStorageConfig(config["storage"]) : defaultStorageConfig();
+    this->blockCache = std::make_shared<BlockCache>((size_t)storage["blockCacheMB"] * 1024 * 1024);
+    PufferfishCache::setDefaultProfile(profileFromConfig(storage, "pufferfish", this->blockCache));
+    PufferfishCache::setDefaultLimits(storage["pufferfish"]["memoryEntries"], storage["pufferfish"]["diskEntries"]);
+    this->pruneDepth = config.contains("pruneDepth") ? (uint32_t)config["pruneDepth"] : 0;
+    this->hotBlocks = config.contains("hotBlocks") ? (uint32_t)config["hotBlocks"] : HOT_BLOCK_WINDOW;
+    size_t ledgerCacheBytes = config.contains("ledgerCacheMB") ? (size_t)config["ledgerCacheMB"] * 1024 * 1024 : 0;
+    string ledgerBackend = config.contains("ledgerBackend") ? (string)config["ledgerBackend"] : "leveldb";
+    if (ledgerBackend != "leveldb" && ledgerBackend != "table") throw std::runtime_error("Unknown ledger backend " + ledgerBackend);
     this->blockStore = std::make_unique<BlockStore>();
-    this->blockStore->init(blockPath);
-    this->txdb.init(txdbPath);
+    // the stores don't depend on each other, open them side by side
+    openInParallel({
+        [&]() {
+            this->ledger.init(ledgerPath, profileFromConfig(storage, "ledger", this->blockCache));
+            if (ledgerCacheBytes > 0) this->ledger.setCacheSize(ledgerCacheBytes);
+            if (ledgerBackend == "table") {
+                this->ledger.enableTable(ledgerPath + "_table");
+            } else if (LedgerTable::exists(ledgerPath + "_table")) {
+                throw std::runtime_error("Ledger balances are in the ledger table, start with --ledger-backend table");
+            }
+            this->ledger.indexBalances();
+        },
+        [&]() { this->openBlockStore(blockPath, storage, config); },
+        [&]() { this->txdb.init(txdbPath, profileFromConfig(storage, "txdb", this->blockCache)); },
+        [&]() { this->walletStore.init(walletPath, profileFromConfig(storage, "wallets", this->blockCache)); }
+    });
+    uint32_t snapshotInterval = config.contains("snapshotInterval") ? (uint32_t)config["snapshotInterval"] : 0;
+    this->snapshots = std::make_unique<SnapshotManager>(ledgerPath + "_snapshots", snapshotInterval);
+    this->idleCompaction = config.contains("idleCompaction") ? (bool)config["idleCompaction"] : false;
+    this->compactions = std::make_unique<CompactionManager>();
+    this->compactions->addStore("ledger", [this]() -> DataStore* { return &this->ledger; });
+    this->compactions->addStore("blocks", [this]() -> DataStore* { return this->blockStore.get(); });
+    this->compactions->addStore("txdb", [this]() -> DataStore* { return &this->txdb; });
+    this->compactions->addStore("pufferfish", []() -> DataStore* { return getPufferfishCache(); });
     hosts.setBlockstore(this->blockStore);
     this->initChain();
 }
 
+void BlockChain::openBlockStore(string blockPath, const json& storage, const json& config) {
+    this->blockStore->init(blockPath, profileFromConfig(storage, "blocks", this->blockCache));
+    this->blockStore->migrateSchema();
+    if (config.contains("blockSegments") && config["blockSegments"]) {
+        this->blockStore->enableSegments(blockPath + "_segments");
+    }
+    if (this->pruneDepth > 0 && this->blockStore->isSegmented()) {
+        Logger::logError("BlockChain", "Pruning is not supported with block segments, keeping all blocks");
+        this->pruneDepth = 0;
+    }
+    if (config.contains("archivePath") && config["archivePath"] != "") {
+        if (this->blockStore->isSegmented() || this->pruneDepth > 0) {
+            Logger::logError("BlockChain", "Archive store is not used with block segments or pruning");
+        } else {
+            this->blockStore->enableArchive(config["archivePath"], profileFromConfig(storage, "archive", this->blockCache));
+        }
+    }
+    if (this->blockStore->getArchivedHeight() > 0 && !this->blockStore->isTiered()) {
+        throw std::runtime_error("Blocks up to " + to_string(this->blockStore->getArchivedHeight()) + " are in the archive store, start with --archive-path");
+    }
+    this->blockStore->enableHeaderFile(blockPath + "_headers");
+}
+
 BlockChain::~BlockChain() {
     this->shutdown = true;
+    this->compactions->stop();
 }
 
 void BlockChain::initChain() {
     this->isSyncing = false;
+    this->groupCommit = false;
+    // a snapshot import cut short leaves a partial ledger or txdb, both
+    // are dropped here and recomputed once the headers are loaded
+    bool importInterrupted = this->ledger.hasIncompleteImport() || this->txdb.hasIncompleteImport();
+    if (importInterrupted) {
+        Logger::logStatus("Snapshot import was interrupted, rebuilding the ledger");
+        this->ledger.clear();
+        this->txdb.clear();
+    }
+    ChainTip durable;
+    if (this->blockStore->getSyncWindow(durable)) this->recoverSyncWindow(durable);
+    if (this->blockStore->hasBlockCount()) this->recoverCommit();
     if (this->blockStore->hasBlockCount()) {
         Logger::logStatus("BlockStore exists, loading from disk");
         size_t count = this->blockStore->getBlockCount();
         this->numBlocks = count;
         this->targetBlockCount = count;
-        Block lastBlock = this->blockStore->getBlock(count);
-        this->totalWork = this->blockStore->getTotalWork();
-        this->difficulty = lastBlock.getDifficulty();
-        this->lastHash = lastBlock.getHash();
+        ChainTip tip;
+        if (this->blockStore->getChainTip(tip) && tip.count == count) {
+            this->loadHeaders(&tip);
+            this->totalWork = tip.totalWork;
+            this->difficulty = tip.difficulty;
+        } else {
+            // stores written before the chain tip record existed
+            this->loadHeaders(NULL);
+            this->totalWork = this->blockStore->getTotalWork();
+            this->difficulty = this->headers.back().difficulty;
+            tip.count = count;
+            tip.difficulty = this->difficulty;
+            tip.lastHash = this->blockHashes.back();
+            tip.headerChecksum = this->blockStore->getHeaderFile()->getChecksum(count);
+            tip.totalWork = this->totalWork;
+            this->blockStore->setChainTip(tip);
+        }
+        this->lastHash = this->blockHashes.back();
+        if (this->walletStore.isEmpty()) this->rebuildWalletStore();
+        if (!this->blockStore->hasHashIndex()) this->rebuildHashIndex();
+        uint32_t historyStart;
+        if (importInterrupted) {
+            this->recomputeLedger();
+        } else if (this->ledger.getHistoryStart(historyStart) && historyStart > this->numBlocks) {
+            // a restart after a rewind was cut short
+            this->ledger.restartBalanceHistory(this->numBlocks);
+        } else {
+            this->ledger.startBalanceHistory(this->numBlocks);
+        }
     } else {
         this->resetChain();
     }
 }
 
+/*
+    Headers and hashes for the whole chain are kept in memory (~150 bytes
+    per block) so difficulty, median time and fork checks never have to
+    go back to the block store. They are read from the header file in one
+    pass; blocks the file is missing are read from the block store and
+    appended to it. The file is only trusted when it ends at the checksum
+    of the chain tip record, otherwise it is rebuilt from the block store.
+*/
+void BlockChain::loadHeaders(const ChainTip* tip) {
+    HeaderFile* file = this->blockStore->getHeaderFile();
+    std::unique_lock<std::mutex> ul(this->headerLock);
+    this->headers.clear();
+    this->blockHashes.clear();
+    this->headers.reserve(this->numBlocks);
+    this->blockHashes.reserve(this->numBlocks);
+    uint32_t loaded = tip ? file->read(this->numBlocks, &this->headers, this->blockHashes) : 0;
+    // drops records of popped blocks and anything after a damaged record
+    file->truncate(loaded);
+    if (loaded < this->numBlocks) {
+        Logger::logStatus("Loading block headers from the block store, starting at block: " + to_string(loaded + 1));
+    }
+    vector<Transaction> noTransactions;
+    for(uint32_t i = loaded + 1; i <= this->numBlocks; i++) {
+        if (i % 100000 == 0) Logger::logStatus("Loading block headers, finished block: " + to_string(i));
+        BlockHeader header = this->blockStore->getBlockHeader(i);
+        SHA256Hash hash = Block(header, noTransactions).getHash();
+        this->headers.push_back(header);
+        this->blockHashes.push_back(hash);
+        file->append(header, hash);
+    }
+    file->flush();
+    if (tip && loaded > 0 && file->getChecksum(this->numBlocks) != tip->headerChecksum) {
+        Logger::logStatus("Header file does not match the chain tip, rebuilding it");
+        file->truncate(0);
+        ul.unlock();
+        this->loadHeaders(NULL);
+    }
+}
+
+void BlockChain::pushHeader(Block& block) {
+    std::unique_lock<std::mutex> ul(this->headerLock);
+    this->headers.push_back(block.serialize());
+    this->blockHashes.push_back(block.getHash());
+    this->blockStore->getHeaderFile()->append(block.serialize(), block.getHash());
+}
+
+void BlockChain::truncateHeaders(uint32_t count) {
+    std::unique_lock<std::mutex> ul(this->headerLock);
+    this->blockStore->getHeaderFile()->truncate(count);
+    if (count >= this->headers.size()) return;
+    this->headers.resize(count);
+    this->blockHashes.resize(count);
+}
+
 void BlockChain::resetChain() {
     Logger::logStatus("BlockStore does not exist");
     this->difficulty = 16;
@@ -113,11 +300,22 @@ void BlockChain::resetChain() {
     this->numBlocks = 0;
     this->totalWork = 0;
     this->lastHash = NULL_SHA256_HASH;
+    {
+        std::unique_lock<std::mutex> ul(this->headerLock);
+        this->headers.clear();
+        this->blockHashes.clear();
+    }
 
     // reset the ledger, block & tx stores
-    this->ledger.clear();
-    this->blockStore->clear();
-    this->txdb.clear();
+    this->snapshots->discardAll();
+    {
+        std::unique_lock<std::shared_mutex> sl(this->storeLock);
+        this->ledger.clear();
+        this->ledger.startBalanceHistory(0);
+        this->blockStore->clear();
+        this->txdb.clear();
+        this->walletStore.clear();
+    }
     
     
     // // User miner;
@@ -161,30 +359,71 @@ void BlockChain::resetChain() {
 }
 
 void BlockChain::closeDB() {
+    this->compactions->stop();
+    this->snapshots->wait();
     txdb.closeDB();
     ledger.closeDB();
+    walletStore.closeDB();
     this->blockStore->closeDB();
 }
 
 void BlockChain::deleteDB() {
     this->closeDB();
+    this->snapshots->discardAll();
     txdb.deleteDB();
     ledger.deleteDB();
+    walletStore.deleteDB();
     this->blockStore->deleteDB();
 }
 
 std::pair<uint8_t*, size_t> BlockChain::getRaw(uint32_t blockId) const{
     if (blockId <= 0 || blockId > this->numBlocks) throw std::runtime_error("Invalid block");
+    // peers syncing from us, leave the disk to them
+    this->compactions->noteActivity();
     return this->blockStore->getRawData(blockId);
 }
 
+std::pair<uint8_t*, size_t> BlockChain::getRawRange(uint32_t start, uint32_t end) const{
+    if (start <= 0 || start > end || end > this->numBlocks) throw std::runtime_error("Invalid block range");
+    this->compactions->noteActivity();
+    return this->blockStore->getRawRange(start, end);
+}
+
+void BlockChain::readRawRange(uint32_t start, uint32_t end, std::function<void(std::string_view)> visitor) const{
+    if (start <= 0 || start > end || end > this->numBlocks) throw std::runtime_error("Invalid block range");
+    this->compactions->noteActivity();
+    this->blockStore->readRawRange(start, end, visitor);
+}
+
 BlockHeader BlockChain::getBlockHeader(uint32_t blockId) const{
-    if (blockId <= 0 || blockId > this->numBlocks) throw std::runtime_error("Invalid block");
-    return this->blockStore->getBlockHeader(blockId);
+    std::unique_lock<std::mutex> ul(this->headerLock);
+    if (blockId <= 0 || blockId > this->headers.size()) throw std::runtime_error("Invalid block");
+    return this->headers[blockId - 1];
+}
+
+/*
+    Returns 0 when the hash is not a block on our chain.
+*/
+uint32_t BlockChain::getBlockIdForHash(SHA256Hash hash) const{
+    uint32_t blockId;
+    if (!this->blockStore->getBlockIdForHash(hash, blockId)) return 0;
+    std::unique_lock<std::mutex> ul(this->headerLock);
+    if (blockId == 0 || blockId > this->blockHashes.size() || this->blockHashes[blockId - 1] != hash) return 0;
+    return blockId;
+}
+
+SHA256Hash BlockChain::getBlockHash(uint32_t blockId) const{
+    std::unique_lock<std::mutex> ul(this->headerLock);
+    if (blockId <= 0 || blockId > this->blockHashes.size()) throw std::runtime_error("Invalid block");
+    return this->blockHashes[blockId - 1];
 }
 
 void BlockChain::sync() {
     this->syncThread.push_back(std::thread(chain_sync, ref(*this)));
+    if (this->pruneDepth > 0 || this->blockStore->isTiered()) {
+        this->syncThread.push_back(std::thread(chain_maintenance, ref(*this)));
+    }
+    if (this->idleCompaction) this->compactions->start();
 }
 
 const Ledger& BlockChain::getLedger() const{
@@ -227,7 +466,7 @@ double BlockChain::getSupply() const {
   return supply + amount_offset;
 };
 
-Bigint BlockChain::getTotalWork() const {
+UInt256 BlockChain::getTotalWork() const {
     return this->totalWork;
 }
 
@@ -278,12 +517,12 @@ void BlockChain::updateDifficulty() {
     if (this->numBlocks % DIFFICULTY_LOOKBACK != 0) return;
     int firstID = this->numBlocks - DIFFICULTY_LOOKBACK;
     int lastID = this->numBlocks;  
-    Block first = this->getBlock(firstID);
-    Block last = this->getBlock(lastID);
-    int32_t elapsed = last.getTimestamp() - first.getTimestamp(); 
+    BlockHeader first = this->getBlockHeader(firstID);
+    BlockHeader last = this->getBlockHeader(lastID);
+    int32_t elapsed = last.timestamp - first.timestamp; 
     uint32_t numBlocksElapsed = lastID - firstID;
     int32_t target = numBlocksElapsed * DESIRED_BLOCK_TIME_SEC;
-    int32_t difficulty = last.getDifficulty();
+    int32_t difficulty = last.difficulty;
     this->difficulty = computeDifficulty(difficulty, elapsed, target);
     if (this->numBlocks >= PUFFERFISH_START_BLOCK && this->numBlocks < (PUFFERFISH_START_BLOCK + DIFFICULTY_LOOKBACK*2)) {
         this->difficulty = MIN_DIFFICULTY;
@@ -300,6 +539,28 @@ uint32_t BlockChain::findBlockForTransaction(Transaction &t) {
     return blockId;
 }
 
+/*
+    Reads a transaction straight out of its block. Only txdb entries from
+    before positions were recorded need the whole block to be scanned.
+*/
+bool BlockChain::findTransaction(SHA256Hash txid, Transaction& t, TransactionPosition& position) {
+    if (!this->txdb.getTransactionPosition(txid, position)) return false;
+    if (position.blockId == 0 || position.blockId > this->getBlockCount()) return false;
+    if (this->blockStore->isPruned(position.blockId)) return false;
+    if (position.txIndex != UNKNOWN_TX_INDEX) {
+        t = this->blockStore->getTransaction(position.blockId, position.txIndex);
+        return t.hashContents() == txid;
+    }
+    Block block = this->getBlock(position.blockId);
+    for(uint32_t i = 0; i < block.getTransactions().size(); i++) {
+        if (block.getTransactions()[i].hashContents() != txid) continue;
+        t = block.getTransactions()[i];
+        position.txIndex = i;
+        return true;
+    }
+    return false;
+}
+
 void BlockChain::setMemPool(std::shared_ptr<MemPool> memPool) {
     this->memPool = memPool;
 }
@@ -309,16 +570,16 @@ uint8_t BlockChain::getDifficulty() const{
 }
 
 ExecutionStatus BlockChain::verifyTransaction(const Transaction& t) {
-    if (this->isSyncing) return IS_SYNCING;
     if (t.isFee()) return EXTRA_MINING_FEE;
     if (!t.signatureValid()) return INVALID_SIGNATURE;
+    // all writes land in the view, so the chain lock is not needed. The
+    // shared store lock keeps block commits and ledger rebuilds out, so
+    // every wallet and the txdb are read at the same height.
+    std::shared_lock<std::shared_mutex> sl(this->storeLock);
+    if (this->isSyncing) return IS_SYNCING;
     LedgerState deltas;
-    // verify the transaction is consistent with ledger
-    std::unique_lock<std::mutex> ul(lock);
-    ExecutionStatus status = Executor::ExecuteTransaction(this->getLedger(), t, deltas);
-
-    //roll back the ledger to it's original state:
-    Executor::Rollback(this->getLedger(), deltas);
+    LedgerView view(this->ledger);
+    ExecutionStatus status = Executor::ExecuteTransaction(view, t, deltas);
 
     if (this->txdb.hasTransaction(t)) {
         status = EXPIRED_TRANSACTION;
@@ -327,39 +588,298 @@ ExecutionStatus BlockChain::verifyTransaction(const Transaction& t) {
     return status;
 }
 
-vector<Transaction> BlockChain::getTransactionsForWallet(PublicWalletAddress addr) const{
-    vector<SHA256Hash> txids = this->blockStore->getTransactionsForWallet(addr);
+// one page of a wallet's history, only the transactions on the page are read
+vector<Transaction> BlockChain::getTransactionsForWallet(PublicWalletAddress addr, uint32_t limit, const TransactionPosition* after, bool newestFirst, vector<TransactionPosition>& positions) const{
     vector<Transaction> ret;
-    // TODO: this is pretty inefficient -- might want direct index of transactions
-    for (auto txid : txids) {
-        uint32_t blockId = this->txdb.blockForTransactionId(txid);
-        if (blockId > 0)
-        {
-            Block b = this->blockStore->getBlock(blockId);
-            for (auto tx : b.getTransactions()) {
-                if (tx.hashContents() == txid) {
-                    ret.push_back(tx);
-                    break;
-                }
+    positions = this->walletStore.getTransactionsForWallet(addr, limit, after, newestFirst);
+    for (auto position : positions) {
+        ret.push_back(this->blockStore->getTransaction(position.blockId, position.txIndex));
+    }
+    return ret;
+}
+
+void BlockChain::rebuildWalletStore() {
+    Logger::logStatus("Building wallet index");
+    for(int i = this->blockStore->getPrunedHeight() + 1; i <= this->numBlocks; i++) {
+        if (i % 10000 == 0) Logger::logStatus("Building wallet index, finished block: " + to_string(i));
+        Block block = this->getBlock(i);
+        this->walletStore.startBatch();
+        this->walletStore.addBlock(block);
+        this->walletStore.commitBatch();
+    }
+}
+
+void BlockChain::rebuildHashIndex() {
+    Logger::logStatus("Building block hash index");
+    this->blockStore->startBatch();
+    for(int i = 1; i <= this->numBlocks; i++) {
+        this->blockStore->setBlockHash(this->getBlockHash(i), i);
+        if (i % 100000 == 0) {
+            this->blockStore->commitBatch();
+            this->blockStore->startBatch();
+        }
+    }
+    this->blockStore->commitBatch(true);
+    this->blockStore->markHashIndexed();
+}
+
+/*
+    Block mutations are staged into one WriteBatch per store and committed
+    one store after another. The ledger batch goes first and records the
+    new block count, the block store batch goes last. Each batch is synced
+    before the next is written (not inside a sync window, see
+    openSyncWindow), so txdb and the wallet store are never behind the
+    ledger on disk. A crash between them leaves the ledger and block
+    counts apart, which recoverCommit repairs at startup by rolling every
+    store back to the lower one.
+*/
+void BlockChain::startCommit() {
+    this->ledger.startBatch();
+    this->txdb.startBatch();
+    this->walletStore.startBatch();
+    this->blockStore->startBatch();
+}
+
+void BlockChain::finishCommit(uint32_t count) {
+    std::unique_lock<std::shared_mutex> sl(this->storeLock);
+    this->ledger.setChainHeight(count);
+    this->blockStore->setBlockCount(count);
+    bool sync = !this->groupCommit;
+    this->ledger.commitBatch(sync);
+    this->txdb.commitBatch(sync);
+    this->walletStore.commitBatch(sync);
+    this->blockStore->commitBatch(sync);
+}
+
+void BlockChain::syncStores() {
+    this->ledger.sync();
+    this->txdb.sync();
+    this->walletStore.sync();
+    this->blockStore->sync();
+}
+
+/*
+    Group commit for bulk sync: block commits inside a sync window are
+    not synced. Opening the window syncs every store and records the
+    current tip as durable, calling it again at a batch boundary moves
+    the durable tip forward. If the node stops inside a window, startup
+    rolls every store back to the durable tip.
+
+    The ledger table writes balances into its mapping as each block
+    commits and a table checkpoint can flush them before the unsynced
+    ledger batch that records them, leaving the table newer than the undo
+    records that would roll it back. With the table every commit stays
+    synced.
+*/
+void BlockChain::openSyncWindow() {
+    if (this->numBlocks == 0 || this->ledger.hasTable()) return;
+    this->syncStores();
+    ChainTip durable;
+    durable.count = this->numBlocks;
+    durable.difficulty = this->difficulty;
+    durable.lastHash = this->lastHash;
+    durable.headerChecksum = this->blockStore->getHeaderFile()->getChecksum(this->numBlocks);
+    durable.totalWork = this->totalWork;
+    this->blockStore->setSyncWindow(durable);
+    this->groupCommit = true;
+}
+
+void BlockChain::closeSyncWindow() {
+    if (!this->groupCommit) return;
+    this->syncStores();
+    this->blockStore->clearSyncWindow();
+    this->groupCommit = false;
+}
+
+void BlockChain::recoverSyncWindow(const ChainTip& durable) {
+    Logger::logStatus("Sync was interrupted, rolling back to durable block " + to_string(durable.count));
+    this->rollbackStoresTo(durable);
+    this->blockStore->clearSyncWindow();
+}
+
+/*
+    Finishes a block commit or rewind that was cut short. If the ledger got
+    ahead of the block store the block never made it and is rolled back,
+    if it fell behind the ledger already reverted (or lost) the blocks
+    above its height and the chain is cut back to match.
+*/
+void BlockChain::recoverCommit() {
+    uint32_t count = this->blockStore->getBlockCount();
+    uint32_t height;
+    if (!this->ledger.getChainHeight(height)) {
+        // ledgers written before the height was recorded
+        this->ledger.setChainHeight(count);
+        return;
+    }
+    if (height == count) return;
+    Logger::logStatus("Last block commit was interrupted, rolling back to block " + to_string(min(height, count)));
+    if (height == 0) {
+        this->resetChain();
+        return;
+    }
+    ChainTip tip;
+    if (height > count && this->blockStore->getChainTip(tip) && tip.count == count) {
+        this->rollbackStoresTo(tip);
+        return;
+    }
+    uint32_t target = min(height, count);
+    UInt256 work = this->blockStore->getTotalWork();
+    for(uint32_t blockId = count; blockId > target; blockId--) {
+        work = removeWork(work, this->blockStore->getBlockHeader(blockId).difficulty);
+    }
+    vector<Transaction> noTransactions;
+    BlockHeader header = this->blockStore->getBlockHeader(target);
+    tip.count = target;
+    tip.difficulty = header.difficulty;
+    tip.lastHash = Block(header, noTransactions).getHash();
+    try {
+        tip.headerChecksum = this->blockStore->getHeaderFile()->getChecksum(target);
+    } catch(const std::exception& e) {
+        // loadHeaders rebuilds the file when it does not match the tip
+        tip.headerChecksum = NULL_SHA256_HASH;
+    }
+    tip.totalWork = work;
+    this->rollbackStoresTo(tip);
+}
+
+/*
+    Rolls every store back to tip at startup. Bodies of the blocks above it
+    may not have reached disk, so only the ledger undo records and the
+    stores' own keys are used: balances are restored from the undo records
+    and index entries above the tip are found by scanning.
+*/
+void BlockChain::rollbackStoresTo(const ChainTip& tip) {
+    this->startCommit();
+    try {
+        for(uint32_t blockId = this->ledger.getLastUndoBlock(); blockId > tip.count; blockId--) {
+            string record;
+            if (!this->ledger.getUndoRecord(blockId, record)) continue;
+            BlockUndo undo(record);
+            for(auto& entry : undo.wallets) {
+                this->ledger.restoreWallet(entry.wallet, entry.exists, entry.balance);
+                this->ledger.removeBalanceCheckpoint(entry.wallet, blockId);
             }
+            this->ledger.removeUndoRecord(blockId);
         }
+        this->blockStore->setTotalWork(tip.totalWork);
+        this->blockStore->setChainTip(tip);
+        if (this->blockStore->getPrunedHeight() > tip.count) this->blockStore->setPrunedHeight(tip.count);
+        if (this->blockStore->getArchivedHeight() > tip.count) this->blockStore->setArchivedHeight(tip.count);
+        this->finishCommit(tip.count);
+    } catch(...) {
+        this->abortCommit();
+        throw;
     }
-    return std::move(ret);
+    this->txdb.removeBlocksAbove(tip.count);
+    this->walletStore.removeBlocksAbove(tip.count);
+    this->blockStore->removeHashesAbove(tip.count);
+    uint32_t historyStart;
+    if (this->ledger.getHistoryStart(historyStart) && tip.count < historyStart) this->ledger.restartBalanceHistory(tip.count);
+    this->snapshots->discardFrom(tip.count + 1);
+    this->syncStores();
+}
+
+void BlockChain::abortCommit() {
+    this->txdb.discardBatch();
+    this->ledger.discardBatch();
+    this->walletStore.discardBatch();
+    this->blockStore->discardBatch();
 }
 
 void BlockChain::popBlock() {
-    Block last = this->getBlock(this->getBlockCount());
-    Executor::RollbackBlock(last, this->ledger, this->txdb);
-    this->numBlocks--;
-    this->totalWork = removeWork(this->totalWork, last.getDifficulty());
-    this->blockStore->setTotalWork(this->totalWork);
-    this->blockStore->setBlockCount(this->numBlocks);
-    this->blockStore->removeBlockWalletTransactions(last);
+    this->rewindTo(this->numBlocks - 1);
+}
+
+/*
+    Reverts a block inside the open commit. Blocks within UNDO_RECORD_WINDOW
+    of the tip have an undo record and are reverted by restoring prior
+    balances directly, deeper or older blocks are re-read and rolled back
+    transaction by transaction.
+*/
+void BlockChain::rollbackBlock(uint32_t blockId) {
+    string record;
+    if (!this->ledger.getUndoRecord(blockId, record)) {
+        Block block = this->getBlock(blockId);
+        Executor::RollbackBlock(block, this->ledger, this->txdb);
+        this->walletStore.removeBlock(block);
+        for(auto& t : block.getTransactions()) {
+            if (!t.isFee()) this->ledger.removeBalanceCheckpoint(t.fromWallet(), blockId);
+            this->ledger.removeBalanceCheckpoint(t.toWallet(), blockId);
+        }
+        return;
+    }
+    BlockUndo undo(record);
+    for(auto& entry : undo.wallets) {
+        this->ledger.restoreWallet(entry.wallet, entry.exists, entry.balance);
+        this->ledger.removeBalanceCheckpoint(entry.wallet, blockId);
+    }
+    for(uint32_t i = 0; i < undo.transactions.size(); i++) {
+        TransactionUndo& entry = undo.transactions[i];
+        this->txdb.removeTransactionId(entry.txid);
+        this->walletStore.removeTransaction(undo.wallets[entry.fromSlot].wallet, {blockId, i});
+        this->walletStore.removeTransaction(undo.wallets[entry.toSlot].wallet, {blockId, i});
+    }
+    this->ledger.removeUndoRecord(blockId);
+}
+
+// balance history checkpoints for the wallets a block changed, inside the open commit
+void BlockChain::recordBalances(uint32_t blockId, const LedgerState& deltas) {
+    for(auto& delta : deltas) {
+        this->ledger.setBalanceCheckpoint(delta.first, blockId, this->ledger.getWalletValue(delta.first));
+    }
+}
+
+/*
+    Drops every block above height. All blocks are reverted into a single
+    set of write batches, so a rewind costs one commit regardless of depth
+    and a crash leaves the chain either fully at the old tip or at height.
+    A pruned node cannot revert blocks whose bodies it dropped, so it stops
+    at the pruned height instead.
+*/
+void BlockChain::rewindTo(uint32_t height) {
+    uint32_t prunedHeight = this->blockStore->getPrunedHeight();
+    if (height < prunedHeight) {
+        Logger::logError("BlockChain::rewindTo", "Fork is deeper than this node can reorg, blocks up to " + to_string(prunedHeight) + " have been pruned. Rewinding to block " + to_string(prunedHeight) + " instead of " + to_string(height));
+        height = prunedHeight;
+    }
+    if (height >= this->numBlocks) return;
+    UInt256 newWork = this->totalWork;
+    this->startCommit();
+    try {
+        for(uint32_t blockId = this->numBlocks; blockId > height; blockId--) {
+            this->rollbackBlock(blockId);
+            this->blockStore->removeBlockHash(this->getBlockHash(blockId));
+            newWork = removeWork(newWork, this->getBlockHeader(blockId).difficulty);
+        }
+        this->blockStore->setTotalWork(newWork);
+        if (height > 0) {
+            ChainTip tip;
+            tip.count = height;
+            tip.difficulty = this->getBlockHeader(height).difficulty;
+            tip.lastHash = this->getBlockHash(height);
+            tip.headerChecksum = this->blockStore->getHeaderFile()->getChecksum(height);
+            tip.totalWork = newWork;
+            this->blockStore->setChainTip(tip);
+        }
+        // dropped blocks are written again in full when they are replaced
+        if (this->blockStore->getPrunedHeight() > height) this->blockStore->setPrunedHeight(height);
+        if (this->blockStore->getArchivedHeight() > height) this->blockStore->setArchivedHeight(height);
+        this->finishCommit(height);
+    } catch(...) {
+        this->abortCommit();
+        throw;
+    }
+    // the baseline at the old start still holds pre-fork balances
+    uint32_t historyStart;
+    if (this->ledger.getHistoryStart(historyStart) && height < historyStart) this->ledger.restartBalanceHistory(height);
+    this->snapshots->discardFrom(height + 1);
+    this->numBlocks = height;
+    this->totalWork = newWork;
+    this->truncateHeaders(height);
 
     if (this->getBlockCount() > 1) {
-        Block newLast = this->getBlock(this->getBlockCount());
         this->updateDifficulty();
-        this->lastHash = newLast.getHash();
+        this->lastHash = this->getBlockHash(this->getBlockCount());
     } else {
         this->resetChain();
     }
@@ -397,8 +917,7 @@ ExecutionStatus BlockChain::addBlock(Block& block) {
         if (this->numBlocks > 10) {
             vector<uint64_t> times;
             for(int i = 0; i < 10; i++) {
-                Block b = this->getBlock(this->numBlocks - i);
-                times.push_back(b.getTimestamp());
+                times.push_back(this->getBlockHeader(this->numBlocks - i).timestamp);
             }
             std::sort(times.begin(), times.end());
             // compute median
@@ -417,25 +936,51 @@ ExecutionStatus BlockChain::addBlock(Block& block) {
     SHA256Hash computedRoot = m.getRootHash();
     if (block.getMerkleRoot() != computedRoot) return INVALID_MERKLE_ROOT;
     LedgerState deltasFromBlock;
-    ExecutionStatus status = Executor::ExecuteBlock(block, this->ledger, this->txdb, deltasFromBlock, this->getCurrentMiningFee(block.getId()));
+    BlockUndo undo(block, this->ledger);
+    this->startCommit();
+    ExecutionStatus status;
+    try {
+        status = Executor::ExecuteBlock(block, this->ledger, this->txdb, deltasFromBlock, this->getCurrentMiningFee(block.getId()));
+        if (status == SUCCESS) {
+            // add all transactions to txdb:
+            for(uint32_t i = 0; i < block.getTransactions().size(); i++) {
+                this->txdb.insertTransaction(block.getTransactions()[i], block.getId(), i);
+            }
+            this->walletStore.addBlock(block);
+            this->ledger.setUndoRecord(block.getId(), undo.serialize());
+            if (block.getId() > UNDO_RECORD_WINDOW) this->ledger.removeUndoRecordsBelow(block.getId() - UNDO_RECORD_WINDOW, UNDO_RECORDS_REMOVED_PER_BLOCK);
+            this->recordBalances(block.getId(), deltasFromBlock);
+            this->blockStore->setBlock(block);
+            this->blockStore->setTotalWork(addWork(this->totalWork, block.getDifficulty()));
+            ChainTip tip;
+            tip.count = this->numBlocks + 1;
+            tip.difficulty = block.getDifficulty();
+            tip.lastHash = block.getHash();
+            tip.headerChecksum = chainHeaderChecksum(this->blockStore->getHeaderFile()->getChecksum(this->numBlocks), block.serialize(), block.getHash());
+            tip.totalWork = addWork(this->totalWork, block.getDifficulty());
+            this->blockStore->setChainTip(tip);
+            this->finishCommit(this->numBlocks + 1);
+        } else {
+            // nothing has been written yet, dropping the batches is the rollback
+            this->abortCommit();
+        }
+    } catch(...) {
+        this->abortCommit();
+        throw;
+    }
 
-    if (status != SUCCESS) {
-        Executor::Rollback(this->ledger, deltasFromBlock);
-    } else {
+    if (status == SUCCESS) {
         if (this->memPool != nullptr) {
             this->memPool->finishBlock(block);
         }
-        // add all transactions to txdb:
-        for(auto t : block.getTransactions()) {
-            this->txdb.insertTransaction(t, block.getId());
-        }
-        this->blockStore->setBlock(block);
         this->numBlocks++;
+        this->pushHeader(block);
         this->totalWork = addWork(this->totalWork, block.getDifficulty());
-        this->blockStore->setTotalWork(this->totalWork);
-        this->blockStore->setBlockCount(this->numBlocks);
         this->lastHash = block.getHash();
         this->updateDifficulty();
+        if (this->snapshots->isDue(block.getId())) {
+            this->snapshots->write(block.getId(), block.getHash(), this->ledger, this->txdb);
+        }
         Logger::logStatus("Added block " + to_string(block.getId()));
         Logger::logStatus("difficulty= " + to_string(block.getDifficulty()));
     }
@@ -446,20 +991,152 @@ map<string, uint64_t> BlockChain::getHeaderChainStats() const{
     return this->hosts.getHeaderChainStats();
 }
 
+json BlockChain::getStorageStats() const{
+    json ret;
+    json blockCache;
+    for(auto elem : this->blockCache->getStats()) {
+        blockCache[elem.first] = elem.second;
+    }
+    ret["blockCache"] = blockCache;
+    ret["ledger"] = this->ledger.getStats();
+    ret["blocks"] = this->blockStore->getStats();
+    ret["txdb"] = this->txdb.getStats();
+    ret["wallets"] = this->walletStore.getStats();
+    ret["pufferfish"] = getPufferfishCacheStats();
+    ret["compaction"] = this->getCompactionStats();
+    return ret;
+}
+
+json BlockChain::getCompactionStats() const{
+    return this->compactions->getStats();
+}
+
+map<string, uint64_t> BlockChain::getLedgerCacheStats() const{
+    return this->ledger.getCacheStats();
+}
+
+uint32_t BlockChain::getPruneDepth() const{
+    return this->pruneDepth;
+}
+
+/*
+    Deletes transaction bodies and wallet index entries for up to
+    PRUNE_BATCH_BLOCKS blocks more than pruneDepth below the tip. Headers,
+    the hash index, the ledger, txdb and undo records are kept, so the
+    node still validates, detects duplicate transactions and can rewind.
+    Each pass is one batch per store, and the pruned key range is
+    compacted after the chain lock has been released. Returns the number
+    of blocks pruned.
+*/
+uint32_t BlockChain::pruneBlocks() {
+    if (this->pruneDepth == 0) return 0;
+    uint32_t start;
+    uint32_t end;
+    {
+        std::unique_lock<std::mutex> ul(lock);
+        if (this->numBlocks <= this->pruneDepth) return 0;
+        start = this->blockStore->getPrunedHeight() + 1;
+        end = min((uint32_t)this->numBlocks - this->pruneDepth, start + PRUNE_BATCH_BLOCKS - 1);
+        if (start > end) return 0;
+        this->walletStore.startBatch();
+        this->blockStore->startBatch();
+        try {
+            for(uint32_t blockId = start; blockId <= end; blockId++) {
+                Block block = this->blockStore->getBlock(blockId);
+                this->walletStore.removeBlock(block);
+                this->blockStore->pruneBlock(blockId);
+            }
+            this->blockStore->setPrunedHeight(end);
+            // wallet entries go first, a crash in between re-prunes the same blocks
+            this->walletStore.commitBatch();
+            this->blockStore->commitBatch(true);
+        } catch(...) {
+            this->walletStore.discardBatch();
+            this->blockStore->discardBatch();
+            throw;
+        }
+    }
+    this->blockStore->compactBlocks(start, end);
+    Logger::logStatus("Pruned blocks " + to_string(start) + " to " + to_string(end));
+    return end - start + 1;
+}
+
+/*
+    Moves up to ARCHIVE_BATCH_BLOCKS blocks that have fallen more than
+    hotBlocks below the tip into the archive store, then compacts the
+    emptied key range of the recent store. Returns the number of blocks
+    moved.
+*/
+uint32_t BlockChain::archiveBlocks() {
+    if (!this->blockStore->isTiered()) return 0;
+    uint32_t start;
+    uint32_t end;
+    {
+        std::unique_lock<std::mutex> ul(lock);
+        if (this->numBlocks <= this->hotBlocks) return 0;
+        start = this->blockStore->getArchivedHeight() + 1;
+        end = min((uint32_t)this->numBlocks - this->hotBlocks, start + ARCHIVE_BATCH_BLOCKS - 1);
+        if (start > end) return 0;
+        this->blockStore->archiveBlocks(start, end);
+    }
+    this->blockStore->compactBlocks(start, end);
+    Logger::logStatus("Archived blocks " + to_string(start) + " to " + to_string(end));
+    return end - start + 1;
+}
+
+/*
+    Rebuilds the ledger and txdb from the newest snapshot that is still on
+    this chain, replaying only the blocks after it. Without a usable
+    snapshot this replays from genesis.
+*/
 void BlockChain::recomputeLedger() {
-    this->isSyncing = true;
+    {
+        // verifiers see the flag before the ledger is touched
+        std::unique_lock<std::shared_mutex> sl(this->storeLock);
+        this->isSyncing = true;
+    }
     std::unique_lock<std::mutex> ul(lock);
-    this->ledger.clear();
-    this->txdb.clear();
-    for(int i = 1; i <= this->numBlocks; i++) {
+    uint32_t start = 0;
+    vector<uint32_t> heights = this->snapshots->list();
+    for (auto it = heights.rbegin(); it != heights.rend() && start == 0; it++) {
+        if (*it > this->numBlocks) continue;
+        try {
+            if (this->snapshots->getBlockHash(*it) != this->getBlockHash(*it)) continue;
+            this->snapshots->restore(*it, this->ledger, this->txdb);
+            start = *it;
+        } catch(const std::exception& e) {
+            Logger::logError("BlockChain::recomputeLedger", "Could not restore snapshot " + to_string(*it) + ": " + e.what());
+        }
+    }
+    if (start < this->blockStore->getPrunedHeight()) {
+        this->isSyncing = false;
+        throw std::runtime_error("Cannot recompute ledger, blocks up to " + to_string(this->blockStore->getPrunedHeight()) + " have been pruned and no snapshot covers them");
+    }
+    if (start == 0) {
+        this->ledger.clear();
+        this->txdb.clear();
+    }
+    // snapshots written before balance history existed start it at their height
+    this->ledger.startBalanceHistory(start);
+    for(int i = start + 1; i <= this->numBlocks; i++) {
         if (i % 10000 == 0) Logger::logStatus("Re-computing chain, finished block: " + to_string(i));
         LedgerState deltas;
         Block block = this->getBlock(i);
+        BlockUndo undo(block, this->ledger);
+        this->ledger.startBatch();
+        this->txdb.startBatch();
         ExecutionStatus addResult = Executor::ExecuteBlock(block, this->ledger, this->txdb, deltas, this->getCurrentMiningFee(i));
+        this->ledger.setUndoRecord(i, undo.serialize());
+        if (i > UNDO_RECORD_WINDOW) this->ledger.removeUndoRecordsBelow(i - UNDO_RECORD_WINDOW, UNDO_RECORDS_REMOVED_PER_BLOCK);
+        this->ledger.setChainHeight(i);
+        if (addResult == SUCCESS) this->recordBalances(i, deltas);
         // add all transactions to txdb:
-        for(auto t : block.getTransactions()) {
-            if (!t.isFee()) this->txdb.insertTransaction(t, block.getId());
+        for(uint32_t j = 0; j < block.getTransactions().size(); j++) {
+            Transaction& t = block.getTransactions()[j];
+            if (!t.isFee()) this->txdb.insertTransaction(t, block.getId(), j);
         }
+        this->ledger.commitBatch();
+        this->txdb.commitBatch();
         if (addResult != SUCCESS) {
             Logger::logError(RED + "[FATAL]" + RESET, "Corrupt blockchain. Exiting. Please delete data dir and sync from scratch.");
             exit(-1);
@@ -471,7 +1148,7 @@ void BlockChain::recomputeLedger() {
 ExecutionStatus BlockChain::startChainSync() {
     std::unique_lock<std::mutex> ul(lock);
     this->isSyncing = true;
-    string bestHost = this->hosts.getGoodHost();
+    string bestHost = this->hosts.getGoodHost(this->numBlocks + 1);
     this->targetBlockCount = this->hosts.getBlockCount();
     // If our current chain is lower POW than the trusted host
     // remove anything that does not align with the hashes of the trusted chain
@@ -480,23 +1157,21 @@ ExecutionStatus BlockChain::startChainSync() {
         uint64_t toPop = 0;
         for(uint64_t i = 1; i <= this->numBlocks; i++) {
             SHA256Hash trustedHash = this->hosts.getBlockHash(bestHost, i);
-            SHA256Hash myHash = this->getBlock(i).getHash();
+            SHA256Hash myHash = this->getBlockHash(i);
             if (trustedHash != myHash) {
                 toPop = this->numBlocks - i + FORK_CHAIN_POP_COUNT;
                 break;
             }
         }
         // pop all subsequent blocks
-        for (uint64_t i = 0; i < toPop; i++) {
-            if (this->numBlocks == 1) break;
-            this->popBlock();
-        }
+        if (toPop > 0) this->rewindTo(max((int64_t)1, (int64_t)this->numBlocks - (int64_t)toPop));
     }
 
     int startCount = this->numBlocks;
 
     int needed = this->targetBlockCount - startCount;
     if (needed > 0) Logger::logStatus("fetching target blockcount=" + to_string(this->targetBlockCount));
+    if (needed > 1) this->openSyncWindow();
     // download any remaining blocks in batches
     uint64_t start = std::time(0);
     for(int i = startCount + 1; i <= this->targetBlockCount; i+=BLOCKS_PER_FETCH) {
@@ -519,10 +1194,14 @@ ExecutionStatus BlockChain::startChainSync() {
             }
             if (failure) {
                 Logger::logError("BlockChain::startChainSync", executionStatusAsString(status));
+                this->closeSyncWindow();
                 this->isSyncing = false;
                 return status;
             }
+            // group commit boundary
+            if (this->groupCommit && end < this->targetBlockCount) this->openSyncWindow();
         } catch (const std::exception &e) {
+            this->closeSyncWindow();
             this->isSyncing = false;
             Logger::logError("BlockChain::startChainSync", "Failed to load block" + string(e.what()));
             return UNKNOWN_ERROR;
@@ -533,6 +1212,7 @@ ExecutionStatus BlockChain::startChainSync() {
     stringstream s;
     s<<"Downloaded " << needed <<" blocks in " << d << " seconds from " + bestHost;
     if (needed > 1) Logger::logStatus(s.str());
+    this->closeSyncWindow();
     this->isSyncing = false;
     return SUCCESS;
 }
@@ -6,6 +6,7 @@
 #include <map>
 #include <memory>
 #include <mutex>
+#include <shared_mutex>
 #include "../core/block.hpp"
 #include "../core/api.hpp"
 #include "../core/constants.hpp"
@@ -15,17 +16,22 @@
 #include "block_store.hpp"
 #include "ledger.hpp"
 #include "tx_store.hpp"
+#include "wallet_store.hpp"
+#include "pufferfish_cache.hpp"
+#include "snapshot_manager.hpp"
+#include "block_undo.hpp"
+#include "compaction_manager.hpp"
 using namespace std;
 
 class MemPool;
 
 class BlockChain {
     public:
-        BlockChain(HostManager& hosts, string ledgerPath="", string blockPath="", string txdbPath="");
+        BlockChain(HostManager& hosts, string ledgerPath="", string blockPath="", string txdbPath="", string walletPath="", json config=json::object());
         ~BlockChain();
         void sync();
         Block getBlock(uint32_t blockId) const;
-        Bigint getTotalWork() const ;
+        UInt256 getTotalWork() const ;
         uint8_t getDifficulty() const;
         uint32_t getBlockCount() const;
         uint32_t getCurrentMiningFee(uint64_t blockId) const;
@@ -35,18 +41,30 @@ class BlockChain {
         Ledger& getLedger();
         uint32_t findBlockForTransaction(Transaction &t);
         uint32_t findBlockForTransactionId(SHA256Hash txid);
+        bool findTransaction(SHA256Hash txid, Transaction& t, TransactionPosition& position);
         ExecutionStatus addBlockSync(Block& block);
         ExecutionStatus verifyTransaction(const Transaction& t);
         std::pair<uint8_t*, size_t> getRaw(uint32_t blockId) const;
+        std::pair<uint8_t*, size_t> getRawRange(uint32_t start, uint32_t end) const;
+        void readRawRange(uint32_t start, uint32_t end, std::function<void(std::string_view)> visitor) const;
         BlockHeader getBlockHeader(uint32_t blockId) const;
+        SHA256Hash getBlockHash(uint32_t blockId) const;
+        uint32_t getBlockIdForHash(SHA256Hash hash) const;
         TransactionAmount getWalletValue(PublicWalletAddress addr) const;
         map<string, uint64_t> getHeaderChainStats() const;
-        vector<Transaction> getTransactionsForWallet(PublicWalletAddress addr) const;
+        map<string, uint64_t> getLedgerCacheStats() const;
+        json getStorageStats() const;
+        json getCompactionStats() const;
+        vector<Transaction> getTransactionsForWallet(PublicWalletAddress addr, uint32_t limit, const TransactionPosition* after, bool newestFirst, vector<TransactionPosition>& positions) const;
         void setMemPool(std::shared_ptr<MemPool> memPool);
         void initChain();
         void recomputeLedger();
         void resetChain();
         void popBlock();
+        void rewindTo(uint32_t height);
+        uint32_t pruneBlocks();
+        uint32_t archiveBlocks();
+        uint32_t getPruneDepth() const;
         void deleteDB();
         void closeDB();
         ExecutionStatus addBlock(Block& block);
@@ -57,17 +75,49 @@ class BlockChain {
         std::shared_ptr<MemPool> memPool;
         int numBlocks;
         int retries;
-        Bigint totalWork;
+        uint32_t pruneDepth;
+        uint32_t hotBlocks;
+        bool idleCompaction;
+        bool groupCommit;
+        UInt256 totalWork;
+        std::shared_ptr<BlockCache> blockCache;
         std::shared_ptr<BlockStore> blockStore;
         Ledger ledger;
         TransactionStore txdb;
+        WalletStore walletStore;
+        std::unique_ptr<SnapshotManager> snapshots;
+        std::unique_ptr<CompactionManager> compactions;
         SHA256Hash lastHash;
         int difficulty;
         void updateDifficulty();
+        void rebuildWalletStore();
+        void rebuildHashIndex();
+        void openBlockStore(string blockPath, const json& storage, const json& config);
+        void loadHeaders(const ChainTip* tip);
+        void pushHeader(Block& block);
+        void truncateHeaders(uint32_t count);
+        void rollbackBlock(uint32_t blockId);
+        void recordBalances(uint32_t blockId, const LedgerState& deltas);
+        void startCommit();
+        void finishCommit(uint32_t count);
+        void abortCommit();
+        void syncStores();
+        void openSyncWindow();
+        void closeSyncWindow();
+        void recoverSyncWindow(const ChainTip& durable);
+        void recoverCommit();
+        void rollbackStoresTo(const ChainTip& tip);
         ExecutionStatus startChainSync();
         int targetBlockCount;
         mutable std::mutex lock;
+        // exclusive while store contents change, shared by readers that need one consistent state
+        mutable std::shared_mutex storeLock;
+        // headers[i] and blockHashes[i] belong to block i + 1
+        vector<BlockHeader> headers;
+        vector<SHA256Hash> blockHashes;
+        mutable std::mutex headerLock;
         vector<std::thread> syncThread;
         map<int,SHA256Hash> checkpoints;
         friend void chain_sync(BlockChain& blockchain);
+        friend void chain_maintenance(BlockChain& blockchain);
 };
@@ -0,0 +1,154 @@
+#include <algorithm>
+#include <chrono>
+#include "../core/logger.hpp"
+#include "compaction_manager.hpp"
+using namespace std;
+
+// no store written and no blocks served for this long counts as idle
+#define COMPACTION_IDLE_MS 5000
+#define COMPACTION_MIN_INTERVAL_MS 1000
+#define COMPACTION_MAX_INTERVAL_MS 300000
+
+static uint64_t nowMillis() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+CompactionManager::CompactionManager() {
+    this->nextTarget = 0;
+    this->seenStalls = 0;
+    this->lastActivity = 0;
+    this->backoffMs = COMPACTION_MIN_INTERVAL_MS;
+    this->running = false;
+}
+
+CompactionManager::~CompactionManager() {
+    this->stop();
+}
+
+void CompactionManager::addStore(string name, std::function<DataStore*()> store) {
+    std::unique_lock<std::mutex> ul(this->lock);
+    this->targets.push_back(Target{name, store, 0, 0});
+}
+
+void CompactionManager::start() {
+    std::unique_lock<std::mutex> ul(this->lock);
+    if (this->running) return;
+    this->running = true;
+    this->worker = std::thread([this]() { this->run(); });
+}
+
+void CompactionManager::stop() {
+    {
+        std::unique_lock<std::mutex> ul(this->lock);
+        this->running = false;
+    }
+    this->wakeup.notify_all();
+    if (this->worker.joinable()) this->worker.join();
+}
+
+void CompactionManager::noteActivity() {
+    this->lastActivity = nowMillis();
+}
+
+void CompactionManager::run() {
+    std::unique_lock<std::mutex> ul(this->lock);
+    while (this->running) {
+        this->wakeup.wait_for(ul, std::chrono::milliseconds((uint32_t)this->backoffMs), [this]() { return !this->running; });
+        if (!this->running) break;
+        ul.unlock();
+        try {
+            this->step();
+        } catch(const std::exception& e) {
+            Logger::logError("CompactionManager::step", e.what());
+        }
+        ul.lock();
+    }
+}
+
+uint64_t CompactionManager::countStalls() const {
+    uint64_t stalls = 0;
+    for(auto& target : this->targets) {
+        DataStore* store = target.store();
+        if (store) stalls += store->getWriteStalls();
+    }
+    return stalls;
+}
+
+bool CompactionManager::isIdle() const {
+    uint64_t lastWrite = this->lastActivity;
+    for(auto& target : this->targets) {
+        DataStore* store = target.store();
+        if (store) lastWrite = max(lastWrite, store->getLastWriteTime());
+    }
+    return nowMillis() - lastWrite >= COMPACTION_IDLE_MS;
+}
+
+/*
+    Compacts the next cold range of the next store that has one. A write
+    stall seen since the previous step doubles the interval instead, our
+    own compaction may have been the cause. Returns true if a range was
+    compacted.
+*/
+bool CompactionManager::step() {
+    uint64_t stalls = this->countStalls();
+    if (stalls > this->seenStalls) {
+        this->seenStalls = stalls;
+        this->backoffMs = min((uint32_t)this->backoffMs * 2, (uint32_t)COMPACTION_MAX_INTERVAL_MS);
+        return false;
+    }
+    if (!this->isIdle()) return false;
+    for(size_t i = 0; i < this->targets.size(); i++) {
+        size_t idx = (this->nextTarget + i) % this->targets.size();
+        DataStore* store = this->targets[idx].store();
+        string begin;
+        string end;
+        if (!store || !store->nextCompactionRange(begin, end)) continue;
+        auto start = std::chrono::steady_clock::now();
+        store->compactRange(begin, end);
+        uint64_t micros = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+        {
+            std::unique_lock<std::mutex> ul(this->lock);
+            this->targets[idx].compactions++;
+            this->targets[idx].compactionMicros += micros;
+        }
+        this->nextTarget = (idx + 1) % this->targets.size();
+        this->backoffMs = max((uint32_t)this->backoffMs / 2, (uint32_t)COMPACTION_MIN_INTERVAL_MS);
+        return true;
+    }
+    return false;
+}
+
+/*
+    Compaction debt is what has been written since each store's last
+    compaction pass plus the level 0 files leveldb still has to merge.
+*/
+json CompactionManager::getStats() const {
+    json ret;
+    uint64_t debtBytes = 0;
+    uint64_t level0Files = 0;
+    uint64_t stalls = 0;
+    uint64_t stallMs = 0;
+    json stores;
+    std::unique_lock<std::mutex> ul(this->lock);
+    for(auto& target : this->targets) {
+        json item;
+        item["compactions"] = target.compactions;
+        item["compactionMs"] = target.compactionMicros / 1000;
+        DataStore* store = target.store();
+        if (store) {
+            debtBytes += store->getUncompactedBytes();
+            level0Files += store->getLevel0Files();
+            stalls += store->getWriteStalls();
+            stallMs += store->getWriteStallMs();
+        }
+        stores[target.name] = item;
+    }
+    ret["running"] = this->running;
+    ret["intervalMs"] = (uint32_t)this->backoffMs;
+    ret["compactionDebtBytes"] = debtBytes;
+    ret["level0Files"] = level0Files;
+    ret["writeStalls"] = stalls;
+    ret["writeStallMs"] = stallMs;
+    ret["stores"] = stores;
+    return ret;
+}
@@ -0,0 +1,51 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "../core/common.hpp"
+#include "data_store.hpp"
+using namespace std;
+
+/*
+    Runs manual leveldb compactions on cold key ranges of the registered
+    stores while the node is idle, so the compactions leveldb would start
+    on its own during the next burst of block commits have less to do.
+    One range is compacted per step on a background thread. Steps are
+    spaced further apart whenever a foreground write stalled and move
+    back towards the base interval after each clean step.
+*/
+class CompactionManager {
+    public:
+        CompactionManager();
+        ~CompactionManager();
+        // the getter may return NULL for stores that are opened lazily
+        void addStore(string name, std::function<DataStore*()> store);
+        void start();
+        void stop();
+        void noteActivity();
+        bool step();
+        json getStats() const;
+    protected:
+        struct Target {
+            string name;
+            std::function<DataStore*()> store;
+            uint64_t compactions;
+            uint64_t compactionMicros;
+        };
+        bool isIdle() const;
+        uint64_t countStalls() const;
+        void run();
+        vector<Target> targets;
+        size_t nextTarget;
+        uint64_t seenStalls;
+        std::atomic<uint64_t> lastActivity;
+        std::atomic<uint32_t> backoffMs;
+        bool running;
+        std::thread worker;
+        std::condition_variable wakeup;
+        mutable std::mutex lock;
+};
@@ -1,24 +1,64 @@
 #include "data_store.hpp"
+#include "memory_backend.hpp"
+#include <cstdio>
 #include <thread>
 
 #ifdef _WIN32
 #include <filesystem>
 #else
 #include <experimental/filesystem>
+#include <unistd.h>
 #endif
 
+// a single write taking longer than this waited on leveldb compactions
+#define WRITE_STALL_MS 50
+#define COMPACTION_SLICES 16
+// a store is due another compaction pass after this many write buffers
+#define COMPACTION_PASS_BUFFERS 4
+#define OPEN_RETRIES 10
+#define OPEN_RETRY_MS 100
+// present while importSnapshot runs, a store that still has it on open is incomplete
+#define IMPORT_MARKER_KEY "IMPORT_IN_PROGRESS"
+
+static uint64_t steadyMillis(std::chrono::steady_clock::time_point t) {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(t.time_since_epoch()).count();
+}
+
 DataStore::DataStore() {
     this->db = NULL;
+    this->filterPolicy = NULL;
+    this->compactionSlice = 0;
+    this->lastWriteTime = 0;
+    this->writeStalls = 0;
+    this->writeStallMicros = 0;
+    this->uncompactedBytes = 0;
 }
 
 void DataStore::closeDB() {
     delete db;
+    this->db = NULL;
+    // the filter policy must outlive the db that uses it
+    delete this->filterPolicy;
+    this->filterPolicy = NULL;
 }
 
 string DataStore::getPath() const{
     return this->path;
 }
 
+json DataStore::getStats() const {
+    json ret = profileToJson(this->profile);
+    string value;
+    if (db && db->GetProperty("leveldb.approximate-memory-usage", &value)) {
+        ret["approximateMemoryUsage"] = std::stoull(value);
+    }
+    ret["level0Files"] = this->getLevel0Files();
+    ret["writeStalls"] = this->getWriteStalls();
+    ret["writeStallMs"] = this->getWriteStallMs();
+    ret["uncompactedBytes"] = this->getUncompactedBytes();
+    return ret;
+}
+
 void DataStore::clear() {
     leveldb::Iterator* it = db->NewIterator(leveldb::ReadOptions());
     for (it->SeekToFirst(); it->Valid(); it->Next()) {
@@ -41,14 +81,252 @@ void DataStore::deleteDB() {
     if(!status.ok()) throw std::runtime_error("Could not close DataStore db : " + status.ToString());
 }
 
-void DataStore::init(string path) {
+void DataStore::init(string path, DataStoreProfile profile) {
     if (this->db) {
         this->closeDB();
     }
     this->path = path;
-    std::this_thread::sleep_for(std::chrono::milliseconds(1000));
+    this->profile = profile;
+    if (profile.backend == "memory") {
+        this->db = new MemoryBackend();
+        return;
+    }
+    if (profile.backend != "leveldb") throw std::runtime_error("Unknown storage backend " + profile.backend);
     leveldb::Options options;
     options.create_if_missing = true;
+    options.write_buffer_size = profile.writeBufferSize;
+    options.max_open_files = profile.maxOpenFiles;
+    options.compression = profile.compression ? leveldb::kSnappyCompression : leveldb::kNoCompression;
+    if (profile.blockCache) options.block_cache = profile.blockCache.get();
+    if (profile.bloomBitsPerKey > 0) {
+        this->filterPolicy = leveldb::NewBloomFilterPolicy(profile.bloomBitsPerKey);
+        options.filter_policy = this->filterPolicy;
+    }
     leveldb::Status status = leveldb::DB::Open(options, path, &this->db);
+    // the lock of a store closed a moment ago may not have been released yet
+    for(int retry = 0; retry < OPEN_RETRIES && status.IsIOError(); retry++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(OPEN_RETRY_MS));
+        status = leveldb::DB::Open(options, path, &this->db);
+    }
     if(!status.ok()) throw std::runtime_error("Could not write DataStore db : " + status.ToString());
 }
+
+/*
+    While a batch is open, put() and remove() are staged in a WriteBatch
+    and only hit the DB when commitBatch() is called.
+*/
+void DataStore::startBatch() {
+    this->discardBatch();
+    this->batch = std::make_unique<leveldb::WriteBatch>();
+}
+
+bool DataStore::isBatching() const {
+    return this->batch != nullptr;
+}
+
+void DataStore::commitBatch(bool sync) {
+    if (!this->batch) return;
+    leveldb::WriteOptions write_options;
+    write_options.sync = sync;
+    auto start = std::chrono::steady_clock::now();
+    leveldb::Status status = db->Write(write_options, this->batch.get());
+    this->recordWrite(start, this->batch->ApproximateSize());
+    this->batch = nullptr;
+    if(!status.ok()) throw std::runtime_error("Could not commit batch to DataStore db : " + status.ToString());
+}
+
+void DataStore::discardBatch() {
+    this->batch = nullptr;
+}
+
+/*
+    A synced write also syncs every unsynced write before it, so an empty
+    one makes everything committed so far durable.
+*/
+void DataStore::sync() {
+    leveldb::WriteOptions write_options;
+    write_options.sync = true;
+    leveldb::WriteBatch empty;
+    leveldb::Status status = db->Write(write_options, &empty);
+    if(!status.ok()) throw std::runtime_error("Could not sync DataStore db : " + status.ToString());
+}
+
+void DataStore::put(const leveldb::Slice& key, const leveldb::Slice& value, bool sync) {
+    if (this->batch) {
+        this->batch->Put(key, value);
+        return;
+    }
+    leveldb::WriteOptions write_options;
+    write_options.sync = sync;
+    auto start = std::chrono::steady_clock::now();
+    leveldb::Status status = db->Put(write_options, key, value);
+    this->recordWrite(start, key.size() + value.size());
+    if(!status.ok()) throw std::runtime_error("Write failed : " + status.ToString());
+}
+
+void DataStore::remove(const leveldb::Slice& key, bool sync) {
+    if (this->batch) {
+        this->batch->Delete(key);
+        return;
+    }
+    leveldb::WriteOptions write_options;
+    write_options.sync = sync;
+    auto start = std::chrono::steady_clock::now();
+    leveldb::Status status = db->Delete(write_options, key);
+    this->recordWrite(start, key.size());
+    if(!status.ok()) throw std::runtime_error("Delete failed : " + status.ToString());
+}
+
+/*
+    leveldb delays or blocks writers while level 0 is backed up, so slow
+    writes are the visible sign of compaction debt. They are counted here
+    for the compaction manager to back off on.
+*/
+void DataStore::recordWrite(std::chrono::steady_clock::time_point start, size_t bytes) {
+    auto now = std::chrono::steady_clock::now();
+    uint64_t micros = std::chrono::duration_cast<std::chrono::microseconds>(now - start).count();
+    if (micros >= WRITE_STALL_MS * 1000) {
+        this->writeStalls++;
+        this->writeStallMicros += micros;
+    }
+    this->uncompactedBytes += bytes;
+    this->lastWriteTime = steadyMillis(now);
+}
+
+uint64_t DataStore::getLastWriteTime() const {
+    return this->lastWriteTime;
+}
+
+uint64_t DataStore::getWriteStalls() const {
+    return this->writeStalls;
+}
+
+uint64_t DataStore::getWriteStallMs() const {
+    return this->writeStallMicros / 1000;
+}
+
+uint64_t DataStore::getUncompactedBytes() const {
+    return this->uncompactedBytes;
+}
+
+int DataStore::getLevel0Files() const {
+    string value;
+    if (!db || !db->GetProperty("leveldb.num-files-at-level0", &value)) return 0;
+    return std::stoi(value);
+}
+
+/*
+    Keys of the stores using the default are hashes, so no part of the
+    key space is colder than another. Once enough has been written since
+    the last pass the whole space is compacted again, one slice of the
+    byte after compactionPrefix per call so a single step stays short.
+    Returns false when no pass is due.
+*/
+bool DataStore::nextCompactionRange(string& begin, string& end) {
+    if (this->compactionSlice == 0) {
+        if (this->uncompactedBytes < COMPACTION_PASS_BUFFERS * this->profile.writeBufferSize) return false;
+        this->uncompactedBytes = 0;
+    }
+    int width = 256 / COMPACTION_SLICES;
+    begin = this->compactionPrefix + string(1, (char)(this->compactionSlice * width));
+    this->compactionSlice = (this->compactionSlice + 1) % COMPACTION_SLICES;
+    if (this->compactionSlice > 0) {
+        end = this->compactionPrefix + string(1, (char)(this->compactionSlice * width));
+    } else if (this->compactionPrefix.empty()) {
+        end = "";
+    } else {
+        // the first key past every key starting with the prefix
+        end = this->compactionPrefix;
+        end.back()++;
+    }
+    return true;
+}
+
+/*
+    Empty bounds are open ends. Runs on the calling thread until leveldb
+    has finished compacting the range.
+*/
+void DataStore::compactRange(const string& begin, const string& end) {
+    leveldb::Slice beginSlice(begin);
+    leveldb::Slice endSlice(end);
+    db->CompactRange(begin.empty() ? NULL : &beginSlice, end.empty() ? NULL : &endSlice);
+}
+
+/*
+    Snapshot files are a flat list of (u32 key length, key, u32 value
+    length, value) records taken from a consistent leveldb snapshot.
+*/
+const leveldb::Snapshot* DataStore::takeSnapshot() {
+    return this->db->GetSnapshot();
+}
+
+void DataStore::releaseSnapshot(const leveldb::Snapshot* snapshot) {
+    this->db->ReleaseSnapshot(snapshot);
+}
+
+void DataStore::exportSnapshot(string file, const leveldb::Snapshot* snapshot) const {
+    FILE* out = fopen(file.c_str(), "wb");
+    if (!out) throw std::runtime_error("Could not create snapshot file " + file);
+    leveldb::ReadOptions options;
+    options.snapshot = snapshot;
+    options.fill_cache = false;
+    std::unique_ptr<leveldb::Iterator> it(db->NewIterator(options));
+    bool ok = true;
+    for (it->SeekToFirst(); ok && it->Valid(); it->Next()) {
+        uint32_t keyLen = it->key().size();
+        uint32_t valueLen = it->value().size();
+        ok = fwrite(&keyLen, sizeof(uint32_t), 1, out) == 1 &&
+             fwrite(it->key().data(), 1, keyLen, out) == keyLen &&
+             fwrite(&valueLen, sizeof(uint32_t), 1, out) == 1 &&
+             fwrite(it->value().data(), 1, valueLen, out) == valueLen;
+    }
+    ok = ok && fflush(out) == 0;
+#ifndef _WIN32
+    ok = ok && fsync(fileno(out)) == 0;
+#endif
+    fclose(out);
+    if (!ok) throw std::runtime_error("Could not write snapshot file " + file);
+}
+
+void DataStore::importSnapshot(string file) {
+    FILE* in = fopen(file.c_str(), "rb");
+    if (!in) throw std::runtime_error("Could not open snapshot file " + file);
+    // the marker goes in before clear() so a crash at any point leaves it,
+    // clear() drops it with everything else so it is written again
+    this->put(IMPORT_MARKER_KEY, "", true);
+    this->clear();
+    this->put(IMPORT_MARKER_KEY, "", true);
+    this->startBatch();
+    string key;
+    string value;
+    uint32_t keyLen;
+    uint32_t valueLen;
+    size_t staged = 0;
+    while (fread(&keyLen, sizeof(uint32_t), 1, in) == 1) {
+        key.resize(keyLen);
+        bool ok = fread(&key[0], 1, keyLen, in) == keyLen &&
+                  fread(&valueLen, sizeof(uint32_t), 1, in) == 1;
+        if (ok) {
+            value.resize(valueLen);
+            ok = fread(&value[0], 1, valueLen, in) == valueLen;
+        }
+        if (!ok) {
+            fclose(in);
+            this->discardBatch();
+            throw std::runtime_error("Truncated snapshot file " + file);
+        }
+        this->batch->Put(key, value);
+        if (++staged % 100000 == 0) {
+            DataStore::commitBatch();
+            this->startBatch();
+        }
+    }
+    fclose(in);
+    this->batch->Delete(IMPORT_MARKER_KEY);
+    DataStore::commitBatch(true);
+}
+
+bool DataStore::hasIncompleteImport() const {
+    string value;
+    return db->Get(leveldb::ReadOptions(), IMPORT_MARKER_KEY, &value).ok();
+}
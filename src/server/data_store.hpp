@@ -1,17 +1,56 @@
 #pragma once
+#include <atomic>
+#include <chrono>
 #include <string>
+#include <memory>
 #include "leveldb/db.h"
+#include "leveldb/write_batch.h"
+#include "leveldb/filter_policy.h"
+#include "store_profile.hpp"
 using namespace std;
 
 class DataStore {
     public:
         DataStore();
-        void init(string path);
-        void deleteDB();
-        void closeDB();
-        void clear();
+        virtual void init(string path, DataStoreProfile profile = DataStoreProfile());
+        virtual void deleteDB();
+        virtual void closeDB();
+        virtual void clear();
         string getPath() const;
+        virtual json getStats() const;
+        void startBatch();
+        virtual void commitBatch(bool sync = false);
+        virtual void discardBatch();
+        bool isBatching() const;
+        virtual void sync();
+        virtual const leveldb::Snapshot* takeSnapshot();
+        virtual void releaseSnapshot(const leveldb::Snapshot* snapshot);
+        virtual void exportSnapshot(string file, const leveldb::Snapshot* snapshot) const;
+        virtual void importSnapshot(string file);
+        bool hasIncompleteImport() const;
+        virtual bool nextCompactionRange(string& begin, string& end);
+        void compactRange(const string& begin, const string& end);
+        uint64_t getLastWriteTime() const;
+        uint64_t getWriteStalls() const;
+        uint64_t getWriteStallMs() const;
+        uint64_t getUncompactedBytes() const;
+        int getLevel0Files() const;
     protected:
+        void put(const leveldb::Slice& key, const leveldb::Slice& value, bool sync = false);
+        void remove(const leveldb::Slice& key, bool sync = false);
+        // leveldb's interface is the storage interface, db is either an
+        // on disk leveldb or a MemoryBackend depending on the profile
         leveldb::DB* db;
+        DataStoreProfile profile;
+        const leveldb::FilterPolicy* filterPolicy;
+        std::unique_ptr<leveldb::WriteBatch> batch;
+        void recordWrite(std::chrono::steady_clock::time_point start, size_t bytes);
         string path;
+        // compaction passes slice the key space on the byte after this prefix
+        string compactionPrefix;
+        int compactionSlice;
+        std::atomic<uint64_t> lastWriteTime;
+        std::atomic<uint64_t> writeStalls;
+        std::atomic<uint64_t> writeStallMicros;
+        std::atomic<uint64_t> uncompactedBytes;
 };
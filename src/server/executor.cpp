@@ -100,7 +100,9 @@ string executionStatusAsString(ExecutionStatus status) {
     }
 }
 
-void deposit(PublicWalletAddress to, TransactionAmount amt, Ledger& ledger,  LedgerState& deltas) {
+// executed against either the persistent Ledger or a LedgerView overlay
+template <typename L>
+void deposit(PublicWalletAddress to, TransactionAmount amt, L& ledger,  LedgerState& deltas) {
     if (!ledger.hasWallet(to)) {
         ledger.createWallet(to);   
     }
@@ -113,7 +115,8 @@ void deposit(PublicWalletAddress to, TransactionAmount amt, Ledger& ledger,  Led
     }
 }
 
-void withdraw(PublicWalletAddress from, TransactionAmount amt, Ledger& ledger,  LedgerState & deltas) {
+template <typename L>
+void withdraw(PublicWalletAddress from, TransactionAmount amt, L& ledger,  LedgerState & deltas) {
     if (ledger.hasWallet(from)) {
         ledger.withdraw(from, amt);
     } else {
@@ -128,7 +131,8 @@ void withdraw(PublicWalletAddress from, TransactionAmount amt, Ledger& ledger,
     }
 }
 
-ExecutionStatus updateLedger(Transaction t, PublicWalletAddress& miner, Ledger& ledger, LedgerState & deltas, TransactionAmount blockMiningFee, uint32_t blockId) {
+template <typename L>
+ExecutionStatus updateLedger(Transaction t, PublicWalletAddress& miner, L& ledger, LedgerState & deltas, TransactionAmount blockMiningFee, uint32_t blockId) {
     TransactionAmount amt = t.getAmount();
     TransactionAmount fees = t.getTransactionFee();
     PublicWalletAddress to = t.toWallet();
@@ -225,7 +229,7 @@ void Executor::RollbackBlock(Block& curr, Ledger& ledger, TransactionStore & txd
     }
 }
 
-ExecutionStatus Executor::ExecuteTransaction(Ledger& ledger, Transaction t,  LedgerState& deltas) {
+ExecutionStatus Executor::ExecuteTransaction(LedgerView& ledger, Transaction t,  LedgerState& deltas) {
     if (!t.isFee() && !t.signatureValid()) {
         return INVALID_SIGNATURE;
     }
@@ -3,6 +3,7 @@
 #include "../core/constants.hpp"
 #include "../core/common.hpp"
 #include "ledger.hpp"
+#include "ledger_view.hpp"
 #include "tx_store.hpp"
 using namespace std;
 
@@ -42,5 +43,5 @@ class Executor {
         static void Rollback(Ledger& ledger, LedgerState& deltas);
         static void RollbackBlock(Block& curr, Ledger& ledger, TransactionStore & txdb);
         static ExecutionStatus ExecuteBlock(Block& block, Ledger& ledger, TransactionStore & txdb, LedgerState& deltas, TransactionAmount miningFee);
-        static ExecutionStatus ExecuteTransaction(Ledger& ledger, Transaction t, LedgerState& deltas);
+        static ExecutionStatus ExecuteTransaction(LedgerView& ledger, Transaction t, LedgerState& deltas);
 };
@@ -0,0 +1,141 @@
+#include <cstring>
+#include <stdexcept>
+#include "../core/crypto.hpp"
+#include "header_file.hpp"
+
+#ifdef _WIN32
+#include <filesystem>
+namespace fs = std::filesystem;
+#else
+#include <experimental/filesystem>
+namespace fs = std::experimental::filesystem;
+#endif
+
+#define CHECKSUM_INPUT_SIZE (32 + BLOCKHEADER_BUFFER_SIZE + 32)
+
+SHA256Hash chainHeaderChecksum(const SHA256Hash& previous, BlockHeader header, const SHA256Hash& hash) {
+    char buffer[CHECKSUM_INPUT_SIZE];
+    memcpy(buffer, previous.data(), 32);
+    blockHeaderToBuffer(header, buffer + 32);
+    memcpy(buffer + 32 + BLOCKHEADER_BUFFER_SIZE, hash.data(), 32);
+    return SHA256(buffer, CHECKSUM_INPUT_SIZE);
+}
+
+HeaderFile::HeaderFile() {
+    this->file = NULL;
+    this->count = 0;
+    this->checksum = NULL_SHA256_HASH;
+}
+
+HeaderFile::~HeaderFile() {
+    this->closeFile();
+}
+
+void HeaderFile::init(string path) {
+    this->closeFile();
+    std::unique_lock<std::mutex> ul(this->lock);
+    this->path = path;
+    this->file = fopen(path.c_str(), "r+b");
+    if (!this->file) this->file = fopen(path.c_str(), "w+b");
+    if (!this->file) throw std::runtime_error("Could not open header file " + path);
+    fseek(this->file, 0, SEEK_END);
+    size_t size = ftell(this->file);
+    this->count = size / HEADER_RECORD_SIZE;
+    // a torn trailing record from a crash mid-append is dropped
+    if (size % HEADER_RECORD_SIZE != 0) fs::resize_file(path, (uintmax_t)this->count * HEADER_RECORD_SIZE);
+    this->checksum = NULL_SHA256_HASH;
+    if (this->count > 0) {
+        fseek(this->file, (long)this->count * HEADER_RECORD_SIZE - 32, SEEK_SET);
+        if (fread(this->checksum.data(), 1, 32, this->file) != 32) throw std::runtime_error("Could not read header file " + path);
+    }
+}
+
+void HeaderFile::closeFile() {
+    std::unique_lock<std::mutex> ul(this->lock);
+    if (this->file) fclose(this->file);
+    this->file = NULL;
+    this->count = 0;
+    this->checksum = NULL_SHA256_HASH;
+}
+
+uint32_t HeaderFile::getCount() const {
+    std::unique_lock<std::mutex> ul(this->lock);
+    return this->count;
+}
+
+// checksum after the first `count` records
+SHA256Hash HeaderFile::getChecksum(uint32_t count) const {
+    std::unique_lock<std::mutex> ul(this->lock);
+    if (count == 0) return NULL_SHA256_HASH;
+    if (count == this->count) return this->checksum;
+    if (count > this->count) throw std::runtime_error("Header file has no record for block " + to_string(count));
+    SHA256Hash ret;
+    fseek(this->file, (long)count * HEADER_RECORD_SIZE - 32, SEEK_SET);
+    if (fread(ret.data(), 1, 32, this->file) != 32) throw std::runtime_error("Could not read header file " + this->path);
+    return ret;
+}
+
+void HeaderFile::append(BlockHeader header, const SHA256Hash& hash) {
+    std::unique_lock<std::mutex> ul(this->lock);
+    if (header.id != this->count + 1) throw std::runtime_error("Header file append out of order");
+    char record[HEADER_RECORD_SIZE];
+    SHA256Hash next = chainHeaderChecksum(this->checksum, header, hash);
+    blockHeaderToBuffer(header, record);
+    memcpy(record + BLOCKHEADER_BUFFER_SIZE, hash.data(), 32);
+    memcpy(record + BLOCKHEADER_BUFFER_SIZE + 32, next.data(), 32);
+    fseek(this->file, (long)this->count * HEADER_RECORD_SIZE, SEEK_SET);
+    if (fwrite(record, 1, HEADER_RECORD_SIZE, this->file) != HEADER_RECORD_SIZE) {
+        throw std::runtime_error("Could not write header file " + this->path);
+    }
+    this->count++;
+    this->checksum = next;
+}
+
+void HeaderFile::truncate(uint32_t count) {
+    if (count >= this->getCount()) return;
+    SHA256Hash checksum = this->getChecksum(count);
+    std::unique_lock<std::mutex> ul(this->lock);
+    fflush(this->file);
+    fs::resize_file(this->path, (uintmax_t)count * HEADER_RECORD_SIZE);
+    this->count = count;
+    this->checksum = checksum;
+}
+
+// the file is only a cache of the block store, it is not synced
+void HeaderFile::flush() {
+    std::unique_lock<std::mutex> ul(this->lock);
+    if (this->file && fflush(this->file) != 0) throw std::runtime_error("Could not flush header file " + this->path);
+}
+
+/*
+    Reads up to `count` records and returns how many were read. With
+    verify set, reading stops at the first record whose checksum does not
+    follow from the records before it.
+*/
+uint32_t HeaderFile::read(uint32_t count, vector<BlockHeader>* headers, vector<SHA256Hash>& hashes, bool verify) const {
+    std::unique_lock<std::mutex> ul(this->lock);
+    count = min(count, this->count);
+    fflush(this->file);
+    fseek(this->file, 0, SEEK_SET);
+    SHA256Hash checksum = NULL_SHA256_HASH;
+    vector<char> chunk(HEADER_RECORD_SIZE * 4096);
+    uint32_t done = 0;
+    while (done < count) {
+        uint32_t records = min(count - done, (uint32_t)4096);
+        if (fread(chunk.data(), HEADER_RECORD_SIZE, records, this->file) != records) break;
+        for(uint32_t i = 0; i < records; i++) {
+            const char* record = chunk.data() + i * HEADER_RECORD_SIZE;
+            BlockHeader header = blockHeaderFromBuffer(record);
+            SHA256Hash hash;
+            memcpy(hash.data(), record + BLOCKHEADER_BUFFER_SIZE, 32);
+            if (verify) {
+                checksum = chainHeaderChecksum(checksum, header, hash);
+                if (header.id != done + 1 || memcmp(checksum.data(), record + BLOCKHEADER_BUFFER_SIZE + 32, 32) != 0) return done;
+            }
+            if (headers) headers->push_back(header);
+            hashes.push_back(hash);
+            done++;
+        }
+    }
+    return done;
+}
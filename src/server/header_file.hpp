@@ -0,0 +1,43 @@
+#pragma once
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "../core/common.hpp"
+#include "../core/block.hpp"
+using namespace std;
+
+// header buffer, block hash, running checksum
+#define HEADER_RECORD_SIZE (BLOCKHEADER_BUFFER_SIZE + 32 + 32)
+
+SHA256Hash chainHeaderChecksum(const SHA256Hash& previous, BlockHeader header, const SHA256Hash& hash);
+
+/*
+    Compact copy of the chain's block headers and hashes, one fixed size
+    record per block, so startup loads them with one sequential read
+    instead of a block store lookup and a hash per block. Each record
+    carries a running checksum over the records up to it, which the
+    chain tip record in the block store pins for the current tip. The
+    file is appended after blocks are committed and may lag the store or
+    hold records of popped blocks after a crash; readers only trust the
+    prefix whose checksums verify.
+*/
+class HeaderFile {
+    public:
+        HeaderFile();
+        ~HeaderFile();
+        void init(string path);
+        void closeFile();
+        uint32_t getCount() const;
+        SHA256Hash getChecksum(uint32_t count) const;
+        void append(BlockHeader header, const SHA256Hash& hash);
+        void truncate(uint32_t count);
+        void flush();
+        uint32_t read(uint32_t count, vector<BlockHeader>* headers, vector<SHA256Hash>& hashes, bool verify = true) const;
+    protected:
+        string path;
+        FILE* file;
+        uint32_t count;
+        SHA256Hash checksum;
+        mutable std::mutex lock;
+};
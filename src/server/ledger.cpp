@@ -1,11 +1,32 @@
+#include <cstring>
 #include <iostream>
 #include <thread>
+#include "leveldb/write_batch.h"
 #include "../core/crypto.hpp"
+#include "../core/logger.hpp"
 #include "ledger.hpp"
+#ifndef _WIN32
+#include <unistd.h>
+#endif
 using namespace std;
 
+#define DEFAULT_LEDGER_CACHE_BYTES 64*1024*1024
+#define UNDO_KEY_SIZE 5
+#define BALANCE_KEY_PREFIX 'B'
+#define BALANCE_KEY_SIZE (1 + sizeof(TransactionAmount) + sizeof(PublicWalletAddress))
+#define WALLET_COUNT_KEY "WALLET_COUNT"
+#define BALANCE_INDEX_BATCH 100000
+#define HISTORY_KEY_PREFIX 'H'
+#define HISTORY_KEY_SIZE (1 + sizeof(PublicWalletAddress) + sizeof(uint32_t))
+#define HISTORY_START_KEY "HISTORY_START"
+#define CHAIN_HEIGHT_KEY "CHAIN_HEIGHT"
+#define TABLE_SEQUENCE_KEY "TABLE_SEQUENCE"
 
-Ledger::Ledger() {
+Ledger::Ledger() : cache(DEFAULT_LEDGER_CACHE_BYTES) {
+    this->walletCount = 0;
+    this->tableSequence = 0;
+    // wallet addresses all start with the network byte
+    this->compactionPrefix = string(1, '\0');
 }
 
 leveldb::Slice walletToSlice(const PublicWalletAddress& w) {
@@ -18,46 +39,678 @@ leveldb::Slice amountToSlice(const TransactionAmount& t) {
     return s2;
 }
 
+/*
+    Undo records share the ledger db so they land in the same batch as the
+    balances they revert. Their 5 byte keys ('U' + big endian block id)
+    cannot collide with 25 byte wallet keys.
+*/
+static void undoKey(char* key, uint32_t blockId) {
+    key[0] = 'U';
+    key[1] = blockId >> 24;
+    key[2] = blockId >> 16;
+    key[3] = blockId >> 8;
+    key[4] = blockId;
+}
+
+/*
+    Rich list index: 'B' + big endian (max - balance) + wallet, so a forward
+    scan lists the largest balances first. Written in the same batch as the
+    balances it mirrors, together with the wallet count.
+*/
+static void balanceKey(char* key, const PublicWalletAddress& wallet, TransactionAmount balance) {
+    uint64_t inverted = UINT64_MAX - balance;
+    key[0] = BALANCE_KEY_PREFIX;
+    for(int i = 0; i < 8; i++) key[1 + i] = inverted >> (56 - 8 * i);
+    memcpy(key + 9, wallet.data(), wallet.size());
+}
+
+/*
+    Balance history: 'H' + wallet + big endian (max - blockId) -> balance
+    after that block, for every wallet the block changed. Newer blocks sort
+    first, so the balance as of block N is the first entry at or after
+    (wallet, N) and takes one seek.
+*/
+static void historyKey(char* key, const PublicWalletAddress& wallet, uint32_t blockId) {
+    uint32_t inverted = UINT32_MAX - blockId;
+    key[0] = HISTORY_KEY_PREFIX;
+    memcpy(key + 1, wallet.data(), wallet.size());
+    key[26] = inverted >> 24;
+    key[27] = inverted >> 16;
+    key[28] = inverted >> 8;
+    key[29] = inverted;
+}
+
+void Ledger::setCacheSize(size_t maxBytes) {
+    std::unique_lock<std::mutex> ul(this->cacheLock);
+    this->cache.setMemoryBudget(maxBytes);
+}
+
+map<string, uint64_t> Ledger::getCacheStats() const {
+    std::unique_lock<std::mutex> ul(this->cacheLock);
+    return this->cache.getStats();
+}
+
+/*
+    Reads go through the cache, misses are loaded from the table or leveldb and cached
+    (including misses for wallets that do not exist). Callers hold cacheLock.
+*/
+void Ledger::readWallet(const PublicWalletAddress& wallet, bool& exists, TransactionAmount& value) const{
+    if (this->cache.lookup(wallet, exists, value)) return;
+    this->loadWallet(wallet, exists, value);
+}
+
+void Ledger::loadWallet(const PublicWalletAddress& wallet, bool& exists, TransactionAmount& value) const{
+    if (this->table) {
+        exists = this->table->get(wallet, value);
+    } else {
+        std::string stored;
+        leveldb::Status status = db->Get(leveldb::ReadOptions(), walletToSlice(wallet), &stored);
+        exists = status.ok();
+        value = exists ? *((TransactionAmount*)stored.c_str()) : 0;
+    }
+    this->cache.insert(wallet, exists, value);
+}
+
+TransactionAmount Ledger::readWalletValue(const PublicWalletAddress& wallet) const{
+    bool exists;
+    TransactionAmount value;
+    this->readWallet(wallet, exists, value);
+    if(!exists) throw std::runtime_error("Tried fetching wallet value for non-existant wallet");
+    return value;
+}
+
+/*
+    Balance as of the last committed block, ignoring anything staged by an
+    open batch. Safe to call from other threads while a block is executing.
+*/
+void Ledger::getCommittedWallet(const PublicWalletAddress& wallet, bool& exists, TransactionAmount& value) const{
+    std::unique_lock<std::mutex> ul(this->cacheLock);
+    if (this->cache.lookupCommitted(wallet, exists, value)) return;
+    // wallets staged by a batch are always cached, so a miss can go to the store
+    this->loadWallet(wallet, exists, value);
+}
+
 bool Ledger::hasWallet(const PublicWalletAddress& wallet) const{
-    std::string value;
-    leveldb::Status status = db->Get(leveldb::ReadOptions(), walletToSlice(wallet), &value);
-    return (status.ok());
+    std::unique_lock<std::mutex> ul(this->cacheLock);
+    bool exists;
+    TransactionAmount value;
+    this->readWallet(wallet, exists, value);
+    return exists;
 }
 
 void Ledger::createWallet(const PublicWalletAddress& wallet) {
-    if(this->hasWallet(wallet)) throw std::runtime_error("Wallet exists");
+    std::unique_lock<std::mutex> ul(this->cacheLock);
+    bool exists;
+    TransactionAmount value;
+    this->readWallet(wallet, exists, value);
+    if(exists) throw std::runtime_error("Wallet exists");
     this->setWalletValue(wallet, 0);
 }
 
+/*
+    Inside a batch balances only become dirty in the cache and are written
+    out once per block by commitBatch. Outside a batch we write through.
+*/
 void Ledger::setWalletValue(const PublicWalletAddress& wallet, TransactionAmount amount) {
-    leveldb::Status status = db->Put(leveldb::WriteOptions(), walletToSlice(wallet), amountToSlice(amount));
-    if (!status.ok()) throw std::runtime_error("Write failed: " + status.ToString());
+    if (this->isBatching()) {
+        bool exists;
+        TransactionAmount value;
+        this->readWallet(wallet, exists, value);
+        this->cache.setDirty(wallet, amount);
+    } else {
+        this->writeThrough(wallet, true, amount);
+    }
+}
+
+// stages the rich list update for one wallet, returns the change in wallet count
+int64_t Ledger::indexBalance(leveldb::WriteBatch& updates, const PublicWalletAddress& wallet, bool oldExists, TransactionAmount oldValue, bool exists, TransactionAmount value) {
+    if (oldExists == exists && (!exists || oldValue == value)) return 0;
+    char key[BALANCE_KEY_SIZE];
+    if (oldExists) {
+        balanceKey(key, wallet, oldValue);
+        updates.Delete(leveldb::Slice(key, BALANCE_KEY_SIZE));
+    }
+    if (exists) {
+        balanceKey(key, wallet, value);
+        updates.Put(leveldb::Slice(key, BALANCE_KEY_SIZE), leveldb::Slice());
+    }
+    return (int64_t)exists - (int64_t)oldExists;
+}
+
+// one balance written outside a batch, callers hold cacheLock
+void Ledger::writeThrough(const PublicWalletAddress& wallet, bool exists, TransactionAmount value) {
+    bool oldExists;
+    TransactionAmount oldValue;
+    this->readWallet(wallet, oldExists, oldValue);
+    leveldb::WriteBatch updates;
+    uint64_t count = this->walletCount + this->indexBalance(updates, wallet, oldExists, oldValue, exists, value);
+    updates.Put(WALLET_COUNT_KEY, amountToSlice(count));
+    if (this->table) {
+        this->table->apply({LedgerTableChange{wallet, exists, exists ? value : 0}});
+    } else if (exists) {
+        updates.Put(walletToSlice(wallet), amountToSlice(value));
+    } else {
+        updates.Delete(walletToSlice(wallet));
+    }
+    leveldb::Status status = db->Write(leveldb::WriteOptions(), &updates);
+    if (!status.ok()) throw std::runtime_error("Write failed : " + status.ToString());
+    this->walletCount = count;
+    this->cache.insert(wallet, exists, exists ? value : 0);
 }
 
 TransactionAmount Ledger::getWalletValue(const PublicWalletAddress& wallet) const{
-    std::string value;
-    leveldb::Status status = db->Get(leveldb::ReadOptions(), walletToSlice(wallet), &value);
-    if(!status.ok()) throw std::runtime_error("Tried fetching wallet value for non-existant wallet");
-    return *((TransactionAmount*)value.c_str());
+    std::unique_lock<std::mutex> ul(this->cacheLock);
+    return this->readWalletValue(wallet);
 }
 
 void Ledger::withdraw(const PublicWalletAddress& wallet, TransactionAmount amt) {
-    TransactionAmount value = this->getWalletValue(wallet);
+    std::unique_lock<std::mutex> ul(this->cacheLock);
+    TransactionAmount value = this->readWalletValue(wallet);
     value -= amt;
     this->setWalletValue(wallet, value);
 }
 
 void Ledger::revertSend(const PublicWalletAddress& wallet, TransactionAmount amt) {
-    TransactionAmount value = this->getWalletValue(wallet);
+    std::unique_lock<std::mutex> ul(this->cacheLock);
+    TransactionAmount value = this->readWalletValue(wallet);
     this->setWalletValue(wallet, value + amt);
 }
 
 void Ledger::deposit(const PublicWalletAddress& wallet, TransactionAmount amt) {
-    TransactionAmount value = this->getWalletValue(wallet);
+    std::unique_lock<std::mutex> ul(this->cacheLock);
+    TransactionAmount value = this->readWalletValue(wallet);
     this->setWalletValue(wallet, value + amt);
 }
 
 void Ledger::revertDeposit(PublicWalletAddress to, TransactionAmount amt) {
-    TransactionAmount value = this->getWalletValue(to);
+    std::unique_lock<std::mutex> ul(this->cacheLock);
+    TransactionAmount value = this->readWalletValue(to);
     this->setWalletValue(to, value - amt);
 }
+
+/*
+    Puts a wallet back to an earlier state, deleting it if it did not
+    exist back then.
+*/
+void Ledger::restoreWallet(const PublicWalletAddress& wallet, bool exists, TransactionAmount value) {
+    std::unique_lock<std::mutex> ul(this->cacheLock);
+    if (this->isBatching()) {
+        bool currExists;
+        TransactionAmount currValue;
+        this->readWallet(wallet, currExists, currValue);
+        this->cache.setDirty(wallet, value, exists);
+    } else {
+        this->writeThrough(wallet, exists, value);
+    }
+}
+
+void Ledger::setUndoRecord(uint32_t blockId, const string& record) {
+    char key[UNDO_KEY_SIZE];
+    undoKey(key, blockId);
+    this->put(leveldb::Slice(key, UNDO_KEY_SIZE), leveldb::Slice(record));
+}
+
+bool Ledger::getUndoRecord(uint32_t blockId, string& record) const{
+    char key[UNDO_KEY_SIZE];
+    undoKey(key, blockId);
+    leveldb::Status status = db->Get(leveldb::ReadOptions(), leveldb::Slice(key, UNDO_KEY_SIZE), &record);
+    return status.ok();
+}
+
+// highest block with an undo record, 0 if there is none
+uint32_t Ledger::getLastUndoBlock() const{
+    std::unique_ptr<leveldb::Iterator> it(db->NewIterator(leveldb::ReadOptions()));
+    it->Seek(leveldb::Slice("V", 1));
+    if (it->Valid()) {
+        it->Prev();
+    } else {
+        it->SeekToLast();
+    }
+    if (!it->Valid() || it->key().size() != UNDO_KEY_SIZE || it->key()[0] != 'U') return 0;
+    const uint8_t* key = (const uint8_t*)it->key().data();
+    return ((uint32_t)key[1] << 24) | ((uint32_t)key[2] << 16) | ((uint32_t)key[3] << 8) | key[4];
+}
+
+void Ledger::removeUndoRecord(uint32_t blockId) {
+    char key[UNDO_KEY_SIZE];
+    undoKey(key, blockId);
+    this->remove(leveldb::Slice(key, UNDO_KEY_SIZE));
+}
+
+/*
+    Removes up to `limit` of the oldest undo records below blockId, so a
+    backlog left by older nodes drains a little with every block instead
+    of in one huge batch. Returns how many were removed.
+*/
+size_t Ledger::removeUndoRecordsBelow(uint32_t blockId, size_t limit) {
+    char first[UNDO_KEY_SIZE];
+    undoKey(first, 0);
+    size_t removed = 0;
+    std::unique_ptr<leveldb::Iterator> it(db->NewIterator(leveldb::ReadOptions()));
+    for(it->Seek(leveldb::Slice(first, UNDO_KEY_SIZE)); it->Valid() && removed < limit; it->Next()) {
+        if (it->key().size() != UNDO_KEY_SIZE || it->key()[0] != 'U') break;
+        const uint8_t* key = (const uint8_t*)it->key().data();
+        uint32_t id = ((uint32_t)key[1] << 24) | ((uint32_t)key[2] << 16) | ((uint32_t)key[3] << 8) | key[4];
+        if (id >= blockId) break;
+        this->remove(it->key());
+        removed++;
+    }
+    return removed;
+}
+
+/*
+    Block count the balances reflect, staged with every block commit. The
+    ledger batch is committed before the other stores, so a count that
+    differs from the block store's marks a commit cut short by a crash.
+*/
+void Ledger::setChainHeight(uint32_t height) {
+    this->put(CHAIN_HEIGHT_KEY, leveldb::Slice((const char*)&height, sizeof(uint32_t)));
+}
+
+bool Ledger::getChainHeight(uint32_t& height) const{
+    string stored;
+    if (!db->Get(leveldb::ReadOptions(), CHAIN_HEIGHT_KEY, &stored).ok() || stored.size() != sizeof(uint32_t)) return false;
+    height = *((const uint32_t*)stored.data());
+    return true;
+}
+
+void Ledger::commitBatch(bool sync) {
+    std::unique_lock<std::mutex> ul(this->cacheLock);
+    if (!this->isBatching()) return;
+    vector<LedgerTableChange> changes;
+    int64_t added = 0;
+    for(auto& change : this->cache.getChanges()) {
+        added += this->indexBalance(*this->batch, change.wallet, change.committedExists, change.committedValue, change.exists, change.value);
+    }
+    uint64_t count = this->walletCount + added;
+    if (added != 0) this->batch->Put(WALLET_COUNT_KEY, amountToSlice(count));
+    for(auto& item : this->cache.getDirty()) {
+        if (this->table) {
+            changes.push_back(LedgerTableChange{item.first, true, item.second});
+        } else {
+            this->batch->Put(walletToSlice(item.first), amountToSlice(item.second));
+        }
+    }
+    for(auto& wallet : this->cache.getRemoved()) {
+        if (this->table) {
+            changes.push_back(LedgerTableChange{wallet, false, 0});
+        } else {
+            this->batch->Delete(walletToSlice(wallet));
+        }
+    }
+    // balances are logged to the table under a sequence number the batch
+    // stores, opening the table replays them only if the batch landed
+    uint64_t sequence = this->tableSequence;
+    try {
+        if (this->table && !changes.empty()) {
+            sequence++;
+            this->batch->Put(TABLE_SEQUENCE_KEY, leveldb::Slice((const char*)&sequence, sizeof(uint64_t)));
+            this->table->prepare(changes, sequence, sync);
+        }
+        DataStore::commitBatch(sync);
+    } catch(...) {
+        if (this->table) this->table->abortPrepared();
+        this->cache.revertDirty();
+        throw;
+    }
+    this->tableSequence = sequence;
+    this->walletCount = count;
+    this->cache.markClean();
+    if (this->table) this->applyTable();
+}
+
+/*
+    Applies the balances of a committed batch to the table. If this fails
+    the group stays in the table's log and is replayed on the next open.
+*/
+void Ledger::applyTable() {
+    this->table->commitPrepared();
+}
+
+uint64_t Ledger::readTableSequence() const{
+    string stored;
+    if (!db->Get(leveldb::ReadOptions(), TABLE_SEQUENCE_KEY, &stored).ok() || stored.size() != sizeof(uint64_t)) return 0;
+    return *((const uint64_t*)stored.data());
+}
+
+void Ledger::sync() {
+    {
+        // the table log must be durable whenever the batch stamping it is
+        std::unique_lock<std::mutex> ul(this->cacheLock);
+        if (this->table) this->table->sync();
+    }
+    DataStore::sync();
+}
+
+void Ledger::discardBatch() {
+    std::unique_lock<std::mutex> ul(this->cacheLock);
+    DataStore::discardBatch();
+    this->cache.revertDirty();
+}
+
+void Ledger::clear() {
+    std::unique_lock<std::mutex> ul(this->cacheLock);
+    DataStore::clear();
+    if (this->table) this->table->clear();
+    this->cache.clear();
+    this->walletCount = 0;
+    this->tableSequence = 0;
+}
+
+void Ledger::closeDB() {
+    std::unique_lock<std::mutex> ul(this->cacheLock);
+    if (this->table) this->table->closeTable();
+    DataStore::closeDB();
+}
+
+void Ledger::deleteDB() {
+    std::unique_lock<std::mutex> ul(this->cacheLock);
+    if (this->table) this->table->deleteTable();
+    DataStore::deleteDB();
+}
+
+/*
+    Moves balances out of leveldb into a memory mapped LedgerTable at
+    `path`. Undo records stay in leveldb.
+*/
+void Ledger::enableTable(string path) {
+    std::unique_lock<std::mutex> ul(this->cacheLock);
+    this->tableSequence = this->readTableSequence();
+    this->table = std::make_unique<LedgerTable>();
+    this->table->init(path, this->tableSequence);
+    this->moveWalletsToTable();
+    this->cache.clear();
+}
+
+bool Ledger::hasTable() const {
+    std::unique_lock<std::mutex> ul(this->cacheLock);
+    return this->table != nullptr;
+}
+
+/*
+    Balances found in leveldb (written before the table was enabled, or
+    by a snapshot import) are copied into the table. The table is
+    checkpointed before they are deleted, so a crash in between only means
+    they are copied again. Callers hold cacheLock.
+*/
+void Ledger::moveWalletsToTable() {
+    vector<LedgerTableChange> changes;
+    leveldb::WriteBatch moved;
+    size_t count = 0;
+    std::unique_ptr<leveldb::Iterator> it(db->NewIterator(leveldb::ReadOptions()));
+    for (it->SeekToFirst(); it->Valid(); it->Next()) {
+        if (it->key().size() != sizeof(PublicWalletAddress)) continue;
+        LedgerTableChange change;
+        memcpy(change.wallet.data(), it->key().data(), change.wallet.size());
+        change.exists = true;
+        change.value = *((TransactionAmount*)it->value().data());
+        changes.push_back(change);
+        moved.Delete(it->key());
+        count++;
+        if (changes.size() == 100000) {
+            this->table->apply(changes);
+            changes.clear();
+        }
+    }
+    if (count == 0) return;
+    this->table->apply(changes);
+    this->table->checkpoint();
+    leveldb::Status status = db->Write(leveldb::WriteOptions(), &moved);
+    if (!status.ok()) throw std::runtime_error("Could not move balances to ledger table : " + status.ToString());
+}
+
+/*
+    Loads the wallet count, building the rich list index first if the
+    ledger was written before it existed. Call once the table (if any) is
+    enabled.
+*/
+void Ledger::indexBalances() {
+    std::unique_lock<std::mutex> ul(this->cacheLock);
+    this->loadBalanceIndex();
+}
+
+// callers hold cacheLock
+void Ledger::loadBalanceIndex() {
+    string stored;
+    if (db->Get(leveldb::ReadOptions(), WALLET_COUNT_KEY, &stored).ok() && stored.size() == sizeof(uint64_t)) {
+        this->walletCount = *((const uint64_t*)stored.data());
+        return;
+    }
+    Logger::logStatus("Building rich list index");
+    uint64_t count = 0;
+    leveldb::WriteBatch updates;
+    this->forEachWallet([&](const PublicWalletAddress& wallet, TransactionAmount value) {
+        count += this->indexBalance(updates, wallet, false, 0, true, value);
+        if (count % BALANCE_INDEX_BATCH == 0) {
+            leveldb::Status status = db->Write(leveldb::WriteOptions(), &updates);
+            if (!status.ok()) throw std::runtime_error("Could not build rich list index : " + status.ToString());
+            updates.Clear();
+        }
+    });
+    // the count goes last, it marks the index as complete
+    updates.Put(WALLET_COUNT_KEY, amountToSlice(count));
+    leveldb::Status status = db->Write(leveldb::WriteOptions(), &updates);
+    if (!status.ok()) throw std::runtime_error("Could not build rich list index : " + status.ToString());
+    this->walletCount = count;
+}
+
+// committed balances from the table or leveldb, callers hold cacheLock
+void Ledger::forEachWallet(std::function<void(const PublicWalletAddress&, TransactionAmount)> visitor) const {
+    if (this->table) {
+        this->table->forEach(visitor);
+        return;
+    }
+    std::unique_ptr<leveldb::Iterator> it(db->NewIterator(leveldb::ReadOptions()));
+    for (it->SeekToFirst(); it->Valid(); it->Next()) {
+        if (it->key().size() != sizeof(PublicWalletAddress)) continue;
+        PublicWalletAddress wallet;
+        memcpy(wallet.data(), it->key().data(), wallet.size());
+        visitor(wallet, *((const TransactionAmount*)it->value().data()));
+    }
+}
+
+uint64_t Ledger::getWalletCount() const {
+    return this->walletCount;
+}
+
+// committed balances ranked from the largest, skipping the first offset wallets
+void Ledger::getRichList(uint64_t offset, uint32_t limit, vector<pair<PublicWalletAddress, TransactionAmount>>& entries) const {
+    std::unique_ptr<leveldb::Iterator> it(db->NewIterator(leveldb::ReadOptions()));
+    char prefix = BALANCE_KEY_PREFIX;
+    it->Seek(leveldb::Slice(&prefix, 1));
+    this->readRichList(it.get(), offset, limit, entries);
+}
+
+// the wallets ranked right below (afterWallet, afterBalance), found with one seek
+void Ledger::getRichList(const PublicWalletAddress& afterWallet, TransactionAmount afterBalance, uint32_t limit, vector<pair<PublicWalletAddress, TransactionAmount>>& entries) const {
+    std::unique_ptr<leveldb::Iterator> it(db->NewIterator(leveldb::ReadOptions()));
+    char key[BALANCE_KEY_SIZE];
+    balanceKey(key, afterWallet, afterBalance);
+    leveldb::Slice cursor(key, BALANCE_KEY_SIZE);
+    it->Seek(cursor);
+    if (it->Valid() && it->key() == cursor) it->Next();
+    this->readRichList(it.get(), 0, limit, entries);
+}
+
+void Ledger::readRichList(leveldb::Iterator* it, uint64_t offset, uint32_t limit, vector<pair<PublicWalletAddress, TransactionAmount>>& entries) const {
+    entries.clear();
+    uint64_t skipped = 0;
+    for(; it->Valid() && entries.size() < limit; it->Next()) {
+        if (it->key()[0] != BALANCE_KEY_PREFIX) break;
+        if (it->key().size() != BALANCE_KEY_SIZE) continue;
+        if (skipped++ < offset) continue;
+        const uint8_t* key = (const uint8_t*)it->key().data();
+        uint64_t inverted = 0;
+        for(int i = 0; i < 8; i++) inverted = (inverted << 8) | key[1 + i];
+        PublicWalletAddress wallet;
+        memcpy(wallet.data(), key + 9, wallet.size());
+        entries.push_back(std::make_pair(wallet, UINT64_MAX - inverted));
+    }
+}
+
+/*
+    History is only recorded from the block it was started at. Every
+    existing balance is checkpointed at that height, so queries at or
+    above it are answered exactly and older ones are refused. Does
+    nothing if history has already been started.
+*/
+void Ledger::startBalanceHistory(uint32_t height) {
+    std::unique_lock<std::mutex> ul(this->cacheLock);
+    uint32_t start;
+    if (this->getHistoryStart(start)) return;
+    if (height > 0) Logger::logStatus("Starting balance history at block " + to_string(height));
+    this->seedBalanceHistory(height);
+}
+
+/*
+    Moves the start of history down to height after a rewind below it.
+    Every checkpoint above height is stale, including the baseline seeded
+    at the old start for wallets the popped blocks never touched, so they
+    are dropped and a new baseline is seeded from the current balances.
+    The old start key stays until the new one overwrites it, so a restart
+    cut short still has a start above the chain height and is redone on
+    the next open.
+*/
+void Ledger::restartBalanceHistory(uint32_t height) {
+    std::unique_lock<std::mutex> ul(this->cacheLock);
+    Logger::logStatus("Chain rewound below the start of balance history, restarting it at block " + to_string(height));
+    leveldb::WriteBatch updates;
+    size_t staged = 0;
+    std::unique_ptr<leveldb::Iterator> it(db->NewIterator(leveldb::ReadOptions()));
+    for(it->Seek(leveldb::Slice(string(1, HISTORY_KEY_PREFIX))); it->Valid() && it->key()[0] == HISTORY_KEY_PREFIX; it->Next()) {
+        if (it->key().size() != HISTORY_KEY_SIZE) continue;
+        const uint8_t* key = (const uint8_t*)it->key().data();
+        uint32_t blockId = UINT32_MAX - (((uint32_t)key[26] << 24) | ((uint32_t)key[27] << 16) | ((uint32_t)key[28] << 8) | key[29]);
+        if (blockId <= height) continue;
+        updates.Delete(it->key());
+        if (++staged % BALANCE_INDEX_BATCH == 0) {
+            leveldb::Status status = db->Write(leveldb::WriteOptions(), &updates);
+            if (!status.ok()) throw std::runtime_error("Could not restart balance history : " + status.ToString());
+            updates.Clear();
+        }
+    }
+    leveldb::Status status = db->Write(leveldb::WriteOptions(), &updates);
+    if (!status.ok()) throw std::runtime_error("Could not restart balance history : " + status.ToString());
+    this->seedBalanceHistory(height);
+}
+
+// checkpoints every balance at height, the start key goes last. callers hold cacheLock
+void Ledger::seedBalanceHistory(uint32_t height) {
+    leveldb::WriteBatch updates;
+    size_t staged = 0;
+    char key[HISTORY_KEY_SIZE];
+    this->forEachWallet([&](const PublicWalletAddress& wallet, TransactionAmount value) {
+        historyKey(key, wallet, height);
+        updates.Put(leveldb::Slice(key, HISTORY_KEY_SIZE), amountToSlice(value));
+        if (++staged % BALANCE_INDEX_BATCH == 0) {
+            leveldb::Status status = db->Write(leveldb::WriteOptions(), &updates);
+            if (!status.ok()) throw std::runtime_error("Could not start balance history : " + status.ToString());
+            updates.Clear();
+        }
+    });
+    updates.Put(HISTORY_START_KEY, leveldb::Slice((const char*)&height, sizeof(uint32_t)));
+    leveldb::Status status = db->Write(leveldb::WriteOptions(), &updates);
+    if (!status.ok()) throw std::runtime_error("Could not start balance history : " + status.ToString());
+}
+
+bool Ledger::getHistoryStart(uint32_t& height) const{
+    string stored;
+    if (!db->Get(leveldb::ReadOptions(), HISTORY_START_KEY, &stored).ok() || stored.size() != sizeof(uint32_t)) return false;
+    height = *((const uint32_t*)stored.data());
+    return true;
+}
+
+// staged with the block's balances when called inside a batch
+void Ledger::setBalanceCheckpoint(const PublicWalletAddress& wallet, uint32_t blockId, TransactionAmount balance) {
+    char key[HISTORY_KEY_SIZE];
+    historyKey(key, wallet, blockId);
+    this->put(leveldb::Slice(key, HISTORY_KEY_SIZE), amountToSlice(balance));
+}
+
+void Ledger::removeBalanceCheckpoint(const PublicWalletAddress& wallet, uint32_t blockId) {
+    char key[HISTORY_KEY_SIZE];
+    historyKey(key, wallet, blockId);
+    this->remove(leveldb::Slice(key, HISTORY_KEY_SIZE));
+}
+
+/*
+    Committed balance of wallet as of blockId and the block it last changed
+    in. False if the wallet did not exist yet.
+*/
+bool Ledger::getBalanceAt(const PublicWalletAddress& wallet, uint32_t blockId, TransactionAmount& balance, uint32_t& changedAt) const{
+    char key[HISTORY_KEY_SIZE];
+    historyKey(key, wallet, blockId);
+    std::unique_ptr<leveldb::Iterator> it(db->NewIterator(leveldb::ReadOptions()));
+    it->Seek(leveldb::Slice(key, HISTORY_KEY_SIZE));
+    if (!it->Valid() || it->key().size() != HISTORY_KEY_SIZE || memcmp(it->key().data(), key, 1 + wallet.size()) != 0) return false;
+    const uint8_t* found = (const uint8_t*)it->key().data();
+    changedAt = UINT32_MAX - (((uint32_t)found[26] << 24) | ((uint32_t)found[27] << 16) | ((uint32_t)found[28] << 8) | found[29]);
+    balance = *((const TransactionAmount*)it->value().data());
+    return true;
+}
+
+json Ledger::getStats() const {
+    json ret = DataStore::getStats();
+    std::unique_lock<std::mutex> ul(this->cacheLock);
+    if (this->table) ret["table"] = this->table->getStats();
+    return ret;
+}
+
+/*
+    With the table enabled the leveldb snapshot only pins undo records, so
+    the committed balances are copied out alongside it and exported as the
+    same wallet records the leveldb ledger would have written.
+*/
+const leveldb::Snapshot* Ledger::takeSnapshot() {
+    std::unique_lock<std::mutex> ul(this->cacheLock);
+    const leveldb::Snapshot* snapshot = DataStore::takeSnapshot();
+    if (!this->table) return snapshot;
+    vector<pair<PublicWalletAddress, TransactionAmount>> wallets;
+    this->table->forEach([&wallets](const PublicWalletAddress& wallet, TransactionAmount value) {
+        wallets.push_back(std::make_pair(wallet, value));
+    });
+    std::unique_lock<std::mutex> pl(this->pinLock);
+    this->pinnedWallets[snapshot] = std::move(wallets);
+    return snapshot;
+}
+
+void Ledger::releaseSnapshot(const leveldb::Snapshot* snapshot) {
+    {
+        std::unique_lock<std::mutex> pl(this->pinLock);
+        this->pinnedWallets.erase(snapshot);
+    }
+    DataStore::releaseSnapshot(snapshot);
+}
+
+void Ledger::exportSnapshot(string file, const leveldb::Snapshot* snapshot) const {
+    DataStore::exportSnapshot(file, snapshot);
+    std::unique_lock<std::mutex> pl(this->pinLock);
+    auto pinned = this->pinnedWallets.find(snapshot);
+    if (pinned == this->pinnedWallets.end()) return;
+    FILE* out = fopen(file.c_str(), "ab");
+    if (!out) throw std::runtime_error("Could not open snapshot file " + file);
+    uint32_t keyLen = sizeof(PublicWalletAddress);
+    uint32_t valueLen = sizeof(TransactionAmount);
+    bool ok = true;
+    for(auto it = pinned->second.begin(); ok && it != pinned->second.end(); it++) {
+        ok = fwrite(&keyLen, sizeof(uint32_t), 1, out) == 1 &&
+             fwrite(it->first.data(), 1, keyLen, out) == keyLen &&
+             fwrite(&valueLen, sizeof(uint32_t), 1, out) == 1 &&
+             fwrite(&it->second, 1, valueLen, out) == valueLen;
+    }
+    ok = ok && fflush(out) == 0;
+#ifndef _WIN32
+    ok = ok && fsync(fileno(out)) == 0;
+#endif
+    fclose(out);
+    if (!ok) throw std::runtime_error("Could not write snapshot file " + file);
+}
+
+void Ledger::importSnapshot(string file) {
+    DataStore::importSnapshot(file);
+    std::unique_lock<std::mutex> ul(this->cacheLock);
+    this->tableSequence = this->readTableSequence();
+    if (this->table) this->moveWalletsToTable();
+    this->cache.clear();
+    this->loadBalanceIndex();
+}
@@ -1,8 +1,15 @@
 #pragma once
+#include <atomic>
+#include <functional>
 #include <set>
+#include <map>
+#include <memory>
+#include <mutex>
 #include "leveldb/db.h"
 #include "../core/common.hpp"
 #include "data_store.hpp"
+#include "ledger_cache.hpp"
+#include "ledger_table.hpp"
 using namespace std;
 
 class Ledger : public DataStore {
@@ -10,11 +17,67 @@ class Ledger : public DataStore {
         Ledger();
         bool hasWallet(const PublicWalletAddress& wallet) const;
         TransactionAmount getWalletValue(const PublicWalletAddress& wallet) const;
+        void getCommittedWallet(const PublicWalletAddress& wallet, bool& exists, TransactionAmount& value) const;
         void createWallet(const PublicWalletAddress& wallet);
         void withdraw(const PublicWalletAddress& wallet, TransactionAmount amt);
         void revertSend(const PublicWalletAddress& wallet, TransactionAmount amt);
         void revertDeposit(PublicWalletAddress to, TransactionAmount amt);
         void deposit(const PublicWalletAddress& wallet, TransactionAmount amt);
+        void restoreWallet(const PublicWalletAddress& wallet, bool exists, TransactionAmount value);
+        void setUndoRecord(uint32_t blockId, const string& record);
+        bool getUndoRecord(uint32_t blockId, string& record) const;
+        void removeUndoRecord(uint32_t blockId);
+        size_t removeUndoRecordsBelow(uint32_t blockId, size_t limit);
+        void commitBatch(bool sync = false);
+        void discardBatch();
+        void sync();
+        uint32_t getLastUndoBlock() const;
+        void setChainHeight(uint32_t height);
+        bool getChainHeight(uint32_t& height) const;
+        void clear();
+        void closeDB();
+        void deleteDB();
+        void enableTable(string path);
+        bool hasTable() const;
+        void indexBalances();
+        uint64_t getWalletCount() const;
+        void getRichList(uint64_t offset, uint32_t limit, vector<pair<PublicWalletAddress, TransactionAmount>>& entries) const;
+        void getRichList(const PublicWalletAddress& afterWallet, TransactionAmount afterBalance, uint32_t limit, vector<pair<PublicWalletAddress, TransactionAmount>>& entries) const;
+        void startBalanceHistory(uint32_t height);
+        void restartBalanceHistory(uint32_t height);
+        bool getHistoryStart(uint32_t& height) const;
+        void setBalanceCheckpoint(const PublicWalletAddress& wallet, uint32_t blockId, TransactionAmount balance);
+        void removeBalanceCheckpoint(const PublicWalletAddress& wallet, uint32_t blockId);
+        bool getBalanceAt(const PublicWalletAddress& wallet, uint32_t blockId, TransactionAmount& balance, uint32_t& changedAt) const;
+        json getStats() const;
+        const leveldb::Snapshot* takeSnapshot();
+        void releaseSnapshot(const leveldb::Snapshot* snapshot);
+        void exportSnapshot(string file, const leveldb::Snapshot* snapshot) const;
+        void importSnapshot(string file);
+        void setCacheSize(size_t maxBytes);
+        map<string, uint64_t> getCacheStats() const;
     protected:
+        virtual void applyTable();
+        uint64_t readTableSequence() const;
+        void moveWalletsToTable();
+        void loadWallet(const PublicWalletAddress& wallet, bool& exists, TransactionAmount& value) const;
+        void readWallet(const PublicWalletAddress& wallet, bool& exists, TransactionAmount& value) const;
+        TransactionAmount readWalletValue(const PublicWalletAddress& wallet) const;
         void setWalletValue(const PublicWalletAddress& wallet, TransactionAmount amount);
+        int64_t indexBalance(leveldb::WriteBatch& updates, const PublicWalletAddress& wallet, bool oldExists, TransactionAmount oldValue, bool exists, TransactionAmount value);
+        void writeThrough(const PublicWalletAddress& wallet, bool exists, TransactionAmount value);
+        void loadBalanceIndex();
+        void readRichList(leveldb::Iterator* it, uint64_t offset, uint32_t limit, vector<pair<PublicWalletAddress, TransactionAmount>>& entries) const;
+        void seedBalanceHistory(uint32_t height);
+        void forEachWallet(std::function<void(const PublicWalletAddress&, TransactionAmount)> visitor) const;
+        mutable LedgerCache cache;
+        mutable std::mutex cacheLock;
+        // balances live here instead of leveldb once enableTable is called
+        std::unique_ptr<LedgerTable> table;
+        // table contents copied when a snapshot is taken, exported with it
+        mutable map<const leveldb::Snapshot*, vector<pair<PublicWalletAddress, TransactionAmount>>> pinnedWallets;
+        mutable std::mutex pinLock;
+        std::atomic<uint64_t> walletCount;
+        // last sequence stamped into both a leveldb batch and the table log
+        uint64_t tableSequence;
 };
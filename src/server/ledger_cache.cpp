@@ -0,0 +1,176 @@
+#include "ledger_cache.hpp"
+#include "../external/murmurhash3/MurmurHash3.hpp"
+using namespace std;
+
+// rough per-entry footprint: hash node + lru node + the entry itself
+#define LEDGER_CACHE_ENTRY_BYTES 128
+
+size_t WalletAddressHash::operator()(const PublicWalletAddress& w) const {
+    uint64_t out[2];
+    MurmurHash3_x64_128(w.data(), w.size(), 0, out);
+    return out[0];
+}
+
+LedgerCache::LedgerCache(size_t maxBytes) {
+    this->hits = 0;
+    this->misses = 0;
+    this->evictions = 0;
+    this->setMemoryBudget(maxBytes);
+}
+
+void LedgerCache::setMemoryBudget(size_t maxBytes) {
+    this->maxEntries = max((size_t)1, maxBytes / LEDGER_CACHE_ENTRY_BYTES);
+    this->evict();
+}
+
+void LedgerCache::touch(Entry& entry) {
+    this->lru.splice(this->lru.begin(), this->lru, entry.lruPos);
+}
+
+bool LedgerCache::lookup(const PublicWalletAddress& wallet, bool& exists, TransactionAmount& value) {
+    auto it = this->entries.find(wallet);
+    if (it == this->entries.end()) {
+        this->misses++;
+        return false;
+    }
+    this->hits++;
+    this->touch(it->second);
+    exists = it->second.exists;
+    value = it->second.value;
+    return true;
+}
+
+bool LedgerCache::lookupCommitted(const PublicWalletAddress& wallet, bool& exists, TransactionAmount& value) {
+    auto it = this->entries.find(wallet);
+    if (it == this->entries.end()) {
+        this->misses++;
+        return false;
+    }
+    this->hits++;
+    this->touch(it->second);
+    exists = it->second.committedExists;
+    value = it->second.committedValue;
+    return true;
+}
+
+void LedgerCache::insert(const PublicWalletAddress& wallet, bool exists, TransactionAmount value) {
+    auto it = this->entries.find(wallet);
+    if (it != this->entries.end()) {
+        Entry& entry = it->second;
+        entry.value = value;
+        entry.exists = exists;
+        if (!entry.dirty) {
+            entry.committedValue = value;
+            entry.committedExists = exists;
+        }
+        this->touch(entry);
+        return;
+    }
+    this->lru.push_front(wallet);
+    Entry entry;
+    entry.value = value;
+    entry.exists = exists;
+    entry.dirty = false;
+    entry.committedValue = value;
+    entry.committedExists = exists;
+    entry.lruPos = this->lru.begin();
+    this->entries.insert(pair<PublicWalletAddress, Entry>(wallet, entry));
+    this->evict();
+}
+
+/*
+    The wallet must already be cached (callers read before they write) so
+    that the committed value is known if the block has to be reverted.
+*/
+void LedgerCache::setDirty(const PublicWalletAddress& wallet, TransactionAmount value, bool exists) {
+    auto it = this->entries.find(wallet);
+    if (it == this->entries.end()) throw std::runtime_error("Ledger cache write to uncached wallet");
+    Entry& entry = it->second;
+    if (!entry.dirty) {
+        entry.dirty = true;
+        this->dirtyWallets.push_back(wallet);
+    }
+    entry.value = exists ? value : 0;
+    entry.exists = exists;
+    this->touch(entry);
+}
+
+vector<pair<PublicWalletAddress, TransactionAmount>> LedgerCache::getDirty() const {
+    vector<pair<PublicWalletAddress, TransactionAmount>> ret;
+    for(auto& wallet : this->dirtyWallets) {
+        const Entry& entry = this->entries.at(wallet);
+        if (!entry.exists) continue;
+        ret.push_back(pair<PublicWalletAddress, TransactionAmount>(wallet, entry.value));
+    }
+    return ret;
+}
+
+// dirty wallets that no longer exist and have to be deleted on flush
+vector<PublicWalletAddress> LedgerCache::getRemoved() const {
+    vector<PublicWalletAddress> ret;
+    for(auto& wallet : this->dirtyWallets) {
+        if (!this->entries.at(wallet).exists) ret.push_back(wallet);
+    }
+    return ret;
+}
+
+vector<LedgerCacheChange> LedgerCache::getChanges() const {
+    vector<LedgerCacheChange> ret;
+    for(auto& wallet : this->dirtyWallets) {
+        const Entry& entry = this->entries.at(wallet);
+        ret.push_back(LedgerCacheChange{wallet, entry.committedExists, entry.committedValue, entry.exists, entry.value});
+    }
+    return ret;
+}
+
+void LedgerCache::markClean() {
+    for(auto& wallet : this->dirtyWallets) {
+        Entry& entry = this->entries.at(wallet);
+        entry.dirty = false;
+        entry.committedValue = entry.value;
+        entry.committedExists = entry.exists;
+    }
+    this->dirtyWallets.clear();
+    this->evict();
+}
+
+void LedgerCache::revertDirty() {
+    for(auto& wallet : this->dirtyWallets) {
+        Entry& entry = this->entries.at(wallet);
+        entry.dirty = false;
+        entry.value = entry.committedValue;
+        entry.exists = entry.committedExists;
+    }
+    this->dirtyWallets.clear();
+    this->evict();
+}
+
+void LedgerCache::evict() {
+    // walk from the cold end, dirty entries are skipped until flushed
+    auto it = this->lru.end();
+    while(this->entries.size() > this->maxEntries && it != this->lru.begin()) {
+        --it;
+        auto entry = this->entries.find(*it);
+        if (entry->second.dirty) continue;
+        this->entries.erase(entry);
+        it = this->lru.erase(it);
+        this->evictions++;
+    }
+}
+
+void LedgerCache::clear() {
+    this->entries.clear();
+    this->lru.clear();
+    this->dirtyWallets.clear();
+}
+
+map<string, uint64_t> LedgerCache::getStats() const {
+    map<string, uint64_t> stats;
+    stats["entries"] = this->entries.size();
+    stats["max_entries"] = this->maxEntries;
+    stats["dirty"] = this->dirtyWallets.size();
+    stats["hits"] = this->hits;
+    stats["misses"] = this->misses;
+    stats["evictions"] = this->evictions;
+    return stats;
+}
@@ -0,0 +1,61 @@
+#pragma once
+#include <list>
+#include <vector>
+#include <unordered_map>
+#include "../core/common.hpp"
+using namespace std;
+
+struct WalletAddressHash {
+    size_t operator()(const PublicWalletAddress& w) const;
+};
+
+// a dirty wallet with the state it had before the batch
+struct LedgerCacheChange {
+    PublicWalletAddress wallet;
+    bool committedExists;
+    TransactionAmount committedValue;
+    bool exists;
+    TransactionAmount value;
+};
+
+/*
+    Write-back cache of wallet balances sitting in front of the ledger db.
+    Clean entries mirror what is on disk (including "wallet does not exist")
+    and are evicted LRU once the memory budget is exceeded. Dirty entries
+    hold balances written by the current block and are pinned until they
+    are flushed or reverted.
+*/
+class LedgerCache {
+    public:
+        LedgerCache(size_t maxBytes);
+        void setMemoryBudget(size_t maxBytes);
+        bool lookup(const PublicWalletAddress& wallet, bool& exists, TransactionAmount& value);
+        bool lookupCommitted(const PublicWalletAddress& wallet, bool& exists, TransactionAmount& value);
+        void insert(const PublicWalletAddress& wallet, bool exists, TransactionAmount value);
+        void setDirty(const PublicWalletAddress& wallet, TransactionAmount value, bool exists = true);
+        vector<pair<PublicWalletAddress, TransactionAmount>> getDirty() const;
+        vector<PublicWalletAddress> getRemoved() const;
+        vector<LedgerCacheChange> getChanges() const;
+        void markClean();
+        void revertDirty();
+        void clear();
+        map<string, uint64_t> getStats() const;
+    protected:
+        struct Entry {
+            TransactionAmount value;
+            bool exists;
+            bool dirty;
+            TransactionAmount committedValue;
+            bool committedExists;
+            list<PublicWalletAddress>::iterator lruPos;
+        };
+        void touch(Entry& entry);
+        void evict();
+        unordered_map<PublicWalletAddress, Entry, WalletAddressHash> entries;
+        list<PublicWalletAddress> lru; // most recently used at the front
+        vector<PublicWalletAddress> dirtyWallets;
+        size_t maxEntries;
+        uint64_t hits;
+        uint64_t misses;
+        uint64_t evictions;
+};
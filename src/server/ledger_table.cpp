@@ -0,0 +1,542 @@
+#include <cstring>
+#include <stdexcept>
+#include "../external/murmurhash3/MurmurHash3.hpp"
+#include "ledger_table.hpp"
+
+#ifdef _WIN32
+#include <filesystem>
+namespace fs = std::filesystem;
+#else
+#include <experimental/filesystem>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+namespace fs = std::experimental::filesystem;
+#endif
+
+#define LEDGER_TABLE_MAGIC 0x314c4254474445ULL
+#define LEDGER_TABLE_VERSION 1
+#define LEDGER_TABLE_HEADER_SIZE 4096
+#define LEDGER_TABLE_INITIAL_CAPACITY (1 << 16)
+// percent of slots (live or tombstone) in use before the table is resized
+#define LEDGER_TABLE_MAX_LOAD 70
+// below this percent of live slots a resize only clears tombstones
+#define LEDGER_TABLE_GROW_LOAD 35
+#define LEDGER_TABLE_RESIZE_STEP 256
+#define LEDGER_TABLE_CHECKPOINT_BYTES (64 * 1024 * 1024)
+#define LOG_RECORD_SIZE (25 + 1 + 8)
+#define LOG_GROUP_HEADER_SIZE (sizeof(uint32_t) + sizeof(uint64_t))
+
+#define SLOT_EMPTY 0
+#define SLOT_LIVE 1
+#define SLOT_DELETED 2
+
+static_assert(sizeof(PublicWalletAddress) == 25, "ledger table slots hold 25 byte addresses");
+
+static uint64_t hashWallet(const PublicWalletAddress& wallet) {
+    uint64_t out[2];
+    MurmurHash3_x64_128(wallet.data(), wallet.size(), 0, out);
+    return out[0];
+}
+
+static uint64_t logChecksum(const char* data, size_t len) {
+    uint64_t out[2];
+    MurmurHash3_x64_128(data, len, 0, out);
+    return out[0];
+}
+
+LedgerTable::LedgerTable() {
+    this->resizing = false;
+    this->migrated = 0;
+    this->logFd = -1;
+    this->logBytes = 0;
+    this->preparedAt = 0;
+    this->lookups = 0;
+    this->probes = 0;
+    this->resizes = 0;
+    this->checkpoints = 0;
+}
+
+LedgerTable::~LedgerTable() {
+    try {
+        this->closeTable();
+    } catch(...) {}
+}
+
+bool LedgerTable::exists(string path) {
+    return fs::exists(path + "/table");
+}
+
+/*
+    Returns the slot holding `wallet` (live or deleted) or -1. On a miss
+    insertAt is the slot a new entry for it should take.
+*/
+int64_t LedgerTable::probe(const Table& table, const PublicWalletAddress& wallet, uint64_t& insertAt, bool reuseTombstones) const {
+    uint64_t mask = table.header->capacity - 1;
+    uint64_t idx = hashWallet(wallet) & mask;
+    insertAt = UINT64_MAX;
+    for(uint64_t i = 0; i <= mask; i++) {
+        const Slot& slot = table.slots[idx];
+        this->probes++;
+        if (slot.state == SLOT_EMPTY) {
+            if (insertAt == UINT64_MAX) insertAt = idx;
+            return -1;
+        }
+        if (memcmp(slot.wallet, wallet.data(), wallet.size()) == 0) return idx;
+        if (slot.state == SLOT_DELETED && reuseTombstones && insertAt == UINT64_MAX) insertAt = idx;
+        idx = (idx + 1) & mask;
+    }
+    return -1;
+}
+
+bool LedgerTable::get(const PublicWalletAddress& wallet, TransactionAmount& value) const {
+    this->lookups++;
+    uint64_t insertAt;
+    if (this->resizing) {
+        int64_t idx = this->probe(this->next, wallet, insertAt, false);
+        if (idx >= 0) {
+            value = this->next.slots[idx].value;
+            return this->next.slots[idx].state == SLOT_LIVE;
+        }
+    }
+    int64_t idx = this->probe(this->table, wallet, insertAt, false);
+    if (idx < 0 || this->table.slots[idx].state != SLOT_LIVE) {
+        value = 0;
+        return false;
+    }
+    value = this->table.slots[idx].value;
+    return true;
+}
+
+void LedgerTable::insertSlot(Table& table, uint64_t idx, const PublicWalletAddress& wallet, bool exists, TransactionAmount value) {
+    Slot& slot = table.slots[idx];
+    if (slot.state == SLOT_DELETED) table.header->tombstones--;
+    memcpy(slot.wallet, wallet.data(), wallet.size());
+    slot.value = exists ? value : 0;
+    slot.state = exists ? SLOT_LIVE : SLOT_DELETED;
+    if (exists) {
+        table.header->live++;
+    } else {
+        table.header->tombstones++;
+    }
+}
+
+/*
+    While resizing, changes only go to the new table. A wallet deleted
+    before its slot was moved needs a tombstone there to hide the copy
+    still in the old table.
+*/
+void LedgerTable::applyChange(const LedgerTableChange& change) {
+    if (!this->resizing) {
+        Header* header = this->table.header;
+        if ((header->live + header->tombstones + 1) * 100 > header->capacity * LEDGER_TABLE_MAX_LOAD) {
+            bool grow = header->live * 100 >= header->capacity * LEDGER_TABLE_GROW_LOAD;
+            this->startResize(grow ? header->capacity * 2 : header->capacity);
+        }
+    }
+    Table& target = this->resizing ? this->next : this->table;
+    uint64_t insertAt;
+    int64_t idx = this->probe(target, change.wallet, insertAt, !this->resizing);
+    if (idx >= 0) {
+        Slot& slot = target.slots[idx];
+        if (slot.state == SLOT_LIVE && !change.exists) {
+            target.header->live--;
+            target.header->tombstones++;
+        } else if (slot.state == SLOT_DELETED && change.exists) {
+            target.header->tombstones--;
+            target.header->live++;
+        }
+        slot.state = change.exists ? SLOT_LIVE : SLOT_DELETED;
+        slot.value = change.exists ? change.value : 0;
+    } else {
+        bool needed = change.exists;
+        if (!needed && this->resizing) {
+            uint64_t oldInsertAt;
+            int64_t oldIdx = this->probe(this->table, change.wallet, oldInsertAt, false);
+            needed = oldIdx >= 0 && this->table.slots[oldIdx].state == SLOT_LIVE;
+        }
+        if (needed) {
+            if (insertAt == UINT64_MAX) throw std::runtime_error("Ledger table is full");
+            this->insertSlot(target, insertAt, change.wallet, change.exists, change.value);
+        }
+    }
+    if (this->resizing) this->stepResize(LEDGER_TABLE_RESIZE_STEP);
+}
+
+/*
+    The log is written before the table so that replaying it on open
+    redoes any group whose table writes had not reached disk.
+*/
+void LedgerTable::apply(const vector<LedgerTableChange>& changes, bool sync) {
+    if (changes.empty()) return;
+    this->commitPrepared();
+    this->appendLog(changes, 0, sync);
+    for(auto& change : changes) {
+        this->applyChange(change);
+    }
+    if (!this->resizing && this->logBytes >= LEDGER_TABLE_CHECKPOINT_BYTES) this->checkpoint();
+}
+
+/*
+    Logs a group without applying it. commitPrepared applies it once the
+    leveldb batch holding `sequence` is written, abortPrepared drops it if
+    that write failed.
+*/
+void LedgerTable::prepare(const vector<LedgerTableChange>& changes, uint64_t sequence, bool sync) {
+    this->commitPrepared();
+    this->preparedAt = this->logBytes;
+    this->appendLog(changes, sequence, sync);
+    this->prepared = changes;
+}
+
+void LedgerTable::commitPrepared() {
+    if (this->prepared.empty()) return;
+    for(auto& change : this->prepared) {
+        this->applyChange(change);
+    }
+    this->prepared.clear();
+    if (!this->resizing && this->logBytes >= LEDGER_TABLE_CHECKPOINT_BYTES) this->checkpoint();
+}
+
+void LedgerTable::forEach(std::function<void(const PublicWalletAddress&, TransactionAmount)> visitor) const {
+    PublicWalletAddress wallet;
+    if (this->resizing) {
+        for(uint64_t i = 0; i < this->next.header->capacity; i++) {
+            const Slot& slot = this->next.slots[i];
+            if (slot.state != SLOT_LIVE) continue;
+            memcpy(wallet.data(), slot.wallet, wallet.size());
+            visitor(wallet, slot.value);
+        }
+    }
+    for(uint64_t i = 0; i < this->table.header->capacity; i++) {
+        const Slot& slot = this->table.slots[i];
+        if (slot.state != SLOT_LIVE) continue;
+        memcpy(wallet.data(), slot.wallet, wallet.size());
+        uint64_t insertAt;
+        if (this->resizing && this->probe(this->next, wallet, insertAt, false) >= 0) continue;
+        visitor(wallet, slot.value);
+    }
+}
+
+void LedgerTable::startResize(uint64_t capacity) {
+    string file = this->path + "/table.next";
+    fs::remove(file);
+    this->openTable(this->next, file, capacity);
+    this->resizing = true;
+    this->migrated = 0;
+}
+
+/*
+    Moves old slots into the new table. After a crash the old table may
+    hold a stale second copy of a wallet further along its probe chain, so
+    the value moved is always the one a lookup in the old table finds.
+*/
+void LedgerTable::stepResize(uint64_t slots) {
+    uint64_t end = min(this->migrated + slots, this->table.header->capacity);
+    PublicWalletAddress wallet;
+    for(uint64_t i = this->migrated; i < end; i++) {
+        const Slot& slot = this->table.slots[i];
+        if (slot.state != SLOT_LIVE) continue;
+        memcpy(wallet.data(), slot.wallet, wallet.size());
+        uint64_t insertAt;
+        if (this->probe(this->next, wallet, insertAt, false) >= 0) continue;
+        uint64_t oldInsertAt;
+        int64_t first = this->probe(this->table, wallet, oldInsertAt, false);
+        if (first < 0 || this->table.slots[first].state != SLOT_LIVE) continue;
+        if (insertAt == UINT64_MAX) throw std::runtime_error("Ledger table is full");
+        this->insertSlot(this->next, insertAt, wallet, true, this->table.slots[first].value);
+    }
+    this->migrated = end;
+    if (this->migrated == this->table.header->capacity) this->finishResize();
+}
+
+/*
+    The new table is synced before it replaces the old one, the log is left
+    alone since replaying it over either table gives the same result.
+*/
+void LedgerTable::finishResize() {
+    this->syncTable(this->next);
+    this->closeTableFile(this->table);
+    fs::rename(this->path + "/table.next", this->path + "/table");
+    this->table = this->next;
+    this->next = Table();
+    this->resizing = false;
+    this->migrated = 0;
+    this->resizes++;
+}
+
+void LedgerTable::recount(Table& table) {
+    table.header->live = 0;
+    table.header->tombstones = 0;
+    for(uint64_t i = 0; i < table.header->capacity; i++) {
+        if (table.slots[i].state == SLOT_LIVE) table.header->live++;
+        if (table.slots[i].state == SLOT_DELETED) table.header->tombstones++;
+    }
+}
+
+void LedgerTable::clear() {
+    string path = this->path;
+    this->deleteTable();
+    this->init(path);
+}
+
+map<string, uint64_t> LedgerTable::getStats() const {
+    map<string, uint64_t> ret;
+    if (!this->table.header) return ret;
+    ret["capacity"] = this->table.header->capacity;
+    ret["wallets"] = this->table.header->live;
+    ret["tombstones"] = this->table.header->tombstones;
+    ret["mappedBytes"] = this->table.mappedSize + this->next.mappedSize;
+    ret["resizing"] = this->resizing;
+    ret["resizeCapacity"] = this->resizing ? this->next.header->capacity : 0;
+    ret["resizeMigratedSlots"] = this->migrated;
+    ret["resizes"] = this->resizes;
+    ret["logBytes"] = this->logBytes;
+    ret["checkpoints"] = this->checkpoints;
+    ret["lookups"] = this->lookups;
+    ret["probes"] = this->probes;
+    return ret;
+}
+
+#ifdef _WIN32
+
+void LedgerTable::init(string path, uint64_t committed) {
+    throw std::runtime_error("Ledger table is not supported on Windows");
+}
+
+void LedgerTable::closeTable() {}
+void LedgerTable::openTable(Table& table, string file, uint64_t capacity) {}
+void LedgerTable::closeTableFile(Table& table) {}
+void LedgerTable::syncTable(Table& table) {}
+void LedgerTable::appendLog(const vector<LedgerTableChange>& changes, uint64_t sequence, bool sync) {}
+void LedgerTable::replayLog(uint64_t committed) {}
+void LedgerTable::checkpoint() {}
+void LedgerTable::sync() {}
+void LedgerTable::abortPrepared() {}
+
+void LedgerTable::deleteTable() {
+    fs::remove_all(this->path);
+}
+
+#else
+
+void LedgerTable::openTable(Table& table, string file, uint64_t capacity) {
+    table.fd = open(file.c_str(), O_RDWR | O_CREAT, 0644);
+    if (table.fd < 0) throw std::runtime_error("Could not open ledger table " + file + " : " + string(strerror(errno)));
+    struct stat st;
+    fstat(table.fd, &st);
+    bool created = st.st_size == 0;
+    if (!created) {
+        Header header;
+        if (pread(table.fd, &header, sizeof(Header), 0) != sizeof(Header) || header.magic != LEDGER_TABLE_MAGIC || header.version != LEDGER_TABLE_VERSION) {
+            close(table.fd);
+            table.fd = -1;
+            throw std::runtime_error("Ledger table " + file + " is corrupt or from another version");
+        }
+        capacity = header.capacity;
+    }
+    table.mappedSize = LEDGER_TABLE_HEADER_SIZE + capacity * sizeof(Slot);
+    if (created && ftruncate(table.fd, table.mappedSize) != 0) {
+        close(table.fd);
+        table.fd = -1;
+        throw std::runtime_error("Could not size ledger table " + file + " : " + string(strerror(errno)));
+    }
+    if (!created && (size_t)st.st_size < table.mappedSize) {
+        close(table.fd);
+        table.fd = -1;
+        throw std::runtime_error("Ledger table " + file + " is truncated");
+    }
+    void* data = mmap(NULL, table.mappedSize, PROT_READ | PROT_WRITE, MAP_SHARED, table.fd, 0);
+    if (data == MAP_FAILED) {
+        close(table.fd);
+        table.fd = -1;
+        throw std::runtime_error("Could not map ledger table " + file + " : " + string(strerror(errno)));
+    }
+    table.data = (char*)data;
+    table.header = (Header*)data;
+    table.slots = (Slot*)(table.data + LEDGER_TABLE_HEADER_SIZE);
+    if (created) {
+        table.header->magic = LEDGER_TABLE_MAGIC;
+        table.header->version = LEDGER_TABLE_VERSION;
+        table.header->clean = 1;
+        table.header->capacity = capacity;
+        table.header->live = 0;
+        table.header->tombstones = 0;
+    }
+}
+
+void LedgerTable::closeTableFile(Table& table) {
+    if (table.data) munmap(table.data, table.mappedSize);
+    if (table.fd >= 0) close(table.fd);
+    table = Table();
+}
+
+void LedgerTable::syncTable(Table& table) {
+    if (msync(table.data, table.mappedSize, MS_SYNC) != 0) {
+        throw std::runtime_error("Could not sync ledger table : " + string(strerror(errno)));
+    }
+}
+
+/*
+    A table that was not closed cleanly may have reached disk with only
+    some of its pages written since the last checkpoint. Replaying the log
+    redoes every change since then, and a rebuild into a fresh table drops
+    any stale copies the partial writes left on probe chains.
+*/
+void LedgerTable::init(string path, uint64_t committed) {
+    this->closeTable();
+    this->prepared.clear();
+    this->path = path;
+    fs::create_directories(path);
+    fs::remove(path + "/table.next");
+    this->openTable(this->table, path + "/table", LEDGER_TABLE_INITIAL_CAPACITY);
+    bool clean = this->table.header->clean == 1;
+    this->table.header->clean = 0;
+    if (msync(this->table.data, LEDGER_TABLE_HEADER_SIZE, MS_SYNC) != 0) {
+        throw std::runtime_error("Could not sync ledger table header : " + string(strerror(errno)));
+    }
+    if (!clean) this->recount(this->table);
+
+    this->logFd = open((path + "/redo.log").c_str(), O_RDWR | O_CREAT | O_APPEND, 0644);
+    if (this->logFd < 0) throw std::runtime_error("Could not open ledger table log : " + string(strerror(errno)));
+    this->replayLog(committed);
+    if (!clean) {
+        if (!this->resizing) this->startResize(this->table.header->capacity);
+        this->stepResize(this->table.header->capacity);
+    }
+    if (this->logBytes > 0 || !clean) this->checkpoint();
+}
+
+void LedgerTable::closeTable() {
+    if (!this->table.data) return;
+    this->checkpoint();
+    this->table.header->clean = 1;
+    this->syncTable(this->table);
+    this->closeTableFile(this->table);
+    if (this->logFd >= 0) close(this->logFd);
+    this->logFd = -1;
+    this->logBytes = 0;
+}
+
+void LedgerTable::deleteTable() {
+    if (this->path == "") return;
+    this->closeTableFile(this->next);
+    this->closeTableFile(this->table);
+    if (this->logFd >= 0) close(this->logFd);
+    this->logFd = -1;
+    this->logBytes = 0;
+    this->resizing = false;
+    this->migrated = 0;
+    fs::remove_all(this->path);
+}
+
+/*
+    Syncs the table and empties the log. A resize in progress is finished
+    first so the log never has to be replayed over a half built table. A
+    prepared group keeps the log, opening decides whether it is replayed.
+*/
+void LedgerTable::checkpoint() {
+    if (this->resizing) this->stepResize(this->table.header->capacity);
+    this->syncTable(this->table);
+    if (!this->prepared.empty()) return;
+    if (ftruncate(this->logFd, 0) != 0 || fdatasync(this->logFd) != 0) {
+        throw std::runtime_error("Could not truncate ledger table log : " + string(strerror(errno)));
+    }
+    this->logBytes = 0;
+    this->checkpoints++;
+}
+
+void LedgerTable::abortPrepared() {
+    if (this->prepared.empty()) return;
+    this->prepared.clear();
+    if (ftruncate(this->logFd, this->preparedAt) != 0) {
+        throw std::runtime_error("Could not truncate ledger table log : " + string(strerror(errno)));
+    }
+    this->logBytes = this->preparedAt;
+}
+
+void LedgerTable::sync() {
+    if (this->logFd >= 0 && fdatasync(this->logFd) != 0) {
+        throw std::runtime_error("Could not sync ledger table log : " + string(strerror(errno)));
+    }
+}
+
+/*
+    Each group is (u32 count, u64 sequence, count records of wallet,
+    exists byte and amount, u64 checksum of everything before it). A torn
+    write is cut off again so later groups don't end up behind an
+    unreadable one. Groups outside a ledger batch have sequence 0.
+*/
+void LedgerTable::appendLog(const vector<LedgerTableChange>& changes, uint64_t sequence, bool sync) {
+    uint32_t count = changes.size();
+    vector<char> buffer(LOG_GROUP_HEADER_SIZE + count * LOG_RECORD_SIZE + sizeof(uint64_t));
+    char* ptr = buffer.data();
+    memcpy(ptr, &count, sizeof(uint32_t));
+    memcpy(ptr + sizeof(uint32_t), &sequence, sizeof(uint64_t));
+    ptr += LOG_GROUP_HEADER_SIZE;
+    for(auto& change : changes) {
+        memcpy(ptr, change.wallet.data(), change.wallet.size());
+        ptr[25] = change.exists ? 1 : 0;
+        memcpy(ptr + 26, &change.value, sizeof(uint64_t));
+        ptr += LOG_RECORD_SIZE;
+    }
+    uint64_t checksum = logChecksum(buffer.data(), ptr - buffer.data());
+    memcpy(ptr, &checksum, sizeof(uint64_t));
+
+    const char* data = buffer.data();
+    size_t remaining = buffer.size();
+    while (remaining > 0) {
+        ssize_t written = write(this->logFd, data, remaining);
+        if (written < 0) {
+            string error = strerror(errno);
+            if (ftruncate(this->logFd, this->logBytes) != 0) {}
+            throw std::runtime_error("Could not write ledger table log : " + error);
+        }
+        data += written;
+        remaining -= written;
+    }
+    if (sync && fdatasync(this->logFd) != 0) {
+        throw std::runtime_error("Could not sync ledger table log : " + string(strerror(errno)));
+    }
+    this->logBytes += buffer.size();
+}
+
+void LedgerTable::replayLog(uint64_t committed) {
+    struct stat st;
+    fstat(this->logFd, &st);
+    vector<char> log(st.st_size);
+    if (st.st_size > 0 && pread(this->logFd, log.data(), log.size(), 0) != (ssize_t)log.size()) {
+        throw std::runtime_error("Could not read ledger table log");
+    }
+    size_t offset = 0;
+    vector<LedgerTableChange> changes;
+    while (offset + LOG_GROUP_HEADER_SIZE <= log.size()) {
+        uint32_t count;
+        uint64_t sequence;
+        memcpy(&count, log.data() + offset, sizeof(uint32_t));
+        memcpy(&sequence, log.data() + offset + sizeof(uint32_t), sizeof(uint64_t));
+        size_t groupSize = LOG_GROUP_HEADER_SIZE + (size_t)count * LOG_RECORD_SIZE;
+        if (offset + groupSize + sizeof(uint64_t) > log.size()) break;
+        uint64_t checksum;
+        memcpy(&checksum, log.data() + offset + groupSize, sizeof(uint64_t));
+        if (checksum != logChecksum(log.data() + offset, groupSize)) break;
+        // prepared for a leveldb batch that never committed
+        if (sequence > committed) break;
+        changes.resize(count);
+        const char* ptr = log.data() + offset + LOG_GROUP_HEADER_SIZE;
+        for(uint32_t i = 0; i < count; i++) {
+            memcpy(changes[i].wallet.data(), ptr, changes[i].wallet.size());
+            changes[i].exists = ptr[25] != 0;
+            memcpy(&changes[i].value, ptr + 26, sizeof(uint64_t));
+            ptr += LOG_RECORD_SIZE;
+        }
+        for(auto& change : changes) {
+            this->applyChange(change);
+        }
+        offset += groupSize + sizeof(uint64_t);
+    }
+    this->logBytes = log.size();
+}
+
+#endif
@@ -0,0 +1,105 @@
+#pragma once
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+#include "../core/common.hpp"
+using namespace std;
+
+struct LedgerTableChange {
+    PublicWalletAddress wallet;
+    bool exists;
+    TransactionAmount value;
+};
+
+/*
+    Fixed width wallet -> balance store for the ledger. Balances live in a
+    memory mapped open addressing table with one 64 byte slot per wallet,
+    probed linearly from the wallet's MurmurHash3. Deleted wallets leave a
+    tombstone that keeps their address.
+
+    Every group of changes is appended to a redo log before it touches the
+    table, and the table is only synced at checkpoints, after which the log
+    is truncated. Opening replays the log over the table, so a crash at any
+    point loses at most the groups whose log records were not complete.
+
+    The ledger logs its groups with prepare() before committing the
+    leveldb batch they belong to, stamped with a sequence number that the
+    batch also stores. Opening only replays groups up to the sequence
+    leveldb committed, so the table and the batch land or vanish together.
+
+    Growing the table allocates a second table and moves a few hundred
+    slots per applied change, so no single write pays for the whole resize.
+    Until the move is done lookups try the new table first and fall back to
+    the old one, which is left untouched so it stays valid for recovery.
+
+    Not thread safe, the ledger calls it under its cache lock.
+*/
+class LedgerTable {
+    public:
+        LedgerTable();
+        ~LedgerTable();
+        void init(string path, uint64_t committed = UINT64_MAX);
+        void closeTable();
+        void deleteTable();
+        void clear();
+        bool get(const PublicWalletAddress& wallet, TransactionAmount& value) const;
+        void apply(const vector<LedgerTableChange>& changes, bool sync = false);
+        void prepare(const vector<LedgerTableChange>& changes, uint64_t sequence, bool sync = false);
+        void commitPrepared();
+        void abortPrepared();
+        void forEach(std::function<void(const PublicWalletAddress&, TransactionAmount)> visitor) const;
+        void checkpoint();
+        void sync();
+        map<string, uint64_t> getStats() const;
+        static bool exists(string path);
+    protected:
+        struct Slot {
+            uint8_t state;
+            uint8_t wallet[25];
+            uint8_t pad[6];
+            uint64_t value;
+            uint8_t reserved[24];
+        };
+        struct Header {
+            uint64_t magic;
+            uint32_t version;
+            uint32_t clean;
+            uint64_t capacity;
+            uint64_t live;
+            uint64_t tombstones;
+        };
+        struct Table {
+            int fd = -1;
+            char* data = NULL;
+            size_t mappedSize = 0;
+            Header* header = NULL;
+            Slot* slots = NULL;
+        };
+        void openTable(Table& table, string file, uint64_t capacity);
+        void closeTableFile(Table& table);
+        void syncTable(Table& table);
+        int64_t probe(const Table& table, const PublicWalletAddress& wallet, uint64_t& insertAt, bool reuseTombstones) const;
+        void applyChange(const LedgerTableChange& change);
+        void insertSlot(Table& table, uint64_t idx, const PublicWalletAddress& wallet, bool exists, TransactionAmount value);
+        void appendLog(const vector<LedgerTableChange>& changes, uint64_t sequence, bool sync);
+        void replayLog(uint64_t committed);
+        void startResize(uint64_t capacity);
+        void stepResize(uint64_t slots);
+        void finishResize();
+        void recount(Table& table);
+        string path;
+        Table table;
+        Table next;
+        bool resizing;
+        uint64_t migrated;
+        int logFd;
+        uint64_t logBytes;
+        // logged by prepare() but not yet applied to the table
+        vector<LedgerTableChange> prepared;
+        uint64_t preparedAt;
+        mutable uint64_t lookups;
+        mutable uint64_t probes;
+        uint64_t resizes;
+        uint64_t checkpoints;
+};
@@ -0,0 +1,42 @@
+#include "ledger_view.hpp"
+using namespace std;
+
+LedgerView::LedgerView(const Ledger& ledger) : ledger(ledger) {
+}
+
+LedgerView::Balance& LedgerView::load(const PublicWalletAddress& wallet) const{
+    auto it = this->overlay.find(wallet);
+    if (it != this->overlay.end()) return it->second;
+    Balance balance;
+    this->ledger.getCommittedWallet(wallet, balance.exists, balance.value);
+    return this->overlay.insert(pair<PublicWalletAddress, Balance>(wallet, balance)).first->second;
+}
+
+bool LedgerView::hasWallet(const PublicWalletAddress& wallet) const{
+    return this->load(wallet).exists;
+}
+
+TransactionAmount LedgerView::getWalletValue(const PublicWalletAddress& wallet) const{
+    Balance& balance = this->load(wallet);
+    if (!balance.exists) throw std::runtime_error("Tried fetching wallet value for non-existant wallet");
+    return balance.value;
+}
+
+void LedgerView::createWallet(const PublicWalletAddress& wallet) {
+    Balance& balance = this->load(wallet);
+    if (balance.exists) throw std::runtime_error("Wallet exists");
+    balance.exists = true;
+    balance.value = 0;
+}
+
+void LedgerView::withdraw(const PublicWalletAddress& wallet, TransactionAmount amt) {
+    Balance& balance = this->load(wallet);
+    if (!balance.exists) throw std::runtime_error("Tried fetching wallet value for non-existant wallet");
+    balance.value -= amt;
+}
+
+void LedgerView::deposit(const PublicWalletAddress& wallet, TransactionAmount amt) {
+    Balance& balance = this->load(wallet);
+    if (!balance.exists) throw std::runtime_error("Tried fetching wallet value for non-existant wallet");
+    balance.value += amt;
+}
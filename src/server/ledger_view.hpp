@@ -0,0 +1,29 @@
+#pragma once
+#include <map>
+#include "../core/common.hpp"
+#include "ledger.hpp"
+using namespace std;
+
+/*
+    Copy-on-write overlay over the committed state of a Ledger. The first
+    read of a wallet pins its committed balance, every write after that only
+    touches the overlay, so executing transactions against a view never
+    writes to disk and never sees balances staged by an in-flight block.
+*/
+class LedgerView {
+    public:
+        LedgerView(const Ledger& ledger);
+        bool hasWallet(const PublicWalletAddress& wallet) const;
+        TransactionAmount getWalletValue(const PublicWalletAddress& wallet) const;
+        void createWallet(const PublicWalletAddress& wallet);
+        void withdraw(const PublicWalletAddress& wallet, TransactionAmount amt);
+        void deposit(const PublicWalletAddress& wallet, TransactionAmount amt);
+    protected:
+        struct Balance {
+            bool exists;
+            TransactionAmount value;
+        };
+        Balance& load(const PublicWalletAddress& wallet) const;
+        const Ledger& ledger;
+        mutable map<PublicWalletAddress, Balance> overlay;
+};
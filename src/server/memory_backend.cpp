@@ -0,0 +1,282 @@
+#include <algorithm>
+#include <functional>
+#include <string_view>
+#include "memory_backend.hpp"
+
+#define ENTRY_OVERHEAD 64
+
+/*
+    Iterators read at a fixed sequence number, pinned with their own
+    snapshot unless the caller passed one. Every step looks the next key
+    up again, so writes to the shards between steps are safe.
+*/
+class MemoryBackend::MemoryIterator : public leveldb::Iterator {
+    public:
+        MemoryIterator(MemoryBackend* db, const leveldb::Snapshot* snapshot, bool ownsSnapshot) {
+            this->db = db;
+            this->snapshot = snapshot;
+            this->ownsSnapshot = ownsSnapshot;
+            this->seq = static_cast<const MemorySnapshot*>(snapshot)->seq;
+            this->valid = false;
+        }
+        ~MemoryIterator() {
+            if (this->ownsSnapshot) this->db->ReleaseSnapshot(this->snapshot);
+        }
+        bool Valid() const override {
+            return this->valid;
+        }
+        void SeekToFirst() override {
+            this->valid = this->db->findKey("", true, true, false, this->seq, this->currKey, this->currValue);
+        }
+        void SeekToLast() override {
+            this->valid = this->db->findKey("", true, false, true, this->seq, this->currKey, this->currValue);
+        }
+        void Seek(const leveldb::Slice& target) override {
+            this->valid = this->db->findKey(target.ToString(), true, true, false, this->seq, this->currKey, this->currValue);
+        }
+        void Next() override {
+            string from = this->currKey;
+            this->valid = this->db->findKey(from, false, true, false, this->seq, this->currKey, this->currValue);
+        }
+        void Prev() override {
+            string from = this->currKey;
+            this->valid = this->db->findKey(from, false, false, false, this->seq, this->currKey, this->currValue);
+        }
+        leveldb::Slice key() const override {
+            return leveldb::Slice(this->currKey);
+        }
+        leveldb::Slice value() const override {
+            return leveldb::Slice(this->currValue);
+        }
+        leveldb::Status status() const override {
+            return leveldb::Status::OK();
+        }
+    protected:
+        MemoryBackend* db;
+        const leveldb::Snapshot* snapshot;
+        bool ownsSnapshot;
+        uint64_t seq;
+        bool valid;
+        string currKey;
+        string currValue;
+};
+
+class MemoryBackend::Applier : public leveldb::WriteBatch::Handler {
+    public:
+        Applier(MemoryBackend* db, uint64_t seq, bool versioned, uint64_t oldest) : db(db), seq(seq), versioned(versioned), oldest(oldest) {}
+        void Put(const leveldb::Slice& key, const leveldb::Slice& value) override {
+            this->db->apply(key, false, value, this->seq, this->versioned, this->oldest);
+        }
+        void Delete(const leveldb::Slice& key) override {
+            this->db->apply(key, true, leveldb::Slice(), this->seq, this->versioned, this->oldest);
+        }
+    protected:
+        MemoryBackend* db;
+        uint64_t seq;
+        bool versioned;
+        uint64_t oldest;
+};
+
+MemoryBackend::MemoryBackend() {
+    this->lastSeq = 0;
+    this->bytes = 0;
+}
+
+MemoryBackend::~MemoryBackend() {}
+
+MemoryBackend::Shard& MemoryBackend::shardFor(const leveldb::Slice& key) const {
+    size_t hash = std::hash<std::string_view>()(std::string_view(key.data(), key.size()));
+    return this->shards[hash % MEMORY_BACKEND_SHARDS];
+}
+
+// newest version of the entry written at or before seq
+bool MemoryBackend::visible(const Entry& entry, uint64_t seq, string* value) {
+    if (entry.seq <= seq) {
+        if (!entry.deleted && value) *value = entry.value;
+        return !entry.deleted;
+    }
+    for(auto it = entry.older.rbegin(); it != entry.older.rend(); it++) {
+        if (it->seq > seq) continue;
+        if (!it->deleted && value) *value = it->value;
+        return !it->deleted;
+    }
+    return false;
+}
+
+/*
+    Keeps only the versions some open snapshot can still read: everything
+    newer than the oldest snapshot plus the newest one at or before it.
+*/
+void MemoryBackend::apply(const leveldb::Slice& key, bool deleted, const leveldb::Slice& value, uint64_t seq, bool versioned, uint64_t oldest) {
+    Shard& shard = this->shardFor(key);
+    std::unique_lock<std::shared_mutex> ul(shard.lock);
+    string k = key.ToString();
+    auto it = shard.entries.find(k);
+    if (!versioned) {
+        if (it != shard.entries.end()) {
+            this->bytes -= it->first.size() + it->second.value.size() + ENTRY_OVERHEAD;
+            if (deleted) {
+                shard.entries.erase(it);
+                return;
+            }
+            it->second.seq = seq;
+            it->second.deleted = false;
+            it->second.value = value.ToString();
+        } else if (!deleted) {
+            shard.entries.emplace(k, Entry{seq, false, value.ToString(), {}});
+        } else {
+            return;
+        }
+        this->bytes += key.size() + value.size() + ENTRY_OVERHEAD;
+        return;
+    }
+    if (it == shard.entries.end()) {
+        if (deleted) return;
+        // older snapshots see no version at all, which reads as missing
+        shard.entries.emplace(k, Entry{seq, false, value.ToString(), {}});
+        this->bytes += key.size() + value.size() + ENTRY_OVERHEAD;
+        return;
+    }
+    Entry& entry = it->second;
+    entry.older.push_back(Version{entry.seq, entry.deleted, std::move(entry.value)});
+    entry.seq = seq;
+    entry.deleted = deleted;
+    entry.value = deleted ? "" : value.ToString();
+    this->bytes += entry.value.size() + ENTRY_OVERHEAD;
+    size_t keep = 0;
+    for(size_t i = 0; i < entry.older.size(); i++) {
+        if (entry.older[i].seq <= oldest) keep = i;
+    }
+    for(size_t i = 0; i < keep; i++) {
+        this->bytes -= entry.older[i].value.size() + ENTRY_OVERHEAD;
+    }
+    entry.older.erase(entry.older.begin(), entry.older.begin() + keep);
+    shard.versioned.push_back(k);
+}
+
+leveldb::Status MemoryBackend::Put(const leveldb::WriteOptions& options, const leveldb::Slice& key, const leveldb::Slice& value) {
+    leveldb::WriteBatch batch;
+    batch.Put(key, value);
+    return this->Write(options, &batch);
+}
+
+leveldb::Status MemoryBackend::Delete(const leveldb::WriteOptions& options, const leveldb::Slice& key) {
+    leveldb::WriteBatch batch;
+    batch.Delete(key);
+    return this->Write(options, &batch);
+}
+
+/*
+    Readers without a snapshot may see a batch half applied, the same as
+    separate Gets against leveldb racing a write. Snapshots and iterators
+    read at a sequence number and see it whole or not at all.
+*/
+leveldb::Status MemoryBackend::Write(const leveldb::WriteOptions& options, leveldb::WriteBatch* updates) {
+    std::unique_lock<std::mutex> ul(this->writeLock);
+    uint64_t seq = this->lastSeq + 1;
+    bool versioned = !this->pinned.empty();
+    Applier applier(this, seq, versioned, versioned ? *this->pinned.begin() : 0);
+    leveldb::Status status = updates->Iterate(&applier);
+    this->lastSeq = seq;
+    return status;
+}
+
+leveldb::Status MemoryBackend::Get(const leveldb::ReadOptions& options, const leveldb::Slice& key, std::string* value) {
+    uint64_t seq = options.snapshot ? static_cast<const MemorySnapshot*>(options.snapshot)->seq : UINT64_MAX;
+    Shard& shard = this->shardFor(key);
+    std::shared_lock<std::shared_mutex> sl(shard.lock);
+    auto it = shard.entries.find(key.ToString());
+    if (it == shard.entries.end() || !visible(it->second, seq, value)) return leveldb::Status::NotFound(leveldb::Slice());
+    return leveldb::Status::OK();
+}
+
+/*
+    Finds the first key after (or before) `from` that is visible at seq,
+    across all shards.
+*/
+bool MemoryBackend::findKey(const string& from, bool inclusive, bool forward, bool fromEnd, uint64_t seq, string& key, string& value) const {
+    bool found = false;
+    string value2;
+    for(auto& shard : this->shards) {
+        std::shared_lock<std::shared_mutex> sl(shard.lock);
+        if (forward) {
+            auto it = inclusive ? shard.entries.lower_bound(from) : shard.entries.upper_bound(from);
+            for(; it != shard.entries.end(); it++) {
+                if (found && it->first >= key) break;
+                if (!visible(it->second, seq, &value2)) continue;
+                key = it->first;
+                value = value2;
+                found = true;
+                break;
+            }
+        } else {
+            auto it = fromEnd ? shard.entries.end() : (inclusive ? shard.entries.upper_bound(from) : shard.entries.lower_bound(from));
+            while (it != shard.entries.begin()) {
+                it--;
+                if (found && it->first <= key) break;
+                if (!visible(it->second, seq, &value2)) continue;
+                key = it->first;
+                value = value2;
+                found = true;
+                break;
+            }
+        }
+    }
+    return found;
+}
+
+leveldb::Iterator* MemoryBackend::NewIterator(const leveldb::ReadOptions& options) {
+    if (options.snapshot) return new MemoryIterator(this, options.snapshot, false);
+    return new MemoryIterator(this, this->GetSnapshot(), true);
+}
+
+const leveldb::Snapshot* MemoryBackend::GetSnapshot() {
+    std::unique_lock<std::mutex> ul(this->writeLock);
+    this->pinned.insert(this->lastSeq);
+    return new MemorySnapshot(this->lastSeq);
+}
+
+void MemoryBackend::ReleaseSnapshot(const leveldb::Snapshot* snapshot) {
+    const MemorySnapshot* memorySnapshot = static_cast<const MemorySnapshot*>(snapshot);
+    std::unique_lock<std::mutex> ul(this->writeLock);
+    auto it = this->pinned.find(memorySnapshot->seq);
+    if (it != this->pinned.end()) this->pinned.erase(it);
+    delete memorySnapshot;
+    if (!this->pinned.empty()) return;
+    // nothing can read old versions anymore
+    for(auto& shard : this->shards) {
+        std::unique_lock<std::shared_mutex> sl(shard.lock);
+        for(auto& k : shard.versioned) {
+            auto entry = shard.entries.find(k);
+            if (entry == shard.entries.end()) continue;
+            for(auto& version : entry->second.older) {
+                this->bytes -= version.value.size() + ENTRY_OVERHEAD;
+            }
+            entry->second.older.clear();
+            if (entry->second.deleted) {
+                this->bytes -= entry->first.size() + ENTRY_OVERHEAD;
+                shard.entries.erase(entry);
+            }
+        }
+        shard.versioned.clear();
+    }
+}
+
+bool MemoryBackend::GetProperty(const leveldb::Slice& property, std::string* value) {
+    if (property == leveldb::Slice("leveldb.approximate-memory-usage")) {
+        *value = to_string(max((int64_t)0, (int64_t)this->bytes));
+        return true;
+    }
+    if (property == leveldb::Slice("leveldb.num-files-at-level0")) {
+        *value = "0";
+        return true;
+    }
+    return false;
+}
+
+// there is nothing to compact, so no range is ever worth compacting
+void MemoryBackend::GetApproximateSizes(const leveldb::Range* range, int n, uint64_t* sizes) {
+    for(int i = 0; i < n; i++) sizes[i] = 0;
+}
+
+void MemoryBackend::CompactRange(const leveldb::Slice* begin, const leveldb::Slice* end) {}
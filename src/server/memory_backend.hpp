@@ -0,0 +1,76 @@
+#pragma once
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <set>
+#include <shared_mutex>
+#include <string>
+#include <vector>
+#include "leveldb/db.h"
+#include "leveldb/write_batch.h"
+using namespace std;
+
+#define MEMORY_BACKEND_SHARDS 16
+
+/*
+    In process implementation of the leveldb::DB interface that DataStore
+    is written against, for ephemeral nodes, benchmarks and running many
+    nodes in one process. Keys are spread over shards by hash, each an
+    ordered map behind its own reader/writer lock, and iterators merge the
+    shards in key order.
+
+    Batches get one sequence number. While no snapshot or iterator is open
+    writes replace values in place; otherwise the previous versions a
+    snapshot can still see are kept on the entry and dropped again once
+    the last snapshot is released.
+*/
+class MemoryBackend : public leveldb::DB {
+    public:
+        MemoryBackend();
+        ~MemoryBackend();
+        leveldb::Status Put(const leveldb::WriteOptions& options, const leveldb::Slice& key, const leveldb::Slice& value) override;
+        leveldb::Status Delete(const leveldb::WriteOptions& options, const leveldb::Slice& key) override;
+        leveldb::Status Write(const leveldb::WriteOptions& options, leveldb::WriteBatch* updates) override;
+        leveldb::Status Get(const leveldb::ReadOptions& options, const leveldb::Slice& key, std::string* value) override;
+        leveldb::Iterator* NewIterator(const leveldb::ReadOptions& options) override;
+        const leveldb::Snapshot* GetSnapshot() override;
+        void ReleaseSnapshot(const leveldb::Snapshot* snapshot) override;
+        bool GetProperty(const leveldb::Slice& property, std::string* value) override;
+        void GetApproximateSizes(const leveldb::Range* range, int n, uint64_t* sizes) override;
+        void CompactRange(const leveldb::Slice* begin, const leveldb::Slice* end) override;
+    protected:
+        struct Version {
+            uint64_t seq;
+            bool deleted;
+            string value;
+        };
+        struct Entry {
+            uint64_t seq;
+            bool deleted;
+            string value;
+            vector<Version> older; // oldest first, only while snapshots are open
+        };
+        struct Shard {
+            mutable std::shared_mutex lock;
+            map<string, Entry> entries;
+            vector<string> versioned;
+        };
+        class MemorySnapshot : public leveldb::Snapshot {
+            public:
+                MemorySnapshot(uint64_t seq) : seq(seq) {}
+                ~MemorySnapshot() {}
+                uint64_t seq;
+        };
+        class MemoryIterator;
+        class Applier;
+        Shard& shardFor(const leveldb::Slice& key) const;
+        void apply(const leveldb::Slice& key, bool deleted, const leveldb::Slice& value, uint64_t seq, bool versioned, uint64_t oldest);
+        static bool visible(const Entry& entry, uint64_t seq, string* value);
+        bool findKey(const string& from, bool inclusive, bool forward, bool fromEnd, uint64_t seq, string& key, string& value) const;
+        mutable Shard shards[MEMORY_BACKEND_SHARDS];
+        // serializes writers against snapshots being taken and released
+        std::mutex writeLock;
+        std::atomic<uint64_t> lastSeq;
+        multiset<uint64_t> pinned;
+        std::atomic<int64_t> bytes;
+};
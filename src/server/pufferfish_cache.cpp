@@ -2,30 +2,307 @@
 
 #include <iostream>
 #include <thread>
+#include <mutex>
+#include <cstring>
 #include "../core/crypto.hpp"
 #include "ledger.hpp"
 using namespace std;
 
+#define PUFFERFISH_SCHEMA_VERSION 2
+#define SCHEMA_VERSION_KEY "SCHEMA_VERSION"
+#define ENTRY_KEY_NAMESPACE 0x01
+#define ENTRY_KEY_SIZE 33
+#define ORDER_KEY_NAMESPACE 0x02
+#define ORDER_KEY_SIZE 9
+#define DEFAULT_MEMORY_ENTRIES 100000
+#define DEFAULT_DISK_ENTRIES 2000000
+// evict in chunks so each insert past the limit isn't its own delete batch
+#define DISK_EVICTION_BATCH 1000
 
-leveldb::Slice sha256ToSlice(const SHA256Hash& h) {
-    leveldb::Slice s2 = leveldb::Slice((const char*) h.data(), h.size());
-    return s2;
+// the cache is opened lazily by PUFFERFISH(), the node sets its profile at startup
+static DataStoreProfile defaultProfile;
+static size_t defaultMemoryEntries = DEFAULT_MEMORY_ENTRIES;
+static size_t defaultDiskEntries = DEFAULT_DISK_ENTRIES;
+static std::mutex defaultProfileLock;
+
+void PufferfishCache::setDefaultProfile(const DataStoreProfile& profile) {
+    std::unique_lock<std::mutex> ul(defaultProfileLock);
+    defaultProfile = profile;
+}
+
+DataStoreProfile PufferfishCache::getDefaultProfile() {
+    std::unique_lock<std::mutex> ul(defaultProfileLock);
+    return defaultProfile;
+}
+
+void PufferfishCache::setDefaultLimits(size_t memoryEntries, size_t diskEntries) {
+    {
+        std::unique_lock<std::mutex> ul(defaultProfileLock);
+        defaultMemoryEntries = memoryEntries;
+        defaultDiskEntries = diskEntries;
+    }
+    PufferfishCache* cache = getPufferfishCache();
+    if (cache) cache->setLimits(memoryEntries, diskEntries);
+}
+
+// inputs are block hashes, already uniformly distributed
+size_t SHA256HashHash::operator()(const SHA256Hash& h) const {
+    size_t ret;
+    memcpy(&ret, h.data(), sizeof(size_t));
+    return ret;
+}
+
+PufferfishMemoryCache::PufferfishMemoryCache(size_t maxEntries) {
+    this->setMaxEntries(maxEntries);
+}
+
+void PufferfishMemoryCache::setMaxEntries(size_t maxEntries) {
+    this->maxEntriesPerShard = max((size_t)1, maxEntries / PUFFERFISH_CACHE_SHARDS);
 }
 
+PufferfishMemoryCache::Shard& PufferfishMemoryCache::shardFor(const SHA256Hash& input) {
+    // the map buckets use the leading bytes, pick the shard with the last one
+    return this->shards[input[31] % PUFFERFISH_CACHE_SHARDS];
+}
+
+bool PufferfishMemoryCache::lookup(const SHA256Hash& input, SHA256Hash& hash) {
+    Shard& shard = this->shardFor(input);
+    std::unique_lock<std::mutex> ul(shard.lock);
+    auto it = shard.entries.find(input);
+    if (it == shard.entries.end()) {
+        shard.misses++;
+        return false;
+    }
+    shard.hits++;
+    shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+    hash = it->second->second;
+    return true;
+}
+
+void PufferfishMemoryCache::insert(const SHA256Hash& input, const SHA256Hash& hash) {
+    Shard& shard = this->shardFor(input);
+    std::unique_lock<std::mutex> ul(shard.lock);
+    auto it = shard.entries.find(input);
+    if (it != shard.entries.end()) {
+        it->second->second = hash;
+        shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+        return;
+    }
+    shard.lru.push_front(pair<SHA256Hash, SHA256Hash>(input, hash));
+    shard.entries[input] = shard.lru.begin();
+    while (shard.entries.size() > this->maxEntriesPerShard) {
+        shard.entries.erase(shard.lru.back().first);
+        shard.lru.pop_back();
+        shard.evictions++;
+    }
+}
+
+void PufferfishMemoryCache::clear() {
+    for(auto& shard : this->shards) {
+        std::unique_lock<std::mutex> ul(shard.lock);
+        shard.entries.clear();
+        shard.lru.clear();
+    }
+}
+
+map<string, uint64_t> PufferfishMemoryCache::getStats() const {
+    map<string, uint64_t> ret;
+    ret["capacity"] = this->maxEntriesPerShard * PUFFERFISH_CACHE_SHARDS;
+    ret["size"] = 0;
+    ret["hits"] = 0;
+    ret["misses"] = 0;
+    ret["evictions"] = 0;
+    for(auto& shard : this->shards) {
+        std::unique_lock<std::mutex> ul(shard.lock);
+        ret["size"] += shard.entries.size();
+        ret["hits"] += shard.hits;
+        ret["misses"] += shard.misses;
+        ret["evictions"] += shard.evictions;
+    }
+    return ret;
+}
+
+/*
+    Entry keys are a namespace byte and the input hash, their value is the
+    result. Order keys are a namespace byte and a big endian insertion
+    sequence number pointing back at the input, so the oldest entries are
+    the first order keys.
+*/
+static void entryKey(char* key, const SHA256Hash& input) {
+    key[0] = ENTRY_KEY_NAMESPACE;
+    memcpy(key + 1, input.data(), input.size());
+}
 
-bool PufferfishCache::hasHash(const SHA256Hash& hash) const{
-    std::string value;
-    leveldb::Status status = db->Get(leveldb::ReadOptions(), sha256ToSlice(hash), &value);
-    return (status.ok());
+static void orderKey(char* key, uint64_t seq) {
+    key[0] = ORDER_KEY_NAMESPACE;
+    for(int i = 0; i < 8; i++) {
+        key[1 + i] = seq >> (56 - 8 * i);
+    }
 }
 
-SHA256Hash PufferfishCache::getHash(const SHA256Hash& hash) const{
-    std::string value;
-    leveldb::Status status = db->Get(leveldb::ReadOptions(), sha256ToSlice(hash), &value);
-    if (!status.ok()) throw std::runtime_error("Hash does not exist");
-    return *((SHA256Hash*)value.c_str());
+static uint64_t orderKeySeq(const leveldb::Slice& key) {
+    uint64_t seq = 0;
+    for(int i = 0; i < 8; i++) {
+        seq = (seq << 8) | (uint8_t)key[1 + i];
+    }
+    return seq;
 }
-void PufferfishCache::setHash(const SHA256Hash& input, const SHA256Hash& value) {
-    leveldb::Status status = db->Put(leveldb::WriteOptions(), sha256ToSlice(input), sha256ToSlice(value));
-    if (!status.ok()) throw std::runtime_error("Write failed: " + status.ToString());
+
+PufferfishCache::PufferfishCache() : memory(DEFAULT_MEMORY_ENTRIES) {
+    this->firstSeq = 0;
+    this->nextSeq = 0;
+    this->maxDiskEntries = DEFAULT_DISK_ENTRIES;
+    this->diskHits = 0;
+    this->diskMisses = 0;
+    this->diskEvictions = 0;
+    this->compactionPrefix = string(1, (char)ENTRY_KEY_NAMESPACE);
+    std::unique_lock<std::mutex> ul(defaultProfileLock);
+    this->memory.setMaxEntries(defaultMemoryEntries);
+    this->maxDiskEntries = defaultDiskEntries;
+}
+
+/*
+    Caches written before the entries were ordered can't be bounded, they
+    are dropped and refilled as blocks are verified again.
+*/
+void PufferfishCache::init(string path, DataStoreProfile profile) {
+    DataStore::init(path, profile);
+    string value;
+    if (!db->Get(leveldb::ReadOptions(), SCHEMA_VERSION_KEY, &value).ok()) {
+        std::unique_ptr<leveldb::Iterator> it(db->NewIterator(leveldb::ReadOptions()));
+        it->SeekToFirst();
+        bool legacy = it->Valid();
+        it.reset();
+        if (legacy) {
+            this->closeDB();
+            this->deleteDB();
+            DataStore::init(path, profile);
+        }
+        uint32_t version = PUFFERFISH_SCHEMA_VERSION;
+        this->put(leveldb::Slice(SCHEMA_VERSION_KEY), leveldb::Slice((const char*)&version, sizeof(uint32_t)), true);
+    }
+    this->loadSequence();
+}
+
+void PufferfishCache::loadSequence() {
+    std::unique_lock<std::mutex> ul(this->writeLock);
+    this->firstSeq = 0;
+    this->nextSeq = 0;
+    std::unique_ptr<leveldb::Iterator> it(db->NewIterator(leveldb::ReadOptions()));
+    char first[ORDER_KEY_SIZE];
+    orderKey(first, 0);
+    it->Seek(leveldb::Slice(first, ORDER_KEY_SIZE));
+    if (!it->Valid() || it->key().size() != ORDER_KEY_SIZE || it->key()[0] != ORDER_KEY_NAMESPACE) return;
+    this->firstSeq = orderKeySeq(it->key());
+    // the last order key sits right before the first key of the next namespace
+    string end(1, (char)(ORDER_KEY_NAMESPACE + 1));
+    it->Seek(leveldb::Slice(end));
+    if (it->Valid()) {
+        it->Prev();
+    } else {
+        it->SeekToLast();
+    }
+    this->nextSeq = orderKeySeq(it->key()) + 1;
+}
+
+void PufferfishCache::clear() {
+    std::unique_lock<std::mutex> ul(this->writeLock);
+    DataStore::clear();
+    this->memory.clear();
+    uint32_t version = PUFFERFISH_SCHEMA_VERSION;
+    this->put(leveldb::Slice(SCHEMA_VERSION_KEY), leveldb::Slice((const char*)&version, sizeof(uint32_t)), true);
+    this->firstSeq = 0;
+    this->nextSeq = 0;
+}
+
+void PufferfishCache::setLimits(size_t memoryEntries, size_t diskEntries) {
+    this->memory.setMaxEntries(memoryEntries);
+    this->maxDiskEntries = diskEntries;
+}
+
+bool PufferfishCache::lookup(const SHA256Hash& input, SHA256Hash& hash) {
+    if (this->memory.lookup(input, hash)) return true;
+    if (!this->readHash(input, hash)) {
+        this->diskMisses++;
+        return false;
+    }
+    this->diskHits++;
+    this->memory.insert(input, hash);
+    return true;
+}
+
+void PufferfishCache::insert(const SHA256Hash& input, const SHA256Hash& hash) {
+    this->memory.insert(input, hash);
+    this->writeHash(input, hash);
+}
+
+bool PufferfishCache::readHash(const SHA256Hash& input, SHA256Hash& hash) const{
+    char key[ENTRY_KEY_SIZE];
+    entryKey(key, input);
+    string value;
+    leveldb::Status status = db->Get(leveldb::ReadOptions(), leveldb::Slice(key, ENTRY_KEY_SIZE), &value);
+    if (!status.ok() || value.size() != hash.size()) return false;
+    memcpy(hash.data(), value.data(), hash.size());
+    return true;
+}
+
+void PufferfishCache::writeHash(const SHA256Hash& input, const SHA256Hash& hash) {
+    std::unique_lock<std::mutex> ul(this->writeLock);
+    char key[ENTRY_KEY_SIZE];
+    entryKey(key, input);
+    string existing;
+    // two threads may have missed on the same input, keep one order key
+    if (db->Get(leveldb::ReadOptions(), leveldb::Slice(key, ENTRY_KEY_SIZE), &existing).ok()) return;
+    char order[ORDER_KEY_SIZE];
+    orderKey(order, this->nextSeq);
+    this->startBatch();
+    this->put(leveldb::Slice(key, ENTRY_KEY_SIZE), leveldb::Slice((const char*)hash.data(), hash.size()));
+    this->put(leveldb::Slice(order, ORDER_KEY_SIZE), leveldb::Slice(key, ENTRY_KEY_SIZE));
+    try {
+        this->commitBatch();
+    } catch(...) {
+        this->discardBatch();
+        throw;
+    }
+    this->nextSeq++;
+    if (this->nextSeq - this->firstSeq >= this->maxDiskEntries + DISK_EVICTION_BATCH) this->evict();
+}
+
+// drops the oldest entries until maxDiskEntries are left, writeLock must be held
+void PufferfishCache::evict() {
+    uint64_t target = this->nextSeq - this->maxDiskEntries;
+    std::unique_ptr<leveldb::Iterator> it(db->NewIterator(leveldb::ReadOptions()));
+    char first[ORDER_KEY_SIZE];
+    orderKey(first, this->firstSeq);
+    this->startBatch();
+    uint64_t evicted = 0;
+    for(it->Seek(leveldb::Slice(first, ORDER_KEY_SIZE)); it->Valid(); it->Next()) {
+        if (it->key().size() != ORDER_KEY_SIZE || it->key()[0] != ORDER_KEY_NAMESPACE) break;
+        if (orderKeySeq(it->key()) >= target) break;
+        this->remove(it->value());
+        this->remove(it->key());
+        evicted++;
+    }
+    try {
+        this->commitBatch();
+    } catch(...) {
+        this->discardBatch();
+        throw;
+    }
+    this->firstSeq = target;
+    this->diskEvictions += evicted;
+}
+
+json PufferfishCache::getStats() const {
+    json ret = DataStore::getStats();
+    json memoryStats;
+    for(auto elem : this->memory.getStats()) {
+        memoryStats[elem.first] = elem.second;
+    }
+    ret["memory"] = memoryStats;
+    ret["diskCapacity"] = (size_t)this->maxDiskEntries;
+    ret["diskHits"] = (uint64_t)this->diskHits;
+    ret["diskMisses"] = (uint64_t)this->diskMisses;
+    ret["diskEvictions"] = (uint64_t)this->diskEvictions;
+    return ret;
 }
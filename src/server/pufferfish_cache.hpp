@@ -1,13 +1,77 @@
 #pragma once
-#include <set>
+#include <atomic>
+#include <list>
+#include <mutex>
+#include <unordered_map>
 #include "leveldb/db.h"
 #include "../core/common.hpp"
 #include "data_store.hpp"
 using namespace std;
 
+#define PUFFERFISH_CACHE_SHARDS 16
+
+struct SHA256HashHash {
+    size_t operator()(const SHA256Hash& h) const;
+};
+
+/*
+    LRU of recent pufferfish results split into shards that each have
+    their own lock, so header chain threads, block verification and sync
+    only wait on each other when they hit the same shard.
+*/
+class PufferfishMemoryCache {
+    public:
+        PufferfishMemoryCache(size_t maxEntries);
+        void setMaxEntries(size_t maxEntries);
+        bool lookup(const SHA256Hash& input, SHA256Hash& hash);
+        void insert(const SHA256Hash& input, const SHA256Hash& hash);
+        void clear();
+        map<string, uint64_t> getStats() const;
+    protected:
+        struct Shard {
+            mutable std::mutex lock;
+            list<pair<SHA256Hash, SHA256Hash>> lru; // most recently used at the front
+            unordered_map<SHA256Hash, list<pair<SHA256Hash, SHA256Hash>>::iterator, SHA256HashHash> entries;
+            uint64_t hits = 0;
+            uint64_t misses = 0;
+            uint64_t evictions = 0;
+        };
+        Shard& shardFor(const SHA256Hash& input);
+        Shard shards[PUFFERFISH_CACHE_SHARDS];
+        std::atomic<size_t> maxEntriesPerShard;
+};
+
+/*
+    Pufferfish results are kept in the sharded memory tier in front of a
+    leveldb tier that holds at most maxDiskEntries results and drops the
+    oldest ones once it is full.
+*/
 class PufferfishCache : public DataStore {
     public:
-        bool hasHash(const SHA256Hash& hash) const;
-        SHA256Hash getHash(const SHA256Hash& hash) const;
-        void setHash(const SHA256Hash& input, const SHA256Hash& hash);
+        PufferfishCache();
+        void init(string path, DataStoreProfile profile = DataStoreProfile());
+        void clear();
+        bool lookup(const SHA256Hash& input, SHA256Hash& hash);
+        void insert(const SHA256Hash& input, const SHA256Hash& hash);
+        void setLimits(size_t memoryEntries, size_t diskEntries);
+        json getStats() const;
+        static void setDefaultProfile(const DataStoreProfile& profile);
+        static DataStoreProfile getDefaultProfile();
+        static void setDefaultLimits(size_t memoryEntries, size_t diskEntries);
+    protected:
+        bool readHash(const SHA256Hash& input, SHA256Hash& hash) const;
+        void writeHash(const SHA256Hash& input, const SHA256Hash& hash);
+        void loadSequence();
+        void evict();
+        PufferfishMemoryCache memory;
+        std::mutex writeLock;
+        uint64_t firstSeq;
+        uint64_t nextSeq;
+        std::atomic<size_t> maxDiskEntries;
+        std::atomic<uint64_t> diskHits;
+        std::atomic<uint64_t> diskMisses;
+        std::atomic<uint64_t> diskEvictions;
 };
+
+json getPufferfishCacheStats();
+PufferfishCache* getPufferfishCache();
@@ -9,9 +9,13 @@
 using namespace std;
 
 #define NEW_BLOCK_PEER_FANOUT 8
+#define RICHLIST_MAX_LIMIT 1000
+#define RICHLIST_MAX_OFFSET 10000
+#define WALLET_TRANSACTIONS_MAX_LIMIT 1000
+#define WALLET_TRANSACTIONS_FULL_LIMIT 10000
 
-RequestManager::RequestManager(HostManager& hosts, string ledgerPath, string blockPath, string txdbPath) : hosts(hosts) {
-    this->blockchain = std::make_shared<BlockChain>(hosts, ledgerPath, blockPath, txdbPath);
+RequestManager::RequestManager(HostManager& hosts, string ledgerPath, string blockPath, string txdbPath, string walletPath, json config) : hosts(hosts) {
+    this->blockchain = std::make_shared<BlockChain>(hosts, ledgerPath, blockPath, txdbPath, walletPath, config);
     this->mempool = std::make_shared<MemPool>(hosts, *this->blockchain);
     this->rateLimiter = std::make_shared<RateLimiter>(30,5); // max of 30 requests over 5 sec period 
     this->limitRequests = true;
@@ -58,11 +62,48 @@ void RequestManager::deleteDB() {
     this->blockchain->deleteDB();
 }
 
-json RequestManager::getTransactionsForWallet(PublicWalletAddress addr) {
+/*
+    The old unpaginated reply, only the newest WALLET_TRANSACTIONS_FULL_LIMIT
+    in chain order. truncated is set when older transactions were left out.
+*/
+json RequestManager::getTransactionsForWallet(PublicWalletAddress addr, bool& truncated) {
     json ret = json::array();
-    vector<Transaction> txs = this->blockchain->getTransactionsForWallet(addr);
-    for(auto tx : txs) {
-        ret.push_back(tx.toJson());
+    vector<TransactionPosition> positions;
+    vector<Transaction> txs = this->blockchain->getTransactionsForWallet(addr, WALLET_TRANSACTIONS_FULL_LIMIT + 1, NULL, true, positions);
+    truncated = txs.size() > WALLET_TRANSACTIONS_FULL_LIMIT;
+    if (truncated) txs.pop_back();
+    for(auto it = txs.rbegin(); it != txs.rend(); it++) {
+        ret.push_back(it->toJson());
+    }
+    return ret;
+}
+
+/*
+    One page of a wallet's history ordered by block and transaction index.
+    One extra entry is read to know whether there is a next page; `next`
+    is the cursor to pass as `after` for it.
+*/
+json RequestManager::getTransactionsForWallet(PublicWalletAddress addr, uint32_t limit, const TransactionPosition* after, bool newestFirst) {
+    json ret;
+    limit = max((uint32_t)1, min(limit, (uint32_t)WALLET_TRANSACTIONS_MAX_LIMIT));
+    vector<TransactionPosition> positions;
+    vector<Transaction> txs = this->blockchain->getTransactionsForWallet(addr, limit + 1, after, newestFirst, positions);
+    bool more = txs.size() > limit;
+    if (more) {
+        txs.pop_back();
+        positions.pop_back();
+    }
+    ret["transactions"] = json::array();
+    for(size_t i = 0; i < txs.size(); i++) {
+        json tx = txs[i].toJson();
+        tx["blockId"] = positions[i].blockId;
+        tx["txIndex"] = positions[i].txIndex;
+        ret["transactions"].push_back(tx);
+    }
+    if (more) {
+        ret["next"] = to_string(positions.back().blockId) + ":" + to_string(positions.back().txIndex);
+    } else {
+        ret["next"] = nullptr;
     }
     return ret;
 }
@@ -123,19 +164,31 @@ json hashTreeToJson(shared_ptr<HashTree> root) {
 
 json RequestManager::getTransactionStatus(SHA256Hash txid) {
     json response;
-    Block b;
-    try {
-        uint32_t blockId = this->blockchain->findBlockForTransactionId(txid);
-        b = this->blockchain->getBlock(blockId);
+    uint32_t blockId = this->blockchain->findBlockForTransactionId(txid);
+    if (blockId > 0 && blockId <= this->blockchain->getBlockCount()) {
         response["status"] = "IN_CHAIN";
-        response["blockId"] = b.getId();
-    } catch(...) {
+        response["blockId"] = blockId;
+    } else {
         response["status"] = "NOT_IN_CHAIN";
         response["blockId"] = -1;
     }
     return response;  
 }
 
+json RequestManager::getTransaction(SHA256Hash txid) {
+    json response;
+    Transaction t;
+    TransactionPosition position;
+    if (!this->blockchain->findTransaction(txid, t, position)) {
+        response["error"] = "Transaction not found";
+        return response;
+    }
+    response = t.toJson();
+    response["blockId"] = position.blockId;
+    response["txIndex"] = position.txIndex;
+    return response;
+}
+
 json RequestManager::verifyTransaction(Transaction& t) {
     json response;
     Block b;
@@ -202,10 +255,22 @@ std::pair<uint8_t*, size_t> RequestManager::getRawBlockData(uint32_t blockId) {
     return this->blockchain->getRaw(blockId);
 }
 
+std::pair<uint8_t*, size_t> RequestManager::getRawBlockRange(uint32_t start, uint32_t end) {
+    return this->blockchain->getRawRange(start, end);
+}
+
+void RequestManager::readRawBlockRange(uint32_t start, uint32_t end, std::function<void(std::string_view)> visitor) {
+    this->blockchain->readRawRange(start, end, visitor);
+}
+
 BlockHeader RequestManager::getBlockHeader(uint32_t blockId) {
     return this->blockchain->getBlockHeader(blockId);
 }
 
+uint32_t RequestManager::getBlockIdForHash(SHA256Hash hash) {
+    return this->blockchain->getBlockIdForHash(hash);
+}
+
 
 std::pair<char*, size_t> RequestManager::getRawTransactionData() {
     return this->mempool->getRaw();
@@ -246,13 +311,82 @@ json RequestManager::getLedger(PublicWalletAddress w) {
     }
     return result;
 }
+json RequestManager::getLedgerAt(PublicWalletAddress w, uint32_t blockId) {
+    json result;
+    const Ledger& ledger = this->blockchain->getLedger();
+    uint32_t start = 0;
+    TransactionAmount balance;
+    uint32_t changedAt;
+    if (blockId > this->blockchain->getBlockCount()) {
+        result["error"] = "Block not found";
+    } else if (ledger.getHistoryStart(start) && blockId < start) {
+        result["error"] = "Balance history starts at block " + to_string(start);
+    } else if (!ledger.getBalanceAt(w, blockId, balance, changedAt)) {
+        result["error"] = "Wallet not found";
+    } else {
+        result["balance"] = balance;
+        result["blockId"] = blockId;
+        result["lastChange"] = changedAt;
+    }
+    return result;
+}
+
+/*
+    Offsets are walked entry by entry in the index, so they are capped and
+    deeper pages are read with the `next` cursor (balance:wallet of the
+    last entry), which is a single seek.
+*/
+json RequestManager::getRichList(uint64_t offset, uint32_t limit) {
+    json result;
+    if (offset > RICHLIST_MAX_OFFSET) {
+        result["error"] = "offset is at most " + to_string(RICHLIST_MAX_OFFSET) + ", use after to page further";
+        return result;
+    }
+    const Ledger& ledger = this->blockchain->getLedger();
+    vector<pair<PublicWalletAddress, TransactionAmount>> entries;
+    limit = min(limit, (uint32_t)RICHLIST_MAX_LIMIT);
+    ledger.getRichList(offset, limit, entries);
+    result["offset"] = offset;
+    this->writeRichList(entries, limit, result);
+    for(size_t i = 0; i < entries.size(); i++) {
+        result["wallets"][i]["rank"] = offset + i + 1;
+    }
+    return result;
+}
+
+json RequestManager::getRichList(const PublicWalletAddress& afterWallet, TransactionAmount afterBalance, uint32_t limit) {
+    json result;
+    const Ledger& ledger = this->blockchain->getLedger();
+    vector<pair<PublicWalletAddress, TransactionAmount>> entries;
+    limit = min(limit, (uint32_t)RICHLIST_MAX_LIMIT);
+    ledger.getRichList(afterWallet, afterBalance, limit, entries);
+    this->writeRichList(entries, limit, result);
+    return result;
+}
+
+void RequestManager::writeRichList(const vector<pair<PublicWalletAddress, TransactionAmount>>& entries, uint32_t limit, json& result) {
+    result["num_wallets"] = this->blockchain->getLedger().getWalletCount();
+    result["wallets"] = json::array();
+    for(size_t i = 0; i < entries.size(); i++) {
+        json entry;
+        entry["wallet"] = walletAddressToString(entries[i].first);
+        entry["balance"] = entries[i].second;
+        result["wallets"].push_back(entry);
+    }
+    if (entries.size() == limit && limit > 0) {
+        result["next"] = to_string(entries.back().second) + ":" + walletAddressToString(entries.back().first);
+    } else {
+        result["next"] = nullptr;
+    }
+}
+
 string RequestManager::getBlockCount() {
     uint32_t count = this->blockchain->getBlockCount();
     return std::to_string(count);
 }
 
 string RequestManager::getTotalWork() {
-    Bigint totalWork = this->blockchain->getTotalWork();
+    UInt256 totalWork = this->blockchain->getTotalWork();
     return to_string(totalWork);
 }
 
@@ -284,6 +418,10 @@ uint64_t RequestManager::getNetworkHashrate() {
     return totalWork / (end - start);
 }
 
+json RequestManager::getStorageStats() {
+    return this->blockchain->getStorageStats();
+}
+
 json RequestManager::getStats() {
     json info;
     if (this->blockchain->getBlockCount() == 1) {
@@ -294,14 +432,22 @@ json RequestManager::getStats() {
     int coins = this->blockchain->getBlockCount()*50;
     info["node_version"] = BUILD_VERSION;
     info["num_coins"] = coins;
-    info["num_wallets"] = 0;
+    info["num_wallets"] = this->blockchain->getLedger().getWalletCount();
     int blockId = this->blockchain->getBlockCount();
     info["pending_transactions"]= this->mempool->size();
+    json ledgerCache;
+    for(auto elem : this->blockchain->getLedgerCacheStats()) {
+        ledgerCache[elem.first] = elem.second;
+    }
+    info["ledger_cache"] = ledgerCache;
+    json compaction = this->blockchain->getCompactionStats();
+    info["compaction_debt_bytes"] = compaction["compactionDebtBytes"];
+    info["write_stall_ms"] = compaction["writeStallMs"];
     
     int idx = this->blockchain->getBlockCount();
     Block a = this->blockchain->getBlock(idx);
-    Block b = this->blockchain->getBlock(idx-1);
-    int timeDelta = a.getTimestamp() - b.getTimestamp();
+    BlockHeader b = this->blockchain->getBlockHeader(idx-1);
+    int timeDelta = a.getTimestamp() - b.timestamp;
     int totalSent = 0;
     int fees = 0;
     info["transactions"] = json::array();
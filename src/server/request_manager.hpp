@@ -15,7 +15,7 @@ using namespace std;
 
 class RequestManager {
     public:
-        RequestManager(HostManager& hosts, string ledgerPath="", string blockPath="", string txdbPath="");
+        RequestManager(HostManager& hosts, string ledgerPath="", string blockPath="", string txdbPath="", string walletPath="", json config=json::object());
         ~RequestManager();
         bool acceptRequest(std::string& ip);
         json addTransaction(Transaction& t);
@@ -24,17 +24,26 @@ class RequestManager {
         json getTransactionQueue();
         json getBlock(uint32_t blockId);
         json getLedger(PublicWalletAddress w);
+        json getLedgerAt(PublicWalletAddress w, uint32_t blockId);
+        json getRichList(uint64_t offset, uint32_t limit);
+        json getRichList(const PublicWalletAddress& afterWallet, TransactionAmount afterBalance, uint32_t limit);
         json getStats();
-        json getTransactionsForWallet(PublicWalletAddress addr);
+        json getStorageStats();
+        json getTransactionsForWallet(PublicWalletAddress addr, bool& truncated);
+        json getTransactionsForWallet(PublicWalletAddress addr, uint32_t limit, const TransactionPosition* after, bool newestFirst);
         json verifyTransaction(Transaction& t);
         json getTransactionStatus(SHA256Hash txid);
+        json getTransaction(SHA256Hash txid);
         json getSupply();
         json getPeers();
         json getPeerStats();
         json getMineStatus(uint32_t blockId);
         json addPeer(string address, uint64_t time, string version, string network);
         BlockHeader getBlockHeader(uint32_t blockId);
+        uint32_t getBlockIdForHash(SHA256Hash hash);
         std::pair<uint8_t*, size_t> getRawBlockData(uint32_t blockId);
+        std::pair<uint8_t*, size_t> getRawBlockRange(uint32_t start, uint32_t end);
+        void readRawBlockRange(uint32_t start, uint32_t end, std::function<void(std::string_view)> visitor);
         std::pair<char*, size_t> getRawTransactionData();
         string getBlockCount();
         string getTotalWork();
@@ -43,6 +52,7 @@ class RequestManager {
         void deleteDB();
         void enableRateLimiting(bool enabled);
     protected:
+        void writeRichList(const vector<pair<PublicWalletAddress, TransactionAmount>>& entries, uint32_t limit, json& result);
         bool limitRequests;
         HostManager& hosts;
         std::shared_ptr<RateLimiter> rateLimiter;
@@ -84,7 +84,7 @@ void PandaniteServer::run(json config) {
     HostManager hosts(config);
 
     
-    RequestManager manager(hosts);
+    RequestManager manager(hosts, "", "", "", "", config);
 
     // start downloading headers from peers
     hosts.syncHeadersWithPeers();
@@ -145,6 +145,19 @@ void PandaniteServer::run(json config) {
         }
     };
 
+    auto storageStatsHandler = [&manager](auto *res, auto *req) {
+        rateLimit(manager, res);
+        sendCorsHeaders(res);
+        try {
+            json stats = manager.getStorageStats();
+            res->writeHeader("Content-Type", "application/json; charset=utf-8")->end(stats.dump());
+        } catch(const std::exception &e) {
+            Logger::logError("/storage_stats", e.what());
+        } catch(...) {
+            Logger::logError("/storage_stats", "unknown");
+        }
+    };
+
     auto totalWorkHandler = [&manager](auto *res, auto *req) {
         rateLimit(manager, res);
         sendCorsHeaders(res);
@@ -165,6 +178,7 @@ void PandaniteServer::run(json config) {
         response["name"] = string(config["name"]);
         response["version"] = BUILD_VERSION;
         response["networkName"] = string(config["networkName"]);
+        if (config["pruneDepth"] > 0) response["pruneDepth"] = config["pruneDepth"];
         res->writeHeader("Content-Type", "text/html; charset=utf-8")->end(response.dump());
     };
 
@@ -210,13 +224,18 @@ void PandaniteServer::run(json config) {
         sendCorsHeaders(res);
         json result;
         try {
-            if (req->getQuery("blockId").length() == 0) {
+            if (req->getQuery("blockId").length() == 0 && req->getQuery("hash").length() == 0) {
                 json err;
                 err["error"] = "No query parameters specified";
                 res->writeHeader("Content-Type", "application/json; charset=utf-8")->end(err.dump());
                 return;
             }
-            int blockId= std::stoi(string(req->getQuery("blockId")));
+            int blockId;
+            if (req->getQuery("hash").length() > 0) {
+                blockId = manager.getBlockIdForHash(stringToSHA256(string(req->getQuery("hash"))));
+            } else {
+                blockId = std::stoi(string(req->getQuery("blockId")));
+            }
             int count = std::stoi(manager.getBlockCount());
             if (blockId<= 0 || blockId > count) {
                 result["error"] = "Invalid Block";
@@ -234,6 +253,36 @@ void PandaniteServer::run(json config) {
         }
     };
 
+    auto blockHeaderByHashHandler = [&manager](auto *res, auto *req) {
+        rateLimit(manager, res);
+        sendCorsHeaders(res);
+        try {
+            if (req->getQuery("hash").length() == 0) {
+                json err;
+                err["error"] = "No query parameters specified";
+                res->writeHeader("Content-Type", "application/json; charset=utf-8")->end(err.dump());
+                return;
+            }
+            uint32_t blockId = manager.getBlockIdForHash(stringToSHA256(string(req->getQuery("hash"))));
+            if (blockId == 0) {
+                json err;
+                err["error"] = "Unknown block hash";
+                res->writeHeader("Content-Type", "application/json; charset=utf-8")->end(err.dump());
+                return;
+            }
+            BlockHeader b = manager.getBlockHeader(blockId);
+            char bhBytes[BLOCKHEADER_BUFFER_SIZE];
+            blockHeaderToBuffer(b, bhBytes);
+            res->writeHeader("Content-Type", "application/octet-stream")->end(std::string_view(bhBytes, BLOCKHEADER_BUFFER_SIZE));
+        } catch(const std::exception &e) {
+            Logger::logError("/block_header", e.what());
+            res->end("");
+        } catch(...) {
+            Logger::logError("/block_header", "unknown");
+            res->end("");
+        }
+    };
+
     auto mineStatusHandler = [&manager](auto *res, auto *req) {
         rateLimit(manager, res);
         sendCorsHeaders(res);
@@ -263,6 +312,28 @@ void PandaniteServer::run(json config) {
         }
     };
 
+    auto transactionHandler = [&manager](auto *res, auto *req) {
+        rateLimit(manager, res);
+        sendCorsHeaders(res);
+        try {
+            if (req->getQuery("txid").length() == 0) {
+                json err;
+                err["error"] = "No query parameters specified";
+                res->writeHeader("Content-Type", "application/json; charset=utf-8")->end(err.dump());
+                return;
+            }
+            SHA256Hash txid = stringToSHA256(string(req->getQuery("txid")));
+            json ret = manager.getTransaction(txid);
+            res->writeHeader("Content-Type", "application/json; charset=utf-8")->end(ret.dump());
+        } catch(const std::exception &e) {
+            Logger::logError("/transaction", e.what());
+            res->end("");
+        } catch(...) {
+            Logger::logError("/transaction", "unknown");
+            res->end("");
+        }
+    };
+
     auto ledgerHandler = [&manager](auto *res, auto *req) {
         rateLimit(manager, res);
         sendCorsHeaders(res);
@@ -274,7 +345,12 @@ void PandaniteServer::run(json config) {
                 return;
             }
             PublicWalletAddress w = stringToWalletAddress(string(req->getQuery("wallet")));
-            json ledger = manager.getLedger(w);
+            json ledger;
+            if (req->getQuery("block").length() > 0) {
+                ledger = manager.getLedgerAt(w, std::stoul(string(req->getQuery("block"))));
+            } else {
+                ledger = manager.getLedger(w);
+            }
             res->writeHeader("Content-Type", "application/json; charset=utf-8")->end(ledger.dump());
         } catch(const std::exception &e) {
             Logger::logError("/ledger", e.what());
@@ -294,7 +370,37 @@ void PandaniteServer::run(json config) {
                 return;
             }
             PublicWalletAddress w = stringToWalletAddress(string(req->getQuery("wallet")));
-            json ret = manager.getTransactionsForWallet(w);
+            string limit = string(req->getQuery("limit"));
+            string after = string(req->getQuery("after"));
+            string direction = string(req->getQuery("direction"));
+            json ret;
+            bool truncated = false;
+            if (req->getQuery("format") == "full") {
+                ret["transactions"] = manager.getTransactionsForWallet(w, truncated);
+                ret["truncated"] = truncated;
+            } else if (limit.length() == 0 && after.length() == 0 && direction.length() == 0) {
+                // plain array as older releases returned it, capped by the request manager
+                ret = manager.getTransactionsForWallet(w, truncated);
+                if (truncated) {
+                    res->writeHeader("Access-Control-Expose-Headers", "X-Truncated");
+                    res->writeHeader("X-Truncated", "true");
+                }
+            } else {
+                size_t split = after.find(':');
+                if ((after.length() > 0 && split == string::npos) || (direction.length() > 0 && direction != "asc" && direction != "desc")) {
+                    json err;
+                    err["error"] = "Invalid after or direction parameter";
+                    res->writeHeader("Content-Type", "application/json; charset=utf-8")->end(err.dump());
+                    return;
+                }
+                TransactionPosition cursor;
+                if (after.length() > 0) {
+                    cursor.blockId = std::stoul(after.substr(0, split));
+                    cursor.txIndex = std::stoul(after.substr(split + 1));
+                }
+                uint32_t pageSize = limit.length() > 0 ? std::stoul(limit) : 100;
+                ret = manager.getTransactionsForWallet(w, pageSize, after.length() > 0 ? &cursor : NULL, direction == "desc");
+            }
             res->writeHeader("Content-Type", "application/json; charset=utf-8")->end(ret.dump());
         } catch(const std::exception &e) {
             Logger::logError("/wallet", e.what());
@@ -303,6 +409,35 @@ void PandaniteServer::run(json config) {
         }
     };
 
+    auto richListHandler = [&manager](auto *res, auto *req) {
+        rateLimit(manager, res);
+        sendCorsHeaders(res);
+        try {
+            uint64_t offset = 0;
+            uint32_t limit = 100;
+            string after = string(req->getQuery("after"));
+            if (req->getQuery("offset").length() > 0) offset = std::stoull(string(req->getQuery("offset")));
+            if (req->getQuery("limit").length() > 0) limit = std::stoul(string(req->getQuery("limit")));
+            json ret;
+            if (after.length() > 0) {
+                size_t split = after.find(':');
+                if (split == string::npos) {
+                    ret["error"] = "Invalid after parameter";
+                } else {
+                    TransactionAmount balance = std::stoull(after.substr(0, split));
+                    ret = manager.getRichList(stringToWalletAddress(after.substr(split + 1)), balance, limit);
+                }
+            } else {
+                ret = manager.getRichList(offset, limit);
+            }
+            res->writeHeader("Content-Type", "application/json; charset=utf-8")->end(ret.dump());
+        } catch(const std::exception &e) {
+            Logger::logError("/richlist", e.what());
+        } catch(...) {
+            Logger::logError("/richlist", "unknown");
+        }
+    };
+
     // TODO: remove this once all nodes and clients migrated
     auto ledgerHandlerDeprecated = [&manager](auto *res, auto *req) {
         rateLimit(manager, res);
@@ -527,11 +662,11 @@ void PandaniteServer::run(json config) {
                 res->end("");
             }
             res->writeHeader("Content-Type", "application/octet-stream");
-            for (int i = start; i <=end; i++) {
-                std::pair<uint8_t*, size_t> buffer = manager.getRawBlockData(i);
-                std::string_view str((char*)buffer.first, buffer.second);
-                res->write(str);
-                delete buffer.first;
+            if (start <= end) {
+                // block segments are written straight from their mapping
+                manager.readRawBlockRange(start, end, [res](std::string_view raw) {
+                    res->write(raw);
+                });
             }
             res->end("");
         } catch(const std::exception &e) {
@@ -638,11 +773,11 @@ void PandaniteServer::run(json config) {
                 res->end("");
             }
             res->writeHeader("Content-Type", "application/octet-stream");
-            for (int i = start; i <=end; i++) {
-                std::pair<uint8_t*, size_t> buffer = manager.getRawBlockData(i);
-                std::string_view str((char*)buffer.first, buffer.second);
-                res->write(str);
-                delete buffer.first;
+            if (start <= end) {
+                // block segments are written straight from their mapping
+                manager.readRawBlockRange(start, end, [res](std::string_view raw) {
+                    res->write(raw);
+                });
             }
             res->end("");
         } catch(const std::exception &e) {
@@ -849,11 +984,15 @@ void PandaniteServer::run(json config) {
         .get("/block_count", blockCountHandler)
         .get("/logs", logsHandler)
         .get("/stats", statsHandler)
+        .get("/storage_stats", storageStatsHandler)
         .get("/block", blockHandler)
+        .get("/block_header", blockHeaderByHashHandler)
         .get("/tx_json", txJsonHandler)
         .get("/mine_status", mineStatusHandler)
+        .get("/transaction", transactionHandler)
         .get("/ledger", ledgerHandler)
         .get("/wallet_transactions", walletHandler)
+        .get("/richlist", richListHandler)
         .get("/gettx/:blockId", getTxHandler) // DEPRECATED
         .get("/mine_status/:b", mineStatusHandlerDeprecated) // DEPRECATED
         .get("/ledger/:user", ledgerHandlerDeprecated) // DEPRECATED
@@ -880,10 +1019,13 @@ void PandaniteServer::run(json config) {
         .options("/block_count", corsHandler)
         .options("/logs", corsHandler)
         .options("/stats", corsHandler)
+        .options("/storage_stats", corsHandler)
         .options("/wallet_transactions", corsHandler)
         .options("/block", corsHandler)
+        .options("/block_header", corsHandler)
         .options("/tx_json", corsHandler)
         .options("/mine_status", corsHandler)
+        .options("/transaction", corsHandler)
         .options("/ledger", corsHandler)
         .options("/mine", corsHandler)
         .options("/getnetworkhashrate", corsHandler)
@@ -0,0 +1,126 @@
+#include <algorithm>
+#include <fstream>
+#include "../core/logger.hpp"
+#include "../core/crypto.hpp"
+#include "snapshot_manager.hpp"
+
+#ifdef _WIN32
+#include <filesystem>
+namespace fs = std::filesystem;
+#else
+#include <experimental/filesystem>
+namespace fs = std::experimental::filesystem;
+#endif
+
+SnapshotManager::SnapshotManager(string path, uint32_t interval, uint32_t keep) {
+    this->path = path;
+    this->interval = interval;
+    this->keep = keep;
+    this->writing = false;
+}
+
+SnapshotManager::~SnapshotManager() {
+    this->wait();
+}
+
+bool SnapshotManager::isDue(uint32_t height) const {
+    return this->interval > 0 && height > 0 && height % this->interval == 0;
+}
+
+void SnapshotManager::wait() {
+    if (this->writer.joinable()) this->writer.join();
+}
+
+void SnapshotManager::write(uint32_t height, SHA256Hash blockHash, Ledger& ledger, TransactionStore& txdb) {
+    // never hold up the block commit that called us
+    if (this->writing) {
+        Logger::logStatus("Skipping ledger snapshot at block " + to_string(height) + ", the previous one is still being written");
+        return;
+    }
+    this->wait();
+    this->writing = true;
+    // both stores are pinned at this block before anything else commits
+    const leveldb::Snapshot* ledgerSnapshot = ledger.takeSnapshot();
+    const leveldb::Snapshot* txdbSnapshot = txdb.takeSnapshot();
+    string dir = this->path + "/" + to_string(height);
+    this->writer = std::thread([this, dir, height, blockHash, &ledger, &txdb, ledgerSnapshot, txdbSnapshot]() {
+        try {
+            fs::remove_all(dir);
+            fs::create_directories(dir);
+            ledger.exportSnapshot(dir + "/ledger", ledgerSnapshot);
+            txdb.exportSnapshot(dir + "/txdb", txdbSnapshot);
+            json meta;
+            meta["height"] = height;
+            meta["hash"] = SHA256toString(blockHash);
+            std::ofstream out(dir + "/meta");
+            out << meta.dump();
+            out.close();
+            if (!out) throw std::runtime_error("Could not write snapshot meta");
+            Logger::logStatus("Wrote ledger snapshot at block " + to_string(height));
+        } catch(const std::exception& e) {
+            Logger::logError("SnapshotManager::write", e.what());
+            std::error_code ec;
+            fs::remove_all(dir, ec);
+        }
+        ledger.releaseSnapshot(ledgerSnapshot);
+        txdb.releaseSnapshot(txdbSnapshot);
+        this->prune();
+        this->writing = false;
+    });
+}
+
+vector<uint32_t> SnapshotManager::list() const {
+    vector<uint32_t> ret;
+    if (!fs::exists(this->path)) return ret;
+    for (auto& entry : fs::directory_iterator(this->path)) {
+        string name = entry.path().filename().string();
+        if (name.empty() || !std::all_of(name.begin(), name.end(), ::isdigit)) continue;
+        if (!fs::exists(entry.path() / "meta")) continue;
+        ret.push_back(std::stoul(name));
+    }
+    std::sort(ret.begin(), ret.end());
+    return ret;
+}
+
+SHA256Hash SnapshotManager::getBlockHash(uint32_t height) const {
+    std::ifstream in(this->path + "/" + to_string(height) + "/meta");
+    json meta = json::parse(in);
+    return stringToSHA256(meta["hash"]);
+}
+
+void SnapshotManager::restore(uint32_t height, Ledger& ledger, TransactionStore& txdb) {
+    this->wait();
+    string dir = this->path + "/" + to_string(height);
+    Logger::logStatus("Restoring ledger snapshot from block " + to_string(height));
+    ledger.importSnapshot(dir + "/ledger");
+    txdb.importSnapshot(dir + "/txdb");
+}
+
+void SnapshotManager::prune() {
+    // directories without meta are left over from interrupted writes
+    for (auto& entry : fs::directory_iterator(this->path)) {
+        if (fs::exists(entry.path() / "meta")) continue;
+        std::error_code ec;
+        fs::remove_all(entry.path(), ec);
+    }
+    vector<uint32_t> heights = this->list();
+    for (int i = 0; i + this->keep < heights.size(); i++) {
+        std::error_code ec;
+        fs::remove_all(this->path + "/" + to_string(heights[i]), ec);
+    }
+}
+
+void SnapshotManager::discardFrom(uint32_t height) {
+    this->wait();
+    for (auto h : this->list()) {
+        if (h < height) continue;
+        std::error_code ec;
+        fs::remove_all(this->path + "/" + to_string(h), ec);
+    }
+}
+
+void SnapshotManager::discardAll() {
+    this->wait();
+    std::error_code ec;
+    fs::remove_all(this->path, ec);
+}
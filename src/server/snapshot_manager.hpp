@@ -0,0 +1,38 @@
+#pragma once
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+#include "../core/common.hpp"
+#include "ledger.hpp"
+#include "tx_store.hpp"
+using namespace std;
+
+/*
+    Writes the ledger and txdb to <path>/<height>/ every `interval` blocks
+    so recovery only has to replay blocks after the newest snapshot.
+    Snapshots are read from leveldb snapshots taken at the commit point
+    and written out on a background thread. A snapshot only counts once
+    its meta file, written last, exists. A snapshot that comes due while
+    the previous one is still being written is skipped.
+*/
+class SnapshotManager {
+    public:
+        SnapshotManager(string path, uint32_t interval, uint32_t keep = 2);
+        ~SnapshotManager();
+        bool isDue(uint32_t height) const;
+        void write(uint32_t height, SHA256Hash blockHash, Ledger& ledger, TransactionStore& txdb);
+        vector<uint32_t> list() const;
+        SHA256Hash getBlockHash(uint32_t height) const;
+        void restore(uint32_t height, Ledger& ledger, TransactionStore& txdb);
+        void discardFrom(uint32_t height);
+        void discardAll();
+        void wait();
+    protected:
+        string path;
+        uint32_t interval;
+        uint32_t keep;
+        std::thread writer;
+        std::atomic<bool> writing;
+        void prune();
+};
@@ -0,0 +1,159 @@
+#include "store_profile.hpp"
+#include <stdexcept>
+
+BlockCache::BlockCache(size_t capacity) {
+    this->cache = leveldb::NewLRUCache(capacity);
+    this->capacity = capacity;
+    this->hits = 0;
+    this->misses = 0;
+}
+
+BlockCache::~BlockCache() {
+    delete this->cache;
+}
+
+leveldb::Cache::Handle* BlockCache::Insert(const leveldb::Slice& key, void* value, size_t charge, void (*deleter)(const leveldb::Slice& key, void* value)) {
+    return this->cache->Insert(key, value, charge, deleter);
+}
+
+leveldb::Cache::Handle* BlockCache::Lookup(const leveldb::Slice& key) {
+    Handle* handle = this->cache->Lookup(key);
+    if (handle) {
+        this->hits++;
+    } else {
+        this->misses++;
+    }
+    return handle;
+}
+
+void BlockCache::Release(Handle* handle) {
+    this->cache->Release(handle);
+}
+
+void* BlockCache::Value(Handle* handle) {
+    return this->cache->Value(handle);
+}
+
+void BlockCache::Erase(const leveldb::Slice& key) {
+    this->cache->Erase(key);
+}
+
+uint64_t BlockCache::NewId() {
+    return this->cache->NewId();
+}
+
+void BlockCache::Prune() {
+    this->cache->Prune();
+}
+
+size_t BlockCache::TotalCharge() const {
+    return this->cache->TotalCharge();
+}
+
+map<string, uint64_t> BlockCache::getStats() const {
+    map<string, uint64_t> ret;
+    ret["capacity"] = this->capacity;
+    ret["usage"] = this->TotalCharge();
+    ret["hits"] = this->hits;
+    ret["misses"] = this->misses;
+    return ret;
+}
+
+/*
+    txdb and the pufferfish cache are random point lookups that mostly
+    miss, so they get bloom filters and skip compression on their
+    incompressible hash keys. The ledger is hot random access, the block
+    store is written and read mostly in order. The block archive only
+    sees bulk appends and old range reads. The pufferfish cache keeps its
+    newest memoryEntries results in memory and at most diskEntries on disk.
+    Every store uses leveldb unless backend is set to "memory", for all
+    stores at the top level or for one store in its own settings.
+*/
+json defaultStorageConfig() {
+    json storage;
+    storage["backend"] = "leveldb";
+    storage["blockCacheMB"] = 64;
+    storage["ledger"] = {{"bloomBitsPerKey", 10}, {"writeBufferMB", 16}, {"maxOpenFiles", 1000}, {"compression", true}};
+    storage["blocks"] = {{"bloomBitsPerKey", 0}, {"writeBufferMB", 32}, {"maxOpenFiles", 1000}, {"compression", true}};
+    storage["archive"] = {{"bloomBitsPerKey", 0}, {"writeBufferMB", 8}, {"maxOpenFiles", 500}, {"compression", true}};
+    storage["txdb"] = {{"bloomBitsPerKey", 10}, {"writeBufferMB", 8}, {"maxOpenFiles", 500}, {"compression", false}};
+    storage["wallets"] = {{"bloomBitsPerKey", 0}, {"writeBufferMB", 8}, {"maxOpenFiles", 500}, {"compression", true}};
+    storage["pufferfish"] = {{"bloomBitsPerKey", 10}, {"writeBufferMB", 4}, {"maxOpenFiles", 200}, {"compression", false}, {"memoryEntries", 100000}, {"diskEntries", 2000000}};
+    return storage;
+}
+
+static void checkBackend(const json& value, const string& name) {
+    if (!value.is_string() || (value != "leveldb" && value != "memory")) {
+        throw std::runtime_error("Storage setting " + name + " must be \"leveldb\" or \"memory\", got " + value.dump());
+    }
+}
+
+static void checkType(const json& value, const json& expected, const string& name) {
+    bool matches = expected.is_boolean() ? value.is_boolean() : value.is_number_unsigned();
+    if (!matches) throw std::runtime_error("Storage setting " + name + " has an invalid value " + value.dump());
+}
+
+/*
+    Merges --storage-config overrides into the defaults. Only keys the
+    defaults have (plus backend) are accepted, with values of the same
+    type, so a typo fails at startup instead of silently opening a store
+    with its defaults.
+*/
+json mergeStorageConfig(const json& overrides) {
+    json storage = defaultStorageConfig();
+    if (!overrides.is_object()) throw std::runtime_error("Storage config must be a JSON object");
+    for(auto& item : overrides.items()) {
+        const string& key = item.key();
+        if (key == "backend") {
+            checkBackend(item.value(), key);
+            continue;
+        }
+        if (!storage.contains(key)) throw std::runtime_error("Unknown storage setting " + key);
+        if (!storage[key].is_object()) {
+            checkType(item.value(), storage[key], key);
+            continue;
+        }
+        if (!item.value().is_object()) throw std::runtime_error("Storage setting " + key + " must be an object");
+        for(auto& setting : item.value().items()) {
+            string name = key + "." + setting.key();
+            if (setting.key() == "backend") {
+                checkBackend(setting.value(), name);
+            } else if (!storage[key].contains(setting.key())) {
+                throw std::runtime_error("Unknown storage setting " + name);
+            } else {
+                checkType(setting.value(), storage[key][setting.key()], name);
+            }
+        }
+    }
+    storage.merge_patch(overrides);
+    return storage;
+}
+
+/*
+    Settings under storage[store] override leveldb's defaults, missing
+    keys are left alone.
+*/
+DataStoreProfile profileFromConfig(const json& storage, const string& store, std::shared_ptr<BlockCache> blockCache) {
+    DataStoreProfile profile;
+    profile.blockCache = blockCache;
+    if (storage.contains("backend")) profile.backend = storage["backend"];
+    if (!storage.contains(store)) return profile;
+    json settings = storage[store];
+    if (settings.contains("backend")) profile.backend = settings["backend"];
+    if (settings.contains("bloomBitsPerKey")) profile.bloomBitsPerKey = settings["bloomBitsPerKey"];
+    if (settings.contains("writeBufferMB")) profile.writeBufferSize = (size_t)settings["writeBufferMB"] * 1024 * 1024;
+    if (settings.contains("maxOpenFiles")) profile.maxOpenFiles = settings["maxOpenFiles"];
+    if (settings.contains("compression")) profile.compression = settings["compression"];
+    return profile;
+}
+
+json profileToJson(const DataStoreProfile& profile) {
+    json ret;
+    ret["backend"] = profile.backend;
+    ret["bloomBitsPerKey"] = profile.bloomBitsPerKey;
+    ret["writeBufferMB"] = profile.writeBufferSize / (1024 * 1024);
+    ret["maxOpenFiles"] = profile.maxOpenFiles;
+    ret["compression"] = profile.compression;
+    ret["sharedBlockCache"] = profile.blockCache != nullptr;
+    return ret;
+}
@@ -0,0 +1,47 @@
+#pragma once
+#include <atomic>
+#include <map>
+#include <memory>
+#include <string>
+#include "leveldb/cache.h"
+#include "../core/common.hpp"
+using namespace std;
+
+/*
+    LRU block cache shared by every store. Wraps leveldb's own LRU cache
+    and counts lookups so cache effectiveness can be reported.
+*/
+class BlockCache : public leveldb::Cache {
+    public:
+        BlockCache(size_t capacity);
+        ~BlockCache();
+        Handle* Insert(const leveldb::Slice& key, void* value, size_t charge, void (*deleter)(const leveldb::Slice& key, void* value)) override;
+        Handle* Lookup(const leveldb::Slice& key) override;
+        void Release(Handle* handle) override;
+        void* Value(Handle* handle) override;
+        void Erase(const leveldb::Slice& key) override;
+        uint64_t NewId() override;
+        void Prune() override;
+        size_t TotalCharge() const override;
+        map<string, uint64_t> getStats() const;
+    protected:
+        leveldb::Cache* cache;
+        size_t capacity;
+        std::atomic<uint64_t> hits;
+        std::atomic<uint64_t> misses;
+};
+
+struct DataStoreProfile {
+    // "leveldb" on disk or "memory" for a MemoryBackend that is gone on close
+    string backend = "leveldb";
+    int bloomBitsPerKey = 0;
+    size_t writeBufferSize = 4 * 1024 * 1024;
+    int maxOpenFiles = 1000;
+    bool compression = true;
+    std::shared_ptr<BlockCache> blockCache;
+};
+
+json defaultStorageConfig();
+json mergeStorageConfig(const json& overrides);
+DataStoreProfile profileFromConfig(const json& storage, const string& store, std::shared_ptr<BlockCache> blockCache);
+json profileToJson(const DataStoreProfile& profile);
@@ -0,0 +1,95 @@
+#include <cstring>
+#include <fstream>
+#include "tx_filter.hpp"
+using namespace std;
+
+#define TX_FILTER_BITS_PER_ITEM 16
+#define TX_FILTER_WORDS_PER_BLOCK 8
+#define TX_FILTER_BITS_PER_BLOCK 512
+#define TX_FILTER_PROBES 8
+#define TX_FILTER_MAGIC "PDNTXF01"
+
+static void probe(const SHA256Hash& txid, size_t numBlocks, size_t& block, uint64_t& h1, uint64_t& h2) {
+    uint64_t h0;
+    memcpy(&h0, txid.data(), 8);
+    memcpy(&h1, txid.data() + 8, 8);
+    memcpy(&h2, txid.data() + 16, 8);
+    block = h0 % numBlocks;
+    h2 |= 1;
+}
+
+TransactionFilter::TransactionFilter(size_t capacity) {
+    size_t numBlocks = max((size_t)1, (capacity * TX_FILTER_BITS_PER_ITEM) / TX_FILTER_BITS_PER_BLOCK);
+    this->capacity = capacity;
+    this->count = 0;
+    this->bits.resize(numBlocks * TX_FILTER_WORDS_PER_BLOCK, 0);
+}
+
+void TransactionFilter::add(const SHA256Hash& txid) {
+    size_t block;
+    uint64_t h1, h2;
+    probe(txid, this->bits.size() / TX_FILTER_WORDS_PER_BLOCK, block, h1, h2);
+    uint64_t* words = this->bits.data() + block * TX_FILTER_WORDS_PER_BLOCK;
+    for(int i = 0; i < TX_FILTER_PROBES; i++) {
+        uint64_t bit = (h1 + i * h2) % TX_FILTER_BITS_PER_BLOCK;
+        words[bit / 64] |= ((uint64_t)1 << (bit % 64));
+    }
+    this->count++;
+}
+
+bool TransactionFilter::mayContain(const SHA256Hash& txid) const {
+    size_t block;
+    uint64_t h1, h2;
+    probe(txid, this->bits.size() / TX_FILTER_WORDS_PER_BLOCK, block, h1, h2);
+    const uint64_t* words = this->bits.data() + block * TX_FILTER_WORDS_PER_BLOCK;
+    for(int i = 0; i < TX_FILTER_PROBES; i++) {
+        uint64_t bit = (h1 + i * h2) % TX_FILTER_BITS_PER_BLOCK;
+        if (!(words[bit / 64] & ((uint64_t)1 << (bit % 64)))) return false;
+    }
+    return true;
+}
+
+void TransactionFilter::clear() {
+    std::fill(this->bits.begin(), this->bits.end(), 0);
+    this->count = 0;
+}
+
+size_t TransactionFilter::getCapacity() const {
+    return this->capacity;
+}
+
+size_t TransactionFilter::getCount() const {
+    return this->count;
+}
+
+size_t TransactionFilter::getSizeInBytes() const {
+    return this->bits.size() * sizeof(uint64_t);
+}
+
+bool TransactionFilter::save(string path) const {
+    ofstream out(path, ios::binary | ios::trunc);
+    if (!out) return false;
+    uint64_t header[3] = {this->capacity, this->count, this->bits.size()};
+    out.write(TX_FILTER_MAGIC, 8);
+    out.write((const char*)header, sizeof(header));
+    out.write((const char*)this->bits.data(), this->bits.size() * sizeof(uint64_t));
+    return (bool)out;
+}
+
+bool TransactionFilter::load(string path) {
+    ifstream in(path, ios::binary);
+    if (!in) return false;
+    char magic[8];
+    uint64_t header[3];
+    in.read(magic, 8);
+    in.read((char*)header, sizeof(header));
+    if (!in || memcmp(magic, TX_FILTER_MAGIC, 8) != 0) return false;
+    if (header[2] == 0 || header[2] % TX_FILTER_WORDS_PER_BLOCK != 0) return false;
+    vector<uint64_t> loaded(header[2]);
+    in.read((char*)loaded.data(), loaded.size() * sizeof(uint64_t));
+    if (!in) return false;
+    this->capacity = header[0];
+    this->count = header[1];
+    this->bits = std::move(loaded);
+    return true;
+}
@@ -0,0 +1,31 @@
+#pragma once
+#include <string>
+#include <vector>
+#include "../core/common.hpp"
+using namespace std;
+
+/*
+    Blocked Bloom filter over transaction ids. Every id maps to a single
+    64 byte block and sets 8 bits inside it, so a lookup touches one cache
+    line. Ids are SHA256 hashes already, so their bytes are used directly
+    as the hash functions.
+
+    There is no removal: ids of popped blocks stay set and only cost an
+    extra false positive until the filter is next rebuilt.
+*/
+class TransactionFilter {
+    public:
+        TransactionFilter(size_t capacity);
+        void add(const SHA256Hash& txid);
+        bool mayContain(const SHA256Hash& txid) const;
+        void clear();
+        size_t getCapacity() const;
+        size_t getCount() const;
+        size_t getSizeInBytes() const;
+        bool save(string path) const;
+        bool load(string path);
+    protected:
+        size_t capacity;
+        size_t count;
+        vector<uint64_t> bits;
+};
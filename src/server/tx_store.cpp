@@ -1,49 +1,243 @@
 #include "tx_store.hpp"
+#include <cstdio>
 #include <thread>
+#include "../core/logger.hpp"
 
+#define TX_FILTER_MIN_CAPACITY 1000000
 
 TransactionStore::TransactionStore() {
+    this->filterNegatives = 0;
+    this->filterFalsePositives = 0;
+    this->filterRebuilding = false;
+}
+
+TransactionStore::~TransactionStore() {
+    this->waitForFilter();
+}
+
+/*
+    The txid filter is saved next to the db on a clean close and deleted
+    as soon as it is loaded again. After a crash there is no file and the
+    filter is rebuilt from the db, so it can never miss a txid that was
+    committed after it was saved.
+*/
+void TransactionStore::init(string path, DataStoreProfile profile) {
+    this->waitForFilter();
+    DataStore::init(path, profile);
+    std::unique_lock<std::mutex> ul(this->filterLock);
+    this->filter = std::make_unique<TransactionFilter>(TX_FILTER_MIN_CAPACITY);
+    bool loaded = this->filter->load(this->getFilterPath());
+    std::remove(this->getFilterPath().c_str());
+    if (!loaded) {
+        ul.unlock();
+        this->rebuildFilter(TX_FILTER_MIN_CAPACITY);
+    }
+}
+
+void TransactionStore::closeDB() {
+    this->waitForFilter();
+    {
+        std::unique_lock<std::mutex> ul(this->filterLock);
+        if (this->filter && this->db && !this->filter->save(this->getFilterPath())) {
+            Logger::logError("TransactionStore::closeDB", "Could not save transaction filter");
+        }
+        this->filter = nullptr;
+    }
+    DataStore::closeDB();
+}
+
+void TransactionStore::deleteDB() {
+    std::remove(this->getFilterPath().c_str());
+    DataStore::deleteDB();
+}
+
+void TransactionStore::clear() {
+    this->waitForFilter();
+    DataStore::clear();
+    std::unique_lock<std::mutex> ul(this->filterLock);
+    if (this->filter) this->filter->clear();
+}
+
+void TransactionStore::commitBatch(bool sync) {
+    DataStore::commitBatch(sync);
+    this->growFilter();
+}
+
+/*
+    Only resizes once staged txids are in the db, a rebuild reads from it.
+    The scan runs on filterBuilder so commits are not held up by it, the
+    current filter keeps answering until the larger one is swapped in.
+*/
+void TransactionStore::growFilter() {
+    size_t capacity = 0;
+    {
+        std::unique_lock<std::mutex> ul(this->filterLock);
+        if (this->filter && !this->filterRebuilding && this->filter->getCount() > this->filter->getCapacity()) {
+            capacity = this->filter->getCapacity() * 2;
+            this->filterRebuilding = true;
+        }
+    }
+    if (capacity == 0) return;
+    // the last builder has already swapped its filter in
+    if (this->filterBuilder.joinable()) this->filterBuilder.join();
+    this->filterBuilder = std::thread([this, capacity]() {
+        try {
+            this->rebuildFilter(capacity);
+        } catch(const std::exception& e) {
+            Logger::logError("TransactionStore::growFilter", e.what());
+            std::unique_lock<std::mutex> ul(this->filterLock);
+            this->filterRebuilding = false;
+            this->filterPending.clear();
+        }
+    });
+}
+
+void TransactionStore::waitForFilter() {
+    if (this->filterBuilder.joinable()) this->filterBuilder.join();
+}
+
+void TransactionStore::importSnapshot(string file) {
+    this->waitForFilter();
+    DataStore::importSnapshot(file);
+    this->rebuildFilter(TX_FILTER_MIN_CAPACITY);
+}
+
+string TransactionStore::getFilterPath() const {
+    return this->path + ".filter";
+}
+
+void TransactionStore::rebuildFilter(size_t capacity) {
+    Logger::logStatus("Building transaction filter for " + this->path);
+    {
+        std::unique_lock<std::mutex> ul(this->filterLock);
+        this->filterRebuilding = true;
+        this->filterPending.clear();
+    }
+    std::unique_ptr<TransactionFilter> rebuilt;
+    size_t count;
+    do {
+        rebuilt = std::make_unique<TransactionFilter>(capacity);
+        std::unique_ptr<leveldb::Iterator> it(db->NewIterator(leveldb::ReadOptions()));
+        for (it->SeekToFirst(); it->Valid(); it->Next()) {
+            if (it->key().size() != 32) continue;
+            SHA256Hash txid;
+            memcpy(txid.data(), it->key().data(), 32);
+            rebuilt->add(txid);
+        }
+        count = rebuilt->getCount();
+        capacity = max(capacity, count * 2);
+    } while (count > rebuilt->getCapacity());
+    std::unique_lock<std::mutex> ul(this->filterLock);
+    // txids added after the scan started may not have been seen by it
+    for(auto& txid : this->filterPending) rebuilt->add(txid);
+    this->filterPending.clear();
+    this->filter = std::move(rebuilt);
+    this->filterRebuilding = false;
+}
+
+bool TransactionStore::mayContain(const SHA256Hash& txid) const {
+    std::unique_lock<std::mutex> ul(this->filterLock);
+    if (!this->filter) return true;
+    if (this->filter->mayContain(txid)) return true;
+    this->filterNegatives++;
+    return false;
+}
+
+void TransactionStore::addToFilter(const SHA256Hash& txid) {
+    std::unique_lock<std::mutex> ul(this->filterLock);
+    if (this->filter) this->filter->add(txid);
+    if (this->filterRebuilding) this->filterPending.push_back(txid);
+}
+
+json TransactionStore::getStats() const {
+    json ret = DataStore::getStats();
+    std::unique_lock<std::mutex> ul(this->filterLock);
+    if (this->filter) {
+        json filterStats;
+        filterStats["capacity"] = this->filter->getCapacity();
+        filterStats["items"] = this->filter->getCount();
+        filterStats["bytes"] = this->filter->getSizeInBytes();
+        filterStats["negatives"] = this->filterNegatives;
+        filterStats["falsePositives"] = this->filterFalsePositives;
+        ret["filter"] = filterStats;
+    }
+    return ret;
+}
+
+void TransactionStore::countFalsePositive() const {
+    std::unique_lock<std::mutex> ul(this->filterLock);
+    this->filterFalsePositives++;
 }
 
 bool TransactionStore::hasTransaction(const Transaction &t) {
     SHA256Hash txHash = t.hashContents();
+    if (!this->mayContain(txHash)) return false;
     leveldb::Slice key = leveldb::Slice((const char*) txHash.data(), txHash.size());
     string value;
     leveldb::Status status = db->Get(leveldb::ReadOptions(),key, &value);
+    if (!status.ok()) this->countFalsePositive();
     return (status.ok());
 }
 
 uint32_t TransactionStore::blockForTransaction(Transaction &t) {
-    SHA256Hash txHash = t.hashContents();
-    leveldb::Slice key = leveldb::Slice((const char*) txHash.data(), txHash.size());
-    string value;
-    leveldb::Status status = db->Get(leveldb::ReadOptions(),key, &value);
-    if (!status.ok()) return 0; //throw std::runtime_error("Could not find specified transaction");
-    uint32_t val = *((uint32_t*)value.c_str());
-    return val;
+    return this->blockForTransactionId(t.hashContents());
 }
 
 uint32_t TransactionStore::blockForTransactionId(SHA256Hash txHash) const{
+    TransactionPosition position;
+    if (!this->getTransactionPosition(txHash, position)) return 0;
+    return position.blockId;
+}
+
+/*
+    Values are the block id followed by the index of the transaction in
+    that block. Entries from older nodes only hold the block id.
+*/
+bool TransactionStore::getTransactionPosition(SHA256Hash txHash, TransactionPosition& position) const{
+    if (!this->mayContain(txHash)) return false;
     leveldb::Slice key = leveldb::Slice((const char*) txHash.data(), txHash.size());
     string value;
     leveldb::Status status = db->Get(leveldb::ReadOptions(),key, &value);
-    if (!status.ok()) return 0; //throw std::runtime_error("Could not find specified transaction");
-    uint32_t val = *((uint32_t*)value.c_str());
-    return val;
+    if (!status.ok()) {
+        this->countFalsePositive();
+        return false;
+    }
+    position.blockId = *((uint32_t*)value.c_str());
+    position.txIndex = UNKNOWN_TX_INDEX;
+    if (value.size() >= sizeof(TransactionPosition)) position.txIndex = *((uint32_t*)(value.c_str() + sizeof(uint32_t)));
+    return true;
 }
 
-void TransactionStore::insertTransaction(Transaction& t, uint32_t blockId) {
+void TransactionStore::insertTransaction(Transaction& t, uint32_t blockId, uint32_t txIndex) {
     SHA256Hash txHash = t.hashContents();
     leveldb::Slice key = leveldb::Slice((const char*) txHash.data(), txHash.size());
-    uint32_t dummy = blockId;
-    leveldb::Slice slice = leveldb::Slice((const char*)&dummy, sizeof(uint32_t));
-    leveldb::Status status = db->Put(leveldb::WriteOptions(), key, slice);
-    if(!status.ok()) throw std::runtime_error("Could not write transaction hash to tx db : " + status.ToString());
+    uint32_t position[2] = {blockId, txIndex};
+    leveldb::Slice slice = leveldb::Slice((const char*)position, sizeof(position));
+    this->addToFilter(txHash);
+    this->put(key, slice);
+    if (!this->isBatching()) this->growFilter();
 }
 
 void TransactionStore::removeTransaction(Transaction& t) {
-    SHA256Hash txHash = t.hashContents();
-    leveldb::Slice key = leveldb::Slice((const char*) txHash.data(), txHash.size());
-    leveldb::Status status = db->Delete(leveldb::WriteOptions(), key);
-    if(!status.ok()) throw std::runtime_error("Could not remove transaction hash from tx db : " + status.ToString());
+    this->removeTransactionId(t.hashContents());
+}
+
+/*
+    Full scan, only used to cut the store back after an interrupted sync
+    when the blocks above height may no longer be readable.
+*/
+void TransactionStore::removeBlocksAbove(uint32_t height) {
+    this->startBatch();
+    std::unique_ptr<leveldb::Iterator> it(db->NewIterator(leveldb::ReadOptions()));
+    for(it->SeekToFirst(); it->Valid(); it->Next()) {
+        if (it->value().size() < sizeof(uint32_t)) continue;
+        uint32_t blockId = *((const uint32_t*)it->value().data());
+        if (blockId > height) this->remove(it->key());
+    }
+    this->commitBatch(true);
+}
+
+void TransactionStore::removeTransactionId(SHA256Hash txid) {
+    leveldb::Slice key = leveldb::Slice((const char*) txid.data(), txid.size());
+    this->remove(key);
 }
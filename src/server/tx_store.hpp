@@ -1,17 +1,57 @@
 #pragma once
 #include <string>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
 #include "leveldb/db.h"
 #include "../core/transaction.hpp"
 #include "data_store.hpp"
+#include "tx_filter.hpp"
 using namespace std;
 
+// txdb entries written before positions were stored only know the block
+#define UNKNOWN_TX_INDEX UINT32_MAX
+
+struct TransactionPosition {
+    uint32_t blockId;
+    uint32_t txIndex;
+};
 
 class TransactionStore : public DataStore {
     public:
         TransactionStore();
+        ~TransactionStore();
+        void init(string path, DataStoreProfile profile = DataStoreProfile());
+        void closeDB();
+        void deleteDB();
+        void clear();
+        void commitBatch(bool sync = false);
+        void importSnapshot(string file);
+        json getStats() const;
         bool hasTransaction(const Transaction &t);
         uint32_t blockForTransaction(Transaction &t);
         uint32_t blockForTransactionId(SHA256Hash txid) const;
-        void insertTransaction(Transaction& t, uint32_t blockId);
+        bool getTransactionPosition(SHA256Hash txid, TransactionPosition& position) const;
+        void insertTransaction(Transaction& t, uint32_t blockId, uint32_t txIndex);
         void removeTransaction(Transaction & t);
+        void removeBlocksAbove(uint32_t height);
+        void removeTransactionId(SHA256Hash txid);
+    protected:
+        bool mayContain(const SHA256Hash& txid) const;
+        void addToFilter(const SHA256Hash& txid);
+        void rebuildFilter(size_t capacity);
+        void growFilter();
+        void waitForFilter();
+        void countFalsePositive() const;
+        string getFilterPath() const;
+        std::unique_ptr<TransactionFilter> filter;
+        mutable std::mutex filterLock;
+        mutable uint64_t filterNegatives;
+        mutable uint64_t filterFalsePositives;
+        // a larger filter is built here while commits carry on, txids
+        // added meanwhile are kept in filterPending and copied into it
+        std::thread filterBuilder;
+        bool filterRebuilding;
+        vector<SHA256Hash> filterPending;
 };
@@ -0,0 +1,118 @@
+#include <memory>
+#include "wallet_store.hpp"
+
+#define WALLET_KEY_SIZE 33
+
+static void writeBigEndianUint32(uint8_t* buffer, uint32_t x) {
+    buffer[0] = x >> 24;
+    buffer[1] = x >> 16;
+    buffer[2] = x >> 8;
+    buffer[3] = x;
+}
+
+static uint32_t readBigEndianUint32(const uint8_t* buffer) {
+    return ((uint32_t)buffer[0] << 24) | ((uint32_t)buffer[1] << 16) | ((uint32_t)buffer[2] << 8) | (uint32_t)buffer[3];
+}
+
+static void walletKey(uint8_t* key, const PublicWalletAddress& wallet, uint32_t blockId, uint32_t txIndex) {
+    memcpy(key, wallet.data(), 25);
+    writeBigEndianUint32(key + 25, blockId);
+    writeBigEndianUint32(key + 29, txIndex);
+}
+
+WalletStore::WalletStore() {
+}
+
+bool WalletStore::isEmpty() const {
+    std::unique_ptr<leveldb::Iterator> it(db->NewIterator(leveldb::ReadOptions()));
+    it->SeekToFirst();
+    return !it->Valid();
+}
+
+// full scan, see TransactionStore::removeBlocksAbove
+void WalletStore::removeBlocksAbove(uint32_t height) {
+    this->startBatch();
+    std::unique_ptr<leveldb::Iterator> it(db->NewIterator(leveldb::ReadOptions()));
+    for(it->SeekToFirst(); it->Valid(); it->Next()) {
+        if (it->key().size() != WALLET_KEY_SIZE) continue;
+        if (readBigEndianUint32((const uint8_t*)it->key().data() + 25) > height) this->remove(it->key());
+    }
+    this->commitBatch(true);
+}
+
+void WalletStore::addBlock(Block& block) {
+    uint8_t key[WALLET_KEY_SIZE];
+    for(int i = 0; i < block.getTransactions().size(); i++) {
+        Transaction& t = block.getTransactions()[i];
+        walletKey(key, t.fromWallet(), block.getId(), i);
+        this->put(leveldb::Slice((const char*)key, WALLET_KEY_SIZE), leveldb::Slice("", 0));
+        walletKey(key, t.toWallet(), block.getId(), i);
+        this->put(leveldb::Slice((const char*)key, WALLET_KEY_SIZE), leveldb::Slice("", 0));
+    }
+}
+
+void WalletStore::removeBlock(Block& block) {
+    uint8_t key[WALLET_KEY_SIZE];
+    for(int i = 0; i < block.getTransactions().size(); i++) {
+        Transaction& t = block.getTransactions()[i];
+        walletKey(key, t.fromWallet(), block.getId(), i);
+        this->remove(leveldb::Slice((const char*)key, WALLET_KEY_SIZE));
+        walletKey(key, t.toWallet(), block.getId(), i);
+        this->remove(leveldb::Slice((const char*)key, WALLET_KEY_SIZE));
+    }
+}
+
+void WalletStore::removeTransaction(const PublicWalletAddress& wallet, TransactionPosition position) {
+    uint8_t key[WALLET_KEY_SIZE];
+    walletKey(key, wallet, position.blockId, position.txIndex);
+    this->remove(leveldb::Slice((const char*)key, WALLET_KEY_SIZE));
+}
+
+vector<TransactionPosition> WalletStore::getTransactionsForWallet(const PublicWalletAddress& wallet) const {
+    leveldb::Slice prefix((const char*)wallet.data(), 25);
+    std::unique_ptr<leveldb::Iterator> it(db->NewIterator(leveldb::ReadOptions()));
+    vector<TransactionPosition> ret;
+    for(it->Seek(prefix); it->Valid() && it->key().starts_with(prefix); it->Next()) {
+        const uint8_t* key = (const uint8_t*)it->key().data();
+        ret.push_back({readBigEndianUint32(key + 25), readBigEndianUint32(key + 29)});
+    }
+    return ret;
+}
+
+/*
+    At most limit entries strictly after (or, newest first, before) the
+    cursor position, in chain order. The scan stops as soon as the page
+    is full.
+*/
+vector<TransactionPosition> WalletStore::getTransactionsForWallet(const PublicWalletAddress& wallet, uint32_t limit, const TransactionPosition* after, bool newestFirst) const {
+    leveldb::Slice prefix((const char*)wallet.data(), 25);
+    std::unique_ptr<leveldb::Iterator> it(db->NewIterator(leveldb::ReadOptions()));
+    vector<TransactionPosition> ret;
+    uint8_t start[WALLET_KEY_SIZE];
+    if (after) {
+        walletKey(start, wallet, after->blockId, after->txIndex);
+    } else {
+        walletKey(start, wallet, newestFirst ? UINT32_MAX : 0, newestFirst ? UINT32_MAX : 0);
+    }
+    leveldb::Slice startKey((const char*)start, WALLET_KEY_SIZE);
+    it->Seek(startKey);
+    if (newestFirst) {
+        if (it->Valid()) {
+            it->Prev();
+        } else {
+            it->SeekToLast();
+        }
+    } else if (after && it->Valid() && it->key() == startKey) {
+        it->Next();
+    }
+    while (ret.size() < limit && it->Valid() && it->key().starts_with(prefix)) {
+        const uint8_t* key = (const uint8_t*)it->key().data();
+        ret.push_back({readBigEndianUint32(key + 25), readBigEndianUint32(key + 29)});
+        if (newestFirst) {
+            it->Prev();
+        } else {
+            it->Next();
+        }
+    }
+    return ret;
+}
@@ -0,0 +1,27 @@
+#pragma once
+#include <string>
+#include <vector>
+#include "leveldb/db.h"
+#include "../core/common.hpp"
+#include "../core/block.hpp"
+#include "data_store.hpp"
+#include "tx_store.hpp"
+using namespace std;
+
+/*
+    Index of every transaction touching a wallet. Keys are
+    wallet | blockId | txIndex with the integers stored big endian, so a
+    prefix scan returns a wallet's history in chain order and each entry
+    points straight at the transaction inside its block.
+*/
+class WalletStore : public DataStore {
+    public:
+        WalletStore();
+        bool isEmpty() const;
+        void addBlock(Block& block);
+        void removeBlock(Block& block);
+        void removeTransaction(const PublicWalletAddress& wallet, TransactionPosition position);
+        void removeBlocksAbove(uint32_t height);
+        vector<TransactionPosition> getTransactionsForWallet(const PublicWalletAddress& wallet) const;
+        vector<TransactionPosition> getTransactionsForWallet(const PublicWalletAddress& wallet, uint32_t limit, const TransactionPosition* after, bool newestFirst) const;
+};
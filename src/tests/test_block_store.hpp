@@ -23,21 +23,7 @@ TEST(test_blockstore_stores_block) {
     ASSERT_EQUAL(blocks.hasBlock(2), true);
     Block b = blocks.getBlock(2);
     ASSERT_TRUE(b==a);
-
-    // test we can get transactions for wallets
-    PublicWalletAddress to = receiver.getAddress();
-    vector<SHA256Hash> txIdsTo = blocks.getTransactionsForWallet(to);
-    ASSERT_EQUAL(txIdsTo.size(), 5);
-    PublicWalletAddress from = miner.getAddress();
-    vector<SHA256Hash> txIdsFrom = blocks.getTransactionsForWallet(from);
-    ASSERT_EQUAL(txIdsFrom.size(), 6);
-
-    // test transactions are removed
-    blocks.removeBlockWalletTransactions(b);
-    txIdsTo = blocks.getTransactionsForWallet(to);
-    txIdsFrom = blocks.getTransactionsForWallet(from);
-    ASSERT_EQUAL(txIdsTo.size(), 0);
-    ASSERT_EQUAL(txIdsFrom.size(), 0);
+    ASSERT_TRUE(blocks.getTransaction(2, 3) == a.getTransactions()[3]);
     blocks.closeDB();
     blocks.deleteDB();
 }
@@ -105,17 +91,552 @@ TEST(test_blockstore_returns_valid_raw_data) {
 }
 
 
-TEST(test_blockstore_stores_bigint) {
+TEST(test_blockstore_stores_total_work) {
     BlockStore blocks;
     blocks.init("./test-data/tmpdb");
 
-    Bigint a = 2;
-    Bigint b = a.pow(10);
+    UInt256 b = UInt256::pow2(200) + UInt256::pow2(10);
     blocks.setTotalWork(b);
 
-    Bigint c = blocks.getTotalWork();
+    UInt256 c = blocks.getTotalWork();
 
     ASSERT_TRUE(b==c);
+    ASSERT_EQUAL(to_string(c), "1606938044258990275541962092341162602522202993782792835302400");
+    blocks.closeDB();
+    blocks.deleteDB();
+}
+
+TEST(test_blockstore_segments_roundtrip) {
+    BlockStore blocks;
+    blocks.init("./test-data/tmpdb");
+    blocks.enableSegments("./test-data/tmpdb_segments");
+    User miner;
+    User receiver;
+    vector<Block> chain;
+    for (int i = 0; i < 10; i++) {
+        Block a;
+        a.setId(i+1);
+        a.addTransaction(miner.mine());
+        for(int j = 0; j < i; j++) {
+            a.addTransaction(miner.send(receiver, 1));
+        }
+        blocks.setBlock(a);
+        chain.push_back(a);
+    }
+    blocks.setBlockCount(10);
+
+    for (int i = 0; i < 10; i++) {
+        ASSERT_TRUE(blocks.getBlock(i+1) == chain[i]);
+        std::pair<uint8_t*, size_t> raw = blocks.getRawData(i+1);
+        ASSERT_EQUAL(raw.second, BLOCKHEADER_BUFFER_SIZE + i * TRANSACTIONINFO_BUFFER_SIZE + TRANSACTIONINFO_BUFFER_SIZE);
+        BlockHeader header = blockHeaderFromBuffer((const char*)raw.first);
+        ASSERT_EQUAL(header.id, i+1);
+        free(raw.first);
+    }
+
+    // rewriting a block drops everything after it
+    Block replacement;
+    replacement.setId(5);
+    replacement.addTransaction(miner.mine());
+    blocks.setBlock(replacement);
+    ASSERT_TRUE(blocks.getBlock(5) == replacement);
+    ASSERT_EQUAL(blocks.hasBlock(6), false);
+    Block next;
+    next.setId(6);
+    next.addTransaction(miner.mine());
+    blocks.setBlock(next);
+    blocks.setBlockCount(5);
+
+    // appends past the durable block count are dropped on reopen
+    blocks.closeDB();
+    blocks.init("./test-data/tmpdb");
+    blocks.enableSegments("./test-data/tmpdb_segments");
+    ASSERT_TRUE(blocks.getBlock(5) == replacement);
+    ASSERT_TRUE(blocks.getBlock(4) == chain[3]);
+    ASSERT_EQUAL(blocks.hasBlock(6), false);
+    blocks.closeDB();
+    blocks.deleteDB();
+}
+
+TEST(test_blockstore_segments_drop_popped_blocks) {
+    BlockStore blocks;
+    blocks.init("./test-data/tmpdb");
+    blocks.enableSegments("./test-data/tmpdb_segments");
+    User miner;
+    User receiver;
+    vector<Block> chain;
+    for (int i = 1; i <= 3; i++) {
+        Block a;
+        a.setId(i);
+        a.addTransaction(miner.mine());
+        blocks.setBlock(a);
+        chain.push_back(a);
+    }
+    blocks.setBlockCount(3);
+    std::pair<uint8_t*, size_t> raw = blocks.getRawData(2);
+    string original((const char*)raw.first, raw.second);
+    free(raw.first);
+
+    Block fork;
+    fork.setId(2);
+    fork.setTimestamp(chain[1].getTimestamp() + 1);
+    fork.addTransaction(miner.mine());
+    fork.addTransaction(miner.send(receiver, 1));
+    vector<string> seen;
+    bool popped = false;
+    blocks.readRawRange(1, 3, [&](std::string_view view) {
+        if (seen.empty()) {
+            // a reorg to a shorter chain while the views are out
+            blocks.startBatch();
+            blocks.setBlockCount(1);
+            blocks.commitBatch();
+            popped = !blocks.hasBlock(2) && !blocks.hasBlock(3);
+            blocks.setBlock(fork);
+            blocks.setBlockCount(2);
+        }
+        seen.push_back(string(view));
+    });
+    ASSERT_TRUE(popped);
+    ASSERT_EQUAL(seen.size(), 3);
+    ASSERT_TRUE(seen[1] == original);
+    ASSERT_EQUAL(blocks.hasBlock(3), false);
+    ASSERT_TRUE(blocks.getBlock(2) == fork);
+
+    // compaction packs the fork block down over the popped ones
+    string begin;
+    string end;
+    blocks.nextCompactionRange(begin, end);
+    ASSERT_TRUE(blocks.getBlock(1) == chain[0]);
+    ASSERT_TRUE(blocks.getBlock(2) == fork);
+    Block next;
+    next.setId(3);
+    next.setTimestamp(chain[2].getTimestamp() + 1);
+    next.addTransaction(miner.mine());
+    blocks.setBlock(next);
+    blocks.setBlockCount(3);
+    blocks.closeDB();
+    blocks.init("./test-data/tmpdb");
+    blocks.enableSegments("./test-data/tmpdb_segments");
+    ASSERT_TRUE(blocks.getBlock(2) == fork);
+    ASSERT_TRUE(blocks.getBlock(3) == next);
+    blocks.closeDB();
+    blocks.deleteDB();
+}
+
+class InspectableSegmentStore : public BlockSegmentStore {
+    public:
+        uint64_t offsetOf(uint32_t blockId) {
+            return this->index[blockId - 1].offset;
+        }
+        uint64_t getWriteOffset() {
+            return this->writeOffset;
+        }
+};
+
+TEST(test_segment_store_reclaims_after_views) {
+    InspectableSegmentStore segments;
+    segments.init("./test-data/tmpdb_segments");
+    User miner;
+    vector<Block> chain;
+    for (int i = 1; i <= 4; i++) {
+        Block a;
+        a.setId(i);
+        a.addTransaction(miner.mine());
+        segments.setBlock(a);
+        chain.push_back(a);
+    }
+    uint64_t blockSize = segments.offsetOf(2);
+    // without views out, a pop is written over straight away
+    segments.truncate(3);
+    ASSERT_EQUAL(segments.getWriteOffset(), 3 * blockSize);
+    segments.setBlock(chain[3]);
+    ASSERT_EQUAL(segments.offsetOf(4), 3 * blockSize);
+
+    segments.readRawRange(2, 2, [&](std::string_view view) {
+        segments.truncate(1);
+        segments.setBlock(chain[1]);
+        ASSERT_FALSE(segments.reclaim());
+    });
+    // appended after the bytes the view pointed at
+    ASSERT_EQUAL(segments.offsetOf(2), 4 * blockSize);
+    ASSERT_EQUAL(segments.hasBlock(3), false);
+    ASSERT_TRUE(segments.reclaim());
+    ASSERT_EQUAL(segments.offsetOf(2), blockSize);
+    ASSERT_EQUAL(segments.getWriteOffset(), 2 * blockSize);
+    ASSERT_TRUE(segments.getBlock(2) == chain[1]);
+    ASSERT_FALSE(segments.reclaim());
+    segments.closeDB();
+    segments.init("./test-data/tmpdb_segments");
+    ASSERT_TRUE(segments.getBlock(2) == chain[1]);
+    ASSERT_EQUAL(segments.getBlockCount(), 2);
+    segments.deleteDB();
+}
+
+TEST(test_segment_store_reclaim_keeps_blocks_larger_than_the_gap) {
+    InspectableSegmentStore segments;
+    segments.init("./test-data/tmpdb_segments");
+    User miner;
+    User receiver;
+    for (int i = 1; i <= 2; i++) {
+        Block a;
+        a.setId(i);
+        a.addTransaction(miner.mine());
+        segments.setBlock(a);
+    }
+    uint64_t blockSize = segments.offsetOf(2);
+    Block larger;
+    larger.setId(2);
+    larger.addTransaction(miner.mine());
+    for (int j = 0; j < 4; j++) larger.addTransaction(miner.send(receiver, j + 1));
+    segments.readRawRange(2, 2, [&](std::string_view view) {
+        segments.truncate(1);
+        segments.setBlock(larger);
+    });
+    // the gap is one small block, moving the larger one down would overlap it
+    ASSERT_EQUAL(segments.offsetOf(2), 2 * blockSize);
+    ASSERT_FALSE(segments.reclaim());
+    ASSERT_EQUAL(segments.offsetOf(2), 2 * blockSize);
+    ASSERT_TRUE(segments.getBlock(2) == larger);
+    Block next;
+    next.setId(3);
+    next.addTransaction(miner.mine());
+    segments.setBlock(next);
+    ASSERT_TRUE(segments.offsetOf(3) > segments.offsetOf(2));
+    segments.closeDB();
+    segments.init("./test-data/tmpdb_segments");
+    ASSERT_TRUE(segments.getBlock(2) == larger);
+    ASSERT_TRUE(segments.getBlock(3) == next);
+    segments.deleteDB();
+}
+
+TEST(test_blockstore_range_reads) {
+    BlockStore blocks;
+    blocks.init("./test-data/tmpdb");
+    User miner;
+    User receiver;
+    vector<Block> stored;
+    for (int i = 1; i <= 5; i++) {
+        Block a;
+        a.setId(i);
+        a.addTransaction(miner.mine());
+        for(int j = 0; j < 8 - i; j++) {
+            a.addTransaction(miner.send(receiver, j + 1));
+        }
+        blocks.setBlock(a);
+        stored.push_back(a);
+    }
+    // replacing a block with a shorter one drops its old tail
+    Block shorter;
+    shorter.setId(3);
+    shorter.addTransaction(miner.mine());
+    blocks.setBlock(shorter);
+    stored[2] = shorter;
+    ASSERT_TRUE(blocks.getTransaction(3, 0) == shorter.getTransactions()[0]);
+    bool threw = false;
+    try {
+        blocks.getTransaction(3, 2);
+    } catch(...) {
+        threw = true;
+    }
+    ASSERT_TRUE(threw);
+
+    std::pair<uint8_t*, size_t> range = blocks.getRawRange(2, 5);
+    size_t offset = 0;
+    for (int i = 2; i <= 5; i++) {
+        ASSERT_TRUE(blocks.getBlock(i) == stored[i - 1]);
+        std::pair<uint8_t*, size_t> single = blocks.getRawData(i);
+        ASSERT_TRUE(offset + single.second <= range.second);
+        ASSERT_EQUAL(memcmp(range.first + offset, single.first, single.second), 0);
+        offset += single.second;
+        free(single.first);
+    }
+    ASSERT_EQUAL(offset, range.second);
+    free(range.first);
+    blocks.closeDB();
+    blocks.deleteDB();
+}
+
+class LegacyBlockStore : public BlockStore {
+    public:
+        void setLegacyBlock(Block& block) {
+            uint32_t blockId = block.getId();
+            BlockHeader header = block.serialize();
+            this->put(leveldb::Slice((const char*)&blockId, sizeof(uint32_t)), leveldb::Slice((const char*)&header, sizeof(BlockHeader)));
+            for(uint32_t i = 0; i < block.getTransactions().size(); i++) {
+                uint32_t transactionId[2] = {blockId, i};
+                TransactionInfo t = block.getTransactions()[i].serialize();
+                this->put(leveldb::Slice((const char*)transactionId, 2*sizeof(uint32_t)), leveldb::Slice((const char*)&t, sizeof(TransactionInfo)));
+                // the old wallet index, wallet followed by txid
+                Transaction& tx = block.getTransactions()[i];
+                SHA256Hash txid = tx.hashContents();
+                string walletKey = string((const char*)tx.toWallet().data(), 25) + string((const char*)txid.data(), 32);
+                this->put(leveldb::Slice(walletKey), leveldb::Slice("", 0));
+            }
+        }
+        void dropSchemaVersion() {
+            this->remove(leveldb::Slice("SCHEMA_VERSION"));
+        }
+        size_t countLegacyWalletKeys() {
+            size_t count = 0;
+            std::unique_ptr<leveldb::Iterator> it(db->NewIterator(leveldb::ReadOptions()));
+            for(it->SeekToFirst(); it->Valid(); it->Next()) {
+                if (it->key().size() == 25 + 32) count++;
+            }
+            return count;
+        }
+};
+
+TEST(test_blockstore_migrates_legacy_keys) {
+    User miner;
+    User receiver;
+    vector<Block> stored;
+    {
+        LegacyBlockStore legacy;
+        legacy.init("./test-data/tmpdb");
+        legacy.dropSchemaVersion();
+        for (int i = 1; i <= 3; i++) {
+            Block a;
+            a.setId(i);
+            Transaction fee = miner.mine();
+            fee.setTimestamp(i);
+            a.addTransaction(fee);
+            a.addTransaction(miner.send(receiver, i));
+            legacy.setLegacyBlock(a);
+            stored.push_back(a);
+        }
+        legacy.setBlockCount(3);
+        legacy.closeDB();
+    }
+    LegacyBlockStore blocks;
+    blocks.init("./test-data/tmpdb");
+    ASSERT_EQUAL(blocks.needsMigration(), true);
+    ASSERT_EQUAL(blocks.countLegacyWalletKeys(), 6);
+    blocks.migrateSchema();
+    ASSERT_EQUAL(blocks.getSchemaVersion(), BLOCK_STORE_SCHEMA_VERSION);
+    ASSERT_EQUAL(blocks.countLegacyWalletKeys(), 0);
+    for (int i = 1; i <= 3; i++) {
+        ASSERT_TRUE(blocks.getBlock(i) == stored[i - 1]);
+    }
+    blocks.closeDB();
+    blocks.init("./test-data/tmpdb");
+    ASSERT_EQUAL(blocks.needsMigration(), false);
+    ASSERT_EQUAL(blocks.getBlockCount(), 3);
+    blocks.closeDB();
+    blocks.deleteDB();
+}
+
+TEST(test_blockstore_indexes_block_hashes) {
+    BlockStore blocks;
+    blocks.init("./test-data/tmpdb");
+    ASSERT_EQUAL(blocks.hasHashIndex(), true);
+    User miner;
+    Block a;
+    a.setId(4);
+    a.addTransaction(miner.mine());
+    blocks.setBlock(a);
+    uint32_t blockId = 0;
+    ASSERT_EQUAL(blocks.getBlockIdForHash(a.getHash(), blockId), true);
+    ASSERT_EQUAL(blockId, 4);
+    blocks.removeBlockHash(a.getHash());
+    ASSERT_EQUAL(blocks.getBlockIdForHash(a.getHash(), blockId), false);
+    blocks.closeDB();
+    blocks.deleteDB();
+}
+
+TEST(test_blockstore_sync_window_rollback_keys) {
+    BlockStore blocks;
+    blocks.init("./test-data/tmpdb");
+    ChainTip durable;
+    ASSERT_EQUAL(blocks.getSyncWindow(durable), false);
+    durable.count = 5;
+    durable.difficulty = 16;
+    durable.lastHash = NULL_SHA256_HASH;
+    durable.headerChecksum = NULL_SHA256_HASH;
+    durable.totalWork = 12345;
+    blocks.setSyncWindow(durable);
+    User miner;
+    Block a;
+    a.setId(5);
+    a.addTransaction(miner.mine());
+    blocks.setBlock(a);
+    Block b;
+    b.setId(6);
+    b.setTimestamp(a.getTimestamp() + 1);
+    b.addTransaction(miner.mine());
+    blocks.setBlock(b);
+
+    ChainTip read;
+    ASSERT_EQUAL(blocks.getSyncWindow(read), true);
+    ASSERT_EQUAL(read.count, 5);
+    ASSERT_TRUE(read.totalWork == UInt256(12345));
+    blocks.removeHashesAbove(read.count);
+    uint32_t blockId = 0;
+    ASSERT_EQUAL(blocks.getBlockIdForHash(a.getHash(), blockId), true);
+    ASSERT_EQUAL(blocks.getBlockIdForHash(b.getHash(), blockId), false);
+    blocks.clearSyncWindow();
+    ASSERT_EQUAL(blocks.getSyncWindow(read), false);
+    blocks.closeDB();
+    blocks.deleteDB();
+}
+
+TEST(test_blockstore_prunes_transactions) {
+    BlockStore blocks;
+    blocks.init("./test-data/tmpdb");
+    User miner;
+    User receiver;
+    for(uint32_t i = 1; i <= 3; i++) {
+        Block b;
+        b.setId(i);
+        b.addTransaction(miner.mine());
+        b.addTransaction(miner.send(receiver, i));
+        blocks.setBlock(b);
+    }
+    blocks.setBlockCount(3);
+
+    blocks.startBatch();
+    blocks.pruneBlock(1);
+    blocks.pruneBlock(2);
+    blocks.setPrunedHeight(2);
+    ASSERT_EQUAL(blocks.isPruned(1), false);
+    blocks.commitBatch();
+    ASSERT_EQUAL(blocks.isPruned(2), true);
+    ASSERT_EQUAL(blocks.isPruned(3), false);
+    blocks.compactBlocks(1, 2);
+
+    // headers stay, bodies are gone
+    ASSERT_EQUAL(blocks.getBlockHeader(2).id, 2);
+    bool threw = false;
+    try {
+        blocks.getBlock(2);
+    } catch(...) {
+        threw = true;
+    }
+    ASSERT_TRUE(threw);
+    ASSERT_EQUAL(blocks.getBlock(3).getTransactions().size(), 2);
+
+    // pruned height survives a restart
+    blocks.closeDB();
+    blocks.init("./test-data/tmpdb");
+    ASSERT_EQUAL(blocks.getPrunedHeight(), 2);
+    blocks.closeDB();
+    blocks.deleteDB();
+}
+
+TEST(test_blockstore_routes_archived_blocks) {
+    BlockStore blocks;
+    blocks.init("./test-data/tmpdb");
+    blocks.enableArchive("./test-data/tmparchive");
+    User miner;
+    User receiver;
+    vector<Block> added;
+    for(uint32_t i = 1; i <= 4; i++) {
+        Block b;
+        b.setId(i);
+        b.addTransaction(miner.mine());
+        b.addTransaction(miner.send(receiver, i));
+        blocks.setBlock(b);
+        added.push_back(b);
+    }
+    blocks.setBlockCount(4);
+    std::pair<uint8_t*, size_t> before = blocks.getRawRange(1, 4);
+
+    blocks.archiveBlocks(1, 2);
+    ASSERT_EQUAL(blocks.getArchivedHeight(), 2);
+    for(uint32_t i = 1; i <= 4; i++) {
+        ASSERT_TRUE(blocks.getBlock(i) == added[i - 1]);
+        ASSERT_EQUAL(blocks.getBlockHeader(i).id, i);
+    }
+    ASSERT_TRUE(blocks.getTransaction(2, 1) == added[1].getTransactions()[1]);
+
+    // ranges spanning both tiers come back in one piece
+    std::pair<uint8_t*, size_t> after = blocks.getRawRange(1, 4);
+    ASSERT_EQUAL(after.second, before.second);
+    ASSERT_EQUAL(memcmp(after.first, before.first, before.second), 0);
+    free(before.first);
+    free(after.first);
+
+    blocks.closeDB();
+    blocks.init("./test-data/tmpdb");
+    ASSERT_EQUAL(blocks.getArchivedHeight(), 2);
+    blocks.enableArchive("./test-data/tmparchive");
+    ASSERT_TRUE(blocks.getBlock(1) == added[0]);
+    blocks.closeDB();
+    blocks.deleteDB();
+}
+
+TEST(test_blockstore_compacts_cold_blocks) {
+    BlockStore blocks;
+    blocks.init("./test-data/tmpdb");
+    string begin;
+    string end;
+    ASSERT_FALSE(blocks.nextCompactionRange(begin, end));
+
+    // only blocks more than the hot window below the tip are cold
+    blocks.setBlockCount(1200);
+    ASSERT_TRUE(blocks.nextCompactionRange(begin, end));
+    ASSERT_EQUAL(begin, string("\x01\x00\x00\x00\x01", 5));
+    ASSERT_EQUAL(end, string("\x01\x00\x00\x00\xc9", 5));
+    blocks.compactRange(begin, end);
+    ASSERT_FALSE(blocks.nextCompactionRange(begin, end));
+
+    blocks.setBlockCount(1300);
+    ASSERT_TRUE(blocks.nextCompactionRange(begin, end));
+    ASSERT_EQUAL(begin, string("\x01\x00\x00\x00\xc9", 5));
+    ASSERT_EQUAL(end, string("\x01\x00\x00\x01\x2d", 5));
+    blocks.closeDB();
+    blocks.deleteDB();
+}
+
+TEST(test_blockstore_header_file_and_chain_tip) {
+    BlockStore blocks;
+    blocks.init("./test-data/tmpdb");
+    blocks.enableHeaderFile("./test-data/tmpdb_headers");
+    HeaderFile* file = blocks.getHeaderFile();
+    vector<Transaction> noTransactions;
+    vector<BlockHeader> added;
+    SHA256Hash checksum = NULL_SHA256_HASH;
+    for(uint32_t i = 1; i <= 5; i++) {
+        Block b;
+        b.setId(i);
+        b.setTimestamp(i);
+        BlockHeader header = b.serialize();
+        checksum = chainHeaderChecksum(checksum, header, b.getHash());
+        file->append(header, b.getHash());
+        added.push_back(header);
+    }
+    ASSERT_TRUE(file->getChecksum(5) == checksum);
+
+    ChainTip tip;
+    tip.count = 5;
+    tip.difficulty = 16;
+    tip.lastHash = Block(added[4], noTransactions).getHash();
+    tip.headerChecksum = checksum;
+    tip.totalWork = 12345;
+    blocks.setChainTip(tip);
+
+    // everything survives a restart and reads back in one pass
+    blocks.closeDB();
+    blocks.init("./test-data/tmpdb");
+    blocks.enableHeaderFile("./test-data/tmpdb_headers");
+    file = blocks.getHeaderFile();
+    ChainTip loaded;
+    ASSERT_TRUE(blocks.getChainTip(loaded));
+    ASSERT_EQUAL(loaded.count, 5);
+    ASSERT_EQUAL(loaded.difficulty, 16);
+    ASSERT_TRUE(loaded.lastHash == tip.lastHash);
+    ASSERT_TRUE(loaded.headerChecksum == checksum);
+    ASSERT_TRUE(loaded.totalWork == tip.totalWork);
+    vector<BlockHeader> headers;
+    vector<SHA256Hash> hashes;
+    ASSERT_EQUAL(file->read(5, &headers, hashes), 5);
+    ASSERT_TRUE(hashes[2] == Block(added[2], noTransactions).getHash());
+    ASSERT_EQUAL(headers[4].timestamp, 5);
+
+    // popped blocks are cut off and the checksum rolls back with them
+    SHA256Hash atThree = file->getChecksum(3);
+    file->truncate(3);
+    ASSERT_EQUAL(file->getCount(), 3);
+    ASSERT_TRUE(file->getChecksum(3) == atThree);
     blocks.closeDB();
     blocks.deleteDB();
 }
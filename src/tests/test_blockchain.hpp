@@ -13,6 +13,7 @@ using namespace std::chrono_literals;
 string ledger = "./test-data/ledger";
 string blocks = "./test-data/blocks";
 string txdb = "./test-data/txdb";
+string wallets = "./test-data/wallets";
 
 void addMerkleHashToBlock(Block& block) {
     // compute merkle tree and verify root matches;
@@ -22,15 +23,64 @@ void addMerkleHashToBlock(Block& block) {
     block.setMerkleRoot(m.getRootHash());
 }
 
+// exposes the stores and commit steps so tests can stage interrupted commits
+class TestChain : public BlockChain {
+    public:
+        TestChain(HostManager& hosts, json config=json::object()) : BlockChain(hosts, ::ledger, ::blocks, ::txdb, ::wallets, config) {}
+        BlockStore& getBlockStore() { return *this->blockStore; }
+        TransactionStore& getTxdb() { return this->txdb; }
+        WalletStore& getWalletStore() { return this->walletStore; }
+        void startSyncWindow() { this->openSyncWindow(); }
+        size_t getHeaderCount() { return this->headers.size(); }
+        size_t getHashCount() { return this->blockHashes.size(); }
+};
+
+// fee timestamps are set from the id so every block's fee has its own txid
+Block mineNextBlock(BlockChain& chain, User& miner, vector<Transaction> transactions = vector<Transaction>()) {
+    Block block;
+    block.setId(chain.getBlockCount() + 1);
+    Transaction fee = miner.mine();
+    fee.setTimestamp(block.getId());
+    block.addTransaction(fee);
+    for(auto& t : transactions) block.addTransaction(t);
+    block.setDifficulty(chain.getDifficulty());
+    addMerkleHashToBlock(block);
+    block.setLastBlockHash(chain.getLastHash());
+    block.setNonce(mineHash(block.getHash(), block.getDifficulty()));
+    return block;
+}
+
+size_t walletTransactionCount(TestChain& chain, User& user) {
+    return chain.getWalletStore().getTransactionsForWallet(user.getAddress()).size();
+}
+
+// the in-memory header and hash vectors hold exactly the given chain
+void checkHeaders(TestChain& chain, vector<Block>& expected) {
+    ASSERT_EQUAL(chain.getHeaderCount(), expected.size());
+    ASSERT_EQUAL(chain.getHashCount(), expected.size());
+    for (uint32_t i = 1; i <= expected.size(); i++) {
+        Block& block = expected[i - 1];
+        BlockHeader header = chain.getBlockHeader(i);
+        ASSERT_EQUAL(header.id, i);
+        ASSERT_EQUAL(header.timestamp, block.getTimestamp());
+        ASSERT_EQUAL(header.numTransactions, block.getTransactions().size());
+        ASSERT_TRUE(header.lastBlockHash == block.getLastBlockHash());
+        ASSERT_TRUE(header.nonce == block.getNonce());
+        ASSERT_TRUE(chain.getBlockHash(i) == block.getHash());
+        ASSERT_EQUAL(chain.getBlockIdForHash(block.getHash()), i);
+    }
+    if (expected.size() > 0) ASSERT_TRUE(chain.getLastHash() == expected.back().getHash());
+}
+
 TEST(check_adding_new_node_with_hash) {
     HostManager h;
-    BlockChain* blockchain = new BlockChain(h, ledger, blocks, txdb);
+    BlockChain* blockchain = new BlockChain(h, ledger, blocks, txdb, wallets);
     User miner;
     User other;
     Transaction fee = miner.mine();
     vector<Transaction> transactions;
     Block newBlock;
-    newBlock.setId(2);
+    newBlock.setId(1);
     newBlock.addTransaction(fee);
     addMerkleHashToBlock(newBlock);
     newBlock.setLastBlockHash(blockchain->getLastHash());
@@ -43,9 +93,122 @@ TEST(check_adding_new_node_with_hash) {
     delete blockchain;
 }
 
+TEST(check_recovers_ledger_ahead_of_block_store) {
+    HostManager h;
+    TestChain* chain = new TestChain(h);
+    User miner;
+    User other;
+    for (int i = 1; i <= 3; i++) {
+        Block block = mineNextBlock(*chain, miner);
+        ASSERT_EQUAL(chain->addBlock(block), SUCCESS);
+    }
+    SHA256Hash lastHash = chain->getLastHash();
+    ChainTip tip;
+    ASSERT_TRUE(chain->getBlockStore().getChainTip(tip));
+    Transaction sent = miner.send(other, PDN(2.0));
+    Block block = mineNextBlock(*chain, miner, {sent});
+    ASSERT_EQUAL(chain->addBlock(block), SUCCESS);
+    ASSERT_EQUAL(chain->getWalletValue(other.getAddress()), PDN(2.0));
+
+    // the ledger, txdb and wallet batches landed, the block store one did not
+    chain->getBlockStore().setBlockCount(3);
+    chain->getBlockStore().setChainTip(tip);
+    chain->getBlockStore().setTotalWork(tip.totalWork);
+    chain->closeDB();
+    delete chain;
+
+    chain = new TestChain(h);
+    ASSERT_EQUAL(chain->getBlockCount(), 3);
+    ASSERT_TRUE(chain->getLastHash() == lastHash);
+    uint32_t height;
+    ASSERT_TRUE(chain->getLedger().getChainHeight(height));
+    ASSERT_EQUAL(height, 3);
+    ASSERT_EQUAL(chain->getWalletValue(miner.getAddress()), PDN(150.0));
+    ASSERT_FALSE(chain->getLedger().hasWallet(other.getAddress()));
+    ASSERT_EQUAL(chain->findBlockForTransaction(sent), 0);
+    ASSERT_EQUAL(walletTransactionCount(*chain, other), 0);
+    ASSERT_EQUAL(walletTransactionCount(*chain, miner), 3);
+    // the dropped block is accepted again
+    ASSERT_EQUAL(chain->addBlock(block), SUCCESS);
+    ASSERT_EQUAL(chain->findBlockForTransaction(sent), 4);
+    chain->deleteDB();
+    delete chain;
+}
+
+TEST(check_recovers_ledger_behind_block_store) {
+    HostManager h;
+    TestChain* chain = new TestChain(h);
+    User miner;
+    User other;
+    vector<Block> added;
+    for (int i = 1; i <= 4; i++) {
+        vector<Transaction> transactions;
+        if (i > 1) transactions.push_back(miner.send(other, PDN(i)));
+        Block block = mineNextBlock(*chain, miner, transactions);
+        ASSERT_EQUAL(chain->addBlock(block), SUCCESS);
+        added.push_back(block);
+    }
+    // a rewind to 2 committed the ledger batch and stopped there
+    chain->getLedger().setChainHeight(2);
+    chain->closeDB();
+    delete chain;
+
+    chain = new TestChain(h);
+    ASSERT_EQUAL(chain->getBlockCount(), 2);
+    ASSERT_TRUE(chain->getLastHash() == added[1].getHash());
+    ASSERT_EQUAL(chain->getWalletValue(miner.getAddress()), PDN(98.0));
+    ASSERT_EQUAL(chain->getWalletValue(other.getAddress()), PDN(2.0));
+    ASSERT_EQUAL(chain->findBlockForTransaction(added[2].getTransactions()[1]), 0);
+    ASSERT_EQUAL(chain->getBlockIdForHash(added[2].getHash()), 0);
+    ASSERT_EQUAL(walletTransactionCount(*chain, other), 1);
+    ASSERT_EQUAL(chain->addBlock(added[2]), SUCCESS);
+    ASSERT_EQUAL(chain->getWalletValue(other.getAddress()), PDN(5.0));
+    chain->deleteDB();
+    delete chain;
+}
+
+TEST(check_rewind_past_undo_records) {
+    HostManager h;
+    TestChain* chain = new TestChain(h);
+    User miner;
+    User other;
+    vector<Block> added;
+    for (int i = 1; i <= 5; i++) {
+        vector<Transaction> transactions;
+        if (i > 1) transactions.push_back(miner.send(other, PDN(i)));
+        Block block = mineNextBlock(*chain, miner, transactions);
+        ASSERT_EQUAL(chain->addBlock(block), SUCCESS);
+        added.push_back(block);
+    }
+    // blocks older than the undo window have no record and are re-read
+    for (uint32_t i = 3; i <= 5; i++) chain->getLedger().removeUndoRecord(i);
+    chain->rewindTo(2);
+    ASSERT_EQUAL(chain->getBlockCount(), 2);
+    ASSERT_TRUE(chain->getLastHash() == added[1].getHash());
+    ASSERT_EQUAL(chain->getWalletValue(miner.getAddress()), PDN(98.0));
+    ASSERT_EQUAL(chain->getWalletValue(other.getAddress()), PDN(2.0));
+    for (int i = 2; i < 5; i++) {
+        ASSERT_EQUAL(chain->findBlockForTransaction(added[i].getTransactions()[1]), 0);
+        ASSERT_EQUAL(chain->getBlockIdForHash(added[i].getHash()), 0);
+    }
+    ASSERT_EQUAL(walletTransactionCount(*chain, other), 1);
+    ASSERT_EQUAL(walletTransactionCount(*chain, miner), 3);
+
+    // the rewind was one commit, a reopen finds the same chain
+    chain->closeDB();
+    delete chain;
+    chain = new TestChain(h);
+    ASSERT_EQUAL(chain->getBlockCount(), 2);
+    ASSERT_EQUAL(chain->getWalletValue(miner.getAddress()), PDN(98.0));
+    ASSERT_EQUAL(chain->addBlock(added[2]), SUCCESS);
+    ASSERT_EQUAL(chain->getWalletValue(other.getAddress()), PDN(5.0));
+    chain->deleteDB();
+    delete chain;
+}
+
 // TEST(check_popping_block) {
 //     HostManager h;
-//     BlockChain* blockchain = new BlockChain(h, ledger, blocks, txdb);
+//     BlockChain* blockchain = new BlockChain(h, ledger, blocks, txdb, wallets);
 //     User miner;
 //     User other;
 //     // have miner mine the next block
@@ -77,7 +240,7 @@ TEST(check_adding_new_node_with_hash) {
 
 // TEST(check_adding_wrong_lastblock_hash_fails) {
 //     HostManager h;
-//     BlockChain* blockchain = new BlockChain(h, ledger, blocks, txdb);
+//     BlockChain* blockchain = new BlockChain(h, ledger, blocks, txdb, wallets);
 //     User miner;
 //     User other;
 //     // have miner mine the next block
@@ -99,7 +262,7 @@ TEST(check_adding_new_node_with_hash) {
 
 // TEST(check_adding_two_nodes_updates_ledger) {
 //     HostManager h;
-//     BlockChain* blockchain = new BlockChain(h, ledger, blocks, txdb);
+//     BlockChain* blockchain = new BlockChain(h, ledger, blocks, txdb, wallets);
 //     User miner;
 
 //     // have miner mine the next block
@@ -125,7 +288,7 @@ TEST(check_adding_new_node_with_hash) {
 
 // TEST(check_sending_transaction_updates_ledger) {
 //     HostManager h;
-//     BlockChain* blockchain = new BlockChain(h, ledger, blocks, txdb);
+//     BlockChain* blockchain = new BlockChain(h, ledger, blocks, txdb, wallets);
 //     User miner;
 //     User other;
 
@@ -165,7 +328,7 @@ TEST(check_adding_new_node_with_hash) {
 
 // TEST(check_duplicate_tx_fails) {
 //     HostManager h;
-//     BlockChain* blockchain = new BlockChain(h, ledger, blocks, txdb);
+//     BlockChain* blockchain = new BlockChain(h, ledger, blocks, txdb, wallets);
 //     User miner;
 //     User other;
 
@@ -194,4 +357,126 @@ TEST(check_adding_new_node_with_hash) {
 //     }
 //     blockchain->deleteDB();
 //     delete blockchain;
-// }
\ No newline at end of file
+// }
+TEST(check_interrupted_sync_window_rolls_back_to_durable_tip) {
+    HostManager h;
+    TestChain* chain = new TestChain(h);
+    User miner;
+    User other;
+    vector<Block> added;
+    for (int i = 1; i <= 4; i++) {
+        if (i == 3) chain->startSyncWindow();
+        vector<Transaction> transactions;
+        if (i > 1) transactions.push_back(miner.send(other, PDN(i)));
+        Block block = mineNextBlock(*chain, miner, transactions);
+        ASSERT_EQUAL(chain->addBlock(block), SUCCESS);
+        added.push_back(block);
+    }
+    // stopped without closing the window, blocks 3 and 4 were never synced
+    chain->closeDB();
+    delete chain;
+
+    chain = new TestChain(h);
+    ChainTip durable;
+    ASSERT_FALSE(chain->getBlockStore().getSyncWindow(durable));
+    ASSERT_EQUAL(chain->getBlockCount(), 2);
+    ASSERT_TRUE(chain->getLastHash() == added[1].getHash());
+    uint32_t height;
+    ASSERT_TRUE(chain->getLedger().getChainHeight(height));
+    ASSERT_EQUAL(height, 2);
+    ASSERT_EQUAL(chain->getWalletValue(miner.getAddress()), PDN(98.0));
+    ASSERT_EQUAL(chain->getWalletValue(other.getAddress()), PDN(2.0));
+    ASSERT_EQUAL(chain->findBlockForTransaction(added[1].getTransactions()[1]), 2);
+    for (int i = 2; i < 4; i++) {
+        ASSERT_EQUAL(chain->findBlockForTransaction(added[i].getTransactions()[1]), 0);
+        ASSERT_EQUAL(chain->getBlockIdForHash(added[i].getHash()), 0);
+    }
+    ASSERT_EQUAL(walletTransactionCount(*chain, other), 1);
+    ASSERT_EQUAL(walletTransactionCount(*chain, miner), 3);
+    ASSERT_EQUAL(chain->addBlock(added[2]), SUCCESS);
+    chain->deleteDB();
+    delete chain;
+}
+
+TEST(check_headers_follow_add_pop_and_rewind) {
+    HostManager h;
+    TestChain* chain = new TestChain(h);
+    User miner;
+    User other;
+    vector<Block> added;
+    for (int i = 1; i <= 5; i++) {
+        Block block = mineNextBlock(*chain, miner);
+        ASSERT_EQUAL(chain->addBlock(block), SUCCESS);
+        added.push_back(block);
+        checkHeaders(*chain, added);
+    }
+
+    Block popped = added.back();
+    chain->popBlock();
+    added.pop_back();
+    checkHeaders(*chain, added);
+    ASSERT_EQUAL(chain->getBlockIdForHash(popped.getHash()), 0);
+
+    // a different block at the popped height replaces its header and hash
+    Block fork = mineNextBlock(*chain, miner, {miner.send(other, PDN(1.0))});
+    ASSERT_FALSE(fork.getHash() == popped.getHash());
+    ASSERT_EQUAL(chain->addBlock(fork), SUCCESS);
+    added.push_back(fork);
+    checkHeaders(*chain, added);
+
+    chain->rewindTo(2);
+    vector<Block> dropped(added.begin() + 2, added.end());
+    added.resize(2);
+    checkHeaders(*chain, added);
+    for (auto& block : dropped) ASSERT_EQUAL(chain->getBlockIdForHash(block.getHash()), 0);
+
+    // headers are rebuilt from the block store on reopen
+    chain->closeDB();
+    delete chain;
+    chain = new TestChain(h);
+    checkHeaders(*chain, added);
+    ASSERT_EQUAL(chain->addBlock(dropped[0]), SUCCESS);
+    added.push_back(dropped[0]);
+    checkHeaders(*chain, added);
+    chain->deleteDB();
+    delete chain;
+}
+
+TEST(check_ledger_table_keeps_commits_synced_in_sync_window) {
+    HostManager h;
+    json config;
+    config["ledgerBackend"] = "table";
+    TestChain* chain = new TestChain(h, config);
+    ASSERT_TRUE(chain->getLedger().hasTable());
+    User miner;
+    User other;
+    vector<Block> added;
+    for (int i = 1; i <= 4; i++) {
+        if (i == 3) {
+            chain->startSyncWindow();
+            ChainTip durable;
+            ASSERT_FALSE(chain->getBlockStore().getSyncWindow(durable));
+        }
+        vector<Transaction> transactions;
+        if (i > 1) transactions.push_back(miner.send(other, PDN(i)));
+        Block block = mineNextBlock(*chain, miner, transactions);
+        ASSERT_EQUAL(chain->addBlock(block), SUCCESS);
+        added.push_back(block);
+    }
+    // stopped inside the sync window, every block commit was still synced
+    chain->closeDB();
+    delete chain;
+
+    chain = new TestChain(h, config);
+    ASSERT_EQUAL(chain->getBlockCount(), 4);
+    ASSERT_TRUE(chain->getLastHash() == added[3].getHash());
+    uint32_t height;
+    ASSERT_TRUE(chain->getLedger().getChainHeight(height));
+    ASSERT_EQUAL(height, 4);
+    ASSERT_EQUAL(chain->getWalletValue(miner.getAddress()), PDN(191.0));
+    ASSERT_EQUAL(chain->getWalletValue(other.getAddress()), PDN(9.0));
+    ASSERT_EQUAL(chain->findBlockForTransaction(added[3].getTransactions()[1]), 4);
+    ASSERT_EQUAL(walletTransactionCount(*chain, other), 3);
+    chain->deleteDB();
+    delete chain;
+}
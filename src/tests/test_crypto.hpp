@@ -39,15 +39,15 @@ TEST(test_signature_verifications) {
 }
 
 TEST(total_work) {
-    Bigint work = 0;
+    UInt256 work = 0;
     work = addWork(work, 16);
     work = addWork(work, 16);
     work = addWork(work, 16);
     Bigint base = 2;
     Bigint mult = 3;
     Bigint expected = mult * base.pow(16);
-    ASSERT_EQUAL(work, expected);
-    ASSERT_EQUAL(work, 196608);
+    ASSERT_EQUAL(to_string(work), to_string(expected));
+    ASSERT_TRUE(work == UInt256(196608));
     work = addWork(work, 32);
     work = addWork(work, 28);
     work = addWork(work, 74);
@@ -63,11 +63,64 @@ TEST(total_work) {
     base = 2;
     b+= base.pow(174);
     
-    ASSERT_EQUAL(b, work);
+    ASSERT_EQUAL(to_string(b), to_string(work));
     ASSERT_EQUAL(to_string(work), "23945242826029513411849172299242470459974281928572928");
+    ASSERT_TRUE(UInt256::fromString(to_string(work)) == work);
+    ASSERT_TRUE(removeWork(work, 174) < work);
+    ASSERT_TRUE(addWork(removeWork(work, 174), 174) == work);
 
 }
 
+TEST(uint256_arithmetic) {
+    UInt256 low = UInt256(UINT64_MAX);
+    UInt256 carried = low + 1;
+    ASSERT_TRUE(carried == UInt256::pow2(64));
+    ASSERT_TRUE(carried - 1 == low);
+    UInt256 top = UInt256::pow2(255);
+    ASSERT_TRUE(top + top == 0);
+    ASSERT_TRUE(UInt256(0) - 1 == (top - 1) + top);
+    ASSERT_TRUE(UInt256::pow2(256) == 0);
+
+    ASSERT_TRUE(low < carried);
+    ASSERT_TRUE(carried > low);
+    ASSERT_TRUE(UInt256::pow2(128) > UInt256::pow2(127) + UInt256::pow2(64));
+    ASSERT_TRUE(UInt256::pow2(200) + 1 > UInt256::pow2(200));
+    ASSERT_TRUE(UInt256(5) <= UInt256(5));
+    ASSERT_TRUE(UInt256(5) >= UInt256(5));
+    ASSERT_TRUE(UInt256(5) != UInt256(6));
+    ASSERT_EQUAL(UInt256(5) < UInt256(5), false);
+
+    // decimal conversion goes through mulAdd and divide
+    ASSERT_EQUAL(to_string(UInt256(0)), "0");
+    ASSERT_EQUAL(to_string(UInt256(1000000000)), "1000000000");
+    ASSERT_EQUAL(to_string(carried), "18446744073709551616");
+    string max = "115792089237316195423570985008687907853269984665640564039457584007913129639935";
+    ASSERT_EQUAL(to_string(UInt256(0) - 1), max);
+    ASSERT_TRUE(UInt256::fromString(max) == UInt256(0) - 1);
+    ASSERT_TRUE(UInt256::fromString("000123") == UInt256(123));
+    bool threw = false;
+    try {
+        UInt256::fromString("115792089237316195423570985008687907853269984665640564039457584007913129639936");
+    } catch(const std::exception& e) {
+        threw = true;
+    }
+    ASSERT_TRUE(threw);
+    threw = false;
+    try {
+        UInt256::fromString("12a");
+    } catch(const std::exception& e) {
+        threw = true;
+    }
+    ASSERT_TRUE(threw);
+
+    uint8_t bytes[UINT256_SIZE];
+    UInt256 value = UInt256::pow2(193) + UInt256::pow2(70) + 0xabcdef;
+    value.toBytes(bytes);
+    ASSERT_EQUAL(bytes[UINT256_SIZE - 1], 0xef);
+    ASSERT_EQUAL(bytes[7], 0x02);
+    ASSERT_TRUE(UInt256::fromBytes(bytes) == value);
+}
+
 TEST(mine_hash) {
     SHA256Hash hash = SHA256("Hello World");
     SHA256Hash answer = mineHash(hash, 6);
@@ -1,5 +1,7 @@
 #include "../core/crypto.hpp"
 #include "../server/ledger.hpp"
+#include "../server/ledger_view.hpp"
+#include "../server/block_undo.hpp"
 using namespace std;
 
 TEST(test_ledger_stores_wallets) {
@@ -14,4 +16,415 @@ TEST(test_ledger_stores_wallets) {
     ASSERT_EQUAL(ledger.getWalletValue(wallet), PDN(50.0));
     ledger.closeDB();
     ledger.deleteDB();
-}
\ No newline at end of file
+}
+
+TEST(test_ledger_batch_commit_and_discard) {
+    std::pair<PublicKey,PrivateKey> pair = generateKeyPair();
+    PublicWalletAddress wallet = walletAddressFromPublicKey(pair.first);
+
+    Ledger ledger;
+    ledger.init("./test-data/tmpdb");
+    ledger.startBatch();
+    ledger.createWallet(wallet);
+    ledger.deposit(wallet, PDN(50.0));
+    // staged writes are visible before commit
+    ASSERT_EQUAL(ledger.getWalletValue(wallet), PDN(50.0));
+    ledger.discardBatch();
+    ASSERT_EQUAL(ledger.hasWallet(wallet), false);
+
+    ledger.startBatch();
+    ledger.createWallet(wallet);
+    ledger.deposit(wallet, PDN(50.0));
+    ledger.withdraw(wallet, PDN(20.0));
+    ledger.commitBatch();
+    ASSERT_EQUAL(ledger.getWalletValue(wallet), PDN(30.0));
+    ledger.closeDB();
+    ledger.deleteDB();
+}
+
+TEST(test_ledger_cache_serves_reads_and_reverts) {
+    PublicWalletAddress a = walletAddressFromPublicKey(generateKeyPair().first);
+    PublicWalletAddress b = walletAddressFromPublicKey(generateKeyPair().first);
+
+    Ledger ledger;
+    ledger.init("./test-data/tmpdb");
+    ledger.createWallet(a);
+    ledger.deposit(a, PDN(10.0));
+    ledger.getWalletValue(a);
+    ASSERT_TRUE(ledger.getCacheStats()["hits"] > 0);
+
+    ledger.startBatch();
+    ledger.withdraw(a, PDN(4.0));
+    ledger.createWallet(b);
+    ledger.deposit(b, PDN(4.0));
+    ASSERT_EQUAL(ledger.getCacheStats()["dirty"], 2);
+    ledger.discardBatch();
+    ASSERT_EQUAL(ledger.getWalletValue(a), PDN(10.0));
+    ASSERT_EQUAL(ledger.hasWallet(b), false);
+
+    // a tiny budget forces evictions but reads still hit leveldb
+    ledger.setCacheSize(1);
+    ledger.startBatch();
+    ledger.createWallet(b);
+    ledger.deposit(b, PDN(1.0));
+    ledger.commitBatch();
+    ASSERT_EQUAL(ledger.getWalletValue(a), PDN(10.0));
+    ASSERT_EQUAL(ledger.getWalletValue(b), PDN(1.0));
+    ASSERT_TRUE(ledger.getCacheStats()["evictions"] > 0);
+    ledger.closeDB();
+    ledger.deleteDB();
+}
+
+TEST(test_ledger_view_does_not_write_through) {
+    PublicWalletAddress a = walletAddressFromPublicKey(generateKeyPair().first);
+    PublicWalletAddress b = walletAddressFromPublicKey(generateKeyPair().first);
+
+    Ledger ledger;
+    ledger.init("./test-data/tmpdb");
+    ledger.createWallet(a);
+    ledger.deposit(a, PDN(10.0));
+
+    LedgerView view(ledger);
+    view.withdraw(a, PDN(3.0));
+    view.createWallet(b);
+    view.deposit(b, PDN(3.0));
+    ASSERT_EQUAL(view.getWalletValue(a), PDN(7.0));
+    ASSERT_EQUAL(view.getWalletValue(b), PDN(3.0));
+    ASSERT_EQUAL(ledger.getWalletValue(a), PDN(10.0));
+    ASSERT_EQUAL(ledger.hasWallet(b), false);
+
+    // balances staged by an open batch are invisible to new views
+    ledger.startBatch();
+    ledger.withdraw(a, PDN(5.0));
+    LedgerView other(ledger);
+    ASSERT_EQUAL(other.getWalletValue(a), PDN(10.0));
+    ledger.discardBatch();
+    ledger.closeDB();
+    ledger.deleteDB();
+}
+
+TEST(test_ledger_snapshot_export_and_import) {
+    PublicWalletAddress a = walletAddressFromPublicKey(generateKeyPair().first);
+    PublicWalletAddress b = walletAddressFromPublicKey(generateKeyPair().first);
+
+    Ledger ledger;
+    ledger.init("./test-data/tmpdb");
+    ledger.createWallet(a);
+    ledger.deposit(a, PDN(10.0));
+    const leveldb::Snapshot* snapshot = ledger.takeSnapshot();
+
+    // writes after the snapshot is taken are not part of it
+    ledger.createWallet(b);
+    ledger.withdraw(a, PDN(4.0));
+    ledger.exportSnapshot("./test-data/ledger.snap", snapshot);
+    ledger.releaseSnapshot(snapshot);
+
+    ledger.importSnapshot("./test-data/ledger.snap");
+    ASSERT_EQUAL(ledger.getWalletValue(a), PDN(10.0));
+    ASSERT_EQUAL(ledger.hasWallet(b), false);
+    remove("./test-data/ledger.snap");
+    ledger.closeDB();
+    ledger.deleteDB();
+}
+
+TEST(test_ledger_snapshot_import_leaves_marker_when_cut_short) {
+    PublicWalletAddress a = walletAddressFromPublicKey(generateKeyPair().first);
+
+    Ledger ledger;
+    ledger.init("./test-data/tmpdb");
+    ledger.createWallet(a);
+    ledger.deposit(a, PDN(10.0));
+    const leveldb::Snapshot* snapshot = ledger.takeSnapshot();
+    ledger.exportSnapshot("./test-data/ledger.snap", snapshot);
+    ledger.releaseSnapshot(snapshot);
+
+    ledger.importSnapshot("./test-data/ledger.snap");
+    ASSERT_EQUAL(ledger.hasIncompleteImport(), false);
+
+    // drop the last byte so the import fails part way through
+    FILE* in = fopen("./test-data/ledger.snap", "rb");
+    string contents;
+    char buf[4096];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), in)) > 0) contents.append(buf, n);
+    fclose(in);
+    FILE* out = fopen("./test-data/ledger.snap", "wb");
+    fwrite(contents.data(), 1, contents.size() - 1, out);
+    fclose(out);
+
+    bool threw = false;
+    try {
+        ledger.importSnapshot("./test-data/ledger.snap");
+    } catch(const std::exception& e) {
+        threw = true;
+    }
+    ASSERT_EQUAL(threw, true);
+    ledger.closeDB();
+    ledger.init("./test-data/tmpdb");
+    ASSERT_EQUAL(ledger.hasIncompleteImport(), true);
+    ledger.clear();
+    ASSERT_EQUAL(ledger.hasIncompleteImport(), false);
+    remove("./test-data/ledger.snap");
+    ledger.closeDB();
+    ledger.deleteDB();
+}
+
+TEST(test_ledger_undo_record_restores_wallets) {
+    PublicWalletAddress a = walletAddressFromPublicKey(generateKeyPair().first);
+    PublicWalletAddress b = walletAddressFromPublicKey(generateKeyPair().first);
+
+    Ledger ledger;
+    ledger.init("./test-data/tmpdb");
+    ledger.createWallet(a);
+    ledger.deposit(a, PDN(10.0));
+
+    BlockUndo undo;
+    undo.wallets.push_back({a, true, PDN(10.0)});
+    undo.wallets.push_back({b, false, 0});
+    undo.transactions.push_back({NULL_SHA256_HASH, 0, 1});
+    ledger.setUndoRecord(7, undo.serialize());
+
+    ledger.startBatch();
+    ledger.withdraw(a, PDN(3.0));
+    ledger.createWallet(b);
+    ledger.deposit(b, PDN(3.0));
+    ledger.commitBatch();
+
+    string record;
+    ASSERT_EQUAL(ledger.getUndoRecord(8, record), false);
+    ASSERT_EQUAL(ledger.getUndoRecord(7, record), true);
+    BlockUndo stored(record);
+    ASSERT_EQUAL(stored.wallets.size(), 2);
+    ASSERT_EQUAL(stored.transactions[0].toSlot, 1);
+
+    // restoring inside a batch deletes wallets that did not exist before
+    ledger.startBatch();
+    for(auto& entry : stored.wallets) {
+        ledger.restoreWallet(entry.wallet, entry.exists, entry.balance);
+    }
+    ledger.removeUndoRecord(7);
+    ledger.commitBatch();
+    ASSERT_EQUAL(ledger.getWalletValue(a), PDN(10.0));
+    ASSERT_EQUAL(ledger.hasWallet(b), false);
+    ASSERT_EQUAL(ledger.getUndoRecord(7, record), false);
+
+    // and they stay deleted once the cache is cold
+    ledger.setCacheSize(0);
+    ASSERT_EQUAL(ledger.hasWallet(b), false);
+    ledger.closeDB();
+    ledger.deleteDB();
+}
+
+TEST(test_ledger_removes_old_undo_records) {
+    Ledger ledger;
+    ledger.init("./test-data/tmpdb");
+    BlockUndo undo;
+    for(uint32_t i = 1; i <= 10; i++) {
+        ledger.setUndoRecord(i, undo.serialize());
+    }
+    // staged with the block's batch, a few at a time
+    ledger.startBatch();
+    ASSERT_EQUAL(ledger.removeUndoRecordsBelow(8, 4), 4);
+    ledger.commitBatch();
+    string record;
+    ASSERT_EQUAL(ledger.getUndoRecord(4, record), false);
+    ASSERT_EQUAL(ledger.getUndoRecord(5, record), true);
+    ledger.startBatch();
+    ASSERT_EQUAL(ledger.removeUndoRecordsBelow(8, 4), 3);
+    ledger.commitBatch();
+    ASSERT_EQUAL(ledger.getUndoRecord(7, record), false);
+    ASSERT_EQUAL(ledger.getUndoRecord(8, record), true);
+    ASSERT_EQUAL(ledger.getLastUndoBlock(), 10);
+    ASSERT_EQUAL(ledger.removeUndoRecordsBelow(8, 4), 0);
+    ledger.closeDB();
+    ledger.deleteDB();
+}
+
+TEST(test_ledger_rich_list_follows_commits) {
+    PublicWalletAddress a = walletAddressFromPublicKey(generateKeyPair().first);
+    PublicWalletAddress b = walletAddressFromPublicKey(generateKeyPair().first);
+    PublicWalletAddress c = walletAddressFromPublicKey(generateKeyPair().first);
+
+    Ledger ledger;
+    ledger.init("./test-data/tmpdb");
+    ledger.indexBalances();
+    ledger.startBatch();
+    ledger.createWallet(a);
+    ledger.deposit(a, PDN(10.0));
+    ledger.createWallet(b);
+    ledger.deposit(b, PDN(30.0));
+    ledger.createWallet(c);
+    ledger.deposit(c, PDN(20.0));
+    ledger.commitBatch();
+    ASSERT_EQUAL(ledger.getWalletCount(), 3);
+
+    vector<pair<PublicWalletAddress, TransactionAmount>> entries;
+    ledger.getRichList(0, 10, entries);
+    ASSERT_EQUAL(entries.size(), 3);
+    ASSERT_TRUE(entries[0].first == b);
+    ASSERT_TRUE(entries[1].first == c);
+    ASSERT_EQUAL(entries[2].second, PDN(10.0));
+
+    // a rolled back wallet leaves the index, a moved balance changes rank
+    ledger.startBatch();
+    ledger.restoreWallet(b, false, 0);
+    ledger.deposit(a, PDN(50.0));
+    ledger.commitBatch();
+    ASSERT_EQUAL(ledger.getWalletCount(), 2);
+    ledger.getRichList(1, 10, entries);
+    ASSERT_EQUAL(entries.size(), 1);
+    ASSERT_TRUE(entries[0].first == c);
+    // the cursor page starts right below the entry it names
+    ledger.getRichList(a, PDN(60.0), 10, entries);
+    ASSERT_EQUAL(entries.size(), 1);
+    ASSERT_TRUE(entries[0].first == c);
+    ledger.getRichList(c, PDN(20.0), 10, entries);
+    ASSERT_EQUAL(entries.size(), 0);
+
+    ledger.closeDB();
+    Ledger reopened;
+    reopened.init("./test-data/tmpdb");
+    reopened.indexBalances();
+    ASSERT_EQUAL(reopened.getWalletCount(), 2);
+    reopened.closeDB();
+    reopened.deleteDB();
+}
+
+TEST(test_ledger_balance_history) {
+    PublicWalletAddress a = walletAddressFromPublicKey(generateKeyPair().first);
+    PublicWalletAddress b = walletAddressFromPublicKey(generateKeyPair().first);
+
+    Ledger ledger;
+    ledger.init("./test-data/tmpdb");
+    ledger.createWallet(a);
+    ledger.deposit(a, PDN(5.0));
+    // wallets from before history started are checkpointed at its start
+    ledger.startBalanceHistory(10);
+    ledger.setBalanceCheckpoint(a, 12, PDN(7.0));
+    ledger.setBalanceCheckpoint(b, 12, PDN(1.0));
+    ledger.setBalanceCheckpoint(a, 20, PDN(9.0));
+
+    uint32_t start = 0;
+    ASSERT_TRUE(ledger.getHistoryStart(start));
+    ASSERT_EQUAL(start, 10);
+    TransactionAmount balance;
+    uint32_t changedAt;
+    ASSERT_TRUE(ledger.getBalanceAt(a, 11, balance, changedAt));
+    ASSERT_EQUAL(balance, PDN(5.0));
+    ASSERT_EQUAL(changedAt, 10);
+    ASSERT_TRUE(ledger.getBalanceAt(a, 19, balance, changedAt));
+    ASSERT_EQUAL(balance, PDN(7.0));
+    ASSERT_TRUE(ledger.getBalanceAt(a, 25, balance, changedAt));
+    ASSERT_EQUAL(changedAt, 20);
+    ASSERT_FALSE(ledger.getBalanceAt(b, 11, balance, changedAt));
+
+    // popping block 20 takes its checkpoint with it
+    ledger.removeBalanceCheckpoint(a, 20);
+    ASSERT_TRUE(ledger.getBalanceAt(a, 25, balance, changedAt));
+    ASSERT_EQUAL(balance, PDN(7.0));
+    ledger.closeDB();
+    ledger.deleteDB();
+}
+
+TEST(test_ledger_chain_height_commits_with_batch) {
+    Ledger ledger;
+    ledger.init("./test-data/tmpdb");
+    uint32_t height = 0;
+    ASSERT_FALSE(ledger.getChainHeight(height));
+    ledger.setChainHeight(5);
+    ASSERT_TRUE(ledger.getChainHeight(height));
+    ASSERT_EQUAL(height, 5);
+
+    // a block that never committed leaves the previous height
+    ledger.startBatch();
+    ledger.setChainHeight(6);
+    ledger.discardBatch();
+    ASSERT_TRUE(ledger.getChainHeight(height));
+    ASSERT_EQUAL(height, 5);
+
+    ledger.startBatch();
+    ledger.setChainHeight(6);
+    ledger.commitBatch();
+    ASSERT_TRUE(ledger.getChainHeight(height));
+    ASSERT_EQUAL(height, 6);
+    ledger.closeDB();
+    ledger.deleteDB();
+}
+
+TEST(test_ledger_balance_history_restarts_below_start) {
+    PublicWalletAddress a = walletAddressFromPublicKey(generateKeyPair().first);
+    PublicWalletAddress b = walletAddressFromPublicKey(generateKeyPair().first);
+
+    Ledger ledger;
+    ledger.init("./test-data/tmpdb");
+    ledger.createWallet(a);
+    ledger.deposit(a, PDN(5.0));
+    ledger.createWallet(b);
+    ledger.deposit(b, PDN(2.0));
+    ledger.startBalanceHistory(10);
+    // block 11 pays a
+    ledger.deposit(a, PDN(1.0));
+    ledger.setBalanceCheckpoint(a, 11, PDN(6.0));
+
+    // pop back to 8, where a held 3 and b held 2, then take a fork block 9 paying b
+    ledger.removeBalanceCheckpoint(a, 11);
+    ledger.restoreWallet(a, true, PDN(3.0));
+    ledger.restartBalanceHistory(8);
+    ledger.deposit(b, PDN(4.0));
+    ledger.setBalanceCheckpoint(b, 9, PDN(6.0));
+
+    uint32_t start = 0;
+    ASSERT_TRUE(ledger.getHistoryStart(start));
+    ASSERT_EQUAL(start, 8);
+    TransactionAmount balance;
+    uint32_t changedAt;
+    // the pre-fork baseline at 10 is gone
+    ASSERT_TRUE(ledger.getBalanceAt(a, 10, balance, changedAt));
+    ASSERT_EQUAL(balance, PDN(3.0));
+    ASSERT_EQUAL(changedAt, 8);
+    ASSERT_TRUE(ledger.getBalanceAt(b, 10, balance, changedAt));
+    ASSERT_EQUAL(balance, PDN(6.0));
+    ASSERT_EQUAL(changedAt, 9);
+    ASSERT_TRUE(ledger.getBalanceAt(b, 8, balance, changedAt));
+    ASSERT_EQUAL(balance, PDN(2.0));
+    ledger.closeDB();
+    ledger.deleteDB();
+}
+
+class TableFailingLedger : public Ledger {
+    protected:
+        void applyTable() {
+            throw std::runtime_error("table write failed");
+        }
+};
+
+TEST(test_ledger_table_recovers_failed_apply) {
+    std::pair<PublicKey,PrivateKey> pair = generateKeyPair();
+    PublicWalletAddress wallet = walletAddressFromPublicKey(pair.first);
+    {
+        TableFailingLedger ledger;
+        ledger.init("./test-data/tmpdb");
+        ledger.enableTable("./test-data/tmptable");
+        ledger.startBatch();
+        ledger.createWallet(wallet);
+        ledger.deposit(wallet, PDN(50.0));
+        ledger.setChainHeight(1);
+        bool threw = false;
+        try {
+            ledger.commitBatch();
+        } catch(const std::exception& e) {
+            threw = true;
+        }
+        ASSERT_TRUE(threw);
+        uint32_t height = 0;
+        ASSERT_TRUE(ledger.getChainHeight(height));
+        ASSERT_EQUAL(height, 1);
+        ledger.closeDB();
+    }
+    Ledger ledger;
+    ledger.init("./test-data/tmpdb");
+    ledger.enableTable("./test-data/tmptable");
+    ASSERT_EQUAL(ledger.getWalletValue(wallet), PDN(50.0));
+    ledger.closeDB();
+    ledger.deleteDB();
+}
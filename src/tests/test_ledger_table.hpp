@@ -0,0 +1,77 @@
+#include "../server/ledger_table.hpp"
+using namespace std;
+
+static PublicWalletAddress tableTestWallet(uint32_t i) {
+    PublicWalletAddress wallet = NULL_ADDRESS;
+    wallet[1] = i >> 24;
+    wallet[2] = i >> 16;
+    wallet[3] = i >> 8;
+    wallet[4] = i;
+    return wallet;
+}
+
+TEST(test_ledger_table_resizes_and_reopens) {
+    LedgerTable table;
+    table.init("./test-data/tmptable");
+    table.clear();
+    vector<LedgerTableChange> changes;
+    for(uint32_t i = 0; i < 100000; i++) {
+        changes.push_back(LedgerTableChange{tableTestWallet(i), true, i});
+        if (changes.size() == 1000) {
+            table.apply(changes);
+            changes.clear();
+        }
+    }
+    // deleting while a resize may still be moving slots
+    for(uint32_t i = 0; i < 100000; i += 10) {
+        changes.push_back(LedgerTableChange{tableTestWallet(i), false, 0});
+    }
+    table.apply(changes);
+
+    TransactionAmount value;
+    ASSERT_TRUE(table.get(tableTestWallet(99999), value));
+    ASSERT_EQUAL(value, 99999);
+    ASSERT_FALSE(table.get(tableTestWallet(500), value));
+    ASSERT_TRUE(table.getStats()["resizes"] > 0);
+    table.closeTable();
+
+    LedgerTable reopened;
+    reopened.init("./test-data/tmptable");
+    uint64_t count = 0;
+    reopened.forEach([&count](const PublicWalletAddress& wallet, TransactionAmount value) {
+        count++;
+    });
+    ASSERT_EQUAL(count, 90000);
+    ASSERT_TRUE(reopened.get(tableTestWallet(12345), value));
+    ASSERT_EQUAL(value, 12345);
+    ASSERT_FALSE(reopened.get(tableTestWallet(12340), value));
+    reopened.deleteTable();
+}
+
+TEST(test_ledger_table_replays_committed_groups) {
+    LedgerTable table;
+    table.init("./test-data/tmptable");
+    table.clear();
+    table.prepare({LedgerTableChange{tableTestWallet(1), true, 10}}, 1);
+    table.commitPrepared();
+    table.prepare({LedgerTableChange{tableTestWallet(2), true, 20}}, 2);
+    table.abortPrepared();
+    TransactionAmount value;
+    ASSERT_FALSE(table.get(tableTestWallet(2), value));
+    // left prepared when the process stops, its batch never committed
+    table.prepare({LedgerTableChange{tableTestWallet(3), true, 30}}, 2);
+    table.closeTable();
+
+    table.init("./test-data/tmptable", 1);
+    ASSERT_TRUE(table.get(tableTestWallet(1), value));
+    ASSERT_EQUAL(value, 10);
+    ASSERT_FALSE(table.get(tableTestWallet(3), value));
+
+    // same again, but this time the batch holding sequence 2 landed
+    table.prepare({LedgerTableChange{tableTestWallet(3), true, 30}}, 2);
+    table.closeTable();
+    table.init("./test-data/tmptable", 2);
+    ASSERT_TRUE(table.get(tableTestWallet(3), value));
+    ASSERT_EQUAL(value, 30);
+    table.deleteTable();
+}
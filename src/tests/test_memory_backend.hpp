@@ -0,0 +1,46 @@
+#include "../server/memory_backend.hpp"
+using namespace std;
+
+TEST(test_memory_backend_batches_iterators_and_snapshots) {
+    MemoryBackend db;
+    leveldb::WriteBatch batch;
+    for(int i = 0; i < 100; i++) {
+        char key[3] = {'k', (char)(i / 10), (char)(i % 10)};
+        batch.Put(leveldb::Slice(key, 3), to_string(i));
+    }
+    ASSERT_TRUE(db.Write(leveldb::WriteOptions(), &batch).ok());
+
+    const leveldb::Snapshot* snapshot = db.GetSnapshot();
+    db.Delete(leveldb::WriteOptions(), leveldb::Slice("k\0\5", 3));
+    db.Put(leveldb::WriteOptions(), leveldb::Slice("k\0\6", 3), "changed");
+
+    string value;
+    ASSERT_TRUE(db.Get(leveldb::ReadOptions(), leveldb::Slice("k\0\5", 3), &value).IsNotFound());
+    leveldb::ReadOptions atSnapshot;
+    atSnapshot.snapshot = snapshot;
+    ASSERT_TRUE(db.Get(atSnapshot, leveldb::Slice("k\0\5", 3), &value).ok());
+    ASSERT_EQUAL(value, "5");
+    ASSERT_TRUE(db.Get(atSnapshot, leveldb::Slice("k\0\6", 3), &value).ok());
+    ASSERT_EQUAL(value, "6");
+
+    // keys come back in order across shards, and the snapshot still has 100
+    int count = 0;
+    string last;
+    std::unique_ptr<leveldb::Iterator> it(db.NewIterator(atSnapshot));
+    for(it->SeekToFirst(); it->Valid(); it->Next()) {
+        ASSERT_TRUE(last < it->key().ToString());
+        last = it->key().ToString();
+        count++;
+    }
+    ASSERT_EQUAL(count, 100);
+    db.ReleaseSnapshot(snapshot);
+
+    count = 0;
+    std::unique_ptr<leveldb::Iterator> latest(db.NewIterator(leveldb::ReadOptions()));
+    for(latest->Seek(leveldb::Slice("k\0\5", 3)); latest->Valid(); latest->Next()) count++;
+    ASSERT_EQUAL(count, 94);
+    latest->SeekToLast();
+    ASSERT_EQUAL(latest->value().ToString(), "99");
+    latest->Prev();
+    ASSERT_EQUAL(latest->value().ToString(), "98");
+}
@@ -0,0 +1,50 @@
+#include "../core/crypto.hpp"
+#include "../server/pufferfish_cache.hpp"
+using namespace std;
+
+TEST(test_pufferfish_cache_memory_tier_evicts_lru) {
+    PufferfishMemoryCache cache(PUFFERFISH_CACHE_SHARDS);
+    SHA256Hash a = SHA256("a");
+    SHA256Hash b = SHA256("b");
+    SHA256Hash out;
+    // one entry per shard, land both inputs in the same shard
+    b[31] = a[31];
+    cache.insert(a, SHA256("1"));
+    ASSERT_TRUE(cache.lookup(a, out));
+    ASSERT_TRUE(out == SHA256("1"));
+    cache.insert(b, SHA256("2"));
+    ASSERT_FALSE(cache.lookup(a, out));
+    ASSERT_TRUE(cache.lookup(b, out));
+    map<string, uint64_t> stats = cache.getStats();
+    ASSERT_EQUAL(stats["hits"], 2);
+    ASSERT_EQUAL(stats["misses"], 1);
+    ASSERT_EQUAL(stats["evictions"], 1);
+}
+
+TEST(test_pufferfish_cache_bounds_disk_tier) {
+    PufferfishCache cache;
+    cache.init("./test-data/tmpdb");
+    cache.setLimits(PUFFERFISH_CACHE_SHARDS, 10);
+    vector<SHA256Hash> inputs;
+    for(int i = 0; i < 1010; i++) {
+        inputs.push_back(SHA256(to_string(i)));
+        cache.insert(inputs.back(), SHA256("result" + to_string(i)));
+    }
+    // the limit plus an eviction batch was reached, only the newest 10 are kept
+    ASSERT_EQUAL(cache.getStats()["diskEvictions"], 1000);
+    cache.closeDB();
+
+    // reopen with an empty memory tier so lookups go to disk
+    PufferfishCache reopened;
+    reopened.init("./test-data/tmpdb");
+    SHA256Hash out;
+    ASSERT_FALSE(reopened.lookup(inputs[0], out));
+    ASSERT_FALSE(reopened.lookup(inputs[999], out));
+    for(int i = 1000; i < 1010; i++) {
+        ASSERT_TRUE(reopened.lookup(inputs[i], out));
+        ASSERT_TRUE(out == SHA256("result" + to_string(i)));
+    }
+    ASSERT_EQUAL(reopened.getStats()["diskHits"], 10);
+    reopened.closeDB();
+    reopened.deleteDB();
+}
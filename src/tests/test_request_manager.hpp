@@ -9,7 +9,7 @@ using namespace std;
 
 TEST(test_accepts_proof_of_work) {
     HostManager hosts;
-    RequestManager r(hosts, "./test-data/tmpdb1", "./test-data/tmpdb2", "./test-data/tmpdb3");
+    RequestManager r(hosts, "./test-data/tmpdb1", "./test-data/tmpdb2", "./test-data/tmpdb3", "./test-data/tmpdb4");
     json pow = r.getProofOfWork();
     string lastHashStr = pow["lastHash"];
     SHA256Hash lastHash = stringToSHA256(lastHashStr);
@@ -37,7 +37,7 @@ TEST(test_accepts_proof_of_work) {
 
 TEST(test_fails_when_missing_merkle_root) {
     HostManager hosts;
-    RequestManager r(hosts, "./test-data/tmpdb1", "./test-data/tmpdb2", "./test-data/tmpdb3");
+    RequestManager r(hosts, "./test-data/tmpdb1", "./test-data/tmpdb2", "./test-data/tmpdb3", "./test-data/tmpdb4");
 
     json pow = r.getProofOfWork();
     string lastHashStr = pow["lastHash"];
@@ -0,0 +1,47 @@
+#include "../server/store_profile.hpp"
+using namespace std;
+
+TEST(test_storage_config_merges_overrides) {
+    json overrides = json::parse(R"({"blockCacheMB": 128, "txdb": {"bloomBitsPerKey": 12, "backend": "memory"}, "backend": "leveldb"})");
+    json storage = mergeStorageConfig(overrides);
+    ASSERT_EQUAL(storage["blockCacheMB"], 128);
+    ASSERT_EQUAL(storage["txdb"]["bloomBitsPerKey"], 12);
+    // keys the override leaves out keep their defaults
+    ASSERT_EQUAL(storage["txdb"]["writeBufferMB"], 8);
+    ASSERT_EQUAL(storage["txdb"]["compression"], false);
+
+    DataStoreProfile txdb = profileFromConfig(storage, "txdb", nullptr);
+    ASSERT_EQUAL(txdb.backend, "memory");
+    ASSERT_EQUAL(txdb.bloomBitsPerKey, 12);
+    ASSERT_EQUAL(txdb.writeBufferSize, 8 * 1024 * 1024);
+    DataStoreProfile ledger = profileFromConfig(storage, "ledger", nullptr);
+    ASSERT_EQUAL(ledger.backend, "leveldb");
+    ASSERT_EQUAL(ledger.bloomBitsPerKey, 10);
+
+    // a top level backend applies to every store without its own
+    storage = mergeStorageConfig(json::parse(R"({"backend": "memory", "ledger": {"backend": "leveldb"}})"));
+    ASSERT_EQUAL(profileFromConfig(storage, "blocks", nullptr).backend, "memory");
+    ASSERT_EQUAL(profileFromConfig(storage, "ledger", nullptr).backend, "leveldb");
+}
+
+TEST(test_storage_config_rejects_unknown_keys_and_values) {
+    vector<string> invalid = {
+        R"({"txbd": {"bloomBitsPerKey": 12}})",
+        R"({"txdb": {"bloomBitsPerkey": 12}})",
+        R"({"backend": "rocksdb"})",
+        R"({"ledger": {"backend": "mem"}})",
+        R"({"ledger": {"compression": "yes"}})",
+        R"({"blockCacheMB": -1})",
+        R"({"blocks": 32})",
+        R"([])"
+    };
+    for(auto& config : invalid) {
+        bool threw = false;
+        try {
+            mergeStorageConfig(json::parse(config));
+        } catch(const std::exception& e) {
+            threw = true;
+        }
+        ASSERT_TRUE(threw);
+    }
+}
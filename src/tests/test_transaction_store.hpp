@@ -1,4 +1,5 @@
 #include "../core/transaction.hpp"
+#include "../core/user.hpp"
 #include "../server/tx_store.hpp"
 using namespace std;
 
@@ -9,7 +10,7 @@ TEST(test_txdb_stores_transaction) {
     txdb.init("./test-data/tmpdb");
     Transaction t = miner.mine();
     ASSERT_EQUAL(txdb.hasTransaction(t), false);
-    txdb.insertTransaction(t, 1);
+    txdb.insertTransaction(t, 1, 0);
     ASSERT_EQUAL(txdb.hasTransaction(t), true);
     ASSERT_EQUAL(txdb.blockForTransaction(t), 1);
     txdb.removeTransaction(t);
@@ -18,9 +19,101 @@ TEST(test_txdb_stores_transaction) {
 
     Transaction t2 = miner.send(other, 333);
     ASSERT_EQUAL(txdb.hasTransaction(t2), false);
-    txdb.insertTransaction(t2, 3);
+    txdb.insertTransaction(t2, 3, 4);
     ASSERT_EQUAL(txdb.hasTransaction(t2), true);
     ASSERT_EQUAL(txdb.blockForTransaction(t2), 3);
+    TransactionPosition position;
+    ASSERT_EQUAL(txdb.getTransactionPosition(t2.hashContents(), position), true);
+    ASSERT_EQUAL(position.blockId, 3);
+    ASSERT_EQUAL(position.txIndex, 4);
     txdb.removeTransaction(t2);
     ASSERT_EQUAL(txdb.hasTransaction(t2), false);
-}
\ No newline at end of file
+    ASSERT_EQUAL(txdb.getTransactionPosition(t2.hashContents(), position), false);
+    txdb.closeDB();
+    txdb.deleteDB();
+}
+
+TEST(test_txdb_filter_answers_misses) {
+    TransactionStore txdb;
+    User miner;
+    User other;
+    txdb.init("./test-data/tmpdb");
+    Transaction stored = miner.send(other, 1);
+    txdb.insertTransaction(stored, 1, 0);
+    for (int i = 0; i < 20; i++) {
+        Transaction missing = miner.send(other, i + 2);
+        ASSERT_EQUAL(txdb.hasTransaction(missing), false);
+        ASSERT_EQUAL(txdb.blockForTransaction(missing), 0);
+    }
+    json stats = txdb.getStats()["filter"];
+    uint64_t negatives = stats["negatives"];
+    uint64_t falsePositives = stats["falsePositives"];
+    // every miss is answered by the filter or counted as a false positive
+    ASSERT_EQUAL(negatives + falsePositives, 40);
+    ASSERT_TRUE(negatives > falsePositives);
+    ASSERT_EQUAL(txdb.hasTransaction(stored), true);
+    txdb.closeDB();
+    txdb.deleteDB();
+}
+
+class LegacyTransactionStore : public TransactionStore {
+    public:
+        void insertLegacy(Transaction& t, uint32_t blockId) {
+            SHA256Hash txid = t.hashContents();
+            this->put(leveldb::Slice((const char*)txid.data(), txid.size()), leveldb::Slice((const char*)&blockId, sizeof(uint32_t)));
+        }
+        void dropFilter() {
+            std::remove(this->getFilterPath().c_str());
+        }
+};
+
+TEST(test_txdb_reads_legacy_positions) {
+    LegacyTransactionStore txdb;
+    User miner;
+    User other;
+    txdb.init("./test-data/tmpdb");
+    Transaction t = miner.send(other, 5);
+    txdb.insertLegacy(t, 7);
+    txdb.closeDB();
+    // older nodes never saved a filter, reopening rebuilds it from disk
+    txdb.dropFilter();
+    txdb.init("./test-data/tmpdb");
+    TransactionPosition position;
+    ASSERT_EQUAL(txdb.getTransactionPosition(t.hashContents(), position), true);
+    ASSERT_EQUAL(position.blockId, 7);
+    ASSERT_EQUAL(position.txIndex, UNKNOWN_TX_INDEX);
+    ASSERT_EQUAL(txdb.blockForTransaction(t), 7);
+    txdb.closeDB();
+    txdb.deleteDB();
+}
+
+TEST(test_txdb_filter_survives_restart) {
+    TransactionStore txdb;
+    User miner;
+    User other;
+    txdb.init("./test-data/tmpdb");
+    vector<Transaction> stored;
+    for (int i = 0; i < 50; i++) {
+        Transaction t = miner.send(other, i + 1);
+        txdb.insertTransaction(t, i + 1, 0);
+        stored.push_back(t);
+    }
+
+    // clean close persists the filter, reopen must still find everything
+    txdb.closeDB();
+    txdb.init("./test-data/tmpdb");
+    for (int i = 0; i < stored.size(); i++) {
+        ASSERT_EQUAL(txdb.blockForTransaction(stored[i]), i + 1);
+    }
+    ASSERT_EQUAL(txdb.getStats()["filter"]["items"], 50);
+
+    // batched inserts reach the filter too
+    Transaction staged = miner.send(other, 1000);
+    txdb.startBatch();
+    txdb.insertTransaction(staged, 51, 0);
+    txdb.commitBatch();
+    ASSERT_EQUAL(txdb.hasTransaction(staged), true);
+    ASSERT_EQUAL(txdb.hasTransaction(miner.send(other, 2000)), false);
+    txdb.closeDB();
+    txdb.deleteDB();
+}
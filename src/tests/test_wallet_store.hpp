@@ -0,0 +1,89 @@
+#include "../core/crypto.hpp"
+#include "../core/user.hpp"
+#include "../server/wallet_store.hpp"
+using namespace std;
+
+TEST(test_wallet_store_indexes_block_positions) {
+    WalletStore wallets;
+    wallets.init("./test-data/tmpdb");
+    User miner;
+    User receiver;
+    vector<Block> chain;
+    for (int i = 0; i < 3; i++) {
+        Block a;
+        // ids straddle a byte boundary to check ordering is numeric
+        a.setId(254 + i);
+        a.addTransaction(miner.mine());
+        for(int j = 0; j < 5; j++) {
+            Transaction t = miner.send(receiver, 1);
+            t.setTimestamp(j);
+            a.addTransaction(t);
+        }
+        wallets.addBlock(a);
+        chain.push_back(a);
+    }
+
+    // test we can get transactions for wallets
+    PublicWalletAddress to = receiver.getAddress();
+    vector<TransactionPosition> txTo = wallets.getTransactionsForWallet(to);
+    ASSERT_EQUAL(txTo.size(), 15);
+    PublicWalletAddress from = miner.getAddress();
+    vector<TransactionPosition> txFrom = wallets.getTransactionsForWallet(from);
+    ASSERT_EQUAL(txFrom.size(), 18);
+    for (int i = 0; i < txTo.size(); i++) {
+        ASSERT_EQUAL(txTo[i].blockId, 254 + i / 5);
+        ASSERT_EQUAL(txTo[i].txIndex, 1 + i % 5);
+    }
+
+    // test transactions are removed
+    wallets.removeBlock(chain[2]);
+    ASSERT_EQUAL(wallets.getTransactionsForWallet(to).size(), 10);
+    wallets.removeBlock(chain[1]);
+    wallets.removeBlock(chain[0]);
+    ASSERT_EQUAL(wallets.getTransactionsForWallet(to).size(), 0);
+    ASSERT_EQUAL(wallets.getTransactionsForWallet(from).size(), 0);
+    ASSERT_TRUE(wallets.isEmpty());
+    wallets.closeDB();
+    wallets.deleteDB();
+}
+
+TEST(test_wallet_store_pages_in_chain_order) {
+    WalletStore wallets;
+    wallets.init("./test-data/tmpdb");
+    User miner;
+    User receiver;
+    for (int i = 0; i < 3; i++) {
+        Block a;
+        a.setId(254 + i);
+        a.addTransaction(miner.mine());
+        for(int j = 0; j < 5; j++) {
+            Transaction t = miner.send(receiver, 1);
+            t.setTimestamp(j);
+            a.addTransaction(t);
+        }
+        wallets.addBlock(a);
+    }
+    PublicWalletAddress to = receiver.getAddress();
+
+    vector<TransactionPosition> page = wallets.getTransactionsForWallet(to, 4, NULL, false);
+    ASSERT_EQUAL(page.size(), 4);
+    ASSERT_EQUAL(page[0].blockId, 254);
+    ASSERT_EQUAL(page[0].txIndex, 1);
+    page = wallets.getTransactionsForWallet(to, 4, &page.back(), false);
+    ASSERT_EQUAL(page[0].blockId, 254);
+    ASSERT_EQUAL(page[0].txIndex, 5);
+    ASSERT_EQUAL(page[1].blockId, 255);
+    ASSERT_EQUAL(page[1].txIndex, 1);
+
+    page = wallets.getTransactionsForWallet(to, 2, NULL, true);
+    ASSERT_EQUAL(page[0].blockId, 256);
+    ASSERT_EQUAL(page[0].txIndex, 5);
+    TransactionPosition cursor = {255, 1};
+    page = wallets.getTransactionsForWallet(to, 100, &cursor, true);
+    ASSERT_EQUAL(page.size(), 5);
+    ASSERT_EQUAL(page[0].blockId, 254);
+    ASSERT_EQUAL(page[0].txIndex, 5);
+    ASSERT_EQUAL(page[4].txIndex, 1);
+    wallets.closeDB();
+    wallets.deleteDB();
+}
@@ -3,16 +3,21 @@
 #include "../core/helpers.hpp"
 // #include "test_block.hpp"
 // #include "test_user.hpp"
-// #include "test_transaction_store.hpp"
+#include "test_transaction_store.hpp"
 // #include "test_executor.hpp"
-// #include "test_crypto.hpp"
+#include "test_crypto.hpp"
 // #include "test_transaction.hpp"
 // #include "test_request_manager.hpp"
 // #include "test_helpers.hpp"
-// #include "test_blockchain.hpp"
+#include "test_blockchain.hpp"
 // #include "test_merkle_tree.hpp"
-// #include "test_ledger.hpp"
+#include "test_ledger.hpp"
 #include "test_block_store.hpp"
+#include "test_wallet_store.hpp"
+#include "test_pufferfish_cache.hpp"
+#include "test_ledger_table.hpp"
+#include "test_memory_backend.hpp"
+#include "test_store_profile.hpp"
 // #include "test_integration.hpp"
 
 using namespace std;
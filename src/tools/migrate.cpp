@@ -0,0 +1,32 @@
+#include "../core/common.hpp"
+#include "../core/constants.hpp"
+#include "../server/block_store.hpp"
+using namespace std;
+
+/*
+    Upgrades the block store of a stopped node to the current key schema
+    in place. The server runs the same migration on startup, this lets it
+    be done ahead of time.
+*/
+int main(int argc, char** argv) {
+    cout<<"=====MIGRATE BLOCKSTORE===="<<endl;
+    string path = argc > 1 ? string(argv[1]) : BLOCK_STORE_FILE_PATH;
+    cout<<"Opening "<<path<<endl;
+    try {
+        BlockStore blocks;
+        blocks.init(path);
+        if (!blocks.needsMigration()) {
+            cout<<"BlockStore already uses key schema v"<<blocks.getSchemaVersion()<<endl;
+            blocks.closeDB();
+            return 0;
+        }
+        cout<<"Migrating from key schema v"<<blocks.getSchemaVersion()<<" to v"<<BLOCK_STORE_SCHEMA_VERSION<<endl;
+        blocks.migrateSchema();
+        cout<<"Done, "<<blocks.getBlockCount()<<" blocks"<<endl;
+        blocks.closeDB();
+    } catch(const std::exception& e) {
+        cout<<"Migration failed: "<<e.what()<<endl;
+        return 1;
+    }
+    return 0;
+}